@@ -0,0 +1,1255 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "7zTypes.h"
+
+#include "7zArchive.h"
+#include "Crc.h"
+#include "Lzma1Dec.h"
+#include "Lzma2Dec.h"
+#include "Threads.h"
+
+#include <atomic>
+
+namespace SevenZip
+{
+	static constexpr uint8 Signature[6] = { '7', 'z', 0xBCu, 0xAFu, 0x27u, 0x1Cu };
+	static constexpr int64 SignatureHeaderSize = 32;
+	static constexpr int32 MaxHeaderDepth = 4;
+	static constexpr int32 MaxThreads = Threads::MaxThreads;
+
+	// Property ids
+	static constexpr uint8 IdEnd = 0x00u;
+	static constexpr uint8 IdHeader = 0x01u;
+	static constexpr uint8 IdArchiveProperties = 0x02u;
+	static constexpr uint8 IdAdditionalStreamsInfo = 0x03u;
+	static constexpr uint8 IdMainStreamsInfo = 0x04u;
+	static constexpr uint8 IdFilesInfo = 0x05u;
+	static constexpr uint8 IdPackInfo = 0x06u;
+	static constexpr uint8 IdUnpackInfo = 0x07u;
+	static constexpr uint8 IdSubStreamsInfo = 0x08u;
+	static constexpr uint8 IdSize = 0x09u;
+	static constexpr uint8 IdCrc = 0x0Au;
+	static constexpr uint8 IdFolder = 0x0Bu;
+	static constexpr uint8 IdCodersUnpackSize = 0x0Cu;
+	static constexpr uint8 IdNumUnpackStream = 0x0Du;
+	static constexpr uint8 IdEmptyStream = 0x0Eu;
+	static constexpr uint8 IdEmptyFile = 0x0Fu;
+	static constexpr uint8 IdName = 0x11u;
+	static constexpr uint8 IdModifiedTime = 0x14u;
+	static constexpr uint8 IdWinAttributes = 0x15u;
+	static constexpr uint8 IdEncodedHeader = 0x17u;
+
+	// Coder ids
+	static constexpr uint64 CoderCopy = 0x00u;
+	static constexpr uint64 CoderLzma = 0x030101u;
+	static constexpr uint64 CoderLzma2 = 0x21u;
+
+	// Coder flags
+	static constexpr uint8 CoderIdSizeMask = 0x0Fu;
+	static constexpr uint8 CoderIsComplex = 0x10u;
+	static constexpr uint8 CoderHasProperties = 0x20u;
+	static constexpr uint8 CoderHasAlternatives = 0x80u;
+	static constexpr uint64 MaxCoderStreams = 64u;
+
+	static constexpr uint32 AttributeDirectory = 0x10u;
+}
+
+/**
+ * Reads the primitive types of a 7z header, failing rather than reading past its end.
+ */
+class CSevenZipBuffer
+{
+public:
+	CSevenZipBuffer( const uint8* data, const int64 size )
+		: Data( data )
+		, Size( size )
+	{
+	}
+
+	bool ReadByte( uint8& value )
+	{
+		if( Position >= Size )
+		{
+			return false;
+		}
+
+		value = Data[Position++];
+		return true;
+	}
+
+	/**
+	 * @brief Reads a 7z NUMBER: the count of leading one bits in the first byte is the number of little endian bytes that follow.
+	 */
+	bool ReadNumber( uint64& value )
+	{
+		uint8 first = 0u;
+		if( !ReadByte( first ) )
+		{
+			return false;
+		}
+
+		value = 0u;
+		uint8 mask = 0x80u;
+		for( int32 index = 0; index < 8; index++ )
+		{
+			if( ( first & mask ) == 0u )
+			{
+				value |= static_cast< uint64 >( first & ( mask - 1u ) ) << ( index * 8 );
+				return true;
+			}
+
+			uint8 byte = 0u;
+			if( !ReadByte( byte ) )
+			{
+				return false;
+			}
+
+			value |= static_cast< uint64 >( byte ) << ( index * 8 );
+			mask >>= 1;
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief Reads a NUMBER that must be no more than limit.
+	 */
+	bool ReadNumber( int64& value, const int64 limit )
+	{
+		uint64 number = 0u;
+		if( !ReadNumber( number ) || number > static_cast< uint64 >( limit ) )
+		{
+			return false;
+		}
+
+		value = static_cast< int64 >( number );
+		return true;
+	}
+
+	bool ReadUInt32( uint32& value )
+	{
+		uint64 wide = 0u;
+		if( !ReadLittleEndian( wide, 4 ) )
+		{
+			return false;
+		}
+
+		value = static_cast< uint32 >( wide );
+		return true;
+	}
+
+	bool ReadLittleEndian( uint64& value, const int32 size )
+	{
+		if( Size - Position < size )
+		{
+			return false;
+		}
+
+		value = 0u;
+		for( int32 index = 0; index < size; index++ )
+		{
+			value |= static_cast< uint64 >( Data[Position++] ) << ( index * 8 );
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief Reads count bits, most significant bit of each byte first.
+	 */
+	bool ReadBits( std::vector< bool >& bits, const int64 count )
+	{
+		if( ( Size - Position ) * 8 < count )
+		{
+			return false;
+		}
+
+		bits.assign( static_cast< uint64 >( count ), false );
+		for( int64 index = 0; index < count; index++ )
+		{
+			bits[static_cast< uint64 >( index )] = ( ( Data[Position + index / 8] >> ( 7 - index % 8 ) ) & 1u ) != 0u;
+		}
+
+		Position += ( count + 7 ) / 8;
+		return true;
+	}
+
+	/**
+	 * @brief Reads a defined-items vector: a byte that is non zero if all count items are defined, otherwise the bits.
+	 */
+	bool ReadDefinedBits( std::vector< bool >& bits, const int64 count )
+	{
+		uint8 all_defined = 0u;
+		if( !ReadByte( all_defined ) )
+		{
+			return false;
+		}
+
+		if( all_defined != 0u )
+		{
+			bits.assign( static_cast< uint64 >( count ), true );
+			return true;
+		}
+
+		return ReadBits( bits, count );
+	}
+
+	bool Skip( const int64 size )
+	{
+		if( size < 0 || Size - Position < size )
+		{
+			return false;
+		}
+
+		Position += size;
+		return true;
+	}
+
+	int64 GetRemaining() const
+	{
+		return Size - Position;
+	}
+
+	const uint8* Data = nullptr;
+	int64 Size = 0;
+	int64 Position = 0;
+};
+
+/** A folder as described in the header, before it is placed in the archive */
+class CSevenZipFolderInfo
+{
+public:
+	CSevenZipArchive::CFolder Folder;
+	int64 PackStreamCount = 0;
+	int64 OutStreamCount = 0;
+	int64 MainOutStream = 0;
+};
+
+/** The pack, folder and substream tables of a StreamsInfo block */
+class CSevenZipStreams
+{
+public:
+	int64 PackPosition = 0;
+	std::vector< int64 > PackSizes;
+	std::vector< CSevenZipFolderInfo > Folders;
+
+	// Per folder, then per substream across all folders
+	std::vector< int64 > SubStreamCounts;
+	std::vector< int64 > SubStreamSizes;
+	std::vector< bool > SubStreamHasCrc;
+	std::vector< uint32 > SubStreamCrcs;
+};
+
+/* ---------- Header parsing ---------- */
+
+static SevenZipResult ReadDigests( CSevenZipBuffer& buffer, const int64 count, std::vector< bool >& defined, std::vector< uint32 >& crcs )
+{
+	if( !buffer.ReadDefinedBits( defined, count ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	crcs.assign( static_cast< uint64 >( count ), 0u );
+	for( int64 index = 0; index < count; index++ )
+	{
+		if( defined[static_cast< uint64 >( index )] && !buffer.ReadUInt32( crcs[static_cast< uint64 >( index )] ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+static SevenZipResult ReadPackInfo( CSevenZipBuffer& buffer, const int64 archiveLength, CSevenZipStreams& streams )
+{
+	// The packed streams start after the signature header, so this keeps their offset from overflowing
+	int64 pack_count = 0;
+	if( !buffer.ReadNumber( streams.PackPosition, archiveLength - SevenZip::SignatureHeaderSize ) || !buffer.ReadNumber( pack_count, buffer.GetRemaining() ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	streams.PackSizes.assign( static_cast< uint64 >( pack_count ), 0 );
+
+	uint8 type = 0u;
+	while( buffer.ReadByte( type ) && type != SevenZip::IdEnd )
+	{
+		if( type == SevenZip::IdSize )
+		{
+			for( int64& pack_size : streams.PackSizes )
+			{
+				if( !buffer.ReadNumber( pack_size, INT64_MAX ) )
+				{
+					return SevenZipResult::SevenZipErrorArchive;
+				}
+			}
+		}
+		else if( type == SevenZip::IdCrc )
+		{
+			// Packed stream checksums are not needed; the unpacked data is checked instead
+			std::vector< bool > defined;
+			std::vector< uint32 > crcs;
+			const SevenZipResult result = ReadDigests( buffer, pack_count, defined, crcs );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+		}
+		else
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	return ( type == SevenZip::IdEnd ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+}
+
+/**
+ * @brief Reads a folder's coders and how their streams are bound; only a lone Copy, LZMA or LZMA2 coder can be decoded.
+ */
+static SevenZipResult ReadFolder( CSevenZipBuffer& buffer, CSevenZipFolderInfo& info )
+{
+	int64 coder_count = 0;
+	if( !buffer.ReadNumber( coder_count, SevenZip::MaxCoderStreams ) || coder_count == 0 )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	int64 in_stream_count = 0;
+	for( int64 coder = 0; coder < coder_count; coder++ )
+	{
+		uint8 flags = 0u;
+		if( !buffer.ReadByte( flags ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		const int32 id_size = flags & SevenZip::CoderIdSizeMask;
+		uint64 id = 0u;
+		for( int32 index = 0; index < id_size; index++ )
+		{
+			uint8 byte = 0u;
+			if( id_size > 8 || !buffer.ReadByte( byte ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			id = ( id << 8 ) | byte;
+		}
+
+		int64 coder_in_streams = 1;
+		int64 coder_out_streams = 1;
+		if( ( flags & SevenZip::CoderIsComplex ) != 0u )
+		{
+			if( !buffer.ReadNumber( coder_in_streams, SevenZip::MaxCoderStreams ) || !buffer.ReadNumber( coder_out_streams, SevenZip::MaxCoderStreams ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+		}
+
+		int64 properties_size = 0;
+		const uint8* properties = nullptr;
+		if( ( flags & SevenZip::CoderHasProperties ) != 0u )
+		{
+			if( !buffer.ReadNumber( properties_size, buffer.GetRemaining() ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			properties = buffer.Data + buffer.Position;
+			buffer.Skip( properties_size );
+		}
+
+		if( ( flags & SevenZip::CoderHasAlternatives ) != 0u )
+		{
+			return SevenZipResult::SevenZipErrorUnsupported;
+		}
+
+		in_stream_count += coder_in_streams;
+		info.OutStreamCount += coder_out_streams;
+
+		if( coder_count == 1 && coder_in_streams == 1 && coder_out_streams == 1 )
+		{
+			CSevenZipArchive::CFolder& folder = info.Folder;
+			if( id == SevenZip::CoderCopy && properties_size == 0 )
+			{
+				folder.Coder = CSevenZipArchive::SevenZipCoder::Copy;
+			}
+			else if( id == SevenZip::CoderLzma && properties_size == 5 )
+			{
+				folder.Coder = CSevenZipArchive::SevenZipCoder::Lzma;
+				memcpy( folder.Properties, properties, 5 );
+			}
+			else if( id == SevenZip::CoderLzma2 && properties_size == 1 )
+			{
+				folder.Coder = CSevenZipArchive::SevenZipCoder::Lzma2;
+				folder.Properties[0] = properties[0];
+			}
+		}
+	}
+
+	// Every out stream but the last is bound to the in stream of another coder
+	const int64 bind_pair_count = info.OutStreamCount - 1;
+	if( bind_pair_count < 0 || in_stream_count < bind_pair_count )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	std::vector< bool > bound_out( static_cast< uint64 >( info.OutStreamCount ), false );
+	for( int64 pair = 0; pair < bind_pair_count; pair++ )
+	{
+		int64 in_index = 0;
+		int64 out_index = 0;
+		if( !buffer.ReadNumber( in_index, in_stream_count - 1 ) || !buffer.ReadNumber( out_index, info.OutStreamCount - 1 ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		bound_out[static_cast< uint64 >( out_index )] = true;
+	}
+
+	info.PackStreamCount = in_stream_count - bind_pair_count;
+	if( info.PackStreamCount == 0 )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	if( info.PackStreamCount > 1 )
+	{
+		for( int64 pack = 0; pack < info.PackStreamCount; pack++ )
+		{
+			int64 in_index = 0;
+			if( !buffer.ReadNumber( in_index, in_stream_count - 1 ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+		}
+	}
+
+	info.MainOutStream = static_cast< int64 >( std::find( bound_out.begin(), bound_out.end(), false ) - bound_out.begin() );
+	return ( info.MainOutStream < info.OutStreamCount ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+}
+
+static SevenZipResult ReadUnpackInfo( CSevenZipBuffer& buffer, CSevenZipStreams& streams )
+{
+	uint8 type = 0u;
+	uint8 external = 0u;
+	int64 folder_count = 0;
+	if( !buffer.ReadByte( type ) || type != SevenZip::IdFolder || !buffer.ReadNumber( folder_count, buffer.GetRemaining() ) || !buffer.ReadByte( external ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	if( external != 0u )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	streams.Folders.resize( static_cast< uint64 >( folder_count ) );
+	for( CSevenZipFolderInfo& info : streams.Folders )
+	{
+		const SevenZipResult result = ReadFolder( buffer, info );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+	}
+
+	if( !buffer.ReadByte( type ) || type != SevenZip::IdCodersUnpackSize )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	// One size per coder out stream; the folder's output is the stream not bound to another coder
+	for( CSevenZipFolderInfo& info : streams.Folders )
+	{
+		for( int64 out_stream = 0; out_stream < info.OutStreamCount; out_stream++ )
+		{
+			int64 size = 0;
+			if( !buffer.ReadNumber( size, INT64_MAX ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			if( out_stream == info.MainOutStream )
+			{
+				info.Folder.UnpackSize = size;
+			}
+		}
+	}
+
+	while( buffer.ReadByte( type ) && type != SevenZip::IdEnd )
+	{
+		if( type != SevenZip::IdCrc )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		std::vector< bool > defined;
+		std::vector< uint32 > crcs;
+		const SevenZipResult result = ReadDigests( buffer, folder_count, defined, crcs );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		for( int64 index = 0; index < folder_count; index++ )
+		{
+			streams.Folders[static_cast< uint64 >( index )].Folder.HasCrc = defined[static_cast< uint64 >( index )];
+			streams.Folders[static_cast< uint64 >( index )].Folder.Crc = crcs[static_cast< uint64 >( index )];
+		}
+	}
+
+	return ( type == SevenZip::IdEnd ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+}
+
+/**
+ * @brief Reads how each folder's output splits into files; type is the property id already read, and receives the next one.
+ */
+static SevenZipResult ReadSubStreamsInfo( CSevenZipBuffer& buffer, CSevenZipStreams& streams, uint8& type )
+{
+	streams.SubStreamCounts.assign( streams.Folders.size(), 1 );
+	if( type == SevenZip::IdNumUnpackStream )
+	{
+		for( int64& count : streams.SubStreamCounts )
+		{
+			if( !buffer.ReadNumber( count, INT64_MAX ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+		}
+
+		if( !buffer.ReadByte( type ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	// All but the last size of each folder are stored; the last is what remains
+	for( uint64 index = 0; index < streams.Folders.size(); index++ )
+	{
+		const int64 count = streams.SubStreamCounts[index];
+		if( count == 0 )
+		{
+			continue;
+		}
+
+		if( count > 1 && type != SevenZip::IdSize )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		int64 remaining = streams.Folders[index].Folder.UnpackSize;
+		for( int64 stream = 1; stream < count; stream++ )
+		{
+			int64 size = 0;
+			if( !buffer.ReadNumber( size, remaining ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			streams.SubStreamSizes.push_back( size );
+			remaining -= size;
+		}
+
+		streams.SubStreamSizes.push_back( remaining );
+	}
+
+	if( type == SevenZip::IdSize && !buffer.ReadByte( type ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	// A folder holding one stream shares its checksum; every other stream's checksum is listed
+	std::vector< bool > defined;
+	std::vector< uint32 > crcs;
+	int64 listed_count = 0;
+	for( uint64 index = 0; index < streams.Folders.size(); index++ )
+	{
+		const bool shared = ( streams.SubStreamCounts[index] == 1 && streams.Folders[index].Folder.HasCrc );
+		listed_count += shared ? 0 : streams.SubStreamCounts[index];
+	}
+
+	while( type != SevenZip::IdEnd )
+	{
+		if( type != SevenZip::IdCrc )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		const SevenZipResult result = ReadDigests( buffer, listed_count, defined, crcs );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		if( !buffer.ReadByte( type ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	int64 listed = 0;
+	for( uint64 index = 0; index < streams.Folders.size(); index++ )
+	{
+		const CSevenZipArchive::CFolder& folder = streams.Folders[index].Folder;
+		if( streams.SubStreamCounts[index] == 1 && folder.HasCrc )
+		{
+			streams.SubStreamHasCrc.push_back( true );
+			streams.SubStreamCrcs.push_back( folder.Crc );
+			continue;
+		}
+
+		for( int64 stream = 0; stream < streams.SubStreamCounts[index]; stream++, listed++ )
+		{
+			const bool has_crc = !defined.empty() && defined[static_cast< uint64 >( listed )];
+			streams.SubStreamHasCrc.push_back( has_crc );
+			streams.SubStreamCrcs.push_back( has_crc ? crcs[static_cast< uint64 >( listed )] : 0u );
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+static SevenZipResult ReadStreamsInfo( CSevenZipBuffer& buffer, const int64 archiveLength, CSevenZipStreams& streams )
+{
+	uint8 type = 0u;
+	if( !buffer.ReadByte( type ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	SevenZipResult result = SevenZipResult::SevenZipOK;
+	if( type == SevenZip::IdPackInfo )
+	{
+		result = ReadPackInfo( buffer, archiveLength, streams );
+		if( result != SevenZipResult::SevenZipOK || !buffer.ReadByte( type ) )
+		{
+			return ( result != SevenZipResult::SevenZipOK ) ? result : SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	if( type == SevenZip::IdUnpackInfo )
+	{
+		result = ReadUnpackInfo( buffer, streams );
+		if( result != SevenZipResult::SevenZipOK || !buffer.ReadByte( type ) )
+		{
+			return ( result != SevenZipResult::SevenZipOK ) ? result : SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	if( type == SevenZip::IdSubStreamsInfo )
+	{
+		if( !buffer.ReadByte( type ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		result = ReadSubStreamsInfo( buffer, streams, type );
+		if( result != SevenZipResult::SevenZipOK || !buffer.ReadByte( type ) )
+		{
+			return ( result != SevenZipResult::SevenZipOK ) ? result : SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+	else
+	{
+		// Without substream information every folder holds one stream
+		uint8 end = SevenZip::IdEnd;
+		result = ReadSubStreamsInfo( buffer, streams, end );
+	}
+
+	return ( type == SevenZip::IdEnd ) ? result : SevenZipResult::SevenZipErrorArchive;
+}
+
+/**
+ * @brief Places each folder's packed streams in the archive, in order after the pack position.
+ */
+static SevenZipResult PlaceFolders( const CSevenZipStreams& streams, const int64 archiveLength, std::vector< CSevenZipArchive::CFolder >& folders )
+{
+	int64 pack_offset = SevenZip::SignatureHeaderSize + streams.PackPosition;
+	uint64 pack_stream = 0u;
+
+	folders.clear();
+	for( const CSevenZipFolderInfo& info : streams.Folders )
+	{
+		CSevenZipArchive::CFolder folder = info.Folder;
+		folder.PackOffset = pack_offset;
+		for( int64 index = 0; index < info.PackStreamCount; index++, pack_stream++ )
+		{
+			if( pack_stream >= streams.PackSizes.size() || streams.PackSizes[pack_stream] > archiveLength - pack_offset )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			pack_offset += streams.PackSizes[pack_stream];
+		}
+
+		folder.PackSize = pack_offset - folder.PackOffset;
+		folders.push_back( folder );
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Appends a UTF-16 code point to a UTF-8 string.
+ */
+static void AppendUtf8( std::string& text, const uint32 codePoint )
+{
+	if( codePoint < 0x80u )
+	{
+		text += static_cast< char >( codePoint );
+	}
+	else if( codePoint < 0x800u )
+	{
+		text += static_cast< char >( 0xC0u | ( codePoint >> 6 ) );
+		text += static_cast< char >( 0x80u | ( codePoint & 0x3Fu ) );
+	}
+	else if( codePoint < 0x10000u )
+	{
+		text += static_cast< char >( 0xE0u | ( codePoint >> 12 ) );
+		text += static_cast< char >( 0x80u | ( ( codePoint >> 6 ) & 0x3Fu ) );
+		text += static_cast< char >( 0x80u | ( codePoint & 0x3Fu ) );
+	}
+	else
+	{
+		text += static_cast< char >( 0xF0u | ( codePoint >> 18 ) );
+		text += static_cast< char >( 0x80u | ( ( codePoint >> 12 ) & 0x3Fu ) );
+		text += static_cast< char >( 0x80u | ( ( codePoint >> 6 ) & 0x3Fu ) );
+		text += static_cast< char >( 0x80u | ( codePoint & 0x3Fu ) );
+	}
+}
+
+/**
+ * @brief Reads the zero terminated UTF-16LE names of every entry.
+ */
+static SevenZipResult ReadNames( CSevenZipBuffer& buffer, std::vector< CSevenZipEntry >& entries )
+{
+	uint8 external = 0u;
+	if( !buffer.ReadByte( external ) || external != 0u )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	for( CSevenZipEntry& entry : entries )
+	{
+		entry.Name.clear();
+		while( true )
+		{
+			uint64 unit = 0u;
+			if( !buffer.ReadLittleEndian( unit, 2 ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			if( unit == 0u )
+			{
+				break;
+			}
+
+			uint32 code_point = static_cast< uint32 >( unit );
+			if( code_point >= 0xD800u && code_point < 0xDC00u )
+			{
+				uint64 low = 0u;
+				if( !buffer.ReadLittleEndian( low, 2 ) || low < 0xDC00u || low >= 0xE000u )
+				{
+					return SevenZipResult::SevenZipErrorArchive;
+				}
+
+				code_point = 0x10000u + ( ( code_point - 0xD800u ) << 10 ) + ( static_cast< uint32 >( low ) - 0xDC00u );
+			}
+
+			AppendUtf8( entry.Name, code_point );
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Reads a per-entry property that has a defined vector, an external flag and a value for each defined entry.
+ */
+static SevenZipResult ReadEntryValues( CSevenZipBuffer& buffer, const int64 count, const int32 valueSize, std::vector< bool >& defined, std::vector< uint64 >& values )
+{
+	uint8 external = 0u;
+	if( !buffer.ReadDefinedBits( defined, count ) || !buffer.ReadByte( external ) || external != 0u )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	values.assign( static_cast< uint64 >( count ), 0u );
+	for( int64 index = 0; index < count; index++ )
+	{
+		if( defined[static_cast< uint64 >( index )] && !buffer.ReadLittleEndian( values[static_cast< uint64 >( index )], valueSize ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Reads the entry table and matches each entry that has contents to the next substream.
+ */
+static SevenZipResult ReadFilesInfo( CSevenZipBuffer& buffer, const CSevenZipStreams& streams, std::vector< CSevenZipArchive::CFolder >& folders, std::vector< CSevenZipEntry >& entries )
+{
+	int64 entry_count = 0;
+	if( !buffer.ReadNumber( entry_count, buffer.GetRemaining() ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	entries.assign( static_cast< uint64 >( entry_count ), CSevenZipEntry() );
+	std::vector< bool > empty_stream( static_cast< uint64 >( entry_count ), false );
+	std::vector< bool > empty_file;
+
+	uint8 type = 0u;
+	while( buffer.ReadByte( type ) && type != SevenZip::IdEnd )
+	{
+		int64 size = 0;
+		if( !buffer.ReadNumber( size, buffer.GetRemaining() ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+
+		CSevenZipBuffer property( buffer.Data + buffer.Position, size );
+		buffer.Skip( size );
+
+		SevenZipResult result = SevenZipResult::SevenZipOK;
+		std::vector< bool > defined;
+		std::vector< uint64 > values;
+		switch( type )
+		{
+		case SevenZip::IdEmptyStream:
+			result = property.ReadBits( empty_stream, entry_count ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+			break;
+
+		case SevenZip::IdEmptyFile:
+			result = property.ReadBits( empty_file, std::count( empty_stream.begin(), empty_stream.end(), true ) ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+			break;
+
+		case SevenZip::IdName:
+			result = ReadNames( property, entries );
+			break;
+
+		case SevenZip::IdWinAttributes:
+			result = ReadEntryValues( property, entry_count, 4, defined, values );
+			for( int64 index = 0; result == SevenZipResult::SevenZipOK && index < entry_count; index++ )
+			{
+				entries[static_cast< uint64 >( index )].HasAttributes = defined[static_cast< uint64 >( index )];
+				entries[static_cast< uint64 >( index )].Attributes = static_cast< uint32 >( values[static_cast< uint64 >( index )] );
+			}
+			break;
+
+		case SevenZip::IdModifiedTime:
+			result = ReadEntryValues( property, entry_count, 8, defined, values );
+			for( int64 index = 0; result == SevenZipResult::SevenZipOK && index < entry_count; index++ )
+			{
+				entries[static_cast< uint64 >( index )].HasModifiedTime = defined[static_cast< uint64 >( index )];
+				entries[static_cast< uint64 >( index )].ModifiedTime = values[static_cast< uint64 >( index )];
+			}
+			break;
+
+		default:
+			// Other times, anti items, padding and unknown properties are skipped
+			break;
+		}
+
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+	}
+
+	if( type != SevenZip::IdEnd )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	// Entries with contents take the substreams in order, folder by folder
+	uint64 folder_index = 0u;
+	uint64 stream = 0u;
+	int64 empty_index = 0;
+	int64 folder_offset = 0;
+	int64 streams_left = 0;
+	for( int64 index = 0; index < entry_count; index++ )
+	{
+		CSevenZipEntry& entry = entries[static_cast< uint64 >( index )];
+		if( empty_stream[static_cast< uint64 >( index )] )
+		{
+			const bool is_file = ( static_cast< uint64 >( empty_index ) < empty_file.size() ) && empty_file[static_cast< uint64 >( empty_index )];
+			entry.IsDirectory = !is_file;
+			empty_index++;
+			continue;
+		}
+
+		while( streams_left == 0 )
+		{
+			if( folder_index >= folders.size() )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			streams_left = streams.SubStreamCounts[folder_index];
+			folders[folder_index].FirstEntry = index;
+			folder_offset = 0;
+			folder_index++;
+		}
+
+		CSevenZipArchive::CFolder& folder = folders[folder_index - 1u];
+		entry.Folder = static_cast< int64 >( folder_index - 1u );
+		entry.FolderOffset = folder_offset;
+		entry.Size = streams.SubStreamSizes[stream];
+		entry.HasCrc = streams.SubStreamHasCrc[stream];
+		entry.Crc = streams.SubStreamCrcs[stream];
+		folder.EntryCount = index - folder.FirstEntry + 1;
+
+		folder_offset += entry.Size;
+		streams_left--;
+		stream++;
+	}
+
+	for( CSevenZipEntry& entry : entries )
+	{
+		entry.IsDirectory = entry.IsDirectory || ( entry.HasAttributes && ( entry.Attributes & SevenZip::AttributeDirectory ) != 0u );
+	}
+
+	return ( stream == streams.SubStreamSizes.size() ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+}
+
+/* ---------- CSevenZipArchive ---------- */
+
+static MemoryInterface allocator;
+
+CSevenZipArchive::CSevenZipArchive( MemoryInterface* alloc )
+	: Alloc( alloc )
+{
+	if( Alloc == nullptr )
+	{
+		Alloc = &allocator;
+	}
+}
+
+/**
+ * @brief Decodes a folder and checks its CRC.
+ *
+ * @param folder      The folder to decode.
+ * @param destination Where the output goes; folder.UnpackSize bytes.
+ * @return SevenZipOK, SevenZipErrorData, SevenZipErrorCrc, SevenZipErrorUnsupported or SevenZipErrorMemory.
+ */
+SevenZipResult CSevenZipArchive::DecodeFolder( const CFolder& folder, uint8* destination ) const
+{
+	const uint8* packed = Archive + folder.PackOffset;
+	int64 output_length = folder.UnpackSize;
+	int64 input_length = folder.PackSize;
+	LzmaStatus status = LzmaStatus::LzmaStatusNotSpecified;
+	SevenZipResult result = SevenZipResult::SevenZipOK;
+
+	switch( folder.Coder )
+	{
+	case SevenZipCoder::Copy:
+		if( folder.PackSize != folder.UnpackSize )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		memcpy( destination, packed, static_cast< uint64 >( folder.UnpackSize ) );
+		status = LzmaStatus::LzmaStatusFinishedWithMark;
+		break;
+
+	case SevenZipCoder::Lzma:
+		result = Lzma1Decode( destination, output_length, packed, input_length, folder.Properties, 5, LzmaFinishMode::LzmaFinishModeEnd, status, Alloc );
+		break;
+
+	case SevenZipCoder::Lzma2:
+		result = Lzma2Decode( destination, output_length, packed, input_length, folder.Properties[0], LzmaFinishMode::LzmaFinishModeEnd, status, Alloc, nullptr, nullptr );
+		break;
+
+	case SevenZipCoder::Unsupported:
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		// The packed size is known, so running out of input means the data is damaged
+		return ( result == SevenZipResult::SevenZipErrorInputEof ) ? SevenZipResult::SevenZipErrorData : result;
+	}
+
+	// 7-Zip writes LZMA without an end mark, as the size is known
+	if( output_length != folder.UnpackSize || ( status != LzmaStatus::LzmaStatusFinishedWithMark && status != LzmaStatus::LzmaStatusMaybeFinishedWithoutMark ) )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	if( folder.HasCrc && Crc32Update( 0u, destination, folder.UnpackSize ) != folder.Crc )
+	{
+		return SevenZipResult::SevenZipErrorCrc;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Parses a header, first decoding it if it is stored compressed.
+ */
+SevenZipResult CSevenZipArchive::ReadHeader( const uint8* header, const int64 headerLength, const int32 depth )
+{
+	CSevenZipBuffer buffer( header, headerLength );
+	uint8 type = 0u;
+	if( !buffer.ReadByte( type ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	if( type == SevenZip::IdEncodedHeader )
+	{
+		CSevenZipStreams streams;
+		std::vector< CFolder > folders;
+		SevenZipResult result = ReadStreamsInfo( buffer, ArchiveLength, streams );
+		if( result == SevenZipResult::SevenZipOK )
+		{
+			result = PlaceFolders( streams, ArchiveLength, folders );
+		}
+
+		if( result == SevenZipResult::SevenZipOK && ( folders.size() != 1u || depth >= SevenZip::MaxHeaderDepth ) )
+		{
+			result = SevenZipResult::SevenZipErrorArchive;
+		}
+
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		const CFolder& folder = folders[0];
+		uint8* decoded = static_cast< uint8* >( Alloc->Alloc( folder.UnpackSize, "CSevenZipArchive::Header" ) );
+		if( decoded == nullptr && folder.UnpackSize > 0 )
+		{
+			return SevenZipResult::SevenZipErrorMemory;
+		}
+
+		result = DecodeFolder( folder, decoded );
+		if( result == SevenZipResult::SevenZipOK )
+		{
+			result = ReadHeader( decoded, folder.UnpackSize, depth + 1 );
+		}
+
+		Alloc->Free( decoded, folder.UnpackSize, "CSevenZipArchive::Header" );
+		return result;
+	}
+
+	if( type != SevenZip::IdHeader || !buffer.ReadByte( type ) )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	if( type == SevenZip::IdArchiveProperties )
+	{
+		while( buffer.ReadByte( type ) && type != SevenZip::IdEnd )
+		{
+			int64 size = 0;
+			if( !buffer.ReadNumber( size, buffer.GetRemaining() ) )
+			{
+				return SevenZipResult::SevenZipErrorArchive;
+			}
+
+			buffer.Skip( size );
+		}
+
+		if( type != SevenZip::IdEnd || !buffer.ReadByte( type ) )
+		{
+			return SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	if( type == SevenZip::IdAdditionalStreamsInfo )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	CSevenZipStreams streams;
+	if( type == SevenZip::IdMainStreamsInfo )
+	{
+		SevenZipResult result = ReadStreamsInfo( buffer, ArchiveLength, streams );
+		if( result == SevenZipResult::SevenZipOK )
+		{
+			result = PlaceFolders( streams, ArchiveLength, Folders );
+		}
+
+		if( result != SevenZipResult::SevenZipOK || !buffer.ReadByte( type ) )
+		{
+			return ( result != SevenZipResult::SevenZipOK ) ? result : SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	if( type == SevenZip::IdFilesInfo )
+	{
+		const SevenZipResult result = ReadFilesInfo( buffer, streams, Folders, Entries );
+		if( result != SevenZipResult::SevenZipOK || !buffer.ReadByte( type ) )
+		{
+			return ( result != SevenZipResult::SevenZipOK ) ? result : SevenZipResult::SevenZipErrorArchive;
+		}
+	}
+
+	return ( type == SevenZip::IdEnd ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorArchive;
+}
+
+/**
+ * Read the archive headers.
+ */
+SevenZipResult CSevenZipArchive::Open( const uint8* archive, int64 archiveLength )
+{
+	Archive = archive;
+	ArchiveLength = archiveLength;
+	Folders.clear();
+	Entries.clear();
+
+	if( archiveLength < SevenZip::SignatureHeaderSize || memcmp( archive, SevenZip::Signature, sizeof( SevenZip::Signature ) ) != 0 )
+	{
+		return SevenZipResult::SevenZipErrorNoArchive;
+	}
+
+	// Only major version 0 exists
+	if( archive[6] != 0u )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	CSevenZipBuffer start_header( archive + 8, SevenZip::SignatureHeaderSize - 8 );
+	uint32 start_header_crc = 0u;
+	uint64 next_header_offset = 0u;
+	uint64 next_header_size = 0u;
+	uint32 next_header_crc = 0u;
+	start_header.ReadUInt32( start_header_crc );
+	start_header.ReadLittleEndian( next_header_offset, 8 );
+	start_header.ReadLittleEndian( next_header_size, 8 );
+	start_header.ReadUInt32( next_header_crc );
+
+	if( Crc32Update( 0u, archive + 12, SevenZip::SignatureHeaderSize - 12 ) != start_header_crc )
+	{
+		return SevenZipResult::SevenZipErrorCrc;
+	}
+
+	// An empty archive has no header at all
+	if( next_header_size == 0u )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	const uint64 available = static_cast< uint64 >( archiveLength - SevenZip::SignatureHeaderSize );
+	if( next_header_offset > available || next_header_size > available - next_header_offset )
+	{
+		return SevenZipResult::SevenZipErrorArchive;
+	}
+
+	const uint8* header = archive + SevenZip::SignatureHeaderSize + next_header_offset;
+	if( Crc32Update( 0u, header, static_cast< int64 >( next_header_size ) ) != next_header_crc )
+	{
+		return SevenZipResult::SevenZipErrorCrc;
+	}
+
+	const SevenZipResult result = ReadHeader( header, static_cast< int64 >( next_header_size ), 0 );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		Folders.clear();
+		Entries.clear();
+	}
+
+	return result;
+}
+
+/**
+ * Decode every folder and pass the entries on in archive order.
+ */
+SevenZipResult CSevenZipArchive::Extract( SevenZipExtractInterface* extract, int32 numThreads )
+{
+	numThreads = std::clamp( numThreads, 1, SevenZip::MaxThreads );
+
+	// Folders that hold no entry need not be decoded
+	std::vector< int64 > folders;
+	for( int64 index = 0; index < static_cast< int64 >( Folders.size() ); index++ )
+	{
+		if( Folders[static_cast< uint64 >( index )].EntryCount > 0 )
+		{
+			folders.push_back( index );
+		}
+	}
+
+	std::vector< uint8* > buffers( static_cast< uint64 >( numThreads ), nullptr );
+	std::vector< SevenZipResult > results( static_cast< uint64 >( numThreads ), SevenZipResult::SevenZipOK );
+	SevenZipResult result = SevenZipResult::SevenZipOK;
+	uint64 entry_index = 0u;
+
+	for( uint64 batch_start = 0u; batch_start < folders.size() && result == SevenZipResult::SevenZipOK; batch_start += static_cast< uint64 >( numThreads ) )
+	{
+		const int32 batch_count = static_cast< int32 >( std::min< uint64 >( static_cast< uint64 >( numThreads ), folders.size() - batch_start ) );
+		for( int32 index = 0; index < batch_count; index++ )
+		{
+			const CFolder& folder = Folders[static_cast< uint64 >( folders[batch_start + static_cast< uint64 >( index )] )];
+			buffers[static_cast< uint64 >( index )] = static_cast< uint8* >( Alloc->Alloc( folder.UnpackSize, "CSevenZipArchive::Folder" ) );
+			const bool failed = ( buffers[static_cast< uint64 >( index )] == nullptr && folder.UnpackSize > 0 );
+			results[static_cast< uint64 >( index )] = failed ? SevenZipResult::SevenZipErrorMemory : SevenZipResult::SevenZipOK;
+		}
+
+		// Each folder is an independent stream, decoded into its own buffer
+		std::atomic< int32 > next_folder = 0;
+		auto worker = [&]()
+		{
+			int32 index;
+			while( ( index = next_folder++ ) < batch_count )
+			{
+				if( results[static_cast< uint64 >( index )] == SevenZipResult::SevenZipOK )
+				{
+					const CFolder& folder = Folders[static_cast< uint64 >( folders[batch_start + static_cast< uint64 >( index )] )];
+					results[static_cast< uint64 >( index )] = DecodeFolder( folder, buffers[static_cast< uint64 >( index )] );
+				}
+			}
+		};
+
+		// The calling thread is the first worker, so a batch of one folder starts no threads, and it takes over the
+		// folders of any thread that could not be started
+		RunWorkers( worker, batch_count );
+
+		// Pass on the entries of this batch, with any empty entries between them
+		const int64 last_folder = folders[batch_start + static_cast< uint64 >( batch_count ) - 1u];
+		for( int32 index = 0; index < batch_count && result == SevenZipResult::SevenZipOK; index++ )
+		{
+			result = results[static_cast< uint64 >( index )];
+		}
+
+		while( result == SevenZipResult::SevenZipOK && entry_index < Entries.size() && Entries[entry_index].Folder <= last_folder )
+		{
+			const CSevenZipEntry& entry = Entries[entry_index++];
+			const uint8* data = nullptr;
+			if( entry.Folder >= 0 )
+			{
+				const uint64 buffer_index = static_cast< uint64 >( std::find( folders.begin() + static_cast< int64 >( batch_start ), folders.end(), entry.Folder ) - folders.begin() ) - batch_start;
+				data = buffers[buffer_index] + entry.FolderOffset;
+				if( entry.HasCrc && Crc32Update( 0u, data, entry.Size ) != entry.Crc )
+				{
+					result = SevenZipResult::SevenZipErrorCrc;
+					break;
+				}
+			}
+
+			result = ( extract->Extract( entry, data ) == SevenZipResult::SevenZipOK ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorProgress;
+		}
+
+		for( int32 index = 0; index < batch_count; index++ )
+		{
+			const CFolder& folder = Folders[static_cast< uint64 >( folders[batch_start + static_cast< uint64 >( index )] )];
+			Alloc->Free( buffers[static_cast< uint64 >( index )], folder.UnpackSize, "CSevenZipArchive::Folder" );
+			buffers[static_cast< uint64 >( index )] = nullptr;
+		}
+	}
+
+	// Entries with no contents after the last folder
+	while( result == SevenZipResult::SevenZipOK && entry_index < Entries.size() )
+	{
+		result = ( extract->Extract( Entries[entry_index++], nullptr ) == SevenZipResult::SevenZipOK ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorProgress;
+	}
+
+	return result;
+}
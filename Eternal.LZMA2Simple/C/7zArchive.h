@@ -0,0 +1,143 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * A read-only reader for .7z archives held in memory.
+ *
+ * It reads the signature header, decodes a compressed header, and builds the folder and substream tables.
+ * Folders are the independently compressed units of an archive. A solid archive packs many entries into one folder;
+ * otherwise every entry has its own. Folders decode concurrently, and the entries in them are passed to an
+ * SevenZipExtractInterface in archive order.
+ *
+ * Folders with one Copy, LZMA or LZMA2 coder are supported. Folders using other coders (BCJ, delta, PPMd, AES) are
+ * listed but fail to extract with SZ_ERROR_UNSUPPORTED.
+ */
+
+/** One file or directory in the archive */
+class CSevenZipEntry
+{
+public:
+	/** The path within the archive, UTF-8 with '/' or '\' separators as stored */
+	std::string Name;
+
+	/** The decompressed size in bytes */
+	int64 Size = 0;
+
+	bool IsDirectory = false;
+
+	/** The CRC32 of the contents, when the archive stores one */
+	bool HasCrc = false;
+	uint32 Crc = 0u;
+
+	/** Windows file attributes, when stored */
+	bool HasAttributes = false;
+	uint32 Attributes = 0u;
+
+	/** Last modified time as a Windows FILETIME, when stored */
+	bool HasModifiedTime = false;
+	uint64 ModifiedTime = 0u;
+
+	/** The folder holding the contents and where in its output they start, or -1 for entries with no contents */
+	int64 Folder = -1;
+	int64 FolderOffset = 0;
+};
+
+/**
+ * Receives extracted entries.
+ */
+class SevenZipExtractInterface
+{
+public:
+	SevenZipExtractInterface() = default;
+	virtual ~SevenZipExtractInterface() = default;
+
+	/**
+	 * Called once for each entry, in archive order, from the thread that called Extract().
+	 * data holds entry.Size bytes and is only valid during the call.
+	 * Returns: SZ_RESULT. (result != SZ_OK) means break.
+	 */
+	virtual SevenZipResult Extract( const CSevenZipEntry& entry, const uint8* data ) = 0;
+};
+
+class CSevenZipArchive
+{
+public:
+	explicit CSevenZipArchive( MemoryInterface* alloc );
+
+	/**
+	 * Open - read the archive headers; nothing is extracted
+	 * The archive data is not copied and must outlive the reader.
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_NO_ARCHIVE  - Not a .7z archive
+	 * SZ_ERROR_ARCHIVE     - The headers are malformed
+	 * SZ_ERROR_CRC         - A header checksum mismatch
+	 * SZ_ERROR_UNSUPPORTED - The header is compressed with an unsupported coder
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 */
+	SevenZipResult Open( const uint8* archive, int64 archiveLength );
+
+	const std::vector< CSevenZipEntry >& GetEntries() const
+	{
+		return Entries;
+	}
+
+	/**
+	 * Extract - decode every folder, up to numThreads at once, passing each entry to extract
+	 * With more than one thread the MemoryInterface must be thread safe. One decoded folder per thread is held at a time.
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_DATA        - Data error
+	 * SZ_ERROR_CRC         - A checksum mismatch
+	 * SZ_ERROR_UNSUPPORTED - A folder uses an unsupported coder
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 * SZ_ERROR_PROGRESS    - extract returned an error
+	 */
+	SevenZipResult Extract( SevenZipExtractInterface* extract, int32 numThreads );
+
+	/** How a folder is compressed */
+	enum class SevenZipCoder
+		: uint8
+	{
+		Copy,
+		Lzma,
+		Lzma2,
+		Unsupported
+	};
+
+	class CFolder
+	{
+	public:
+		SevenZipCoder Coder = SevenZipCoder::Unsupported;
+		uint8 Properties[5] = {};
+
+		/** Where the packed data is in the archive */
+		int64 PackOffset = 0;
+		int64 PackSize = 0;
+
+		int64 UnpackSize = 0;
+		bool HasCrc = false;
+		uint32 Crc = 0u;
+
+		/** The entries stored in this folder */
+		int64 FirstEntry = 0;
+		int64 EntryCount = 0;
+	};
+
+private:
+	SevenZipResult ReadHeader( const uint8* header, int64 headerLength, int32 depth );
+	SevenZipResult DecodeFolder( const CFolder& folder, uint8* destination ) const;
+
+	MemoryInterface* Alloc = nullptr;
+	const uint8* Archive = nullptr;
+	int64 ArchiveLength = 0;
+
+	std::vector< CFolder > Folders;
+	std::vector< CSevenZipEntry > Entries;
+};
@@ -115,6 +115,12 @@ namespace Lzma
 
 	static constexpr uint32 Lzma2MaxCompressedChunkSize = ( 1u << 16 ) + 16u;
 
+	// Inputs below this size can use the small input entry points
+	static constexpr int64 SmallInputLimit = 1 << 16;
+
+	// With a progress interface, Lzma2Decode stops to report progress after every this many bytes of output
+	static constexpr int64 Lzma2DecodeProgressInterval = 1 << 24;
+
 	static constexpr uint8 LiteralNextStateLut[NumStates] = { 0, 0, 0, 0, 1, 2, 3, 4,  5,  6, 4, 5 };
 	static constexpr uint8 MatchNextStateLut[NumStates] = { 7, 7, 7, 7, 7, 7, 7, 10, 10, 10, 10, 10 };
 	static constexpr uint8 RepNextStateLut[NumStates] = { 8, 8, 8, 8, 8, 8, 8, 11, 11, 11, 11, 11 };
@@ -150,6 +156,16 @@ public:
 	 * Returns the number of actually written bytes. ( result < size ) means error.
 	 */
 	virtual int64 Write( const uint8* bufferBase, const int64 offset, int64 size ) = 0;
+
+	/**
+	 * Returns a pointer where the next size bytes can be built in place before being passed to Write(), or nullptr if the stream has no such space.
+	 * Write() does not copy data that is already at that position.
+	 */
+	virtual uint8* GetWriteBuffer( const int64 size )
+	{
+		( void )size;
+		return nullptr;
+	}
 };
 
 /**
@@ -207,6 +223,28 @@ public:
 			free( address );
 		}
 	}
+
+	/**
+	 * Allocates size bytes that are mapped twice back to back, so that address + size aliases address.
+	 * Returns nullptr if this is not supported, in which case callers fall back to Alloc and copy data instead.
+	 */
+	virtual uint8* AllocMirrored( const int64 size, const char* tag )
+	{
+		( void )size;
+		( void )tag;
+
+		return nullptr;
+	}
+
+	/**
+	 * Frees up the memory allocated by AllocMirrored above.
+	 */
+	virtual void FreeMirrored( uint8* address, const int64 size, const char* tag )
+	{
+		( void )address;
+		( void )size;
+		( void )tag;
+	}
 };
 
 /**
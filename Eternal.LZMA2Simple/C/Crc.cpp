@@ -0,0 +1,134 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "Crc.h"
+
+#include <array>
+
+namespace Crc
+{
+	static constexpr uint32 Crc32Polynomial = 0xEDB88320u;
+	static constexpr uint64 Crc64Polynomial = 0xC96C5795D7870F42ull;
+}
+
+/**
+ * @brief Builds the slicing-by-8 lookup tables for a reflected CRC.
+ *
+ * Table 0 is the CRC of every single byte value; table k advances an entry of table k - 1 past one more zero byte,
+ * so eight bytes can be folded in with eight independent lookups.
+ *
+ * @param polynomial The reflected generator polynomial.
+ * @return The eight tables.
+ */
+template< typename TCrc >
+static constexpr std::array< std::array< TCrc, 256 >, 8 > MakeCrcTables( const TCrc polynomial )
+{
+	std::array< std::array< TCrc, 256 >, 8 > tables = {};
+	for( uint32 value = 0u; value < 256u; value++ )
+	{
+		TCrc crc = value;
+		for( int32 bit = 0; bit < 8; bit++ )
+		{
+			crc = ( crc >> 1 ) ^ ( ( crc & 1u ) != 0u ? polynomial : 0u );
+		}
+
+		tables[0][value] = crc;
+	}
+
+	for( uint32 table = 1u; table < 8u; table++ )
+	{
+		for( uint32 value = 0u; value < 256u; value++ )
+		{
+			const TCrc previous = tables[table - 1u][value];
+			tables[table][value] = ( previous >> 8 ) ^ tables[0][previous & 0xffu];
+		}
+	}
+
+	return tables;
+}
+
+static constexpr std::array< std::array< uint32, 256 >, 8 > Crc32Tables = MakeCrcTables< uint32 >( Crc::Crc32Polynomial );
+static constexpr std::array< std::array< uint64, 256 >, 8 > Crc64Tables = MakeCrcTables< uint64 >( Crc::Crc64Polynomial );
+
+/**
+ * @brief Continues a reflected CRC over more data, eight bytes at a time.
+ *
+ * The eight bytes are loaded as one little endian word, so the first byte lines up with the low byte of the CRC.
+ *
+ * @param tables The tables from MakeCrcTables().
+ * @param crc    The CRC of the preceding data, or 0 to start.
+ * @param data   Pointer to the data.
+ * @param size   Number of bytes.
+ * @return The CRC of all the data so far.
+ */
+template< typename TCrc >
+static TCrc CrcUpdate( const std::array< std::array< TCrc, 256 >, 8 >& tables, TCrc crc, const uint8* data, const int64 size )
+{
+	crc = ~crc;
+
+	int64 index = 0;
+	for( ; index + 8 <= size; index += 8 )
+	{
+		uint64 word;
+		memcpy( &word, data + index, sizeof( word ) );
+		word ^= crc;
+
+		crc = tables[7][word & 0xffu] ^ tables[6][( word >> 8 ) & 0xffu] ^ tables[5][( word >> 16 ) & 0xffu] ^ tables[4][( word >> 24 ) & 0xffu]
+			^ tables[3][( word >> 32 ) & 0xffu] ^ tables[2][( word >> 40 ) & 0xffu] ^ tables[1][( word >> 48 ) & 0xffu] ^ tables[0][word >> 56];
+	}
+
+	for( ; index < size; index++ )
+	{
+		crc = tables[0][( crc ^ data[index] ) & 0xffu] ^ ( crc >> 8 );
+	}
+
+	return ~crc;
+}
+
+/**
+ * @brief Continues a CRC-32 over more data.
+ *
+ * @param crc  The CRC of the preceding data, or 0 to start.
+ * @param data Pointer to the data.
+ * @param size Number of bytes.
+ * @return The CRC of all the data so far.
+ */
+uint32 Crc32Update( const uint32 crc, const uint8* data, const int64 size )
+{
+	return CrcUpdate< uint32 >( Crc32Tables, crc, data, size );
+}
+
+/**
+ * @brief Continues a CRC-64 over more data.
+ *
+ * @param crc  The CRC of the preceding data, or 0 to start.
+ * @param data Pointer to the data.
+ * @param size Number of bytes.
+ * @return The CRC of all the data so far.
+ */
+uint64 Crc64Update( const uint64 crc, const uint8* data, const int64 size )
+{
+	return CrcUpdate< uint64 >( Crc64Tables, crc, data, size );
+}
+
+/**
+ * @brief Continues the checksum over more data; does nothing for ChecksumTypeNone.
+ *
+ * @param data Pointer to the data.
+ * @param size Number of bytes.
+ */
+void CChecksum::Update( const uint8* data, const int64 size )
+{
+	switch( Type )
+	{
+	case ChecksumType::ChecksumTypeCrc32:
+		Value = Crc32Update( static_cast< uint32 >( Value ), data, size );
+		break;
+
+	case ChecksumType::ChecksumTypeCrc64:
+		Value = Crc64Update( Value, data, size );
+		break;
+
+	case ChecksumType::ChecksumTypeNone:
+		break;
+	}
+}
@@ -0,0 +1,41 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+
+/**
+ * Checksums used by the .xz and .7z containers, and optionally computed alongside LZMA2 compression and decompression.
+ * Start with crc = 0, and pass the previous result back in to continue over more data.
+ */
+
+/** CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320) */
+uint32 Crc32Update( uint32 crc, const uint8* data, int64 size );
+
+/** CRC-64 (ECMA-182, reflected polynomial 0xC96C5795D7870F42) */
+uint64 Crc64Update( uint64 crc, const uint8* data, int64 size );
+
+enum class ChecksumType
+	: uint8
+{
+	ChecksumTypeNone = 0,
+	ChecksumTypeCrc32,
+	ChecksumTypeCrc64
+};
+
+/** A running checksum of data that arrives in pieces */
+class CChecksum
+{
+public:
+	explicit CChecksum( const ChecksumType type )
+		: Type( type )
+	{
+	}
+
+	void Update( const uint8* data, int64 size );
+
+	ChecksumType Type = ChecksumType::ChecksumTypeNone;
+
+	/** The checksum of all the data so far; a CRC-32 uses the low 32 bits */
+	uint64 Value = 0u;
+};
@@ -0,0 +1,1081 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "7zTypes.h"
+
+#include <bit>
+
+#include "Filter.h"
+
+namespace LzmaFilter
+{
+	/** The delta filter works on runs of this many bytes at once, which the compiler turns into vector operations */
+	static constexpr int64 DeltaLaneSize = 32;
+
+	/** The shuffle filter transposes this many elements at a time */
+	static constexpr int64 ShuffleTileSize = 16;
+
+	/** An x86 CALL or JMP is the opcode then a 32 bit offset */
+	static constexpr int64 X86BranchSize = 5;
+
+	/** The x86 filter looks for opcodes a word at a time */
+	static constexpr uint64 X86OpcodeBytes = 0xE8E8E8E8E8E8E8E8ull;
+	static constexpr uint64 X86OpcodeMask = 0xFEFEFEFEFEFEFEFEull;
+	static constexpr uint64 LowBits = 0x0101010101010101ull;
+	static constexpr uint64 HighBits = 0x8080808080808080ull;
+}
+
+/** A run of bytes at the same place in every block, gathered into a plane of its own */
+class CBlockField
+{
+public:
+	int32 Offset;
+	int32 Size;
+
+	/** The width of the values that are delta coded when LzmaFilter::BcnDeltaEndpoints is set, or 0 for none */
+	int32 DeltaWidth;
+};
+
+class CBlockLayout
+{
+public:
+	int32 BlockSize;
+	int32 FieldCount;
+	CBlockField Fields[6];
+};
+
+/** The two endpoints then the indices; the planes are in field order, so each one starts at blocks * Offset */
+static constexpr CBlockLayout Bc1Layout = { 8, 3, { { 0, 2, 2 }, { 2, 2, 2 }, { 4, 4, 0 } } };
+static constexpr CBlockLayout Bc3Layout = { 16, 6, { { 0, 1, 1 }, { 1, 1, 1 }, { 2, 6, 0 }, { 8, 2, 2 }, { 10, 2, 2 }, { 12, 4, 0 } } };
+
+/**
+ * @brief Copies one field of every block into a plane, or back.
+ *
+ * @param source       The first field to read.
+ * @param sourceStep   The distance between fields in the source.
+ * @param destination  The first field to write.
+ * @param destStep     The distance between fields in the destination.
+ * @param blocks       The number of blocks.
+ */
+template< int32 TFieldSize >
+static void CopyField( const uint8* source, const int64 sourceStep, uint8* destination, const int64 destStep, const int64 blocks )
+{
+	for( int64 block = 0; block < blocks; block++ )
+	{
+		memcpy( destination, source, TFieldSize );
+		source += sourceStep;
+		destination += destStep;
+	}
+}
+
+static void CopyField( const int32 fieldSize, const uint8* source, const int64 sourceStep, uint8* destination, const int64 destStep, const int64 blocks )
+{
+	switch( fieldSize )
+	{
+	case 1:
+		CopyField< 1 >( source, sourceStep, destination, destStep, blocks );
+		break;
+
+	case 2:
+		CopyField< 2 >( source, sourceStep, destination, destStep, blocks );
+		break;
+
+	case 4:
+		CopyField< 4 >( source, sourceStep, destination, destStep, blocks );
+		break;
+
+	default:
+		CopyField< 6 >( source, sourceStep, destination, destStep, blocks );
+		break;
+	}
+}
+
+/**
+ * @brief Gathers each field of the blocks into its own plane, delta coding the endpoints if asked to.
+ *
+ * Bytes past the last whole block are copied unchanged.
+ *
+ * @param layout       The fields of a block.
+ * @param source       The blocks.
+ * @param destination  Where to write the planes; must not overlap source.
+ * @param size         The number of bytes.
+ * @param delta        True to delta code the fields that have a DeltaWidth.
+ */
+static void SplitBlocks( const CBlockLayout& layout, const uint8* source, uint8* destination, const int64 size, const bool delta )
+{
+	const int64 blocks = size / layout.BlockSize;
+	for( int32 index = 0; index < layout.FieldCount; index++ )
+	{
+		const CBlockField& field = layout.Fields[index];
+		const uint8* block = source + field.Offset;
+		uint8* plane = destination + blocks * field.Offset;
+		const int32 width = delta ? field.DeltaWidth : 0;
+
+		if( width == 2 )
+		{
+			uint16 previous = 0u;
+			for( int64 count = 0; count < blocks; count++ )
+			{
+				const uint16 value = static_cast< uint16 >( block[0] | ( block[1] << 8 ) );
+				const uint16 difference = static_cast< uint16 >( value - previous );
+				plane[0] = static_cast< uint8 >( difference );
+				plane[1] = static_cast< uint8 >( difference >> 8 );
+				previous = value;
+				block += layout.BlockSize;
+				plane += 2;
+			}
+		}
+		else if( width == 1 )
+		{
+			uint8 previous = 0u;
+			for( int64 count = 0; count < blocks; count++ )
+			{
+				*plane++ = static_cast< uint8 >( *block - previous );
+				previous = *block;
+				block += layout.BlockSize;
+			}
+		}
+		else
+		{
+			CopyField( field.Size, block, layout.BlockSize, plane, field.Size, blocks );
+		}
+	}
+
+	const int64 whole = blocks * layout.BlockSize;
+	memcpy( destination + whole, source + whole, static_cast< uint64 >( size - whole ) );
+}
+
+/**
+ * @brief The inverse of SplitBlocks().
+ *
+ * @param layout       The fields of a block.
+ * @param source       The planes.
+ * @param destination  Where to write the blocks; must not overlap source.
+ * @param size         The number of bytes.
+ * @param delta        True if the fields that have a DeltaWidth are delta coded.
+ */
+static void JoinBlocks( const CBlockLayout& layout, const uint8* source, uint8* destination, const int64 size, const bool delta )
+{
+	const int64 blocks = size / layout.BlockSize;
+	for( int32 index = 0; index < layout.FieldCount; index++ )
+	{
+		const CBlockField& field = layout.Fields[index];
+		const uint8* plane = source + blocks * field.Offset;
+		uint8* block = destination + field.Offset;
+		const int32 width = delta ? field.DeltaWidth : 0;
+
+		if( width == 2 )
+		{
+			uint16 previous = 0u;
+			for( int64 count = 0; count < blocks; count++ )
+			{
+				previous = static_cast< uint16 >( previous + ( plane[0] | ( plane[1] << 8 ) ) );
+				block[0] = static_cast< uint8 >( previous );
+				block[1] = static_cast< uint8 >( previous >> 8 );
+				block += layout.BlockSize;
+				plane += 2;
+			}
+		}
+		else if( width == 1 )
+		{
+			uint8 previous = 0u;
+			for( int64 count = 0; count < blocks; count++ )
+			{
+				previous = static_cast< uint8 >( previous + *plane++ );
+				*block = previous;
+				block += layout.BlockSize;
+			}
+		}
+		else
+		{
+			CopyField( field.Size, plane, field.Size, block, layout.BlockSize, blocks );
+		}
+	}
+
+	const int64 whole = blocks * layout.BlockSize;
+	memcpy( destination + whole, source + whole, static_cast< uint64 >( size - whole ) );
+}
+
+/**
+ * @brief Gathers byte k of every element into plane k, a tile of elements at a time.
+ *
+ * Each tile is transposed in a local array and written out as one run per plane, rather than a byte at a time across
+ * every plane.
+ *
+ * @param source      The elements.
+ * @param destination Where to write the planes; must not overlap source.
+ * @param elements    The number of elements.
+ */
+template< int64 TElementSize >
+static void ShuffleElements( const uint8* source, uint8* destination, const int64 elements )
+{
+	int64 element = 0;
+	for( ; element + LzmaFilter::ShuffleTileSize <= elements; element += LzmaFilter::ShuffleTileSize )
+	{
+		uint8 tile[TElementSize][LzmaFilter::ShuffleTileSize];
+		for( int64 index = 0; index < LzmaFilter::ShuffleTileSize; index++ )
+		{
+			for( int64 plane = 0; plane < TElementSize; plane++ )
+			{
+				tile[plane][index] = source[( element + index ) * TElementSize + plane];
+			}
+		}
+
+		for( int64 plane = 0; plane < TElementSize; plane++ )
+		{
+			memcpy( destination + plane * elements + element, tile[plane], LzmaFilter::ShuffleTileSize );
+		}
+	}
+
+	for( ; element < elements; element++ )
+	{
+		for( int64 plane = 0; plane < TElementSize; plane++ )
+		{
+			destination[plane * elements + element] = source[element * TElementSize + plane];
+		}
+	}
+}
+
+/**
+ * @brief The inverse of ShuffleElements().
+ *
+ * @param source      The planes.
+ * @param destination Where to write the elements; must not overlap source.
+ * @param elements    The number of elements.
+ */
+template< int64 TElementSize >
+static void UnshuffleElements( const uint8* source, uint8* destination, const int64 elements )
+{
+	int64 element = 0;
+	for( ; element + LzmaFilter::ShuffleTileSize <= elements; element += LzmaFilter::ShuffleTileSize )
+	{
+		uint8 tile[LzmaFilter::ShuffleTileSize][TElementSize];
+		for( int64 plane = 0; plane < TElementSize; plane++ )
+		{
+			for( int64 index = 0; index < LzmaFilter::ShuffleTileSize; index++ )
+			{
+				tile[index][plane] = source[plane * elements + element + index];
+			}
+		}
+
+		memcpy( destination + element * TElementSize, tile, sizeof( tile ) );
+	}
+
+	for( ; element < elements; element++ )
+	{
+		for( int64 plane = 0; plane < TElementSize; plane++ )
+		{
+			destination[element * TElementSize + plane] = source[plane * elements + element];
+		}
+	}
+}
+
+/**
+ * @brief Splits a group of elementSize byte elements into elementSize planes; bytes past the last whole element are
+ * copied unchanged.
+ *
+ * @param elementSize  2, 4, 8 or 16.
+ * @param source       The elements.
+ * @param destination  Where to write the planes; must not overlap source.
+ * @param size         The number of bytes.
+ */
+static void ShuffleBytes( const uint32 elementSize, const uint8* source, uint8* destination, const int64 size )
+{
+	const int64 elements = size / elementSize;
+	switch( elementSize )
+	{
+	case 2u:
+		ShuffleElements< 2 >( source, destination, elements );
+		break;
+
+	case 4u:
+		ShuffleElements< 4 >( source, destination, elements );
+		break;
+
+	case 8u:
+		ShuffleElements< 8 >( source, destination, elements );
+		break;
+
+	default:
+		ShuffleElements< 16 >( source, destination, elements );
+		break;
+	}
+
+	const int64 whole = elements * elementSize;
+	memcpy( destination + whole, source + whole, static_cast< uint64 >( size - whole ) );
+}
+
+/**
+ * @brief The inverse of ShuffleBytes().
+ *
+ * @param elementSize  2, 4, 8 or 16.
+ * @param source       The planes.
+ * @param destination  Where to write the elements; must not overlap source.
+ * @param size         The number of bytes.
+ */
+static void UnshuffleBytes( const uint32 elementSize, const uint8* source, uint8* destination, const int64 size )
+{
+	const int64 elements = size / elementSize;
+	switch( elementSize )
+	{
+	case 2u:
+		UnshuffleElements< 2 >( source, destination, elements );
+		break;
+
+	case 4u:
+		UnshuffleElements< 4 >( source, destination, elements );
+		break;
+
+	case 8u:
+		UnshuffleElements< 8 >( source, destination, elements );
+		break;
+
+	default:
+		UnshuffleElements< 16 >( source, destination, elements );
+		break;
+	}
+
+	const int64 whole = elements * elementSize;
+	memcpy( destination + whole, source + whole, static_cast< uint64 >( size - whole ) );
+}
+
+CLzmaFilter::CLzmaFilter( const LzmaFilterType type, const uint32 parameter )
+	: Type( type )
+	, Parameter( parameter )
+	, Position( parameter )
+{
+}
+
+CLzmaFilter::~CLzmaFilter()
+{
+	if( Alloc != nullptr )
+	{
+		Alloc->Free( Scratch, LzmaFilter::GroupSize, "CLzmaFilter::Scratch" );
+	}
+}
+
+/**
+ * @brief Checks that a filter type is known and the parameter suits it.
+ *
+ * @param type      The filter.
+ * @param parameter The filter specific parameter.
+ * @return SevenZipOK, or SevenZipErrorUnsupported.
+ */
+SevenZipResult CLzmaFilter::Validate( const LzmaFilterType type, const uint32 parameter )
+{
+	switch( type )
+	{
+	case LzmaFilterType::LzmaFilterTypeNone:
+		return ( parameter == 0u ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorUnsupported;
+
+	case LzmaFilterType::LzmaFilterTypeBc1:
+	case LzmaFilterType::LzmaFilterTypeBc3:
+		return ( ( parameter & ~LzmaFilter::BcnDeltaEndpoints ) == 0u ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorUnsupported;
+
+	case LzmaFilterType::LzmaFilterTypeDelta:
+		return ( parameter >= 1u && parameter <= LzmaFilter::DeltaMaxDistance ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorUnsupported;
+
+	case LzmaFilterType::LzmaFilterTypeShuffle:
+		return ( parameter == 2u || parameter == 4u || parameter == 8u || parameter == 16u ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorUnsupported;
+
+	case LzmaFilterType::LzmaFilterTypeX86:
+		return SevenZipResult::SevenZipOK;
+
+	case LzmaFilterType::LzmaFilterTypeArm64:
+		return ( ( parameter % LzmaFilter::BranchAlignmentArm64 ) == 0u ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorUnsupported;
+
+	default:
+		break;
+	}
+
+	return SevenZipResult::SevenZipErrorUnsupported;
+}
+
+/**
+ * @brief Validates the filter and allocates the group it rearranges in place through.
+ *
+ * @param alloc Memory allocator for the scratch group.
+ * @return SevenZipOK, SevenZipErrorUnsupported or SevenZipErrorMemory.
+ */
+SevenZipResult CLzmaFilter::Create( MemoryInterface* alloc )
+{
+	const SevenZipResult result = Validate( Type, Parameter );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	if( Scratch == nullptr && EstimateMemory() > 0 )
+	{
+		Alloc = alloc;
+		Scratch = static_cast< uint8* >( Alloc->Alloc( LzmaFilter::GroupSize, "CLzmaFilter::Scratch" ) );
+		if( Scratch == nullptr )
+		{
+			return SevenZipResult::SevenZipErrorMemory;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Returns the number of bytes Create() allocates; only the filters that split groups into planes need a scratch group.
+ */
+int64 CLzmaFilter::EstimateMemory() const
+{
+	switch( Type )
+	{
+	case LzmaFilterType::LzmaFilterTypeBc1:
+	case LzmaFilterType::LzmaFilterTypeBc3:
+	case LzmaFilterType::LzmaFilterTypeShuffle:
+		return LzmaFilter::GroupSize;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Filters data ahead of compression.
+ *
+ * @param source      The data to filter.
+ * @param destination Where to write the filtered data; may be source.
+ * @param size        The number of bytes available.
+ * @param last        True if this is the end of the data.
+ * @return The number of bytes filtered.
+ */
+int64 CLzmaFilter::Encode( const uint8* source, uint8* destination, const int64 size, const bool last )
+{
+	switch( Type )
+	{
+	case LzmaFilterType::LzmaFilterTypeBc1:
+	case LzmaFilterType::LzmaFilterTypeBc3:
+	case LzmaFilterType::LzmaFilterTypeShuffle:
+		return EncodeGroups( source, destination, size, last );
+
+	case LzmaFilterType::LzmaFilterTypeDelta:
+		return EncodeDelta( source, destination, size );
+
+	default:
+		break;
+	}
+
+	// The branch filters convert in place; an empty source may have no data
+	if( source != destination && size > 0 )
+	{
+		memmove( destination, source, static_cast< uint64 >( size ) );
+	}
+
+	if( Type == LzmaFilterType::LzmaFilterTypeX86 )
+	{
+		return ConvertX86( destination, size, true, last );
+	}
+
+	if( Type == LzmaFilterType::LzmaFilterTypeArm64 )
+	{
+		return ConvertArm64( destination, size, true, last );
+	}
+
+	return size;
+}
+
+/**
+ * @brief Restores filtered data after decompression.
+ *
+ * @param source      The filtered data.
+ * @param destination Where to write the original data; may be source.
+ * @param size        The number of bytes available.
+ * @param last        True if this is the end of the data.
+ * @return The number of bytes restored.
+ */
+int64 CLzmaFilter::Decode( const uint8* source, uint8* destination, const int64 size, const bool last )
+{
+	switch( Type )
+	{
+	case LzmaFilterType::LzmaFilterTypeBc1:
+	case LzmaFilterType::LzmaFilterTypeBc3:
+	case LzmaFilterType::LzmaFilterTypeShuffle:
+		return DecodeGroups( source, destination, size, last );
+
+	case LzmaFilterType::LzmaFilterTypeDelta:
+		return DecodeDelta( source, destination, size );
+
+	default:
+		break;
+	}
+
+	// The branch filters convert in place; an empty source may have no data
+	if( source != destination && size > 0 )
+	{
+		memmove( destination, source, static_cast< uint64 >( size ) );
+	}
+
+	if( Type == LzmaFilterType::LzmaFilterTypeX86 )
+	{
+		return ConvertX86( destination, size, false, last );
+	}
+
+	if( Type == LzmaFilterType::LzmaFilterTypeArm64 )
+	{
+		return ConvertArm64( destination, size, false, last );
+	}
+
+	return size;
+}
+
+/**
+ * @brief Undoes the filter over a whole buffer of decompressed data, a group at a time.
+ *
+ * The LZMA decoders use the output buffer as their dictionary, so the filter can only be undone once decoding has
+ * finished. Each group is checksummed straight after it is restored, while it is still in cache.
+ *
+ * @param data     The decompressed data.
+ * @param size     The number of bytes decompressed.
+ * @param checksum The checksum to update with the restored data, or nullptr.
+ */
+void CLzmaFilter::DecodeInPlace( uint8* data, const int64 size, CChecksum* checksum )
+{
+	int64 offset = 0;
+	while( offset < size )
+	{
+		const int64 group = std::min( size - offset, LzmaFilter::GroupSize );
+		const int64 restored = Decode( data + offset, data + offset, group, offset + group == size );
+
+		if( checksum != nullptr )
+		{
+			checksum->Update( data + offset, restored );
+		}
+
+		offset += restored;
+	}
+}
+
+/**
+ * @brief Rearranges one group into planes, for the BCn and shuffle filters.
+ *
+ * @param source      The group.
+ * @param destination Where to write the planes; must not overlap source.
+ * @param size        The number of bytes in the group.
+ */
+void CLzmaFilter::SplitGroup( const uint8* source, uint8* destination, const int64 size ) const
+{
+	if( Type == LzmaFilterType::LzmaFilterTypeShuffle )
+	{
+		ShuffleBytes( Parameter, source, destination, size );
+		return;
+	}
+
+	const CBlockLayout& layout = ( Type == LzmaFilterType::LzmaFilterTypeBc1 ) ? Bc1Layout : Bc3Layout;
+	SplitBlocks( layout, source, destination, size, ( Parameter & LzmaFilter::BcnDeltaEndpoints ) != 0u );
+}
+
+/**
+ * @brief The inverse of SplitGroup().
+ *
+ * @param source      The planes.
+ * @param destination Where to write the group; must not overlap source.
+ * @param size        The number of bytes in the group.
+ */
+void CLzmaFilter::JoinGroup( const uint8* source, uint8* destination, const int64 size ) const
+{
+	if( Type == LzmaFilterType::LzmaFilterTypeShuffle )
+	{
+		UnshuffleBytes( Parameter, source, destination, size );
+		return;
+	}
+
+	const CBlockLayout& layout = ( Type == LzmaFilterType::LzmaFilterTypeBc1 ) ? Bc1Layout : Bc3Layout;
+	JoinBlocks( layout, source, destination, size, ( Parameter & LzmaFilter::BcnDeltaEndpoints ) != 0u );
+}
+
+/**
+ * @brief Splits each whole group into planes, through the scratch group when working in place.
+ *
+ * @param source      The data to filter.
+ * @param destination Where to write the filtered data; may be source.
+ * @param size        The number of bytes available.
+ * @param last        True if this is the end of the data, so a partial group can be filtered.
+ * @return The number of bytes filtered.
+ */
+int64 CLzmaFilter::EncodeGroups( const uint8* source, uint8* destination, const int64 size, const bool last )
+{
+	const int64 count = last ? size : size - ( size % LzmaFilter::GroupSize );
+	for( int64 offset = 0; offset < count; offset += LzmaFilter::GroupSize )
+	{
+		const int64 group = std::min( LzmaFilter::GroupSize, count - offset );
+		if( source == destination )
+		{
+			SplitGroup( source + offset, Scratch, group );
+			memcpy( destination + offset, Scratch, static_cast< uint64 >( group ) );
+		}
+		else
+		{
+			SplitGroup( source + offset, destination + offset, group );
+		}
+	}
+
+	return count;
+}
+
+/**
+ * @brief Joins the planes in each whole group back together, through the scratch group when working in place.
+ *
+ * @param source      The filtered data.
+ * @param destination Where to write the original data; may be source.
+ * @param size        The number of bytes available.
+ * @param last        True if this is the end of the data, so a partial group can be restored.
+ * @return The number of bytes restored.
+ */
+int64 CLzmaFilter::DecodeGroups( const uint8* source, uint8* destination, const int64 size, const bool last )
+{
+	const int64 count = last ? size : size - ( size % LzmaFilter::GroupSize );
+	for( int64 offset = 0; offset < count; offset += LzmaFilter::GroupSize )
+	{
+		const int64 group = std::min( LzmaFilter::GroupSize, count - offset );
+		if( source == destination )
+		{
+			memcpy( Scratch, source + offset, static_cast< uint64 >( group ) );
+			JoinGroup( Scratch, destination + offset, group );
+		}
+		else
+		{
+			JoinGroup( source + offset, destination + offset, group );
+		}
+	}
+
+	return count;
+}
+
+/**
+ * @brief Keeps the last Parameter bytes of unfiltered data, reaching back into History when size is smaller.
+ *
+ * History[index] holds the byte Parameter - index bytes before the start of the current call.
+ *
+ * @param data The unfiltered data of the current call.
+ * @param size The number of bytes.
+ */
+void CLzmaFilter::UpdateHistory( const uint8* data, const int64 size )
+{
+	const int64 distance = Parameter;
+	if( size >= distance )
+	{
+		memcpy( History, data + size - distance, static_cast< uint64 >( distance ) );
+		return;
+	}
+
+	memmove( History, History + size, static_cast< uint64 >( distance - size ) );
+	memcpy( History + distance - size, data, static_cast< uint64 >( size ) );
+}
+
+/**
+ * @brief Replaces each byte with its difference from the byte Parameter bytes earlier.
+ *
+ * Works from the end back, so every byte is read before an in place write replaces it. The bulk runs a lane at a
+ * time with no dependency between bytes, which the compiler turns into vector subtracts.
+ *
+ * @param source      The data to filter.
+ * @param destination Where to write the filtered data; may be source.
+ * @param size        The number of bytes.
+ * @return size.
+ */
+int64 CLzmaFilter::EncodeDelta( const uint8* source, uint8* destination, const int64 size )
+{
+	const int64 distance = Parameter;
+
+	// The start of the next call needs the unfiltered bytes, which an in place call is about to overwrite
+	uint8 history[LzmaFilter::DeltaMaxDistance];
+	memcpy( history, History, sizeof( History ) );
+	UpdateHistory( source, size );
+
+	int64 position = size;
+	while( position - LzmaFilter::DeltaLaneSize >= distance )
+	{
+		position -= LzmaFilter::DeltaLaneSize;
+
+		uint8 lane[LzmaFilter::DeltaLaneSize];
+		for( int64 index = 0; index < LzmaFilter::DeltaLaneSize; index++ )
+		{
+			lane[index] = static_cast< uint8 >( source[position + index] - source[position + index - distance] );
+		}
+
+		memcpy( destination + position, lane, sizeof( lane ) );
+	}
+
+	while( position > distance )
+	{
+		position--;
+		destination[position] = static_cast< uint8 >( source[position] - source[position - distance] );
+	}
+
+	// The first bytes reach back into the previous call
+	while( position > 0 )
+	{
+		position--;
+		destination[position] = static_cast< uint8 >( source[position] - history[position] );
+	}
+
+	return size;
+}
+
+/**
+ * @brief Restores delta coded data a stride of TDistance bytes at a time.
+ *
+ * The previous stride is held in a local array, which the compiler keeps in registers and adds a whole stride to at
+ * once, rather than reloading each byte it has just stored.
+ *
+ * @param source      The filtered data.
+ * @param destination Where to write the original data; may be source.
+ * @param position    The first byte to restore; at least TDistance bytes in.
+ * @param size        The number of bytes.
+ * @return The first byte not restored; fewer than TDistance bytes from the end.
+ */
+template< int64 TDistance >
+static int64 DecodeDeltaStrides( const uint8* source, uint8* destination, int64 position, const int64 size )
+{
+	uint8 previous[TDistance];
+	memcpy( previous, destination + position - TDistance, TDistance );
+
+	for( ; position + TDistance <= size; position += TDistance )
+	{
+		for( int64 index = 0; index < TDistance; index++ )
+		{
+			previous[index] = static_cast< uint8 >( previous[index] + source[position + index] );
+		}
+
+		memcpy( destination + position, previous, TDistance );
+	}
+
+	return position;
+}
+
+/**
+ * @brief Adds back the byte Parameter bytes earlier, which has already been restored.
+ *
+ * This is a running sum with a stride of Parameter. Distances of at least a lane add a whole lane of restored data at
+ * once, and power of two distances below that run a stride at a time in registers. Other short distances run a byte
+ * at a time; keeping their strides in registers measured no faster.
+ *
+ * @param source      The filtered data.
+ * @param destination Where to write the original data; may be source.
+ * @param size        The number of bytes.
+ * @return size.
+ */
+int64 CLzmaFilter::DecodeDelta( const uint8* source, uint8* destination, const int64 size )
+{
+	const int64 distance = Parameter;
+	const int64 head = std::min( size, distance );
+
+	int64 position = 0;
+	for( ; position < head; position++ )
+	{
+		destination[position] = static_cast< uint8 >( source[position] + History[position] );
+	}
+
+	if( position < size )
+	{
+		switch( distance )
+		{
+		case 1:
+			position = DecodeDeltaStrides< 1 >( source, destination, position, size );
+			break;
+
+		case 2:
+			position = DecodeDeltaStrides< 2 >( source, destination, position, size );
+			break;
+
+		case 4:
+			position = DecodeDeltaStrides< 4 >( source, destination, position, size );
+			break;
+
+		case 8:
+			position = DecodeDeltaStrides< 8 >( source, destination, position, size );
+			break;
+
+		case 16:
+			position = DecodeDeltaStrides< 16 >( source, destination, position, size );
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if( distance >= LzmaFilter::DeltaLaneSize )
+	{
+		for( ; position + LzmaFilter::DeltaLaneSize <= size; position += LzmaFilter::DeltaLaneSize )
+		{
+			uint8 lane[LzmaFilter::DeltaLaneSize];
+			for( int64 index = 0; index < LzmaFilter::DeltaLaneSize; index++ )
+			{
+				lane[index] = static_cast< uint8 >( source[position + index] + destination[position + index - distance] );
+			}
+
+			memcpy( destination + position, lane, sizeof( lane ) );
+		}
+	}
+
+	for( ; position < size; position++ )
+	{
+		destination[position] = static_cast< uint8 >( source[position] + destination[position - distance] );
+	}
+
+	UpdateHistory( destination, size );
+	return size;
+}
+
+/**
+ * @brief Tells whether a byte could be the top byte of a near x86 branch offset; it is all zeros or all ones.
+ */
+static bool IsX86OffsetTop( const uint8 value )
+{
+	return value == 0x00u || value == 0xFFu;
+}
+
+/**
+ * @brief Converts the targets of x86 CALL (0xE8) and JMP (0xE9) instructions between relative and absolute.
+ *
+ * A port of the xz x86 BCJ filter, so the output matches it byte for byte. The mask records which of the previous
+ * bytes were also 0xE8 or 0xE9, to avoid converting what is likely the middle of another instruction. Most bytes are
+ * neither, so the search for the next opcode tests eight bytes at once.
+ *
+ * @param data   The code, converted in place.
+ * @param size   The number of bytes.
+ * @param encode True to make targets absolute, false to make them relative again.
+ * @param last   True if this is the end of the data; the last few bytes are left as they are.
+ * @return The number of bytes converted; an instruction that runs past the end is left for the next call.
+ */
+int64 CLzmaFilter::ConvertX86( uint8* data, const int64 size, const bool encode, const bool last )
+{
+	static constexpr bool mask_to_allowed_status[8] = { true, true, true, false, true, false, false, false };
+	static constexpr uint32 mask_to_bit_number[8] = { 0u, 1u, 2u, 2u, 3u, 3u, 3u, 3u };
+
+	if( size < LzmaFilter::X86BranchSize )
+	{
+		return last ? size : 0;
+	}
+
+	uint32 previous_mask = X86PreviousMask;
+	uint32 previous_position = X86PreviousPosition;
+	if( Position - previous_position > 5u )
+	{
+		previous_position = Position - 5u;
+	}
+
+	const int64 limit = size - LzmaFilter::X86BranchSize;
+	int64 position = 0;
+	while( position <= limit )
+	{
+		if( position + 8 <= size )
+		{
+			// A byte is 0xE8 or 0xE9 when it becomes zero; the lowest flagged byte is always a true match
+			uint64 word;
+			memcpy( &word, data + position, sizeof( word ) );
+			const uint64 opcodes = ( word & LzmaFilter::X86OpcodeMask ) ^ LzmaFilter::X86OpcodeBytes;
+			const uint64 matches = ( opcodes - LzmaFilter::LowBits ) & ~opcodes & LzmaFilter::HighBits;
+			if( matches == 0u )
+			{
+				position += 8;
+				continue;
+			}
+
+			position += std::countr_zero( matches ) >> 3;
+			if( position > limit )
+			{
+				break;
+			}
+		}
+		else if( ( data[position] & 0xFEu ) != 0xE8u )
+		{
+			position++;
+			continue;
+		}
+
+		const uint32 address = Position + static_cast< uint32 >( position );
+		const uint32 offset = address - previous_position;
+		previous_position = address;
+
+		if( offset > 5u )
+		{
+			previous_mask = 0u;
+		}
+		else
+		{
+			for( uint32 index = 0u; index < offset; index++ )
+			{
+				previous_mask &= 0x77u;
+				previous_mask <<= 1;
+			}
+		}
+
+		uint8 top = data[position + 4];
+		if( IsX86OffsetTop( top ) && mask_to_allowed_status[( previous_mask >> 1 ) & 0x7u] && ( previous_mask >> 1 ) < 0x10u )
+		{
+			uint32 source = ( static_cast< uint32 >( top ) << 24 ) | ( static_cast< uint32 >( data[position + 3] ) << 16 )
+				| ( static_cast< uint32 >( data[position + 2] ) << 8 ) | data[position + 1];
+
+			uint32 destination = 0u;
+			while( true )
+			{
+				const uint32 next_address = address + static_cast< uint32 >( LzmaFilter::X86BranchSize );
+				destination = encode ? source + next_address : source - next_address;
+
+				if( previous_mask == 0u )
+				{
+					break;
+				}
+
+				const uint32 bit_number = mask_to_bit_number[previous_mask >> 1];
+				top = static_cast< uint8 >( destination >> ( 24u - bit_number * 8u ) );
+				if( !IsX86OffsetTop( top ) )
+				{
+					break;
+				}
+
+				source = destination ^ ( ( 1u << ( 32u - bit_number * 8u ) ) - 1u );
+			}
+
+			data[position + 4] = static_cast< uint8 >( ~( ( ( destination >> 24 ) & 1u ) - 1u ) );
+			data[position + 3] = static_cast< uint8 >( destination >> 16 );
+			data[position + 2] = static_cast< uint8 >( destination >> 8 );
+			data[position + 1] = static_cast< uint8 >( destination );
+			position += LzmaFilter::X86BranchSize;
+			previous_mask = 0u;
+		}
+		else
+		{
+			position++;
+			previous_mask |= 1u;
+			if( IsX86OffsetTop( top ) )
+			{
+				previous_mask |= 0x10u;
+			}
+		}
+	}
+
+	X86PreviousMask = previous_mask;
+	X86PreviousPosition = previous_position;
+
+	if( last )
+	{
+		position = size;
+	}
+
+	Position += static_cast< uint32 >( position );
+	return position;
+}
+
+/**
+ * @brief Converts the targets of ARM64 BL and ADRP instructions between relative and absolute.
+ *
+ * A port of the xz ARM64 BCJ filter, so the output matches it byte for byte. Every instruction is 4 bytes and
+ * aligned, so each word is converted on its own. ADRP targets more than 512MB away are left alone, as they are
+ * probably not code. Both conversions are worked out for every word and the right one selected, with no branches,
+ * which the compiler turns into vector operations.
+ *
+ * @param data   The code, converted in place.
+ * @param size   The number of bytes.
+ * @param encode True to make targets absolute, false to make them relative again.
+ * @param last   True if this is the end of the data; up to 3 bytes past the last whole word are left as they are.
+ * @return The number of bytes converted.
+ */
+int64 CLzmaFilter::ConvertArm64( uint8* data, const int64 size, const bool encode, const bool last )
+{
+	// Decoding subtracts the address; ( x ^ ~0 ) - ~0 is -x
+	const uint32 negate = encode ? 0u : ~0u;
+	const uint32 start = Position;
+
+	int64 position = 0;
+	for( ; position + 4 <= size; position += 4 )
+	{
+		uint32 instruction;
+		memcpy( &instruction, data + position, sizeof( instruction ) );
+
+		const uint32 address = start + static_cast< uint32 >( position );
+
+		// BL; a 26 bit word offset
+		const uint32 words = ( ( address >> 2 ) ^ negate ) - negate;
+		const uint32 branch = 0x94000000u | ( ( instruction + words ) & 0x03FFFFFFu );
+		const bool is_branch = ( instruction >> 26 ) == 0x25u;
+
+		// ADRP; a 21 bit page offset split in two
+		const uint32 source = ( ( instruction >> 29 ) & 3u ) | ( ( instruction >> 3 ) & 0x001FFFFCu );
+		const uint32 destination = source + ( ( ( address >> 12 ) ^ negate ) - negate );
+		const uint32 page = ( instruction & 0x9000001Fu ) | ( ( destination & 3u ) << 29 ) | ( ( destination & 0x0003FFFCu ) << 3 )
+			| ( ( 0u - ( destination & 0x00020000u ) ) & 0x00E00000u );
+		const bool is_page = ( instruction & 0x9F000000u ) == 0x90000000u && ( ( source + 0x00020000u ) & 0x001C0000u ) == 0u;
+
+		instruction = is_branch ? branch : ( is_page ? page : instruction );
+		memcpy( data + position, &instruction, sizeof( instruction ) );
+	}
+
+	if( last )
+	{
+		position = size;
+	}
+
+	Position += static_cast< uint32 >( position );
+	return position;
+}
+
+CFilterInStream::CFilterInStream( const uint8* source, const int64 sourceLength, CLzmaFilter& filter, CChecksum* checksum )
+	: Source( source )
+	, SourceLength( sourceLength )
+	, Filter( filter )
+	, Checksum( checksum )
+{
+}
+
+CFilterInStream::~CFilterInStream()
+{
+	if( Alloc != nullptr )
+	{
+		Alloc->Free( Group, LzmaFilter::GroupSize, "CFilterInStream::Group" );
+	}
+}
+
+/**
+ * @brief Allocates the buffer each group is filtered into.
+ *
+ * @param alloc Memory allocator for the group.
+ * @return SevenZipOK, or SevenZipErrorMemory.
+ */
+SevenZipResult CFilterInStream::Create( MemoryInterface* alloc )
+{
+	Alloc = alloc;
+	Group = static_cast< uint8* >( Alloc->Alloc( LzmaFilter::GroupSize, "CFilterInStream::Group" ) );
+	return ( Group != nullptr ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorMemory;
+}
+
+/**
+ * @brief Copies filtered data into the encoder's window, filtering the next group when the current one runs out.
+ *
+ * @param bufferBase The encoder's window.
+ * @param offset     Where in the window to write.
+ * @param size       In: the space available. Out: the number of bytes written; 0 at the end of the source.
+ * @return SevenZipOK.
+ */
+SevenZipResult CFilterInStream::Read( uint8* bufferBase, const int64 offset, int64* size )
+{
+	if( GroupOffset == GroupLength )
+	{
+		const int64 remaining = SourceLength - SourceOffset;
+		const int64 length = std::min( remaining, LzmaFilter::GroupSize );
+
+		GroupLength = Filter.Encode( Source + SourceOffset, Group, length, length == remaining );
+		GroupOffset = 0;
+
+		if( Checksum != nullptr )
+		{
+			Checksum->Update( Source + SourceOffset, GroupLength );
+		}
+
+		SourceOffset += GroupLength;
+	}
+
+	*size = std::min( *size, GroupLength - GroupOffset );
+	memcpy( bufferBase + offset, Group + GroupOffset, static_cast< uint64 >( *size ) );
+	GroupOffset += *size;
+
+	return SevenZipResult::SevenZipOK;
+}
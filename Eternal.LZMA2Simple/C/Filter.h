@@ -0,0 +1,171 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+#include "Crc.h"
+
+/**
+ * Reversible filters that rearrange data before compression, and restore it after decompression, so that the match
+ * finder sees longer and more regular matches.
+ *
+ * A filter runs over the data in groups of LzmaFilter::GroupSize bytes, so it never needs a second full size buffer.
+ * The filters that split data into planes do so within each group.
+ * The same filter type and parameter must be used to decode as to encode; they are not stored in the compressed stream.
+ */
+
+enum class LzmaFilterType
+	: uint8
+{
+	LzmaFilterTypeNone = 0,
+
+	/** BC1 (DXT1) texture blocks; 8 bytes of two RGB565 endpoints and 32 bits of indices */
+	LzmaFilterTypeBc1,
+
+	/** BC3 (DXT5) texture blocks; 16 bytes of two alpha endpoints, 48 bits of alpha indices, then a BC1 block */
+	LzmaFilterTypeBc3,
+
+	/** Each byte less the byte the parameter (1 to 256) bytes before it, as the xz delta filter */
+	LzmaFilterTypeDelta,
+
+	/** Arrays of 2, 4, 8 or 16 byte elements, per the parameter; byte k of every element in a group is stored together */
+	LzmaFilterTypeShuffle,
+
+	/** x86 and x86-64 code; relative CALL and JMP targets become absolute, as the xz x86 BCJ filter */
+	LzmaFilterTypeX86,
+
+	/** ARM64 code; relative BL and ADRP targets become absolute, as the xz ARM64 BCJ filter */
+	LzmaFilterTypeArm64
+};
+
+namespace LzmaFilter
+{
+	/** The number of bytes a filter works on at once */
+	static constexpr int64 GroupSize = 1 << 16;
+
+	/** BCn filter parameter - store each endpoint as the difference from the same endpoint in the previous block */
+	static constexpr uint32 BcnDeltaEndpoints = 1u;
+
+	/** The largest delta filter distance; e.g. 4 for 32 bit samples, or the vertex size for a vertex buffer */
+	static constexpr uint32 DeltaMaxDistance = 256u;
+
+	/** The branch filters take the address the code is loaded at as their parameter, usually 0; ARM64 needs a multiple of 4 */
+	static constexpr uint32 BranchAlignmentArm64 = 4u;
+}
+
+class CLzmaFilter
+{
+public:
+	CLzmaFilter( LzmaFilterType type, uint32 parameter );
+	~CLzmaFilter();
+
+	CLzmaFilter( const CLzmaFilter& ) = delete;
+	CLzmaFilter& operator=( const CLzmaFilter& ) = delete;
+
+	/**
+	 * Validate - check the parameter suits the filter type
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_UNSUPPORTED - Unknown type, or a parameter the type does not support
+	 */
+	static SevenZipResult Validate( LzmaFilterType type, uint32 parameter );
+
+	/**
+	 * Create - validate the filter and allocate the memory it needs to work in place (source == destination)
+	 * Filtering from one buffer to another needs no memory, so Create() need not be called first.
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_UNSUPPORTED - See Validate()
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 */
+	SevenZipResult Create( MemoryInterface* alloc );
+
+	/**
+	 * Encode - filter size bytes from source into destination, which may be the same buffer
+	 * Data is passed in order over any number of calls, with last set on the final one. Returns the number of bytes
+	 * filtered; any remainder must be passed again at the start of the next call. A call of at least GroupSize bytes
+	 * always makes progress, and a call with last set filters everything.
+	 */
+	int64 Encode( const uint8* source, uint8* destination, int64 size, bool last );
+
+	/**
+	 * Decode - the inverse of Encode, called with the same sequence of sizes or any other that keeps to its rules
+	 */
+	int64 Decode( const uint8* source, uint8* destination, int64 size, bool last );
+
+	/**
+	 * DecodeInPlace - undo the filter over a whole buffer, a group at a time, after it has been decompressed
+	 * checksum - if not nullptr, updated with each group once it is restored
+	 */
+	void DecodeInPlace( uint8* data, int64 size, CChecksum* checksum );
+
+	/** The number of bytes Create() allocates */
+	int64 EstimateMemory() const;
+
+private:
+	void SplitGroup( const uint8* source, uint8* destination, int64 size ) const;
+	void JoinGroup( const uint8* source, uint8* destination, int64 size ) const;
+	int64 EncodeGroups( const uint8* source, uint8* destination, int64 size, bool last );
+	int64 DecodeGroups( const uint8* source, uint8* destination, int64 size, bool last );
+	int64 EncodeDelta( const uint8* source, uint8* destination, int64 size );
+	int64 DecodeDelta( const uint8* source, uint8* destination, int64 size );
+	void UpdateHistory( const uint8* data, int64 size );
+	int64 ConvertX86( uint8* data, int64 size, bool encode, bool last );
+	int64 ConvertArm64( uint8* data, int64 size, bool encode, bool last );
+
+	LzmaFilterType Type = LzmaFilterType::LzmaFilterTypeNone;
+	uint32 Parameter = 0u;
+
+	MemoryInterface* Alloc = nullptr;
+
+	/** Holds one group while it is rearranged in place */
+	uint8* Scratch = nullptr;
+
+	/** The last Parameter bytes of unfiltered data from the previous call, for the delta filter */
+	uint8 History[LzmaFilter::DeltaMaxDistance] = {};
+
+	/** The address of the next byte the branch filters will see */
+	uint32 Position = 0u;
+
+	/** The x86 filter's record of the bytes before the last 0xE8 or 0xE9 it saw, and where that was */
+	uint32 X86PreviousMask = 0u;
+	uint32 X86PreviousPosition = 0u - 5u;
+};
+
+/**
+ * Feeds a block of memory to an encoder through a filter, one group at a time.
+ * Each group is filtered into a buffer that stays in cache until the encoder copies it into its window.
+ */
+class CFilterInStream
+	: public InStreamInterface
+{
+public:
+	/** checksum - if not nullptr, updated with the source data as each group is filtered */
+	CFilterInStream( const uint8* source, int64 sourceLength, CLzmaFilter& filter, CChecksum* checksum );
+	virtual ~CFilterInStream() override;
+
+	/**
+	 * Create - allocate the group buffer
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 */
+	SevenZipResult Create( MemoryInterface* alloc );
+
+	virtual SevenZipResult Read( uint8* bufferBase, const int64 offset, int64* size ) override;
+
+private:
+	const uint8* Source = nullptr;
+	int64 SourceLength = 0;
+	int64 SourceOffset = 0;
+
+	CLzmaFilter& Filter;
+	CChecksum* Checksum = nullptr;
+
+	MemoryInterface* Alloc = nullptr;
+
+	/** The filtered group, and how much of it the encoder has read */
+	uint8* Group = nullptr;
+	int64 GroupLength = 0;
+	int64 GroupOffset = 0;
+};
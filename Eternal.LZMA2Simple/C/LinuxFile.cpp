@@ -0,0 +1,453 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "LinuxFile.h"
+
+#if defined( _LINUX )
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Clips a range to a mapping and moves its start down to a page boundary, as madvise needs.
+ *
+ * @param data       Start of the mapping, or nullptr if there is none.
+ * @param fileLength Length of the mapping in bytes.
+ * @param offset     Start of the range.
+ * @param length     Length of the range.
+ * @param start      Receives the page aligned start of the range.
+ * @param size       Receives the length of the range from start.
+ * @return false if nothing of the range is mapped.
+ */
+static bool GetPageRange( uint8* data, const int64 fileLength, const int64 offset, const int64 length, uint8*& start, uint64& size )
+{
+	const int64 page_mask = sysconf( _SC_PAGESIZE ) - 1;
+	const int64 begin = std::max<int64>( offset, 0 ) & ~page_mask;
+	const int64 end = std::min( offset + length, fileLength );
+	if( data == nullptr || end <= begin )
+	{
+		return false;
+	}
+
+	start = data + begin;
+	size = static_cast<uint64>( end - begin );
+	return true;
+}
+
+/**
+ * @brief Writes all of a buffer to a file at an offset, carrying on after short writes and interruptions.
+ *
+ * @param descriptor The file to write to.
+ * @param data       The bytes to write.
+ * @param size       Number of bytes to write.
+ * @param offset     Position in the file to write them at.
+ * @return false if a write failed.
+ */
+static bool WriteAll( const int32 descriptor, const uint8* data, int64 size, int64 offset )
+{
+	while( size > 0 )
+	{
+		const ssize_t written = pwrite( descriptor, data, static_cast<uint64>( size ), offset );
+		if( written < 0 )
+		{
+			if( errno == EINTR )
+			{
+				continue;
+			}
+
+			return false;
+		}
+
+		data += written;
+		size -= written;
+		offset += written;
+	}
+
+	return true;
+}
+
+CMappedFile::~CMappedFile()
+{
+	Close( Length );
+}
+
+/**
+ * @brief Maps an existing file read only, and tells the kernel it will be read in order so it reads ahead.
+ *
+ * @param filename Path of the file.
+ * @return SevenZipOK, or SevenZipErrorRead if the file could not be opened or mapped.
+ */
+SevenZipResult CMappedFile::OpenRead( const char* filename )
+{
+	Descriptor = open( filename, O_RDONLY | O_CLOEXEC );
+	if( Descriptor < 0 )
+	{
+		return SevenZipResult::SevenZipErrorRead;
+	}
+
+	struct stat status = {};
+	if( fstat( Descriptor, &status ) != 0 )
+	{
+		return SevenZipResult::SevenZipErrorRead;
+	}
+
+	if( status.st_size > 0 )
+	{
+		void* address = mmap( nullptr, static_cast<uint64>( status.st_size ), PROT_READ, MAP_PRIVATE, Descriptor, 0 );
+		if( address == MAP_FAILED )
+		{
+			return SevenZipResult::SevenZipErrorRead;
+		}
+
+		Data = static_cast<uint8*>( address );
+		Length = status.st_size;
+
+		// Only a hint; the mapping reads the same without it
+		madvise( Data, static_cast<uint64>( Length ), MADV_SEQUENTIAL );
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Creates a file of a known size and maps it read write, so it can be written like a buffer.
+ *
+ * @param filename Path of the file; an existing file is truncated.
+ * @param length   Size of the file in bytes.
+ * @return SevenZipOK, or SevenZipErrorWrite if the file could not be created, sized or mapped.
+ */
+SevenZipResult CMappedFile::Create( const char* filename, const int64 length )
+{
+	Writable = true;
+	Descriptor = open( filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if( Descriptor < 0 || length < 0 )
+	{
+		return SevenZipResult::SevenZipErrorWrite;
+	}
+
+	// File systems without fallocate still work, but then a full disk shows up as SIGBUS
+	if( length > 0 && fallocate( Descriptor, 0, 0, length ) != 0 && errno == ENOSPC )
+	{
+		return SevenZipResult::SevenZipErrorWrite;
+	}
+
+	if( ftruncate( Descriptor, length ) != 0 )
+	{
+		return SevenZipResult::SevenZipErrorWrite;
+	}
+
+	Length = length;
+	if( length > 0 )
+	{
+		void* address = mmap( nullptr, static_cast<uint64>( length ), PROT_READ | PROT_WRITE, MAP_SHARED, Descriptor, 0 );
+		if( address == MAP_FAILED )
+		{
+			return SevenZipResult::SevenZipErrorWrite;
+		}
+
+		Data = static_cast<uint8*>( address );
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Unmaps and closes the file, cutting a created file down to the bytes that were written.
+ *
+ * @param length The final size of a file from Create(); ignored for a file from OpenRead().
+ * @return SevenZipOK, or SevenZipErrorWrite if a created file could not be resized or closed.
+ */
+SevenZipResult CMappedFile::Close( const int64 length )
+{
+	SevenZipResult result = SevenZipResult::SevenZipOK;
+
+	if( Data != nullptr )
+	{
+		munmap( Data, static_cast<uint64>( Length ) );
+		Data = nullptr;
+	}
+
+	if( Descriptor >= 0 )
+	{
+		if( Writable && length != Length && ftruncate( Descriptor, std::max<int64>( length, 0 ) ) != 0 )
+		{
+			result = SevenZipResult::SevenZipErrorWrite;
+		}
+
+		if( close( Descriptor ) != 0 && Writable )
+		{
+			result = SevenZipResult::SevenZipErrorWrite;
+		}
+
+		Descriptor = -1;
+	}
+
+	Length = 0;
+	Writable = false;
+	return result;
+}
+
+/**
+ * @brief Faults in the pages of a range in one call, rather than one page fault at a time as they are first written.
+ *
+ * @param offset Start of the range.
+ * @param length Length of the range.
+ */
+void CMappedFile::Populate( const int64 offset, const int64 length ) const
+{
+#if defined( MADV_POPULATE_WRITE )
+	uint8* start = nullptr;
+	uint64 size = 0u;
+	if( Writable && GetPageRange( Data, Length, offset, length, start, size ) )
+	{
+		// Kernels before 5.14 do not have this; the pages then fault in as they are written
+		madvise( start, size, MADV_POPULATE_WRITE );
+	}
+#else
+	( void )offset;
+	( void )length;
+#endif
+}
+
+/**
+ * @brief Drops a range from the resident set. Later reads fault the pages back in from the page cache or the file.
+ *
+ * @param offset Start of the range; the page it falls in is released too.
+ * @param length Length of the range.
+ */
+void CMappedFile::Release( const int64 offset, const int64 length ) const
+{
+	uint8* start = nullptr;
+	uint64 size = 0u;
+	if( GetPageRange( Data, Length, offset, length, start, size ) )
+	{
+		// The mapping is shared or read only, so nothing written is lost
+		madvise( start, size, MADV_DONTNEED );
+	}
+}
+
+/**
+ * @brief Starts writing the dirty pages of a range to disk, so they are not all left for the final close.
+ *
+ * @param offset Start of the range.
+ * @param length Length of the range.
+ */
+void CMappedFile::StartWriteback( const int64 offset, const int64 length ) const
+{
+	uint8* start = nullptr;
+	uint64 size = 0u;
+	if( Writable && GetPageRange( Data, Length, offset, length, start, size ) )
+	{
+		sync_file_range( Descriptor, start - Data, static_cast<int64>( size ), SYNC_FILE_RANGE_WRITE );
+	}
+}
+
+CFileOutStream::~CFileOutStream()
+{
+	Close();
+}
+
+/**
+ * @brief Creates the file and allocates the batch buffer.
+ *
+ * @param filename Path of the file; an existing file is truncated.
+ * @param alloc    Allocator for the batch buffer.
+ * @return SevenZipOK, SevenZipErrorMemory, or SevenZipErrorWrite if the file could not be created.
+ */
+SevenZipResult CFileOutStream::Create( const char* filename, MemoryInterface* alloc )
+{
+	Alloc = alloc;
+	Batch = static_cast<uint8*>( Alloc->Alloc( LinuxFile::WriteBatchSize, "CFileOutStream::Batch" ) );
+	if( Batch == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	Descriptor = open( filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if( Descriptor < 0 )
+	{
+		return SevenZipResult::SevenZipErrorWrite;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Adds bytes to the batch, writing the batch out first if they do not fit.
+ *
+ * @param bufferBase Base of the buffer holding the bytes.
+ * @param offset     Offset of the bytes from bufferBase.
+ * @param size       Number of bytes.
+ * @return size, or 0 if a write has failed.
+ */
+int64 CFileOutStream::Write( const uint8* bufferBase, const int64 offset, int64 size )
+{
+	if( Failed || Descriptor < 0 )
+	{
+		return 0;
+	}
+
+	const uint8* data = bufferBase + offset;
+
+	// Already built in place at the end of the batch by GetWriteBuffer()
+	if( data == Batch + BatchLength && BatchLength + size <= LinuxFile::WriteBatchSize )
+	{
+		BatchLength += size;
+		return size;
+	}
+
+	if( BatchLength + size > LinuxFile::WriteBatchSize && !Flush() )
+	{
+		return 0;
+	}
+
+	if( size >= LinuxFile::WriteBatchSize )
+	{
+		if( !WriteAll( Descriptor, data, size, FileOffset ) )
+		{
+			Failed = true;
+			return 0;
+		}
+
+		FileOffset += size;
+		return size;
+	}
+
+	memcpy( Batch + BatchLength, data, static_cast<uint64>( size ) );
+	BatchLength += size;
+	return size;
+}
+
+/**
+ * @brief Returns the space at the end of the batch, writing the batch out first if size bytes do not fit.
+ *
+ * @param size Number of bytes the caller will build.
+ * @return Where to build them, or nullptr if they are larger than a batch or a write has failed.
+ */
+uint8* CFileOutStream::GetWriteBuffer( const int64 size )
+{
+	if( Failed || Descriptor < 0 || size > LinuxFile::WriteBatchSize )
+	{
+		return nullptr;
+	}
+
+	if( BatchLength + size > LinuxFile::WriteBatchSize && !Flush() )
+	{
+		return nullptr;
+	}
+
+	return Batch + BatchLength;
+}
+
+/**
+ * @brief Writes out the batch and closes the file.
+ *
+ * @return SevenZipOK, or SevenZipErrorWrite if any write failed or the file could not be closed.
+ */
+SevenZipResult CFileOutStream::Close()
+{
+	if( Descriptor >= 0 )
+	{
+		Flush();
+		if( close( Descriptor ) != 0 )
+		{
+			Failed = true;
+		}
+
+		Descriptor = -1;
+	}
+
+	if( Batch != nullptr )
+	{
+		Alloc->Free( Batch, LinuxFile::WriteBatchSize, "CFileOutStream::Batch" );
+		Batch = nullptr;
+	}
+
+	return Failed ? SevenZipResult::SevenZipErrorWrite : SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Writes the batch to the file and empties it.
+ *
+ * @return false if the write failed.
+ */
+bool CFileOutStream::Flush()
+{
+	if( BatchLength > 0 )
+	{
+		if( Failed || !WriteAll( Descriptor, Batch, BatchLength, FileOffset ) )
+		{
+			Failed = true;
+			return false;
+		}
+
+		FileOffset += BatchLength;
+		BatchLength = 0;
+	}
+
+	return true;
+}
+
+CMappedFileProgress::CMappedFileProgress( const CMappedFile* input, const int64 inputWindow, const CMappedFile* output, const int64 outputWindow, ProgressInterface* progress )
+	: Input( input )
+	, InputWindow( inputWindow )
+	, Output( output )
+	, OutputWindow( outputWindow )
+	, CallerProgress( progress )
+{
+}
+
+/**
+ * @brief Faults in the output the decoder is about to write, releases what the coder has finished with, then passes
+ * the call on to the caller's progress interface.
+ *
+ * @param inSize  Number of input bytes the coder has consumed.
+ * @param outSize Number of output bytes the coder has produced.
+ * @return The caller's result, or SevenZipOK if there is no caller progress interface.
+ */
+SevenZipResult CMappedFileProgress::Progress( const int64 inSize, const int64 outSize )
+{
+	if( Input != nullptr && inSize >= 0 )
+	{
+		const int64 release_end = ( ( inSize - InputWindow ) / LinuxFile::ReleaseStep ) * LinuxFile::ReleaseStep;
+		if( release_end > InputReleased )
+		{
+			Input->Release( InputReleased, release_end - InputReleased );
+			InputReleased = release_end;
+		}
+	}
+
+	if( Output != nullptr && outSize >= 0 )
+	{
+		const int64 release_end = ( ( outSize - OutputWindow ) / LinuxFile::ReleaseStep ) * LinuxFile::ReleaseStep;
+		if( release_end > OutputReleased )
+		{
+			Output->StartWriteback( OutputReleased, release_end - OutputReleased );
+			Output->Release( OutputReleased, release_end - OutputReleased );
+			OutputReleased = release_end;
+		}
+
+		// Lzma2Decode calls this before each slice of output it decodes
+		const int64 populate_start = std::max( OutputPopulated, outSize );
+		const int64 populate_end = std::min( outSize + Lzma::Lzma2DecodeProgressInterval, Output->Length );
+		if( populate_end > populate_start )
+		{
+			Output->Populate( populate_start, populate_end - populate_start );
+			OutputPopulated = populate_end;
+		}
+	}
+
+	if( CallerProgress != nullptr )
+	{
+		return CallerProgress->Progress( inSize, outSize );
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+#endif
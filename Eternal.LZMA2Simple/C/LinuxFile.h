@@ -0,0 +1,159 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+
+#if defined( _LINUX )
+
+namespace LinuxFile
+{
+	/** The largest batch CFileOutStream collects before writing it to the file */
+	static constexpr int64 WriteBatchSize = 1 << 22;
+
+	/** Mapped pages are released and written back in steps of this many bytes */
+	static constexpr int64 ReleaseStep = 1 << 21;
+}
+
+/**
+ * A file mapped into memory; either an existing file read only, or a new file of a known size read write.
+ * The mapping stays valid until Close() or the destructor. An empty file has no mapping, and Data is nullptr.
+ */
+class CMappedFile
+{
+public:
+	CMappedFile() = default;
+	~CMappedFile();
+
+	CMappedFile( const CMappedFile& ) = delete;
+	CMappedFile& operator=( const CMappedFile& ) = delete;
+
+	/**
+	 * OpenRead - map an existing file read only, to be read from start to end
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_READ        - The file could not be opened or mapped
+	 */
+	SevenZipResult OpenRead( const char* filename );
+
+	/**
+	 * Create - create or truncate a file of length bytes and map it read write
+	 * The blocks are reserved up front where the file system allows, so a full disk is reported here rather than
+	 * raising SIGBUS when a page is first written.
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_WRITE       - The file could not be created, sized or mapped
+	 */
+	SevenZipResult Create( const char* filename, int64 length );
+
+	/**
+	 * Close - unmap and close the file; a file from Create() is cut to length bytes first, e.g. after a failed decode
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_WRITE       - The file could not be resized or closed
+	 */
+	SevenZipResult Close( int64 length );
+
+	/** Fault in the pages of a range ahead of writing it, so the writer does not stop on each page */
+	void Populate( int64 offset, int64 length ) const;
+
+	/** Drop a range from this process's resident memory; written data stays in the page cache on its way to the file */
+	void Release( int64 offset, int64 length ) const;
+
+	/** Start writing a range of a file from Create() back to disk, without waiting for it */
+	void StartWriteback( int64 offset, int64 length ) const;
+
+	uint8* Data = nullptr;
+	int64 Length = 0;
+
+private:
+	int32 Descriptor = -1;
+	bool Writable = false;
+};
+
+/**
+ * Writes a stream to a file with pwrite in batches of up to LinuxFile::WriteBatchSize bytes.
+ * GetWriteBuffer() hands out space in the batch, so the encoder builds each chunk where it will be written from.
+ */
+class CFileOutStream
+	: public OutStreamInterface
+{
+public:
+	CFileOutStream() = default;
+	virtual ~CFileOutStream() override;
+
+	/**
+	 * Create - create or truncate the file and allocate the batch
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 * SZ_ERROR_WRITE       - The file could not be created
+	 */
+	SevenZipResult Create( const char* filename, MemoryInterface* alloc );
+
+	virtual int64 Write( const uint8* bufferBase, const int64 offset, int64 size ) override;
+	virtual uint8* GetWriteBuffer( const int64 size ) override;
+
+	/**
+	 * Close - write out the batch and close the file
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_WRITE       - A write failed, or the file could not be closed
+	 */
+	SevenZipResult Close();
+
+	/** The number of bytes written to the stream so far */
+	int64 GetOffset() const
+	{
+		return FileOffset + BatchLength;
+	}
+
+private:
+	bool Flush();
+
+	int32 Descriptor = -1;
+	bool Failed = false;
+
+	MemoryInterface* Alloc = nullptr;
+	uint8* Batch = nullptr;
+	int64 BatchLength = 0;
+
+	/** The number of bytes written to the file, before the batch */
+	int64 FileOffset = 0;
+};
+
+/**
+ * The progress interface to pass while coding from or to mapped files.
+ * It faults in the output ahead of the decoder, and releases the input and output once they are further behind the
+ * coder than it can reach, so the resident memory stays near the dictionary size rather than growing with the files.
+ */
+class CMappedFileProgress
+	: public ProgressInterface
+{
+public:
+	/**
+	 * input        - the mapped input, or nullptr
+	 * inputWindow  - how far behind its position the coder still reads the input; the dictionary size for the encoder's direct input
+	 * output       - the mapped output, or nullptr
+	 * outputWindow - how far behind its position the coder still reads the output; the dictionary size for the decoder
+	 * progress     - the caller's progress interface to pass the calls on to, or nullptr
+	 */
+	CMappedFileProgress( const CMappedFile* input, int64 inputWindow, const CMappedFile* output, int64 outputWindow, ProgressInterface* progress );
+	virtual ~CMappedFileProgress() override = default;
+
+	virtual SevenZipResult Progress( int64 inSize, int64 outSize ) override;
+
+private:
+	const CMappedFile* Input = nullptr;
+	int64 InputWindow = 0;
+	int64 InputReleased = 0;
+
+	const CMappedFile* Output = nullptr;
+	int64 OutputWindow = 0;
+	int64 OutputReleased = 0;
+	int64 OutputPopulated = 0;
+
+	ProgressInterface* CallerProgress = nullptr;
+};
+
+#endif
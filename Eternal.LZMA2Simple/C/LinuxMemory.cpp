@@ -0,0 +1,226 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "LinuxMemory.h"
+
+#if defined( _LINUX )
+
+#include <cstring>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace LinuxMemory
+{
+	static constexpr int64 HugePageSize = 1 << 21;
+	static constexpr int64 HugePageMask = HugePageSize - 1;
+
+	// Node masks are passed to the kernel as a single word
+	static constexpr int32 MaxNumaNodes = 64;
+}
+
+/**
+ * @brief Returns whether an allocation is large and randomly accessed enough to go on huge pages.
+ *
+ * The window normally comes from AllocMirrored, and only reaches Alloc when it cannot be mirrored.
+ *
+ * @param size Size of the allocation in bytes.
+ * @param tag  Tag passed to Alloc or AllocMirrored.
+ * @return true for match finder hash and window allocations of at least one huge page.
+ */
+static bool UseHugePages( const int64 size, const char* tag )
+{
+	if( size < LinuxMemory::HugePageSize || tag == nullptr )
+	{
+		return false;
+	}
+
+	return strcmp( tag, "CMatchFinder::Hash" ) == 0 || strcmp( tag, "CMatchFinder::BufferBase" ) == 0;
+}
+
+/**
+ * @brief Maps memory that starts on a huge page boundary.
+ *
+ * Maps an extra huge page so the start can be moved up to a boundary, then returns the slack either side.
+ *
+ * @param size       Number of bytes to map.
+ * @param protection Protection of the mapping, as passed to mmap.
+ * @return Pointer to the mapping, or nullptr on failure.
+ */
+static uint8* MapAligned( const int64 size, const int32 protection )
+{
+	void* reserved = mmap( nullptr, static_cast<uint64>( size + LinuxMemory::HugePageSize ), protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( reserved == MAP_FAILED )
+	{
+		return nullptr;
+	}
+
+	uint8* base = static_cast<uint8*>( reserved );
+	uint8* address = reinterpret_cast<uint8*>( ( reinterpret_cast<uint64>( base ) + LinuxMemory::HugePageMask ) & ~static_cast<uint64>( LinuxMemory::HugePageMask ) );
+	const int64 head_size = address - base;
+	if( head_size > 0 )
+	{
+		munmap( base, static_cast<uint64>( head_size ) );
+	}
+
+	const int64 tail_size = LinuxMemory::HugePageSize - head_size;
+	if( tail_size > 0 )
+	{
+		munmap( address + size, static_cast<uint64>( tail_size ) );
+	}
+
+	return address;
+}
+
+/**
+ * @brief Maps memory on a huge page boundary for the match finder, and uses malloc for everything else.
+ *
+ * @param size Number of bytes to allocate.
+ * @param tag  Name of the allocation.
+ * @return Pointer to the memory, or nullptr on failure.
+ */
+void* LinuxMemoryInterface::Alloc( const int64 size, const char* tag )
+{
+	if( !UseHugePages( size, tag ) )
+	{
+		return MemoryInterface::Alloc( size, tag );
+	}
+
+	const int64 mapped_size = ( size + LinuxMemory::HugePageMask ) & ~LinuxMemory::HugePageMask;
+	uint8* address = MapAligned( mapped_size, PROT_READ | PROT_WRITE );
+	if( address == nullptr )
+	{
+		return nullptr;
+	}
+
+	// Only a hint; the memory is still usable if huge pages are disabled
+	madvise( address, static_cast<uint64>( mapped_size ), MADV_HUGEPAGE );
+	BindToNode( address, mapped_size );
+	return address;
+}
+
+/**
+ * @brief Releases memory returned by Alloc.
+ *
+ * @param address Pointer returned by Alloc.
+ * @param size    Size passed to Alloc.
+ * @param tag     Tag passed to Alloc.
+ */
+void LinuxMemoryInterface::Free( void* address, const int64 size, const char* tag )
+{
+	if( !UseHugePages( size, tag ) )
+	{
+		MemoryInterface::Free( address, size, tag );
+		return;
+	}
+
+	if( address != nullptr )
+	{
+		const int64 mapped_size = ( size + LinuxMemory::HugePageMask ) & ~LinuxMemory::HugePageMask;
+		munmap( address, static_cast<uint64>( mapped_size ) );
+	}
+}
+
+/**
+ * @brief Asks the kernel to take the pages of a mapping from the preferred NUMA node.
+ *
+ * @param address Start of the mapping.
+ * @param size    Size of the mapping in bytes.
+ */
+void LinuxMemoryInterface::BindToNode( void* address, const int64 size ) const
+{
+	if( NumaNode < 0 || NumaNode >= LinuxMemory::MaxNumaNodes )
+	{
+		return;
+	}
+
+	// Preferred rather than bound, so a full node falls back to another instead of failing
+	const uint64 node_mask = 1ull << NumaNode;
+	syscall( SYS_mbind, address, static_cast<uint64>( size ), MPOL_PREFERRED, &node_mask, LinuxMemory::MaxNumaNodes + 1, 0 );
+}
+
+/**
+ * @brief Allocates a buffer whose second half is a mapping of the first.
+ *
+ * A match finder window of at least one huge page starts on a huge page boundary and is advised onto huge pages, as
+ * in Alloc. The backing file is shared memory, so the kernel only uses huge pages for it when
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled is advise or always.
+ *
+ * @param size Size of one copy in bytes; must be a multiple of the page size.
+ * @param tag  Name given to the backing memory file.
+ * @return Pointer to 2 * size bytes of address space, or nullptr on failure.
+ */
+uint8* LinuxMemoryInterface::AllocMirrored( const int64 size, const char* tag )
+{
+	if( size <= 0 || ( size % sysconf( _SC_PAGESIZE ) ) != 0 )
+	{
+		return nullptr;
+	}
+
+	const int file = memfd_create( tag, MFD_CLOEXEC );
+	if( file < 0 )
+	{
+		return nullptr;
+	}
+
+	uint8* address = nullptr;
+	if( ftruncate( file, size ) == 0 )
+	{
+		// Reserve the address space for both copies, then map the file over each half
+		const bool huge_pages = UseHugePages( size, tag );
+		uint8* base = nullptr;
+		if( huge_pages )
+		{
+			base = MapAligned( size * 2, PROT_NONE );
+		}
+		else
+		{
+			void* reserved = mmap( nullptr, static_cast<uint64>( size * 2 ), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+			base = ( reserved != MAP_FAILED ) ? static_cast<uint8*>( reserved ) : nullptr;
+		}
+
+		if( base != nullptr )
+		{
+			if( mmap( base, static_cast<uint64>( size ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0 ) != MAP_FAILED
+				&& mmap( base + size, static_cast<uint64>( size ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0 ) != MAP_FAILED )
+			{
+				address = base;
+				if( huge_pages )
+				{
+					// Only a hint, as in Alloc; both views share the same pages
+					madvise( base, static_cast<uint64>( size * 2 ), MADV_HUGEPAGE );
+				}
+
+				BindToNode( base, size * 2 );
+			}
+			else
+			{
+				munmap( base, static_cast<uint64>( size * 2 ) );
+			}
+		}
+	}
+
+	// The mappings keep the file alive
+	close( file );
+	return address;
+}
+
+/**
+ * @brief Releases a buffer returned by AllocMirrored.
+ *
+ * @param address Pointer returned by AllocMirrored.
+ * @param size    Size of one copy in bytes, as passed to AllocMirrored.
+ * @param tag     Name given to the backing memory file.
+ */
+void LinuxMemoryInterface::FreeMirrored( uint8* address, const int64 size, const char* tag )
+{
+	( void )tag;
+
+	if( address != nullptr )
+	{
+		munmap( address, static_cast<uint64>( size * 2 ) );
+	}
+}
+
+#endif
@@ -0,0 +1,49 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+
+#if defined( _LINUX )
+
+/**
+ * Memory interface that uses Linux virtual memory features not available through malloc.
+ * Pass it as the alloc parameter of the compression functions.
+ *
+ * The match finder hash and window are placed on 2 MB aligned transparent huge pages, as their random access pattern
+ * otherwise misses the TLB on nearly every lookup with large dictionaries. The window is mirrored through shared memory,
+ * which only goes on huge pages when /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it. All other allocations
+ * use malloc.
+ */
+class LinuxMemoryInterface
+	: public MemoryInterface
+{
+public:
+	LinuxMemoryInterface() = default;
+	virtual ~LinuxMemoryInterface() override = default;
+
+	/**
+	 * numaNode - the NUMA node the match finder memory should preferably come from, e.g. the node of the worker thread using this interface.
+	 * Pass -1 to leave placement to the kernel.
+	 */
+	explicit LinuxMemoryInterface( const int32 numaNode )
+		: NumaNode( numaNode )
+	{
+	}
+
+	virtual void* Alloc( const int64 size, const char* tag ) override;
+	virtual void Free( void* address, const int64 size, const char* tag ) override;
+
+	/**
+	 * Maps the same anonymous file twice back to back. size must be a multiple of the page size.
+	 */
+	virtual uint8* AllocMirrored( const int64 size, const char* tag ) override;
+	virtual void FreeMirrored( uint8* address, const int64 size, const char* tag ) override;
+
+private:
+	void BindToNode( void* address, const int64 size ) const;
+
+	int32 NumaNode = -1;
+};
+
+#endif
@@ -16,6 +16,9 @@ namespace MatchFinder
 	static constexpr uint32 MatchFinderHash3Size = 1u << 16;
 	static constexpr uint32 MatchFinderHash3Mask = MatchFinderHash3Size - 1u;
 
+	// Smallest main and 3-byte hash tables used with CompactHash
+	static constexpr uint32 CompactHashMinMask = ( 1u << 10 ) - 1u;
+
 	/*
 	  We use up to 3 crc values for hash:
 		crc0
@@ -47,6 +50,11 @@ namespace MatchFinder
 	static constexpr uint32 MinBlockSizeReserve = 1u << 24;
 
 	static_assert( MinBlockSizeReserve > BlockSizeAlignSize, "Block size reserve too small" );
+
+	// 16-bit references are rebased every ( SmallRefMaxPosition - CyclicBufferSize ) positions
+	static constexpr uint32 SmallRefMaxPosition = 1u << 16;
+	// keep at least 16K positions between rebases so the pass over the tables stays cheap
+	static constexpr uint32 SmallRefMaxHistorySize = SmallRefMaxPosition - ( 1u << 14 );
 }
 
 uint32 CMatchFinder::CrcLookupTable[256] =
@@ -73,7 +81,15 @@ void CMatchFinder::FreeBuffer()
 {
 	if( !DirectInput && BufferBase != nullptr )
 	{
-		Alloc->Free( BufferBase, BlockSize, "CMatchFinder::BufferBase" );
+		if( MirroredWindow )
+		{
+			Alloc->FreeMirrored( BufferBase, BlockSize, "CMatchFinder::BufferBase" );
+		}
+		else
+		{
+			Alloc->Free( BufferBase, BlockSize, "CMatchFinder::BufferBase" );
+		}
+
 		BufferBase = nullptr;
 	}
 }
@@ -90,7 +106,14 @@ bool CMatchFinder::CreateBuffer( const uint32 newBlockSize )
 		FreeBuffer();
 
 		BlockSize = newBlockSize;
-		BufferBase = static_cast<uint8*>( Alloc->Alloc( BlockSize, "CMatchFinder::BufferBase" ) );
+
+		// A mirrored window lets the history wrap around instead of being moved down
+		BufferBase = Alloc->AllocMirrored( BlockSize, "CMatchFinder::BufferBase" );
+		MirroredWindow = ( BufferBase != nullptr );
+		if( !MirroredWindow )
+		{
+			BufferBase = static_cast<uint8*>( Alloc->Alloc( BlockSize, "CMatchFinder::BufferBase" ) );
+		}
 	}
 
 	return BufferBase != nullptr;
@@ -100,7 +123,7 @@ void CMatchFinder::FreeHashes()
 {
 	if( Hash != nullptr )
 	{
-		Alloc->Free( Hash, NumRefs * static_cast<int64>( sizeof( CLzRef ) ), "CMatchFinder::Hash" );
+		Alloc->Free( Hash, NumRefs * GetRefSize(), "CMatchFinder::Hash" );
 		Hash = nullptr;
 	}
 }
@@ -110,7 +133,7 @@ bool CMatchFinder::AllocHashes( const int64 num )
 	if( Hash == nullptr || NumRefs != num )
 	{
 		NumRefs = num;
-		Hash = static_cast<CLzRef*>( Alloc->Alloc( NumRefs * static_cast< int64 >( sizeof( CLzRef ) ), "CMatchFinder::Hash" ) );
+		Hash = Alloc->Alloc( NumRefs * GetRefSize(), "CMatchFinder::Hash" );
 	}
 
 	return Hash != nullptr;
@@ -153,6 +176,11 @@ void CMatchFinder::ReadBlock()
 	const uint32 available_bytes = StreamPosition - Position;
 	int64 offset = BufferOffset + available_bytes;
 	int64 size = BlockSize - BufferOffset - available_bytes;
+	if( MirroredWindow )
+	{
+		// Fill up to one window past the oldest byte still needed
+		size += std::max<int64>( BufferOffset - KeepSizeBefore, 0 );
+	}
 
 	// Check if buffer has space (should always be true in normal operation)
 	if( size == 0u )
@@ -180,6 +208,13 @@ void CMatchFinder::ReadBlock()
 
 void CMatchFinder::MoveBlock()
 {
+	if( MirroredWindow )
+	{
+		// Both copies hold the same bytes, so stepping back one window moves nothing
+		BufferOffset -= BlockSize;
+		return;
+	}
+
 	const uint32 offset = static_cast<uint32>( BufferOffset ) - KeepSizeBefore;
 	const uint32 keep_before = ( offset & MatchFinder::BlockMoveAlignMask ) + KeepSizeBefore;
 	const uint32 move_size = keep_before + StreamPosition - Position;
@@ -209,15 +244,20 @@ bool CMatchFinder::NeedMove() const
 		return false;
 	}
 
+	if( MirroredWindow )
+	{
+		return ( BufferOffset - KeepSizeBefore ) >= BlockSize;
+	}
+
 	return ( BlockSize - BufferOffset ) <= KeepSizeAfter;
 }
 
-uint32 CMatchFinder::GetBlockSize( const uint32 inHistorySize ) const
+uint32 CMatchFinder::GetBlockSize( const uint32 inHistorySize, const uint32 keepSizeBefore, const uint32 keepSizeAfter )
 {
-	uint32 block_size = KeepSizeBefore + KeepSizeAfter;
+	uint32 block_size = keepSizeBefore + keepSizeAfter;
 
 	// if 32-bit overflow
-	if( KeepSizeBefore < inHistorySize || block_size < KeepSizeBefore )  
+	if( keepSizeBefore < inHistorySize || block_size < keepSizeBefore )  
 	{
 		return 0u;
 	}
@@ -246,6 +286,128 @@ uint32 CMatchFinder::GetBlockSize( const uint32 inHistorySize ) const
 }
 
 
+/**
+ * @brief Returns the mask of the main hash table for a given history size.
+ *
+ * @param historySize      Size of the history (dictionary) in bytes.
+ * @param expectedDataSize Number of bytes expected to be encoded; the table is not sized beyond it.
+ * @param compactHash      true to drop the 64K-entry minimum.
+ * @return Hash mask; the table has one more entry than this.
+ */
+uint32 CMatchFinder::GetHashMask( const uint32 historySize, const int64 expectedDataSize, const bool compactHash )
+{
+	uint32 history_size = historySize;
+	if( history_size > expectedDataSize )
+	{
+		history_size = static_cast<uint32>( expectedDataSize );
+	}
+
+	if( history_size != 0u )
+	{
+		history_size--;
+	}
+
+	history_size |= ( history_size >> 1 );
+	history_size |= ( history_size >> 2 );
+	history_size |= ( history_size >> 4 );
+	history_size |= ( history_size >> 8 );
+
+	// we propagated 16 bits in (hs). Low 16 bits must be set later
+	history_size >>= 1;
+	if( history_size >= MatchFinder::BigHashSizeLimit )
+	{
+		history_size >>= 1;
+	}
+
+	if( compactHash )
+	{
+		return history_size | MatchFinder::CompactHashMinMask;
+	}
+
+	// (hash_size >= (1 << 16)) : Required for (NumHashBytes > 2)
+	history_size |= MatchFinder::BlockSizeAlignMask; /* don't change it! */
+	return history_size;
+}
+
+/**
+ * @brief Returns the mask of the 3-byte hash table.
+ *
+ * The full size table maps each (byte 1, byte 2) pair to its own entry for a given first byte, so a
+ * candidate only needs its first byte checked. A compact table is no larger than the main hash.
+ *
+ * @param hashMask    Mask of the main hash table.
+ * @param compactHash true to size the table to the main hash.
+ */
+uint32 CMatchFinder::GetHash3Mask( const uint32 hashMask, const bool compactHash )
+{
+	return compactHash ? std::min( hashMask, MatchFinder::MatchFinderHash3Mask ) : MatchFinder::MatchFinderHash3Mask;
+}
+
+/**
+ * @brief Returns the number of references in the combined hash and son allocation.
+ *
+ * @param historySize      Size of the history (dictionary) in bytes.
+ * @param expectedDataSize Number of bytes expected to be encoded.
+ * @param binaryTree       true for the binary tree match finder, which keeps two son links per position.
+ * @param compactHash      true if the hash tables are sized to the data.
+ * @return Number of CLzRef entries Create() allocates.
+ */
+int64 CMatchFinder::GetNumRefs( const uint32 historySize, const int64 expectedDataSize, const bool binaryTree, const bool compactHash )
+{
+	const uint32 hash_mask = GetHashMask( historySize, expectedDataSize, compactHash );
+	const int64 hash_size_sum = static_cast<int64>( hash_mask ) + 1 + MatchFinder::MatchFinderHash2Size + GetHash3Mask( hash_mask, compactHash ) + 1;
+
+	int64 son_count = static_cast<int64>( historySize ) + 1;
+	if( binaryTree )
+	{
+		son_count <<= 1;
+	}
+
+	// Aligned size is not required here, but it can be better for some loops
+	return ( hash_size_sum + son_count + MatchFinder::NumRefAlignmentTableMask ) & MatchFinder::NumRefAlignmentTableTruncate;
+}
+
+/**
+ * @brief Returns true if a match finder for this history size stores 16-bit references.
+ *
+ * @param historySize Size of the history (dictionary) in bytes.
+ */
+bool CMatchFinder::UsesSmallRefs( const uint32 historySize )
+{
+	return historySize <= MatchFinder::SmallRefMaxHistorySize;
+}
+
+/**
+ * @brief Returns the number of bytes a match finder allocates when reading its input directly from memory.
+ *
+ * @param historySize      Size of the history (dictionary) in bytes.
+ * @param expectedDataSize Number of bytes expected to be encoded.
+ * @param binaryTree       true for the binary tree match finder.
+ * @return Size of the match finder object plus its hash and son tables.
+ */
+int64 CMatchFinder::GetAllocationSize( const uint32 historySize, const int64 expectedDataSize, const bool binaryTree )
+{
+	const int64 ref_size = UsesSmallRefs( historySize ) ? sizeof( CLzSmallRef ) : sizeof( CLzRef );
+	return static_cast<int64>( sizeof( CMatchFinder ) ) + GetNumRefs( historySize, expectedDataSize, binaryTree, false ) * ref_size;
+}
+
+/**
+ * @brief Returns the size of the window Create() allocates when the match finder reads from a stream.
+ *
+ * @param inHistorySize       Size of the history (dictionary) in bytes.
+ * @param keepAddBufferBefore Extra bytes to keep before the current position.
+ * @param inMatchMaxLen       Maximum match length to search for.
+ * @param keepAddBufferAfter  Extra bytes to keep after the current position.
+ * @return The window size in bytes; 0 for settings Create() rejects.
+ */
+int64 CMatchFinder::GetStreamBufferSize( const uint32 inHistorySize, const uint32 keepAddBufferBefore, const uint32 inMatchMaxLen, const uint32 keepAddBufferAfter )
+{
+	// The same keep sizes as Create()
+	const uint32 keep_size_before = inHistorySize + keepAddBufferBefore + 1u;
+	const uint32 keep_size_after = std::max( keepAddBufferAfter + inMatchMaxLen, 4u );
+	return GetBlockSize( inHistorySize, keep_size_before, keep_size_after );
+}
+
 /**
  * @brief Allocates and configures the match finder for the given stream parameters.
  *
@@ -274,65 +436,28 @@ bool CMatchFinder::Create( const uint32 inHistorySize, const uint32 keepAddBuffe
 	}
 	else
 	{
-		buffer_created = CreateBuffer( GetBlockSize( inHistorySize ) );
+		buffer_created = CreateBuffer( GetBlockSize( inHistorySize, KeepSizeBefore, KeepSizeAfter ) );
 	}
 
-	if( DirectInput || buffer_created )
+	// A small reference match finder cannot address a larger window
+	const bool small_refs = ( GetRefSize() == sizeof( CLzSmallRef ) );
+	if( ( DirectInput || buffer_created ) && ( !small_refs || UsesSmallRefs( inHistorySize ) ) )
 	{
 		// do not change it
 		const uint32 new_cyclic_buffer_size = inHistorySize + 1u;
 		MatchMaxLength = inMatchMaxLen;
 
-		FixedHashSize = 0u;
-		uint32 history_size = inHistorySize;
-		if( history_size > ExpectedDataSize )
-		{
-			history_size = static_cast<uint32>( ExpectedDataSize );
-		}
-
-		if( history_size != 0u )
-		{
-			history_size--;
-		}
-
-		history_size |= ( history_size >> 1 );
-		history_size |= ( history_size >> 2 );
-		history_size |= ( history_size >> 4 );
-		history_size |= ( history_size >> 8 );
-
-		// we propagated 16 bits in (hs). Low 16 bits must be set later
-		history_size >>= 1;
-		if( history_size >= MatchFinder::BigHashSizeLimit )
-		{
-			history_size >>= 1;
-		}
-
-		// (hash_size >= (1 << 16)) : Required for (NumHashBytes > 2)
-		history_size |= MatchFinder::BlockSizeAlignMask; /* don't change it! */
-
-		HashMask = history_size;
-		history_size++;
-
-		FixedHashSize += MatchFinder::MatchFinderHash2Size + MatchFinder::MatchFinderHash3Size;
-
-		history_size += FixedHashSize;
+		HashMask = GetHashMask( inHistorySize, ExpectedDataSize, CompactHash );
+		Hash3Mask = GetHash3Mask( HashMask, CompactHash );
+		FixedHashSize = MatchFinder::MatchFinderHash2Size + Hash3Mask + 1u;
 
 		HistorySize = inHistorySize;
-		HashSizeSum = history_size;
+		HashSizeSum = HashMask + 1u + FixedHashSize;
 		// it must be = (HistorySize + 1)
 		CyclicBufferSize = new_cyclic_buffer_size; 
+		MaxPosition = small_refs ? MatchFinder::SmallRefMaxPosition : 0u;
 
-		int64 son_count = new_cyclic_buffer_size;
-		if( IsBinaryTreeMode() )
-		{
-			son_count <<= 1;
-		}
-
-		int64 new_size = history_size + son_count;
-
-		// Aligned size is not required here, but it can be better for some loops
-		new_size = ( new_size + MatchFinder::NumRefAlignmentTableMask ) & MatchFinder::NumRefAlignmentTableTruncate;
-
+		const int64 new_size = GetNumRefs( inHistorySize, ExpectedDataSize, IsBinaryTreeMode(), CompactHash );
 		if( AllocHashes( new_size ) )
 		{
 			SonOffset = HashSizeSum;
@@ -346,7 +471,7 @@ bool CMatchFinder::Create( const uint32 inHistorySize, const uint32 keepAddBuffe
 
 void CMatchFinder::SetLimits()
 {
-	uint32 length = 0u - Position;
+	uint32 length = MaxPosition - Position;
 	if( length == 0u )
 	{
 		length = UINT32_MAX;  
@@ -391,12 +516,8 @@ void CMatchFinder::SetLimits()
  */
 void CMatchFinder::Init()
 {
-	// MatchFinder_Init_LowHash( mf );
-	memset( Hash, 0u, FixedHashSize * sizeof( CLzRef ) );
-
-	// MatchFinder_Init_HighHash( mf );
-	CLzRef* items = Hash + FixedHashSize;
-	memset( items, 0u, ( HashMask + 1 ) * sizeof( CLzRef ) );
+	// MatchFinder_Init_LowHash( mf ) and MatchFinder_Init_HighHash( mf );
+	memset( Hash, 0u, ( static_cast< uint64 >( FixedHashSize ) + HashMask + 1u ) * GetRefSize() );
 
 	BufferOffset = 0;
 
@@ -437,9 +558,34 @@ void CMatchFinder::CheckLimits()
 		CyclicBufferPosition = 0u;
 	}
 
+	if( Position == MaxPosition && MaxPosition != 0u )
+	{
+		Normalize();
+	}
+
 	SetLimits();
 }
 
+/**
+ * @brief Rebases the 16-bit references so the current window starts just above zero.
+ *
+ * References that have already left the window become EMPTY_HASH_VALUE; they could never match anyway,
+ * so the match results are the same as with 32-bit references.
+ */
+void CMatchFinder::Normalize()
+{
+	const uint32 sub_value = Position - CyclicBufferSize;
+	CLzSmallRef* refs = GetRefs<CLzSmallRef>();
+	for( int64 index = 0; index < NumRefs; index++ )
+	{
+		const uint32 ref = refs[index];
+		refs[index] = static_cast< CLzSmallRef >( ( ref > sub_value ) ? ( ref - sub_value ) : 0u );
+	}
+
+	Position -= sub_value;
+	StreamPosition -= sub_value;
+}
+
 void CMatchFinder::MovePos()
 {
 	/* we go here at the end of stream data, when (avail < num_hash_bytes)
@@ -460,6 +606,7 @@ void CMatchFinder::MovePos()
 	}
 }
 
+template< typename TRef >
 uint32 CMatchFinder::HashCalcInternal( uint32* h2, uint32* h3, uint32* hv ) const
 {
 	// Load all bytes once
@@ -473,28 +620,55 @@ uint32 CMatchFinder::HashCalcInternal( uint32* h2, uint32* h3, uint32* hv ) cons
 	*h2 = temp1 & MatchFinder::MatchFinderHash2Mask;
 
 	const uint32 temp2 = temp1 ^ ( b2 << 8 );
-	*h3 = temp2 & MatchFinder::MatchFinderHash3Mask;
+	*h3 = temp2 & Hash3Mask;
 
 	*hv = ( temp2 ^ ( CrcLookupTable[b3] << MatchFinder::HashCrcShift1 ) ) & HashMask;
 
-	return Hash[*hv + MatchFinder::MatchFinderHash2Size + MatchFinder::MatchFinderHash3Size];
+	return GetRefs<TRef>()[*hv + FixedHashSize];
 }
 
+template< typename TRef >
 void CMatchFinder::HashUpdate( const uint32 h2, const uint32 h3, const uint32 hv, uint32* d2, uint32* d3 ) const
 {
-	*d2 = Position - Hash[h2];
-	*d3 = Position - Hash[h3 + MatchFinder::MatchFinderHash2Size];
-
-	Hash[h2] = Position;
-	Hash[h3 + MatchFinder::MatchFinderHash2Size] = Position;
-	Hash[hv + MatchFinder::MatchFinderHash2Size + MatchFinder::MatchFinderHash3Size] = Position;
+	TRef* refs = GetRefs<TRef>();
+	*d2 = Position - refs[h2];
+	*d3 = Position - refs[h3 + MatchFinder::MatchFinderHash2Size];
+
+	const TRef position = static_cast< TRef >( Position );
+	refs[h2] = position;
+	refs[h3 + MatchFinder::MatchFinderHash2Size] = position;
+	refs[hv + FixedHashSize] = position;
 }
 
+template< typename TRef >
 void CMatchFinder::HashSkip( const uint32 h2, const uint32 h3, const uint32 hv ) const
 {
-	Hash[h2] = Hash[h3 + MatchFinder::MatchFinderHash2Size]
-		= Hash[hv + MatchFinder::MatchFinderHash2Size + MatchFinder::MatchFinderHash3Size]
-		= Position;
+	TRef* refs = GetRefs<TRef>();
+	refs[h2] = refs[h3 + MatchFinder::MatchFinderHash2Size]
+		= refs[hv + FixedHashSize]
+		= static_cast< TRef >( Position );
+}
+
+/**
+ * @brief Checks that the 3-byte hash candidate at distance d3 really starts with the current three bytes.
+ *
+ * The full size 3-byte hash is unique for bytes 1 and 2 once byte 0 matches; a compact one is not.
+ */
+bool CMatchFinder::IsHash3Match( const uint32 d3, const uint32 maxDistance ) const
+{
+	if( d3 >= maxDistance )
+	{
+		return false;
+	}
+
+	const uint8* current = BufferBase + BufferOffset;
+	const uint8* match = current - d3;
+	if( match[0] != current[0] )
+	{
+		return false;
+	}
+
+	return Hash3Mask == MatchFinder::MatchFinderHash3Mask || ( match[1] == current[1] && match[2] == current[2] );
 }
 
 bool CMatchFinder::FindDistances( uint32* d2, const uint32 d3, const uint32 maxDistance, uint32* distances, uint32& matchCount ) const
@@ -510,7 +684,7 @@ bool CMatchFinder::FindDistances( uint32* d2, const uint32 d3, const uint32 maxD
 		if( BufferBase[BufferOffset - *d2 + 2] != BufferBase[BufferOffset + 2] )
 		{
 			// Try d3 as fallback
-			if( d3 < maxDistance && BufferBase[BufferOffset - d3] == BufferBase[BufferOffset] )
+			if( IsHash3Match( d3, maxDistance ) )
 			{
 				matchCount++;
 				distances[matchCount++] = d3 - 1u;
@@ -526,7 +700,7 @@ bool CMatchFinder::FindDistances( uint32* d2, const uint32 d3, const uint32 maxD
 	}
 
 	// Secondary path: Check d3 match
-	if( d3 < maxDistance && BufferBase[BufferOffset - d3] == BufferBase[BufferOffset] )
+	if( IsHash3Match( d3, maxDistance ) )
 	{
 		matchCount++;
 		distances[matchCount++] = d3 - 1u;
@@ -556,25 +730,28 @@ uint32 CMatchFinder::UpdateMaxLen( const uint32 d2, const uint32 maxLength ) con
 	return static_cast< uint32 >( index - BufferOffset );
 }
 
+template< typename TRef >
 uint32 CMatchFinder::CalcHash( uint32* d2, uint32* d3 ) const
 {
 	uint32 h2, h3, hv;
 
-	uint32 current_match = HashCalcInternal( &h2, &h3, &hv );
-	HashUpdate( h2, h3, hv, d2, d3 );
+	uint32 current_match = HashCalcInternal<TRef>( &h2, &h3, &hv );
+	HashUpdate<TRef>( h2, h3, hv, d2, d3 );
 	return current_match;
 }
 
+template< typename TRef >
 uint32 CMatchFinder::CalcHashSkip() const
 {
 	uint32 h2, h3, hv;
 
-	uint32 current_match = HashCalcInternal( &h2, &h3, &hv );
-	HashSkip( h2, h3, hv );
+	uint32 current_match = HashCalcInternal<TRef>( &h2, &h3, &hv );
+	HashSkip<TRef>( h2, h3, hv );
 	return current_match;
 }
 
 
+template< typename TRef >
 class CMatchFinderHashChain
 	: public CMatchFinder
 {
@@ -591,6 +768,11 @@ public:
 		return false;
 	}
 
+	virtual int32 GetRefSize() const override
+	{
+		return sizeof( TRef );
+	}
+
 	/**
 	 * @brief Finds matches at the current position using a hash chain and advances the position.
 	 *
@@ -607,7 +789,7 @@ public:
 
 		uint32 d2;
 		uint32 d3;
-		const uint32 current_match = CalcHash( &d2, &d3 );
+		const uint32 current_match = CalcHash<TRef>( &d2, &d3 );
 		const uint32 max_distance = std::min( CyclicBufferSize, Position );
 		uint32 max_length = 3u;
 
@@ -620,7 +802,7 @@ public:
 
 			if( max_length == LengthLimit )
 			{
-				Hash[SonOffset + CyclicBufferPosition] = current_match;
+				GetRefs<TRef>()[SonOffset + CyclicBufferPosition] = static_cast< TRef >( current_match );
 				MovePos();
 				return;
 			}
@@ -653,6 +835,7 @@ public:
 				length -= skip_count;
 
 				// Update hash chain for skipped positions
+				TRef* refs = GetRefs<TRef>();
 				const uint32 son_base = SonOffset;
 				uint32 son_idx = son_base + CyclicBufferPosition;
 				CyclicBufferPosition += skip_count;
@@ -660,7 +843,7 @@ public:
 				uint32 remaining = skip_count;
 				do
 				{
-					Hash[son_idx++] = CalcHashSkip();
+					refs[son_idx++] = static_cast< TRef >( CalcHashSkip<TRef>() );
 					BufferOffset++;
 					Position++;
 				} while( --remaining > 0u );
@@ -679,7 +862,8 @@ private:
 		uint32 cut_value = CutValue;
 		uint32 match_count = 0u;
 
-		Hash[SonOffset + CyclicBufferPosition] = currentMatch;
+		TRef* refs = GetRefs<TRef>();
+		refs[SonOffset + CyclicBufferPosition] = static_cast< TRef >( currentMatch );
 
 		do
 		{
@@ -695,7 +879,7 @@ private:
 			}
 
 			const uint64 cyclic_idx = CyclicBufferPosition - delta + ( ( delta > CyclicBufferPosition ) ? CyclicBufferSize : 0u );
-			currentMatch = Hash[SonOffset + cyclic_idx];
+			currentMatch = refs[SonOffset + cyclic_idx];
 
 			const int64 current_offset = BufferOffset;
 			const int64 history_offset = current_offset - delta;
@@ -729,6 +913,7 @@ private:
 };
 
 // Algorithm-specific base classes (Binary Tree vs Hash Chain)
+template< typename TRef >
 class CMatchFinderBinaryTree
 	: public CMatchFinder
 {
@@ -745,6 +930,11 @@ public:
 		return true;
 	}
 
+	virtual int32 GetRefSize() const override
+	{
+		return sizeof( TRef );
+	}
+
 	/**
 	 * @brief Finds matches at the current position using a binary tree and advances the position.
 	 *
@@ -761,7 +951,7 @@ public:
 
 		uint32 d2;
 		uint32 d3;
-		const uint32 current_match = CalcHash( &d2, &d3 );
+		const uint32 current_match = CalcHash<TRef>( &d2, &d3 );
 		const uint32 max_distance = std::min( CyclicBufferSize, Position );
 		uint32 max_length = 3u;
 
@@ -801,7 +991,7 @@ public:
 			}
 			else
 			{
-				const uint32 current_match = CalcHashSkip();
+				const uint32 current_match = CalcHashSkip<TRef>();
 				SkipMatchesSpec( current_match );
 
 				MovePos();
@@ -816,6 +1006,7 @@ private:
 		uint32 cut_value = CutValue;
 		uint32 match_count = 0u;
 
+		TRef* refs = GetRefs<TRef>();
 		const uint32 son_base = SonOffset;
 		uint32 son_index0 = ( CyclicBufferPosition << 1 ) + 1u;
 		uint32 son_index1 = ( CyclicBufferPosition << 1 );
@@ -835,8 +1026,8 @@ private:
 				const int64 history_offset = current_offset - delta;
 				uint32 length = ( length0 < length1 ) ? length0 : length1;
 
-				const uint32 pair0 = Hash[son_base + pair_idx];
-				const uint32 pair1 = Hash[son_base + pair_idx + 1];
+				const uint32 pair0 = refs[son_base + pair_idx];
+				const uint32 pair1 = refs[son_base + pair_idx + 1];
 
 				// Find the full match length
 				if( BufferBase[history_offset + length] == BufferBase[current_offset + length] )
@@ -857,8 +1048,8 @@ private:
 
 							if( length == LengthLimit )
 							{
-								Hash[son_base + son_index1] = pair0;
-								Hash[son_base + son_index0] = pair1;
+								refs[son_base + son_index1] = static_cast< TRef >( pair0 );
+								refs[son_base + son_index0] = static_cast< TRef >( pair1 );
 								return match_count;
 							}
 						}
@@ -868,8 +1059,8 @@ private:
 						// Skip mode
 						if( length == LengthLimit )
 						{
-							Hash[son_base + son_index1] = pair0;
-							Hash[son_base + son_index0] = pair1;
+							refs[son_base + son_index1] = static_cast< TRef >( pair0 );
+							refs[son_base + son_index0] = static_cast< TRef >( pair1 );
 							return match_count;
 						}
 					}
@@ -878,14 +1069,14 @@ private:
 				// Update binary tree pointers (same for both)
 				if( BufferBase[history_offset + length] < BufferBase[current_offset + length] )
 				{
-					Hash[son_base + son_index1] = currentMatch;
+					refs[son_base + son_index1] = static_cast< TRef >( currentMatch );
 					currentMatch = pair1;
 					son_index1 = pair_idx + 1;
 					length1 = length;
 				}
 				else
 				{
-					Hash[son_base + son_index0] = currentMatch;
+					refs[son_base + son_index0] = static_cast< TRef >( currentMatch );
 					currentMatch = pair0;
 					son_index0 = pair_idx;
 					length0 = length;
@@ -893,8 +1084,8 @@ private:
 			} while( --cut_value != 0 && cyclic_check < currentMatch );
 		}
 
-		Hash[son_base + son_index0] = 0u;
-		Hash[son_base + son_index1] = 0u;
+		refs[son_base + son_index0] = 0u;
+		refs[son_base + son_index1] = 0u;
 		return match_count;
 	}
 
@@ -905,27 +1096,40 @@ private:
 };
 
 
+template< typename TRef >
+static CMatchFinder* CreateMatchFinder( const bool useBinaryTree, MemoryInterface* alloc )
+{
+	CMatchFinder* match_finder = nullptr;
+	if( useBinaryTree )
+	{
+		match_finder = static_cast<CMatchFinderBinaryTree<TRef>*>( alloc->Alloc( sizeof( CMatchFinder ), "CRangeEnc::CMatchFinderBinaryTree" ) );
+		new ( match_finder ) CMatchFinderBinaryTree<TRef>( alloc );
+	}
+	else
+	{
+		match_finder = static_cast< CMatchFinderHashChain<TRef>* >( alloc->Alloc( sizeof( CMatchFinder ), "CRangeEnc::CMatchFinderHashChain" ) );
+		new ( match_finder ) CMatchFinderHashChain<TRef>( alloc );
+	}
+
+	return match_finder;
+}
+
 /**
  * @brief Factory function that constructs and returns a CMatchFinder instance.
  *
  * @param useBinaryTree If true, creates a binary-tree match finder;
  *                      otherwise creates a hash-chain match finder.
+ * @param historySize   Size of the history (dictionary) the match finder will be created with;
+ *                      small windows get a match finder with 16-bit references.
  * @param alloc         Memory allocator used for all internal allocations.
  * @return Pointer to the newly constructed CMatchFinder, or nullptr on allocation failure.
  */
-CMatchFinder* CreateMatchFinder( const bool useBinaryTree, MemoryInterface* alloc )
+CMatchFinder* CreateMatchFinder( const bool useBinaryTree, const uint32 historySize, MemoryInterface* alloc )
 {
-	CMatchFinder* match_finder = nullptr;
-	if( useBinaryTree )
+	if( CMatchFinder::UsesSmallRefs( historySize ) )
 	{
-		match_finder = static_cast<CMatchFinderBinaryTree*>( alloc->Alloc( sizeof( CMatchFinder ), "CRangeEnc::CMatchFinderBinaryTree" ) );
-		new ( match_finder ) CMatchFinderBinaryTree( alloc );
-	}
-	else
-	{
-		match_finder = static_cast< CMatchFinderHashChain* >( alloc->Alloc( sizeof( CMatchFinder ), "CRangeEnc::CMatchFinderHashChain" ) );
-		new ( match_finder ) CMatchFinderHashChain( alloc );
+		return CreateMatchFinder<CLzSmallRef>( useBinaryTree, alloc );
 	}
 
-	return match_finder;
+	return CreateMatchFinder<CLzRef>( useBinaryTree, alloc );
 }
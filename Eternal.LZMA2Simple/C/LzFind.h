@@ -5,6 +5,9 @@
 
 typedef uint32 CLzRef;
 
+/** Reference type used when every position in the window fits in 16 bits. */
+typedef uint16 CLzSmallRef;
+
 class CMatchFinder
 {
 public:
@@ -20,16 +23,25 @@ public:
 
 	void Free();
 	bool Create( const uint32 inHistorySize, const uint32 keepAddBufferBefore, const uint32 inMatchMaxLen, uint32 keepAddBufferAfter );
+	static int64 GetAllocationSize( const uint32 historySize, const int64 expectedDataSize, const bool binaryTree );
+	static int64 GetStreamBufferSize( const uint32 inHistorySize, const uint32 keepAddBufferBefore, const uint32 inMatchMaxLen, const uint32 keepAddBufferAfter );
+	static bool UsesSmallRefs( const uint32 historySize );
 	void Init();
 
 protected:
 	void CheckLimits();
 	void MovePos();
 	bool FindDistances( uint32* d2, const uint32 d3, const uint32 maxDistance, uint32* distancesContainer, uint32& matchCount ) const;
+	bool IsHash3Match( const uint32 d3, const uint32 maxDistance ) const;
 
 	uint32 UpdateMaxLen( const uint32 d2, const uint32 maxLength ) const;
-	uint32 CalcHash( uint32* d2, uint32* d3 ) const;
-	uint32 CalcHashSkip() const;
+	template< typename TRef > uint32 CalcHash( uint32* d2, uint32* d3 ) const;
+	template< typename TRef > uint32 CalcHashSkip() const;
+
+	template< typename TRef > TRef* GetRefs() const
+	{
+		return static_cast< TRef* >( Hash );
+	}
 
 private:
 	void FreeBuffer();
@@ -41,16 +53,21 @@ private:
 	void ReadBlock();
 	void MoveBlock();
 	bool NeedMove() const;
-	uint32 GetBlockSize( const uint32 historySize ) const;
+	static uint32 GetBlockSize( const uint32 historySize, const uint32 keepSizeBefore, const uint32 keepSizeAfter );
+	static uint32 GetHashMask( const uint32 historySize, const int64 expectedDataSize, const bool compactHash );
+	static uint32 GetHash3Mask( const uint32 hashMask, const bool compactHash );
+	static int64 GetNumRefs( const uint32 historySize, const int64 expectedDataSize, const bool binaryTree, const bool compactHash );
 	void SetLimits();
+	void Normalize();
 
-	uint32 HashCalcInternal( uint32* h2, uint32* h3, uint32* hv ) const;
+	template< typename TRef > uint32 HashCalcInternal( uint32* h2, uint32* h3, uint32* hv ) const;
 	// Keep hash update/skip as protected helpers
-	void HashUpdate( const uint32 h2, const uint32 h3, const uint32 hv, uint32* d2, uint32* d3 ) const;
-	void HashSkip( const uint32 h2, const uint32 h3, const uint32 hv ) const;
+	template< typename TRef > void HashUpdate( const uint32 h2, const uint32 h3, const uint32 hv, uint32* d2, uint32* d3 ) const;
+	template< typename TRef > void HashSkip( const uint32 h2, const uint32 h3, const uint32 hv ) const;
 
 public:
 	virtual bool IsBinaryTreeMode() const = 0;
+	virtual int32 GetRefSize() const = 0;
 	virtual void GetMatches( uint32* distances, uint32& pairCount ) = 0;
 	virtual void Skip( uint32 length ) = 0;
 
@@ -68,12 +85,19 @@ public:
 
 	bool DirectInput = false;
 
+	/* Size every hash table to the expected data instead of the 64K-entry minimum; changes the matches found */
+	bool CompactHash = false;
+
 protected:
 
 	MemoryInterface* Alloc = nullptr;
-	CLzRef* Hash = nullptr;
+	/* Hash tables followed by the sons; CLzRef or CLzSmallRef entries depending on GetRefSize() */
+	void* Hash = nullptr;
 	uint32 PositionLimit = 0;
 
+	/* Position at which the references are rebased; 0 lets Position run to the 32-bit wrap */
+	uint32 MaxPosition = 0;
+
 	/* wrap over Zero is allowed (StreamPosition < Position). Use ( uint32 )( StreamPosition - Position ) */
 	uint32 LengthLimit = 0;
 	uint32 CyclicBufferPosition = 0;
@@ -86,6 +110,7 @@ private:
 	uint32 MatchMaxLength = 0;
 	int64 NumRefs = 0;
 	uint32 HashMask = 0;
+	uint32 Hash3Mask = 0;
 	uint32 BlockSize = 0;
 	uint32 KeepSizeBefore = 0;
 	uint32 KeepSizeAfter = 0;
@@ -94,6 +119,7 @@ private:
 	uint32 HashSizeSum = 0;
 
 	bool StreamEndWasReached = false;
+	bool MirroredWindow = false;
 
 	static uint32 CrcLookupTable[256];
 };
@@ -103,4 +129,4 @@ private:
 	 keepAddBufferBefore + MatchMaxLength + keepAddBufferAfter < 511MB
 */
 
-CMatchFinder* CreateMatchFinder( const bool useBinaryTree, MemoryInterface* alloc );
+CMatchFinder* CreateMatchFinder( const bool useBinaryTree, const uint32 historySize, MemoryInterface* alloc );
@@ -93,7 +93,8 @@ Out:
  */
 void Lzma1Dec::UpdateWithDecompressed( const uint8* src, const int64 offset, const int64 size )
 {
-	memcpy( Dictionary + DictionaryPosition, src + offset, static_cast< uint64 >( size ) );
+	// The source can overlap the dictionary when decoding in place
+	memmove( Dictionary + DictionaryPosition, src + offset, static_cast< uint64 >( size ) );
 	DictionaryPosition += size;
 	if( ( CheckDictionarySize == 0u ) && ( DecoderProperties.DictionarySize - ProcessedPosition <= size ) )
 	{
@@ -1485,6 +1486,18 @@ void Lzma1Dec::FreeProbabilities()
 	}
 }
 
+/**
+ * @brief Returns the number of probabilities the decoder allocates for the given literal coder.
+ *
+ * @param literalContextBits  Number of literal context bits.
+ * @param literalPositionBits Number of literal position bits.
+ */
+uint32 Lzma1Dec::GetNumProbabilities( const uint8 literalContextBits, const uint8 literalPositionBits )
+{
+	return LzmaDecoder::IsRepeat + ( Lzma::NumStates * 4u ) + ( Lzma::NumLengthToPositionStates << Lzma::NumPositionSlotBits )
+		+ ( Lzma::LiteralSize << ( literalContextBits + literalPositionBits ) );
+}
+
 /**
  * @brief Allocates (or reuses) the probability table required for LZMA decoding.
  *
@@ -1495,8 +1508,7 @@ void Lzma1Dec::FreeProbabilities()
  */
 SevenZipResult Lzma1Dec::AllocateProbabilities()
 {
-	const uint32 num_probabilities = LzmaDecoder::IsRepeat + ( Lzma::NumStates * 4u ) + ( Lzma::NumLengthToPositionStates << Lzma::NumPositionSlotBits )
-		+ ( Lzma::LiteralSize << ( DecoderProperties.LiteralContextBits + DecoderProperties.LiteralPositionBits ) );
+	const uint32 num_probabilities = GetNumProbabilities( DecoderProperties.LiteralContextBits, DecoderProperties.LiteralPositionBits );
 	if( ( Probabilities == nullptr ) || ( num_probabilities != NumProbabilities ) )
 	{
 		FreeProbabilities();
@@ -1513,6 +1525,60 @@ SevenZipResult Lzma1Dec::AllocateProbabilities()
 	return SevenZipResult::SevenZipOK;
 }
 
+/**
+ * @brief Copies the range coder and model state into a checkpoint; the caller fills in the offsets and window.
+ *
+ * Only valid between DecodeToDict() calls that were given all their input, so nothing is held in the temporary buffer.
+ * The probabilities are copied into memory from the decoder's MemoryInterface, which Lzma1FreeCheckpoints() releases.
+ *
+ * @return SevenZipOK on success, SevenZipErrorMemory if allocation fails.
+ */
+SevenZipResult Lzma1Dec::SaveCheckpoint( CLzma1Checkpoint& checkpoint ) const
+{
+	checkpoint.Probabilities = static_cast< CProbability* >( Alloc->Alloc( NumProbabilities * sizeof( CProbability ), "CLzma1Checkpoint::Probabilities" ) );
+	if( checkpoint.Probabilities == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	checkpoint.NumProbabilities = NumProbabilities;
+	std::copy_n( Probabilities, NumProbabilities, checkpoint.Probabilities );
+	std::copy_n( RepeatDistances, Lzma::NumRepeats, checkpoint.RepeatDistances );
+	checkpoint.Range = Parameters.Range;
+	checkpoint.Code = Parameters.Code;
+	checkpoint.State = Parameters.State;
+	checkpoint.ProcessedPosition = ProcessedPosition;
+	checkpoint.CheckDictionarySize = CheckDictionarySize;
+	checkpoint.RemainingLength = RemainingLength;
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Restores the state saved by SaveCheckpoint(), after the properties are decoded and the probabilities allocated.
+ *
+ * The window must already be in the dictionary, ending at DictionaryPosition.
+ *
+ * @return SevenZipOK, or SevenZipErrorUnsupported if the checkpoint was taken with different literal coder properties.
+ */
+SevenZipResult Lzma1Dec::RestoreCheckpoint( const CLzma1Checkpoint& checkpoint )
+{
+	if( checkpoint.NumProbabilities != NumProbabilities || checkpoint.RemainingLength >= LzmaDecoder::MaxNormalMatchLength )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	std::copy_n( checkpoint.Probabilities, NumProbabilities, Probabilities );
+	std::copy_n( checkpoint.RepeatDistances, Lzma::NumRepeats, RepeatDistances );
+	Parameters.Range = checkpoint.Range;
+	Parameters.Code = checkpoint.Code;
+	Parameters.State = checkpoint.State;
+	ProcessedPosition = checkpoint.ProcessedPosition;
+	CheckDictionarySize = checkpoint.CheckDictionarySize;
+	RemainingLength = checkpoint.RemainingLength;
+	TempBufferSize = 0u;
+	return SevenZipResult::SevenZipOK;
+}
+
 /**
  * @brief Decompresses a complete LZMA1 stream in a single call.
  *
@@ -61,6 +61,9 @@ public:
 	void UpdateWithDecompressed( const uint8* src, const int64 offset, const int64 size );
 	SevenZipResult AllocateProbabilities();
 	void FreeProbabilities();
+	static uint32 GetNumProbabilities( const uint8 literalContextBits, const uint8 literalPositionBits );
+	SevenZipResult SaveCheckpoint( CLzma1Checkpoint& checkpoint ) const;
+	SevenZipResult RestoreCheckpoint( const CLzma1Checkpoint& checkpoint );
 
 	/**
 	 * LzmaDec_DecodeToDict
@@ -86,8 +89,8 @@ public:
 
 	CLzmaDecoderProperties DecoderProperties;
 	CProbability* Probabilities = nullptr;
-	int64 DictionaryBufferSize;
-	int64 DictionaryPosition;
+	int64 DictionaryBufferSize = 0;
+	int64 DictionaryPosition = 0;
 
 	uint32 PositionMask;
 	uint32 LiteralMask;
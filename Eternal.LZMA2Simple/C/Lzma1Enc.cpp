@@ -5,6 +5,8 @@
 #include "Lzma1Enc.h"
 #include "LzFind.h"
 
+#include <bit>
+
 #ifdef _DEBUG
 #ifdef _WINDOWS
 #define NOMINMAX
@@ -67,44 +69,6 @@ static uint8 GetBlockSizeFromPosition( const uint32 position )
 #endif
 }
 
-class CheckedSeqOutStream
-	: public OutStreamInterface
-{
-public:
-	CheckedSeqOutStream( uint8* dest, const int64 destOffset, const int64 destSize )
-	{
-		WorkBuffer = dest;
-		WorkBufferOffset = destOffset;
-		WorkBufferSize = destOffset + destSize;
-		Overflow = false;
-	}
-
-	virtual int64 Write( const uint8* data, const int64 offset, int64 size ) override
-	{
-		const int64 remaining = WorkBufferSize - WorkBufferOffset;
-		if( remaining < size )
-		{
-			size = remaining;
-			Overflow = true;
-		}
-
-		if( size != 0 )
-		{
-			memcpy( &WorkBuffer[WorkBufferOffset], &data[offset], static_cast<uint64>( size ) );
-			WorkBufferOffset += size;
-		}
-
-		return size;
-	}
-
-	bool Overflow = false;
-	int64 WorkBufferOffset = 0;
-
-private:
-	uint8* WorkBuffer = nullptr;
-	int64 WorkBufferSize = 0;
-};
-
 uint32 CLzmaEncoderProperties::GetDictionarySize() const
 {
 	uint32 dictionary_size = DictionarySize;
@@ -146,6 +110,81 @@ uint32 CLzmaEncoderProperties::GetDictionarySize() const
 	return dictionary_size;
 }
 
+/**
+ * @brief Returns the number of bytes the LZMA1 encoder allocates with these properties.
+ *
+ * @return The total of every allocation made through the MemoryInterface.
+ */
+int64 CLzmaEncoderProperties::EstimateEncoderMemory() const
+{
+	return EstimateLzmaEncoderMemory( 0u );
+}
+
+/**
+ * @brief Returns the number of bytes a LZMA1 encoder keeping keepWindowSize bytes of window allocates with these properties.
+ *
+ * Exact when encoding from memory with the data size equal to EstimatedSourceDataSize; an upper bound for smaller inputs.
+ * A filtered encode reads through a CFilterInStream, so it adds the group the filter is applied to and the input window
+ * the match finder reads the stream into.
+ *
+ * @param keepWindowSize Number of bytes at the start of the window the encoder preserves across Init calls.
+ * @return The total of every allocation made through the MemoryInterface.
+ */
+int64 CLzmaEncoderProperties::EstimateLzmaEncoderMemory( const uint32 keepWindowSize ) const
+{
+	const uint8 literal_context_bits = std::clamp<uint8>( LiteralContextBits, 0, Lzma::MaxLiteralContextBits );
+	const uint8 literal_position_bits = std::clamp<uint8>( LiteralPositionBits, 0, Lzma::MaxLiteralPositionBits );
+	const uint32 dictionary_size = GetDictionarySize();
+	int64 memory = Lzma1Enc::GetAllocationSize( dictionary_size, literal_context_bits + literal_position_bits, UsesBinaryTree() );
+
+	if( Filter != LzmaFilterType::LzmaFilterTypeNone )
+	{
+		// Before Normalize() the fast bytes are not known yet, so assume the most
+		const uint32 fast_bytes = ( FastBytes < 0 ) ? Lzma::MaxMatchLength : static_cast< uint32 >( std::clamp<int16>( FastBytes, Lzma::Lzma1MinMatchLength, Lzma::MaxMatchLength ) );
+		memory += LzmaFilter::GroupSize + Lzma1Enc::GetStreamWindowSize( dictionary_size, fast_bytes, keepWindowSize );
+	}
+
+	return memory;
+}
+
+/**
+ * @brief Returns the largest dictionary size below the given one that a LZMA2 header can describe exactly.
+ *
+ * @param dictionarySize Current dictionary size in bytes.
+ * @return The next smaller size of the form 2^n or 3 * 2^n.
+ */
+static uint32 GetSmallerDictionarySize( const uint32 dictionarySize )
+{
+	const uint32 power = std::bit_floor( dictionarySize - 1u );
+	const uint32 three_quarters = power + ( power >> 1 );
+	return ( three_quarters < dictionarySize ) ? three_quarters : power;
+}
+
+/**
+ * @brief Lowers the dictionary size until the encoder fits in MemoryBudget.
+ *
+ * @return SevenZipOK on success, SevenZipErrorMemory if even the smallest dictionary does not fit.
+ */
+SevenZipResult CLzmaEncoderProperties::ApplyMemoryBudget()
+{
+	if( MemoryBudget <= 0 )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	while( EstimateEncoderMemory() > MemoryBudget )
+	{
+		if( DictionarySize <= Lzma::MinDictionarySize )
+		{
+			return SevenZipResult::SevenZipErrorMemory;
+		}
+
+		DictionarySize = std::max( GetSmallerDictionarySize( DictionarySize ), Lzma::MinDictionarySize );
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
 /** Enforce the limits common to both Lzma1 and Lzma2. */
 SevenZipResult CLzmaEncoderProperties::Normalize()
 {
@@ -161,12 +200,21 @@ SevenZipResult CLzmaEncoderProperties::Normalize()
 		FastBytes = static_cast<int16>( ( CompressionLevel < 7 ) ? 32 : 64 );
 	}
 
-	return SevenZipResult::SevenZipOK;
+	if( CLzmaFilter::Validate( Filter, FilterParameter ) != SevenZipResult::SevenZipOK )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	return ApplyMemoryBudget();
 }
 
 SevenZipResult CLzma1EncoderProperties::Normalize()
 {
-	CLzmaEncoderProperties::Normalize();
+	const SevenZipResult result = CLzmaEncoderProperties::Normalize();
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
 
 	FastBytes = std::clamp<int16>( FastBytes, Lzma::Lzma1MinMatchLength, Lzma::MaxMatchLength );
 
@@ -195,23 +243,32 @@ void CLengthEncoder::Init()
 	}
 }
 
-void CRangeEncoder::FreeMemory()
+/**
+ * @brief Sets the buffer the encoded bytes are written to directly.
+ *
+ * @param output     Destination buffer.
+ * @param outputSize Capacity of the destination buffer in bytes.
+ */
+void CRangeEncoder::SetOutput( uint8* output, const int64 outputSize )
 {
-	if( RangeEncoderBuffer != nullptr )
-	{
-		Alloc->Free( RangeEncoderBuffer, LzmaEncoder::RangeEncoderBufferSize, "CRangeEncoder::RangeEncoderBuffer" );
-		RangeEncoderBuffer = nullptr;
-	}
+	Output = output;
+	OutputSize = outputSize;
 }
 
-uint8* CRangeEncoder::AllocateMemory()
+/**
+ * @brief Returns the number of bytes written to the destination buffer.
+ */
+int64 CRangeEncoder::GetOutputLength() const
 {
-	if( RangeEncoderBuffer == nullptr )
-	{
-		RangeEncoderBuffer = static_cast< uint8* >( Alloc->Alloc( LzmaEncoder::RangeEncoderBufferSize, "CRangeEncoder::RangeEncoderBuffer" ) );
-	}
+	return std::min( Processed + BufferOffset, OutputSize );
+}
 
-	return RangeEncoderBuffer;
+/**
+ * @brief Returns true if more bytes were encoded than fit in the destination buffer.
+ */
+bool CRangeEncoder::HasOverflowed() const
+{
+	return ( Processed + BufferOffset ) > OutputSize;
 }
 
 void CRangeEncoder::Init()
@@ -222,29 +279,43 @@ void CRangeEncoder::Init()
 	CacheSize = 0u;
 	BufferOffset = 0u;
 	Processed = 0u;
+	OutputBuffer = Output;
+	OutputBufferSize = OutputSize;
 	Result = SevenZipResult::SevenZipOK;
+
+	if( OutputBufferSize <= 0 )
+	{
+		// Every byte written overflows, so count them straight away
+		OutputBuffer = OverflowSink;
+		OutputBufferSize = LzmaEncoder::OverflowSinkSize;
+	}
 }
 
-void CRangeEncoder::FlushStream()
+/**
+ * @brief Called when OutputBuffer is full; later bytes are only counted, and the encoder is stopped once any are discarded.
+ */
+void CRangeEncoder::Overflow()
 {
-	if( Result == SevenZipResult::SevenZipOK )
+	if( OutputBuffer != OverflowSink )
 	{
-		if( BufferOffset != outStream->Write( RangeEncoderBuffer, 0, BufferOffset ) )
-		{
-			Result = SevenZipResult::SevenZipErrorWrite;
-		}
+		// The destination is exactly full, which is only an error if another byte follows
+		OutputBuffer = OverflowSink;
+		OutputBufferSize = LzmaEncoder::OverflowSinkSize;
+	}
+	else
+	{
+		Result = SevenZipResult::SevenZipErrorWrite;
 	}
 
 	Processed += BufferOffset;
 	BufferOffset = 0u;
 }
 
-
 void CRangeEncoder::CheckFlush()
 {
-	if( BufferOffset >= LzmaEncoder::RangeEncoderBufferSize )
+	if( BufferOffset >= OutputBufferSize )
 	{
-		FlushStream();
+		Overflow();
 	}
 }
 
@@ -255,7 +326,7 @@ void CRangeEncoder::ShiftLow()
 	Low = low32 << 8;
 	if( low32 < 0xFF000000u || high32 != 0u )
 	{
-		RangeEncoderBuffer[BufferOffset++] = static_cast< uint8 >( ( Cache + high32 ) & 0xff );
+		OutputBuffer[BufferOffset++] = static_cast< uint8 >( ( Cache + high32 ) & 0xff );
 		Cache = low32 >> 24;
 
 		CheckFlush();
@@ -266,7 +337,7 @@ void CRangeEncoder::ShiftLow()
 
 			do
 			{
-				RangeEncoderBuffer[BufferOffset++] = static_cast< uint8 >( high32 & 0xff );
+				OutputBuffer[BufferOffset++] = static_cast< uint8 >( high32 & 0xff );
 				CheckFlush();
 
 			} while( --CacheSize != 0u );
@@ -461,12 +532,45 @@ void CRangeEncoder::EncodeTreeAllOnes( CProbability* probabilities, int8 numBits
 	}
 }
 
+/**
+ * @brief Returns the history size the match finder is created with for a dictionary size.
+ *
+ * @param dictionarySize Dictionary size in bytes.
+ */
+static uint32 GetHistorySize( const uint32 dictionarySize )
+{
+	// Reduce by 1 to avoid 32-bit wraparound issues in decoder
+	if( dictionarySize == ( 2u << 30 ) || dictionarySize == ( 3u << 30 ) )
+	{
+		return dictionarySize - 1u;
+	}
+
+	return dictionarySize;
+}
+
+/**
+ * @brief Returns the bytes the match finder keeps before the dictionary window.
+ *
+ * @param historySize    History size from GetHistorySize().
+ * @param keepWindowSize Number of bytes at the start of the window to preserve across Init calls.
+ */
+static uint32 GetKeepBeforeSize( const uint32 historySize, const uint32 keepWindowSize )
+{
+	uint32 before_size = LzmaEncoder::NumOptimals;
+	if( before_size + historySize < keepWindowSize )
+	{
+		before_size = keepWindowSize - historySize;
+	}
+
+	return before_size;
+}
+
 Lzma1Enc::Lzma1Enc( const CLzmaEncoderProperties* encoderProperties, MemoryInterface* alloc, ProgressInterface* progress )
 	: Alloc( alloc )
 	, Progress( progress )
-	, RangeCoder( alloc )
 {
 	SavedState.LiteralProbabilities = nullptr;
+	memset( LiteralContextSaved, 0xff, sizeof( LiteralContextSaved ) );
 
 	DictionarySize = encoderProperties->DictionarySize;
 	FastBytes = static_cast< uint32 >( encoderProperties->FastBytes );
@@ -476,8 +580,7 @@ Lzma1Enc::Lzma1Enc( const CLzmaEncoderProperties* encoderProperties, MemoryInter
 	PositionBits = encoderProperties->PositionBits;
 	FastMode = ( encoderProperties->CompressionLevel < 5 );
 
-	const bool use_binary_tree = ( encoderProperties->CompressionLevel >= 5 );
-	MatchFinder = CreateMatchFinder( use_binary_tree, Alloc );
+	MatchFinder = CreateMatchFinder( encoderProperties->UsesBinaryTree(), GetHistorySize( DictionarySize ), Alloc );
 
 	MatchFinder->CutValue = encoderProperties->MatchCycles;
 	WriteEndMark = encoderProperties->WriteEndMark;
@@ -487,10 +590,10 @@ Lzma1Enc::~Lzma1Enc()
 {
 	FreeLits();
 
-	if( Optimals != nullptr )
+	if( Optimals.Price != nullptr )
 	{
-		Alloc->Free( Optimals, LzmaEncoder::NumOptimals * sizeof( COptimal ), "Lzma1Enc::Optimals" );
-		Optimals = nullptr;
+		Alloc->Free( Optimals.Price, LzmaEncoder::OptimalsSize, "Lzma1Enc::Optimals" );
+		Optimals = {};
 	}
 
 	if( MatchFinder != nullptr )
@@ -506,6 +609,9 @@ Lzma1Enc::~Lzma1Enc()
  *
  * Used by the LZMA2 encoder to allow fallback to copy-block mode when
  * LZMA compression does not achieve sufficient size reduction.
+ *
+ * The literal probabilities are saved lazily: each literal context is copied
+ * the first time it is about to be modified, so untouched contexts cost nothing.
  */
 void Lzma1Enc::SaveState()
 {
@@ -527,12 +633,14 @@ void Lzma1Enc::SaveState()
 	memcpy( dest->PositionSlotEncoder, PositionSlotEncoder, sizeof( PositionSlotEncoder ) );
 	memcpy( dest->PositionEncoders, PositionEncoders, sizeof( PositionEncoders ) );
 
-	uint32 prob_size = ( 0x300u << TotalLiteralBits ) * sizeof( CProbability );
-	memcpy( dest->LiteralProbabilities, LiteralProbabilities, prob_size );
+	const uint32 context_words = ( ( 1u << TotalLiteralBits ) + 63u ) >> 6;
+	memset( LiteralContextSaved, 0, context_words * sizeof( uint64 ) );
 }
 
 /**
  * @brief Restores the encoder probability state from the previously saved SavedState.
+ *
+ * Only the literal contexts that were modified since SaveState() are copied back.
  */
 void Lzma1Enc::RestoreState()
 {
@@ -554,8 +662,51 @@ void Lzma1Enc::RestoreState()
 	memcpy( PositionSlotEncoder, src->PositionSlotEncoder, sizeof( src->PositionSlotEncoder ) );
 	memcpy( PositionEncoders, src->PositionEncoders, sizeof( src->PositionEncoders ) );
 
-	uint32 prob_size = ( 0x300u << TotalLiteralBits ) * sizeof( CProbability );
-	memcpy( LiteralProbabilities, src->LiteralProbabilities, prob_size );
+	const uint32 num_contexts = 1u << TotalLiteralBits;
+	for( uint32 context = 0u; context < num_contexts; context++ )
+	{
+		if( ( LiteralContextSaved[context >> 6] & ( 1ull << ( context & 63u ) ) ) != 0u )
+		{
+			const uint32 offset = context * Lzma::LiteralSize;
+			memcpy( LiteralProbabilities + offset, src->LiteralProbabilities + offset, Lzma::LiteralSize * sizeof( CProbability ) );
+		}
+	}
+
+	memset( LiteralContextSaved, 0xff, sizeof( LiteralContextSaved ) );
+
+	MatchPricesValid = false;
+	RepeatLengthPricesValid = false;
+	StateIsInitial = false;
+}
+
+/**
+ * @brief Copies one literal context into SavedState if it has not been saved since SaveState().
+ *
+ * @param context Index of the literal context that is about to be modified.
+ */
+void Lzma1Enc::SaveLiteralContext( const uint32 context )
+{
+	uint64& saved = LiteralContextSaved[context >> 6];
+	const uint64 bit = 1ull << ( context & 63u );
+	if( ( saved & bit ) == 0u )
+	{
+		saved |= bit;
+
+		const uint32 offset = context * Lzma::LiteralSize;
+		memcpy( SavedState.LiteralProbabilities + offset, LiteralProbabilities + offset, Lzma::LiteralSize * sizeof( CProbability ) );
+	}
+}
+
+/**
+ * @brief Copies every literal context not yet saved into SavedState, before they are all overwritten.
+ */
+void Lzma1Enc::SaveLiteralContexts()
+{
+	const uint32 num_contexts = 1u << TotalLiteralBits;
+	for( uint32 context = 0u; context < num_contexts; context++ )
+	{
+		SaveLiteralContext( context );
+	}
 }
 
 /**
@@ -568,6 +719,20 @@ void Lzma1Enc::SetDataSize( int64 expectedDataSize ) const
 	MatchFinder->ExpectedDataSize = expectedDataSize;
 }
 
+/**
+ * @brief Sizes the match-finder hash tables to the data rather than to the 64K-entry minimum.
+ *
+ * Makes setup cheaper for small inputs, but the matches found and so the compressed output can differ.
+ * Must be called before the encoder is prepared.
+ */
+void Lzma1Enc::UseCompactHash() const
+{
+	MatchFinder->CompactHash = true;
+}
+
+// Literal prices are walked each time rather than cached per context. Every encoded literal changes its context's probabilities,
+// so a 256-entry table is only read 2 to 12 times before it is stale, against the ~32 reads needed to repay building it.
+// Memoising single entries was no faster either; literal pricing is only 2-6% of encode time.
 uint32 Lzma1Enc::GetPrice( const uint32 literalContext, uint32 symbol ) const
 {
 	const uint32 base_offset = 3u * ( literalContext << LiteralContextBits );
@@ -620,6 +785,46 @@ void Lzma1Enc::SetPrices( const CProbability* baseArray, const uint32 baseOffset
 	}
 }
 
+/**
+ * @brief Prices the first numPairs symbol pairs of a bit tree.
+ *
+ * Path prices are accumulated one tree level at a time, so each internal node is priced once
+ * instead of once per symbol below it. The sums are identical to walking each symbol to the root.
+ *
+ * @param probabilities Bit-tree probabilities, indexed from node 1.
+ * @param numBits       Depth of the tree.
+ * @param numPairs      Number of symbol pairs to price, starting from symbol 0.
+ * @param startPrice    Price added to every symbol.
+ * @param prices        Output array receiving numPairs * 2 prices.
+ */
+void Lzma1Enc::FillTreePairPrices( const CProbability* probabilities, const int8 numBits, const uint32 numPairs, const uint32 startPrice, uint32* prices )
+{
+	uint32 node_prices[1u << Lzma::LengthEncoderNumHighBits];
+	const int8 pair_level = static_cast<int8>( numBits - 1 );
+
+	node_prices[1] = startPrice;
+	for( int8 level = 1; level <= pair_level; level++ )
+	{
+		// Only visit nodes that lead to one of the requested pairs
+		const uint32 first_node = 1u << level;
+		const uint32 last_node = first_node + ( ( numPairs - 1u ) >> ( pair_level - level ) );
+		for( uint32 node = first_node; node <= last_node; node++ )
+		{
+			const uint32 xor_value = ( 0u - ( node & 1u ) ) & Lzma::BitModelTableMask;
+			node_prices[node] = node_prices[node >> 1] + ProbabilityPrices[( probabilities[node >> 1] ^ xor_value ) >> LzmaEncoder::NumMoveReducingBits];
+		}
+	}
+
+	const uint32 first_pair = 1u << pair_level;
+	for( uint32 pair = 0u; pair < numPairs; pair++ )
+	{
+		const uint32 price = node_prices[first_pair + pair];
+		const uint32 probability = probabilities[first_pair + pair];
+		prices[pair << 1] = price + ProbabilityPrices[probability >> LzmaEncoder::NumMoveReducingBits];
+		prices[( pair << 1 ) + 1u] = price + ProbabilityPrices[( probability ^ Lzma::BitModelTableMask ) >> LzmaEncoder::NumMoveReducingBits];
+	}
+}
+
 void Lzma1Enc::UpdateTables( CLengthPriceEncoder* lpe, const uint32 numPosStates, const CLengthEncoder* le )
 {
 	DebugPrint( "---UpdateTables" );
@@ -638,27 +843,11 @@ void Lzma1Enc::UpdateTables( CLengthPriceEncoder* lpe, const uint32 numPosStates
 
 	if( table_size > Lzma::LengthEncoderNumLowSymbols * 2u )
 	{
-		uint32 price_offset = Lzma::LengthEncoderNumLowSymbols << 1;
+		const uint32 price_offset = Lzma::LengthEncoderNumLowSymbols << 1;
 		table_size -= ( Lzma::LengthEncoderNumLowSymbols << 1 ) - 1u;
 		table_size >>= 1;
 		b += ProbabilityPrices[( le->Low[Lzma::LengthEncoderNumLowSymbols] ^ Lzma::BitModelTableMask ) >> LzmaEncoder::NumMoveReducingBits];
-		do
-		{
-			uint32 symbol = --table_size + ( 1u << ( Lzma::LengthEncoderNumHighBits - 1 ) );
-			uint32 price = b;
-			do
-			{
-				const uint32 bit = symbol & 1u;
-				symbol >>= 1;
-				const uint32 xor_value = ( 0u - bit ) & Lzma::BitModelTableMask;
-				uint32 price_index = le->High[symbol] ^ xor_value;
-				price += ProbabilityPrices[price_index >> LzmaEncoder::NumMoveReducingBits];
-			} while( symbol >= 2 );
-
-			probability = le->High[table_size + ( 1u << ( Lzma::LengthEncoderNumHighBits - 1 ) )];
-			lpe->Prices[0][price_offset + ( table_size << 1 )] = price + ProbabilityPrices[probability >> LzmaEncoder::NumMoveReducingBits];
-			lpe->Prices[0][price_offset + ( table_size << 1 ) + 1u] = price + ProbabilityPrices[( probability ^ Lzma::BitModelTableMask ) >> LzmaEncoder::NumMoveReducingBits];
-		} while( table_size != 0 );
+		FillTreePairPrices( le->High, Lzma::LengthEncoderNumHighBits, table_size, b, lpe->Prices[0] + price_offset );
 
 		DebugPrint( "Update Tables: %d, %d, %d", lpe->Prices[0][0], lpe->Prices[0][1], lpe->Prices[0][2] );
 
@@ -750,38 +939,38 @@ uint32 Lzma1Enc::Backward( uint32 cur )
 
 	while( cur != 0u )
 	{
-		distance = Optimals[cur].Distance;
-		length = Optimals[cur].Length;
+		distance = Optimals.Distance[cur];
+		length = Optimals.Length[cur];
 
-		const uint32 extra = Optimals[cur].Extra;
+		const uint32 extra = Optimals.Extra[cur];
 		cur -= length;
 
 		if( extra != 0u )
 		{
 			wr--;
-			Optimals[wr].Length = length;
+			Optimals.Length[wr] = length;
 			cur -= extra;
 			length = extra;
 			if( extra == 1u )
 			{
-				Optimals[wr].Distance = distance;
+				Optimals.Distance[wr] = distance;
 				distance = LzmaEncoder::MarkLiteral;
 			}
 			else
 			{
-				Optimals[wr].Distance = 0u;
+				Optimals.Distance[wr] = 0u;
 				length--;
 				wr--;
-				Optimals[wr].Distance = LzmaEncoder::MarkLiteral;
-				Optimals[wr].Length = 1u;
+				Optimals.Distance[wr] = LzmaEncoder::MarkLiteral;
+				Optimals.Length[wr] = 1u;
 			}
 		}
 
 		if( cur != 0u )
 		{
 			wr--;
-			Optimals[wr].Distance = distance;
-			Optimals[wr].Length = length;
+			Optimals.Distance[wr] = distance;
+			Optimals.Length[wr] = length;
 		}
 	}
 
@@ -797,11 +986,11 @@ bool Lzma1Enc::GetBestPrice( uint32& curRef, const uint32 last )
 	if( cur >= LzmaEncoder::NumOptimals - 64 )
 	{
 		DebugPrint( "---GetBestPrice" );
-		uint32 price = Optimals[cur].Price;
+		uint32 price = Optimals.Price[cur];
 		uint32 best = cur;
 		for( uint32 price_index = cur + 1; price_index <= last; price_index++ )
 	{
-			const uint32 price2 = Optimals[price_index].Price;
+			const uint32 price2 = Optimals.Price[price_index];
 			if( price >= price2 )
 			{
 				price = price2;
@@ -830,34 +1019,34 @@ void Lzma1Enc::GetOptimalRepeats( uint32* repeats, const uint32 previous, const
 	{
 		if( distance == 0 )
 		{
-			repeats[0] = Optimals[previous].Repeats[0];
-			repeats[1] = Optimals[previous].Repeats[1];
-			repeats[2] = Optimals[previous].Repeats[2];
-			repeats[3] = Optimals[previous].Repeats[3];
+			repeats[0] = Optimals.Repeats[previous][0];
+			repeats[1] = Optimals.Repeats[previous][1];
+			repeats[2] = Optimals.Repeats[previous][2];
+			repeats[3] = Optimals.Repeats[previous][3];
 		}
 		else
 		{
-			repeats[1] = Optimals[previous].Repeats[0];
+			repeats[1] = Optimals.Repeats[previous][0];
 			if( distance == 1 )
 			{
-				repeats[0] = Optimals[previous].Repeats[1];
-				repeats[2] = Optimals[previous].Repeats[2];
-				repeats[3] = Optimals[previous].Repeats[3];
+				repeats[0] = Optimals.Repeats[previous][1];
+				repeats[2] = Optimals.Repeats[previous][2];
+				repeats[3] = Optimals.Repeats[previous][3];
 			}
 			else
 			{
-				repeats[2] = Optimals[previous].Repeats[1];
-				repeats[0] = Optimals[previous].Repeats[distance];
-				repeats[3] = Optimals[previous].Repeats[distance ^ 1];
+				repeats[2] = Optimals.Repeats[previous][1];
+				repeats[0] = Optimals.Repeats[previous][distance];
+				repeats[3] = Optimals.Repeats[previous][distance ^ 1];
 			}
 		}
 	}
 	else
 	{
 		repeats[0] = distance - Lzma::NumRepeats + 1;
-		repeats[1] = Optimals[previous].Repeats[0];
-		repeats[2] = Optimals[previous].Repeats[1];
-		repeats[3] = Optimals[previous].Repeats[2];
+		repeats[1] = Optimals.Repeats[previous][0];
+		repeats[2] = Optimals.Repeats[previous][1];
+		repeats[3] = Optimals.Repeats[previous][2];
 	}
 }
 
@@ -930,7 +1119,7 @@ uint32 Lzma1Enc::CheckFastMatches( const uint32 mainLength, const uint32 pairCou
 void Lzma1Enc::InitFirstOptimal( const uint32 position, const int64 dataOffset, const uint32 curByte, const uint32 matchByte, const uint32 positionState ) const
 {
 	// Set initial state
-	Optimals[0].State = static_cast<CState>( State );
+	Optimals.State[0] = static_cast<CState>( State );
 
 	// Calculate literal context and get probability array
 	const uint32 literal_context = ( ( position << 8 ) + MatchFinder->BufferBase[dataOffset - 1] ) & LiteralMask;
@@ -939,12 +1128,12 @@ void Lzma1Enc::InitFirstOptimal( const uint32 position, const int64 dataOffset,
 	const uint32 literal_price = ( State >= 7u ) ? MatchedGetPrice( literal_context, curByte, matchByte ) : GetPrice( literal_context, curByte );
 
 	// Initialize first optimal with literal cost
-	Optimals[1].Price = ProbabilityPrices[IsMatch[State][positionState] >> LzmaEncoder::NumMoveReducingBits] + literal_price;
-	Optimals[1].Distance = LzmaEncoder::MarkLiteral;
-	Optimals[1].Extra = 0;
-	Optimals[1].Length = 1u;
+	Optimals.Price[1] = ProbabilityPrices[IsMatch[State][positionState] >> LzmaEncoder::NumMoveReducingBits] + literal_price;
+	Optimals.Distance[1] = LzmaEncoder::MarkLiteral;
+	Optimals.Extra[1] = 0;
+	Optimals.Length[1] = 1u;
 
-	DebugPrint( "InitFirstOptimal: %d", Optimals[1].Price );
+	DebugPrint( "InitFirstOptimal: %d", Optimals.Price[1] );
 }
 
 // Try short repeat (REP0 with length 1)
@@ -964,19 +1153,19 @@ void Lzma1Enc::TryShortRepeat( const uint32 curByte, const uint32 matchByte, con
 		ProbabilityPrices[IsRep0Long[State][positionState] >> LzmaEncoder::NumMoveReducingBits];
 
 	// Update optimal if this is better
-	if( short_repeat_price < Optimals[1].Price )
+	if( short_repeat_price < Optimals.Price[1] )
 	{
 		DebugPrint( "ShortRepeatPrice: %d", short_repeat_price );
 
-		Optimals[1].Price = short_repeat_price;
-		Optimals[1].Distance = 0u;
-		Optimals[1].Extra = 0;
+		Optimals.Price[1] = short_repeat_price;
+		Optimals.Distance[1] = 0u;
+		Optimals.Extra[1] = 0;
 	}
 
 	// Early exit if we should use this result immediately
 	if( last < 2u )
 	{
-		BackRes = Optimals[1].Distance;
+		BackRes = Optimals.Distance[1];
 		last = 1u;
 	}
 }
@@ -1001,14 +1190,14 @@ void Lzma1Enc::ProcessRepeatMatches( const uint32* repLens, const uint32 repeatM
 		for( uint32 length = repeat_length; length >= 2u; length-- )
 		{
 			const uint32 price = base_price + RepeatLenEnc.Prices[positionState][length - Lzma::Lzma1MinMatchLength];
-			if( price < Optimals[length].Price )
+			if( price < Optimals.Price[length] )
 			{
 				DebugPrint( "ProcessRepeatMatchesPrice: %d", price );
 				
-				Optimals[length].Price = price;
-				Optimals[length].Length = length;
-				Optimals[length].Distance = distance;
-				Optimals[length].Extra = 0;
+				Optimals.Price[length] = price;
+				Optimals.Length[length] = length;
+				Optimals.Distance[length] = distance;
+				Optimals.Extra[length] = 0;
 			}
 		}
 	}
@@ -1068,13 +1257,13 @@ void Lzma1Enc::ProcessMainMatches( const uint32 mainLength, const uint32 pairCou
 		}
 
 		// Update optimal if this is better
-		if( price < Optimals[length].Price )
+		if( price < Optimals.Price[length] )
 		{
 			DebugPrint( "ProcessMainMatches: %d", price );
-			Optimals[length].Price = price;
-			Optimals[length].Length = length;
-			Optimals[length].Distance = distance + Lzma::NumRepeats;
-			Optimals[length].Extra = 0;
+			Optimals.Price[length] = price;
+			Optimals.Length[length] = length;
+			Optimals.Distance[length] = distance + Lzma::NumRepeats;
+			Optimals.Extra[length] = 0;
 		}
 
 		// Check if we've processed all matches
@@ -1138,14 +1327,14 @@ void Lzma1Enc::TryLiteralRep0( const uint32 cur, uint32& last, const bool nextIs
 	const uint32 final_price = price + RepeatLenEnc.Prices[position_state2][length - 1u - Lzma::Lzma1MinMatchLength];
 
 	// Update optimal if this is better
-	if( final_price < Optimals[offset].Price )
+	if( final_price < Optimals.Price[offset] )
 	{
 		DebugPrint( "TryLiteralRep: %d", final_price );
 
-		Optimals[offset].Price = final_price;
-		Optimals[offset].Length = length - 1u;
-		Optimals[offset].Distance = 0u;
-		Optimals[offset].Extra = 1;
+		Optimals.Price[offset] = final_price;
+		Optimals.Length[offset] = length - 1u;
+		Optimals.Distance[offset] = 0u;
+		Optimals.Extra[offset] = 1;
 	}
 }
 
@@ -1207,13 +1396,13 @@ void Lzma1Enc::TryRepLitRep0( const uint32 cur, uint32& last, const uint32 repIn
 	const uint32 final_price = price + RepeatLenEnc.Prices[final_position_state][repeat0_length - 1u - Lzma::Lzma1MinMatchLength];
 
 	// Update optimal if this is better
-	if( final_price < Optimals[offset].Price )
+	if( final_price < Optimals.Price[offset] )
 	{
 		DebugPrint( "TryRepLitRep: %d", final_price );
-		Optimals[offset].Price = final_price;
-		Optimals[offset].Length = repeat0_length - 1u;
-		Optimals[offset].Extra = static_cast<CExtra>( length + 1u );
-		Optimals[offset].Distance = repIndex;
+		Optimals.Price[offset] = final_price;
+		Optimals.Length[offset] = repeat0_length - 1u;
+		Optimals.Extra[offset] = static_cast<CExtra>( length + 1u );
+		Optimals.Distance[offset] = repIndex;
 	}
 }
 
@@ -1251,13 +1440,13 @@ void Lzma1Enc::ProcessRepeatsInLoop( const uint32 cur, uint32& last, uint32& sta
 		for( uint32 length = match_length; length >= 2u; length-- )
 		{
 			const uint32 price = base_price + RepeatLenEnc.Prices[PositionState][length - Lzma::Lzma1MinMatchLength];
-			if( price < Optimals[cur + length].Price )
+			if( price < Optimals.Price[cur + length] )
 			{
 				DebugPrint( "ProcessRepeatsInLoop: %d", price );
-				Optimals[cur + length].Price = price;
-				Optimals[cur + length].Length = length;
-				Optimals[cur + length].Distance = repeat_index;
-				Optimals[cur + length].Extra = 0;
+				Optimals.Price[cur + length] = price;
+				Optimals.Length[cur + length] = length;
+				Optimals.Distance[cur + length] = repeat_index;
+				Optimals.Extra[cur + length] = 0;
 			}
 		}
 
@@ -1333,13 +1522,13 @@ void Lzma1Enc::TryMatchLitRep0( const uint32 cur, uint32& last, const uint32 mat
 	const uint32 final_price = price + RepeatLenEnc.Prices[final_position_state][rep0_length - 1u - Lzma::Lzma1MinMatchLength];
 
 	// Update optimal if this is better
-	if( final_price < Optimals[end_position].Price )
+	if( final_price < Optimals.Price[end_position] )
 	{
 		DebugPrint( "TryMatchLitRep: %d", final_price );
-		Optimals[end_position].Price = final_price;
-		Optimals[end_position].Length = rep0_length - 1u;
-		Optimals[end_position].Extra = static_cast<CExtra>( matchLength + 1u );
-		Optimals[end_position].Distance = matchDistance + Lzma::NumRepeats;
+		Optimals.Price[end_position] = final_price;
+		Optimals.Length[end_position] = rep0_length - 1u;
+		Optimals.Extra[end_position] = static_cast<CExtra>( matchLength + 1u );
+		Optimals.Distance[end_position] = matchDistance + Lzma::NumRepeats;
 	}
 }
 
@@ -1393,13 +1582,13 @@ void Lzma1Enc::ProcessMainMatchesInLoop( const uint32 cur, uint32& last, const u
 		}
 
 		// Update optimal if this is better
-		if( price < Optimals[cur + match_length].Price )
+		if( price < Optimals.Price[cur + match_length] )
 		{
 			DebugPrint( "ProcessMainMatchesInLoop: %d", price );
-			Optimals[cur + match_length].Price = price;
-			Optimals[cur + match_length].Length = match_length;
-			Optimals[cur + match_length].Distance = match_distance + Lzma::NumRepeats;
-			Optimals[cur + match_length].Extra = 0;
+			Optimals.Price[cur + match_length] = price;
+			Optimals.Length[cur + match_length] = match_length;
+			Optimals.Distance[cur + match_length] = match_distance + Lzma::NumRepeats;
+			Optimals.Extra[cur + match_length] = 0;
 		}
 
 		// Check if we've reached a match boundary
@@ -1497,10 +1686,10 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 	}
 
 	// Copy initial repeat distances
-	Optimals[0].Repeats[0] = reps[0];
-	Optimals[0].Repeats[1] = reps[1];
-	Optimals[0].Repeats[2] = reps[2];
-	Optimals[0].Repeats[3] = reps[3];
+	Optimals.Repeats[0][0] = reps[0];
+	Optimals.Repeats[0][1] = reps[1];
+	Optimals.Repeats[0][2] = reps[2];
+	Optimals.Repeats[0][3] = reps[3];
 
 	// Process initial repeat matches
 	ProcessRepeatMatches( repeat_lengths, repeat_match_price, position_state );
@@ -1533,32 +1722,32 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 		// Process current position
 		position++;
 
-		const uint32 prev = cur - Optimals[cur].Length;
+		const uint32 prev = cur - Optimals.Length[cur];
 		uint32 state;
 
 		// Determine state based on previous optimal
-		if( Optimals[cur].Length == 1u )
+		if( Optimals.Length[cur] == 1u )
 		{
-			state = Optimals[prev].State;
-			state = ( Optimals[cur].Distance == 0u ) ? Lzma::ShortRepNextStateLut[state] : Lzma::LiteralNextStateLut[state];
+			state = Optimals.State[prev];
+			state = ( Optimals.Distance[cur] == 0u ) ? Lzma::ShortRepNextStateLut[state] : Lzma::LiteralNextStateLut[state];
 		}
 		else
 		{
-			const uint32 dist = Optimals[cur].Distance;
+			const uint32 dist = Optimals.Distance[cur];
 			uint32 adjusted_prev = prev;
 
-			if( Optimals[cur].Extra != 0 )
+			if( Optimals.Extra[cur] != 0 )
 			{
-				adjusted_prev -= Optimals[cur].Extra;
+				adjusted_prev -= Optimals.Extra[cur];
 				state = LzmaEncoder::EncodeStateRepeatAfterLiteral;
-				if( Optimals[cur].Extra == 1u )
+				if( Optimals.Extra[cur] == 1u )
 				{
 					state = ( dist < Lzma::NumRepeats ) ? LzmaEncoder::EncodeStateRepeatAfterLiteral : LzmaEncoder::EncodeStateMatchAfterLiteral;
 				}
 			}
 			else
 			{
-				state = Optimals[adjusted_prev].State;
+				state = Optimals.State[adjusted_prev];
 				state = ( dist < Lzma::NumRepeats ) ? Lzma::RepNextStateLut[state] : Lzma::MatchNextStateLut[state];
 			}
 
@@ -1566,11 +1755,11 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 		}
 
 		// Update current optimal's state and reps
-		Optimals[cur].State = static_cast<CState>( state );
-		Optimals[cur].Repeats[0] = reps[0];
-		Optimals[cur].Repeats[1] = reps[1];
-		Optimals[cur].Repeats[2] = reps[2];
-		Optimals[cur].Repeats[3] = reps[3];
+		Optimals.State[cur] = static_cast<CState>( state );
+		Optimals.Repeats[cur][0] = reps[0];
+		Optimals.Repeats[cur][1] = reps[1];
+		Optimals.Repeats[cur][2] = reps[2];
+		Optimals.Repeats[cur][3] = reps[3];
 
 		// Update context
 		Position = position;
@@ -1582,7 +1771,7 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 		const uint8 match_byte2 = MatchFinder->BufferBase[MatchFinder->BufferOffset - reps[0] - 1u];
 
 		// Calculate prices for current position
-		const uint32 current_price = Optimals[cur].Price;
+		const uint32 current_price = Optimals.Price[cur];
 		const uint32 prob = IsMatch[state][PositionState];
 		MatchPrice = current_price + ProbabilityPrices[( prob ^ Lzma::BitModelTableMask ) >> LzmaEncoder::NumMoveReducingBits];
 		uint32 literal_price = current_price + ProbabilityPrices[prob >> LzmaEncoder::NumMoveReducingBits];
@@ -1590,7 +1779,7 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 		bool next_is_literal = false;
 
 		// Try literal
-		if( ( Optimals[cur + 1u].Price < LzmaEncoder::InfinityPrice && match_byte2 == current_byte2 ) || literal_price > Optimals[cur + 1u].Price )
+		if( ( Optimals.Price[cur + 1u] < LzmaEncoder::InfinityPrice && match_byte2 == current_byte2 ) || literal_price > Optimals.Price[cur + 1u] )
 		{
 			literal_price = 0u;
 		}
@@ -1601,12 +1790,12 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 				MatchedGetPrice( literal_context, current_byte2, match_byte2 ) :
 				GetPrice( literal_context, current_byte2 );
 
-			if( literal_price < Optimals[cur + 1u].Price )
+			if( literal_price < Optimals.Price[cur + 1u] )
 			{
-				Optimals[cur + 1u].Price = literal_price;
-				Optimals[cur + 1u].Length = 1u;
-				Optimals[cur + 1u].Distance = LzmaEncoder::MarkLiteral;
-				Optimals[cur + 1u].Extra = 0;
+				Optimals.Price[cur + 1u] = literal_price;
+				Optimals.Length[cur + 1u] = 1u;
+				Optimals.Distance[cur + 1u] = LzmaEncoder::MarkLiteral;
+				Optimals.Extra[cur + 1u] = 0;
 				next_is_literal = true;
 
 				DebugPrint( "Write literal optimal: %d", literal_price );
@@ -1619,20 +1808,20 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 		const uint32 num_avail_full = std::min( NumAvail, LzmaEncoder::NumOptimals - 1u - cur );
 
 		// Try short repeat at current position
-		if( state < 7u && match_byte2 == current_byte2 && RepeatMatchPrice < Optimals[cur + 1u].Price )
+		if( state < 7u && match_byte2 == current_byte2 && RepeatMatchPrice < Optimals.Price[cur + 1u] )
 		{
-			if( Optimals[cur + 1u].Length < 2u || Optimals[cur + 1u].Distance != 0u )
+			if( Optimals.Length[cur + 1u] < 2u || Optimals.Distance[cur + 1u] != 0u )
 			{
 				const uint32 short_repeat_price = RepeatMatchPrice +
 												  ProbabilityPrices[IsRepG0[state] >> LzmaEncoder::NumMoveReducingBits] +
 												  ProbabilityPrices[IsRep0Long[state][PositionState] >> LzmaEncoder::NumMoveReducingBits];
 
-				if( short_repeat_price < Optimals[cur + 1u].Price )
+				if( short_repeat_price < Optimals.Price[cur + 1u] )
 				{
-					Optimals[cur + 1u].Price = short_repeat_price;
-					Optimals[cur + 1u].Length = 1u;
-					Optimals[cur + 1u].Distance = 0u;
-					Optimals[cur + 1u].Extra = 0;
+					Optimals.Price[cur + 1u] = short_repeat_price;
+					Optimals.Length[cur + 1u] = 1u;
+					Optimals.Distance[cur + 1u] = 0u;
+					Optimals.Extra[cur + 1u] = 0;
 					next_is_literal = false;
 
 					DebugPrint( "Write non-literal optimal: %d", short_repeat_price );
@@ -1672,7 +1861,7 @@ uint32 Lzma1Enc::GetOptimum( uint32 position )
 	// Reset infinity prices
 	do
 	{
-		Optimals[last].Price = LzmaEncoder::InfinityPrice;
+		Optimals.Price[last] = LzmaEncoder::InfinityPrice;
 	} while( --last != 0u );
 
 	return Backward( cur );
@@ -1879,6 +2068,7 @@ void Lzma1Enc::WriteEndMarker( uint32 posState )
 
 	// Update state to match state
 	State = Lzma::MatchNextStateLut[State];
+	MatchPricesValid = false;
 
 	// Encode match length = 0 (minimum length, which signals end marker)
 	RangeCoder.LengthEncode( LengthProbabilities, 0u, posState );
@@ -1933,7 +2123,6 @@ void Lzma1Enc::Flush( uint32 nowPos )
 	}
 
 	RangeCoder.FlushData();
-	RangeCoder.FlushStream();
 }
 
 // Helper function to calculate price for encoding a symbol through binary tree
@@ -1977,25 +2166,6 @@ uint32 Lzma1Enc::GetPositionModelPrice( const uint32 positionIndex, const uint32
 	return price;
 }
 
-uint32 Lzma1Enc::CalcTreeDistancePrice( uint32 lps, uint32 symbol ) const
-{
-	const CProbability* probabilities = PositionSlotEncoder[lps];
-	uint32 price = 0u;
-	// Start from tree root
-	symbol += ( 1u << ( Lzma::NumPositionSlotBits - 1 ) );
-
-	for ( uint32 count = 0; count < Lzma::NumPositionSlotBits - 1; count++ )
-	{
-		const uint32 bit = symbol & 1u;
-		symbol >>= 1;
-		const uint32 xor_value = ( 0u - bit ) & Lzma::BitModelTableMask;
-		const uint32 price_index = probabilities[symbol] ^ xor_value;
-		price += ProbabilityPrices[price_index >> LzmaEncoder::NumMoveReducingBits];
-	}
-
-	return price;
-}
-
 void Lzma1Enc::FillAlignPrices()
 {
 	DebugPrint( "---FillAlignPrices" );
@@ -2047,14 +2217,7 @@ void Lzma1Enc::FillDistancesPrices()
 		uint32* pos_slot_prices = PositionSlotPrices[lps];
 
 		// Calculate position slot prices (6-bit encoding)
-		for( uint32 slot = 0u; slot < dist_table_size; slot++ )
-		{
-			const uint32 price = CalcTreeDistancePrice( lps, slot );
-			const uint32 probability = PositionSlotEncoder[lps][slot + ( 1u << ( Lzma::NumPositionSlotBits - 1 ) )];
-
-			pos_slot_prices[slot << 1] = price + ProbabilityPrices[probability >> LzmaEncoder::NumMoveReducingBits];
-			pos_slot_prices[( slot << 1 ) + 1u] = price + ProbabilityPrices[( probability ^ Lzma::BitModelTableMask ) >> LzmaEncoder::NumMoveReducingBits];
-		}
+		FillTreePairPrices( PositionSlotEncoder[lps], Lzma::NumPositionSlotBits, dist_table_size, 0u, pos_slot_prices );
 
 		// Add delta for slots beyond position model range (aligned distances)
 		uint32 delta = ( ( Lzma::EndPositionModelIndex / 2u - 1u ) - Lzma::NumAlignmentBits ) << LzmaEncoder::NumBitPriceShiftBits;
@@ -2109,6 +2272,8 @@ void Lzma1Enc::Lit( const uint32 nowPos32 )
 	const uint32 prob_offset = 3u * ( work << LiteralContextBits );
 	uint32 state = State;
 	State = Lzma::LiteralNextStateLut[State];
+
+	SaveLiteralContext( prob_offset / Lzma::LiteralSize );
 	if( state < 7 )
 	{
 		RangeCoder.Encode( LiteralProbabilities, prob_offset, MatchFinder->BufferBase[data_offset] );
@@ -2135,8 +2300,8 @@ uint32 Lzma1Enc::GetLength( uint32 nowPos32 )
 		}
 		else
 		{
-			length = Optimals[oci].Length;
-			BackRes = Optimals[oci].Distance;
+			length = Optimals.Length[oci];
+			BackRes = Optimals.Distance[oci];
 			OptimalCurrent = oci + 1;
 		}
 	}
@@ -2158,6 +2323,7 @@ uint32 Lzma1Enc::LiteralBit( CRangeEncoder& re )
 		ReadMatchDistances( pair_count );
 		re.EncodeBit0( IsMatch[LzmaEncoder::EncodeStateStart][0] );
 		uint8 current_byte = MatchFinder->BufferBase[MatchFinder->BufferOffset - AdditionalOffset];
+		SaveLiteralContext( 0u );
 		re.Encode( LiteralProbabilities, 0, current_byte );
 		AdditionalOffset--;
 		
@@ -2175,6 +2341,8 @@ SevenZipResult Lzma1Enc::CodeOneBlock( uint32 maxPackSize, const uint32 maxUnpac
 		NeedInit = false;
 	}
 
+	StateIsInitial = false;
+
 	if( Finished )
 	{
 		return Result;
@@ -2283,6 +2451,7 @@ SevenZipResult Lzma1Enc::CodeOneBlock( uint32 maxPackSize, const uint32 maxUnpac
 					{
 						RangeCoder.LengthEncode( RepeatLengthProbabilities, length - Lzma::Lzma1MinMatchLength, pos_state );
 						--RepeatLenEncCounter;
+						RepeatLengthPricesValid = false;
 						State = Lzma::RepNextStateLut[State];
 					}
 				}
@@ -2301,6 +2470,7 @@ SevenZipResult Lzma1Enc::CodeOneBlock( uint32 maxPackSize, const uint32 maxUnpac
 					Repeats[0] = dist + 1u;
 
 					MatchPriceCount++;
+					MatchPricesValid = false;
 
 					// Encode position slot
 					uint32 pos_slot;
@@ -2375,12 +2545,14 @@ SevenZipResult Lzma1Enc::CodeOneBlock( uint32 maxPackSize, const uint32 maxUnpac
 						FillAlignPrices();
 						FillDistancesPrices();
 						UpdateTables( &LenEnc, 1u << PositionBits, &LengthProbabilities );
+						MatchPricesValid = true;
 					}
 
 					if( RepeatLenEncCounter <= 0 )
 					{
 						RepeatLenEncCounter = LzmaEncoder::RepeatLengthCount;
 						UpdateTables( &RepeatLenEnc, 1u << PositionBits, &RepeatLengthProbabilities );
+						RepeatLengthPricesValid = true;
 					}
 				}
 
@@ -2414,21 +2586,54 @@ SevenZipResult Lzma1Enc::CodeOneBlock( uint32 maxPackSize, const uint32 maxUnpac
 	return CheckErrors();
 }
 
-SevenZipResult Lzma1Enc::AllocateMemory( uint32 keepWindowSize )
+/**
+ * @brief Returns the size in bytes of one literal probability table.
+ *
+ * @param literalBits Sum of the literal context and literal position bits.
+ */
+static uint32 GetLiteralProbabilitiesSize( const int32 literalBits )
 {
-	// Allocate range encoder buffer
-	if( RangeCoder.AllocateMemory() == nullptr )
-	{
-		return SevenZipResult::SevenZipErrorMemory;
-	}
+	return ( 0x300u << literalBits ) * sizeof( CProbability );
+}
 
+/**
+ * @brief Returns the number of bytes an encoder allocates when encoding from memory.
+ *
+ * @param dictionarySize Dictionary size in bytes.
+ * @param literalBits    Sum of the literal context and literal position bits.
+ * @param binaryTree     true if the encoder uses the binary tree match finder.
+ * @return The total of every allocation made through the MemoryInterface.
+ */
+int64 Lzma1Enc::GetAllocationSize( const uint32 dictionarySize, const int32 literalBits, const bool binaryTree )
+{
+	// The literal tables are allocated twice; the second copy backs SaveState()
+	return GetLiteralProbabilitiesSize( literalBits ) * 2 + LzmaEncoder::OptimalsSize
+		+ CMatchFinder::GetAllocationSize( GetHistorySize( dictionarySize ), INT64_MAX, binaryTree );
+}
+
+/**
+ * @brief Returns the size of the input window an encoder allocates when encoding from a stream, e.g. through a filter.
+ *
+ * @param dictionarySize Dictionary size in bytes.
+ * @param fastBytes      The normalized FastBytes property.
+ * @param keepWindowSize Number of bytes at the start of the window to preserve across Init calls.
+ * @return The window size in bytes.
+ */
+int64 Lzma1Enc::GetStreamWindowSize( const uint32 dictionarySize, const uint32 fastBytes, const uint32 keepWindowSize )
+{
+	const uint32 history_size = GetHistorySize( dictionarySize );
+	return CMatchFinder::GetStreamBufferSize( history_size, GetKeepBeforeSize( history_size, keepWindowSize ), fastBytes, Lzma::MaxMatchLength + 1u );
+}
+
+SevenZipResult Lzma1Enc::AllocateMemory( uint32 keepWindowSize )
+{
 	// Allocate or reallocate literal probability tables if needed
 	const int32 lclp = LiteralContextBits + LiteralPositionBits;
 	if( LiteralProbabilities == nullptr || SavedState.LiteralProbabilities == nullptr || TotalLiteralBits != lclp )
 	{
 		FreeLits();
 
-		const uint32 prob_array_size = ( 0x300u << lclp ) * sizeof( CProbability );
+		const uint32 prob_array_size = GetLiteralProbabilitiesSize( lclp );
 		LiteralProbabilities = static_cast<CProbability*>( Alloc->Alloc( prob_array_size, "Lzma1Enc::LiteralProbabilities" ) );
 		SavedState.LiteralProbabilities = static_cast<CProbability*>( Alloc->Alloc( prob_array_size, "Lzma1Enc::SavedState.LiteralProbabilities" ) );
 
@@ -2441,20 +2646,10 @@ SevenZipResult Lzma1Enc::AllocateMemory( uint32 keepWindowSize )
 		TotalLiteralBits = lclp;
 	}
 
-	// Adjust dictionary size for large dictionaries to avoid decoder issues
-	uint32 dict_size = DictionarySize;
-	if( dict_size == ( 2u << 30 ) || dict_size == ( 3u << 30 ) )
-	{
-		// Reduce by 1 to avoid 32-bit wraparound issues in decoder
-		dict_size--;
-	}
+	const uint32 dict_size = GetHistorySize( DictionarySize );
 
 	// Calculate buffer size before dictionary window
-	uint32 before_size = LzmaEncoder::NumOptimals;
-	if( before_size + dict_size < keepWindowSize )
-	{
-		before_size = keepWindowSize - dict_size;
-	}
+	const uint32 before_size = GetKeepBeforeSize( dict_size, keepWindowSize );
 
 	// Create match finder with calculated buffer sizes
 	if( !MatchFinder->Create( dict_size, before_size, FastBytes, Lzma::MaxMatchLength + 1u ) )
@@ -2462,13 +2657,21 @@ SevenZipResult Lzma1Enc::AllocateMemory( uint32 keepWindowSize )
 		return SevenZipResult::SevenZipErrorMemory;
 	}
 
-	if( Optimals == nullptr )
+	if( Optimals.Price == nullptr )
 	{
-		Optimals = static_cast< COptimal* >( Alloc->Alloc( LzmaEncoder::NumOptimals * sizeof( COptimal ), "Lzma1Enc::Optimals" ) );
-		if( Optimals == nullptr )
+		// One allocation carved into the parallel arrays, widest elements first to keep each one aligned
+		uint8* optimals = static_cast< uint8* >( Alloc->Alloc( LzmaEncoder::OptimalsSize, "Lzma1Enc::Optimals" ) );
+		if( optimals == nullptr )
 		{
 			return SevenZipResult::SevenZipErrorMemory;
 		}
+
+		Optimals.Price = reinterpret_cast< uint32* >( optimals );
+		Optimals.Length = Optimals.Price + LzmaEncoder::NumOptimals;
+		Optimals.Distance = Optimals.Length + LzmaEncoder::NumOptimals;
+		Optimals.Repeats = reinterpret_cast< uint32( * )[Lzma::NumRepeats] >( Optimals.Distance + LzmaEncoder::NumOptimals );
+		Optimals.State = reinterpret_cast< CState* >( Optimals.Repeats + LzmaEncoder::NumOptimals );
+		Optimals.Extra = reinterpret_cast< CExtra* >( Optimals.State + LzmaEncoder::NumOptimals );
 	}
 
 	return SevenZipResult::SevenZipOK;
@@ -2516,6 +2719,8 @@ void Lzma1Enc::Init()
 		probability = Lzma::InitProbabilityValue;
 	}
 
+	SaveLiteralContexts();
+
 	const uint32 count = Lzma::LiteralSize << ( LiteralPositionBits + LiteralContextBits );
 	for( uint32 i = 0; i < count; i++ )
 	{
@@ -2525,35 +2730,57 @@ void Lzma1Enc::Init()
 	LengthProbabilities.Init();
 	RepeatLengthProbabilities.Init();
 
+	MatchPricesValid = false;
+	RepeatLengthPricesValid = false;
+
 	OptimalEnd = 0u;
 	OptimalCurrent = 0u;
 
 	for( uint32 optimal_index = 0; optimal_index < LzmaEncoder::NumOptimals; optimal_index++ )
 	{
-		Optimals[optimal_index].Price = LzmaEncoder::InfinityPrice;
+		Optimals.Price[optimal_index] = LzmaEncoder::InfinityPrice;
 	}
 
 	AdditionalOffset = 0u;
 
 	PositionMask = ( 1u << PositionBits ) - 1u;
 	LiteralMask = ( 0x100u << LiteralPositionBits ) - ( 0x100u >> LiteralContextBits );
+
+	StateIsInitial = true;
 }
 
+/**
+ * @brief Brings the price tables up to date with the current probabilities.
+ *
+ * Tables are only rebuilt when a probability they depend on has changed since they were
+ * last filled, which avoids a full rebuild at the start of every LZMA2 chunk.
+ */
 void Lzma1Enc::InitPrices()
 {
-	if( !FastMode )
-	{
-		FillDistancesPrices();
-		FillAlignPrices();
-	}
-
 	LenEnc.TableSize = FastBytes + 1 - Lzma::Lzma1MinMatchLength;
 	RepeatLenEnc.TableSize = FastBytes + 1 - Lzma::Lzma1MinMatchLength;
 
 	RepeatLenEncCounter = LzmaEncoder::RepeatLengthCount;
 
-	UpdateTables( &LenEnc, 1u << PositionBits, &LengthProbabilities );
-	UpdateTables( &RepeatLenEnc, 1u << PositionBits, &RepeatLengthProbabilities );
+	// Only the optimal parser reads the price tables
+	if( FastMode )
+	{
+		return;
+	}
+
+	if( !MatchPricesValid )
+	{
+		FillDistancesPrices();
+		FillAlignPrices();
+		UpdateTables( &LenEnc, 1u << PositionBits, &LengthProbabilities );
+		MatchPricesValid = true;
+	}
+
+	if( !RepeatLengthPricesValid )
+	{
+		UpdateTables( &RepeatLenEnc, 1u << PositionBits, &RepeatLengthProbabilities );
+		RepeatLengthPricesValid = true;
+	}
 }
 
 SevenZipResult Lzma1Enc::AllocAndInit( uint32 keepWindowSize )
@@ -2599,6 +2826,14 @@ SevenZipResult Lzma1Enc::Prepare( InStreamInterface* inStream, uint32 keepWindow
 	return AllocAndInit( keepWindowSize );
 }
 
+/**
+ * @brief Prepares the encoder to read uncompressed data directly from memory, without an input window.
+ *
+ * @param src            Pointer to the uncompressed data; must stay valid until encoding finishes.
+ * @param srcLen         Number of uncompressed bytes.
+ * @param keepWindowSize Number of bytes at the start of the window to preserve across Init calls.
+ * @return SevenZipOK on success, or a memory-allocation error code.
+ */
 SevenZipResult Lzma1Enc::MemPrepare( const uint8* src, int64 srcLen, uint32 keepWindowSize )
 {
 	MatchFinder->DirectInput = true;
@@ -2606,7 +2841,6 @@ SevenZipResult Lzma1Enc::MemPrepare( const uint8* src, int64 srcLen, uint32 keep
 	MatchFinder->DirectInputRemaining = srcLen;
 	NeedInit = true;
 
-	SetDataSize( srcLen );
 	return AllocAndInit( keepWindowSize );
 }
 
@@ -2630,6 +2864,43 @@ int64 Lzma1Enc::GetCurrentOffset() const
 	return MatchFinder->BufferOffset - AdditionalOffset;
 }
 
+/**
+ * @brief Returns the uncompressed bytes already buffered ahead of the current encode position.
+ *
+ * Must only be called between blocks, when no match-finder lookahead is pending.
+ *
+ * @param data On exit: pointer to the next byte to be encoded.
+ * @return Number of bytes available at data without reading from the input stream.
+ */
+uint32 Lzma1Enc::GetLookahead( const uint8*& data )
+{
+	if( NeedInit )
+	{
+		MatchFinder->Init();
+		NeedInit = false;
+	}
+
+	data = MatchFinder->BufferBase + MatchFinder->BufferOffset;
+	return MatchFinder->StreamPosition - MatchFinder->Position;
+}
+
+/**
+ * @brief Advances past bytes that were stored uncompressed, keeping the match-finder history intact.
+ *
+ * @param length Number of bytes to skip; must not exceed the value returned by GetLookahead().
+ * @return SevenZipOK on success, or SevenZipErrorRead if the input stream failed.
+ */
+SevenZipResult Lzma1Enc::SkipUncompressed( uint32 length )
+{
+	if( length > 0u )
+	{
+		MatchFinder->Skip( length );
+		NowPos64 += length;
+	}
+
+	return ( MatchFinder->Result != SevenZipResult::SevenZipOK ) ? SevenZipResult::SevenZipErrorRead : SevenZipResult::SevenZipOK;
+}
+
 SevenZipResult Lzma1Enc::ReportProgress() const
 {
 	if( Progress != nullptr )
@@ -2697,7 +2968,7 @@ SevenZipResult Lzma1Enc::GetCodedProperties( uint8* properties, uint64& size ) c
 /**
  * @brief Encodes one LZMA block into a caller-supplied memory buffer.
  *
- * @param reInit          If true, re-initialises encoder state before encoding.
+ * @param reInit          If true, re-initialises encoder state before encoding; skipped if nothing has been coded since the last Init().
  * @param baseDest        Base pointer of the destination buffer.
  * @param offset          Byte offset into baseDest at which to start writing.
  * @param destLen         On entry: maximum bytes to write.
@@ -2708,13 +2979,11 @@ SevenZipResult Lzma1Enc::GetCodedProperties( uint8* properties, uint64& size ) c
  */
 SevenZipResult Lzma1Enc::CodeOneMemBlock( bool reInit, uint8* baseDest, int64 offset, int64& destLen, uint32 desiredPackSize, uint32& unpackSize )
 {
-	CheckedSeqOutStream out_stream( baseDest, offset, destLen );
-
 	WriteEndMark = false;
 	Finished = false;
 	Result = SevenZipResult::SevenZipOK;
 
-	if( reInit )
+	if( reInit && !StateIsInitial )
 	{
 		Init();
 	}
@@ -2722,8 +2991,8 @@ SevenZipResult Lzma1Enc::CodeOneMemBlock( bool reInit, uint8* baseDest, int64 of
 	InitPrices();
 
 	const int64 now_pos_64 = NowPos64;
+	RangeCoder.SetOutput( baseDest + offset, destLen );
 	RangeCoder.Init();
-	RangeCoder.outStream = &out_stream;
 
 	if( desiredPackSize == 0 )
 	{
@@ -2733,8 +3002,8 @@ SevenZipResult Lzma1Enc::CodeOneMemBlock( bool reInit, uint8* baseDest, int64 of
 	const SevenZipResult result = CodeOneBlock( desiredPackSize, unpackSize );
 
 	unpackSize = static_cast< uint32 >( NowPos64 - now_pos_64 );
-	destLen = out_stream.WorkBufferOffset - offset;
-	if( out_stream.Overflow )
+	destLen = RangeCoder.GetOutputLength();
+	if( RangeCoder.HasOverflowed() )
 	{
 		return SevenZipResult::SevenZipErrorOutputEof;
 	}
@@ -2754,12 +3023,40 @@ SevenZipResult Lzma1Enc::CodeOneMemBlock( bool reInit, uint8* baseDest, int64 of
  */
 SevenZipResult Lzma1Enc::MemEncode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength )
 {
-	CheckedSeqOutStream out_stream( compressed, 0, compressedLength );
+	RangeCoder.SetOutput( compressed, compressedLength );
 
-	RangeCoder.outStream = &out_stream;
+	SetDataSize( decompressedLength );
+	return EncodeAll( MemPrepare( decompressed, decompressedLength, 0 ), compressedLength, decompressedLength );
+}
 
-	SevenZipResult result = MemPrepare( decompressed, decompressedLength, 0 );
+/**
+ * @brief Compresses the data read from a stream, writing the output to an in-memory buffer.
+ *
+ * @param compressed         Output buffer to receive the compressed data.
+ * @param compressedLength   On entry: capacity of the output buffer.
+ *                           On exit:  number of compressed bytes written.
+ * @param inStream           The stream to read the uncompressed data from.
+ * @param decompressedLength Number of uncompressed bytes the stream holds.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma1Enc::StreamEncode( uint8* compressed, int64& compressedLength, InStreamInterface* inStream, int64 decompressedLength )
+{
+	RangeCoder.SetOutput( compressed, compressedLength );
+
+	SetDataSize( decompressedLength );
+	return EncodeAll( Prepare( inStream, 0 ), compressedLength, decompressedLength );
+}
 
+/**
+ * @brief Codes blocks until the input is exhausted, once the encoder is prepared.
+ *
+ * @param result             The result of preparing the encoder; nothing is coded unless it is SevenZipOK.
+ * @param compressedLength   On exit: number of compressed bytes written.
+ * @param decompressedLength Number of uncompressed bytes expected.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma1Enc::EncodeAll( SevenZipResult result, int64& compressedLength, const int64 decompressedLength )
+{
 	if( result == SevenZipResult::SevenZipOK )
 	{
 		while( !Finished && result == SevenZipResult::SevenZipOK )
@@ -2777,8 +3074,8 @@ SevenZipResult Lzma1Enc::MemEncode( uint8* compressed, int64& compressedLength,
 		}
 	}
 
-	compressedLength = out_stream.WorkBufferOffset;
-	if( out_stream.Overflow )
+	compressedLength = RangeCoder.GetOutputLength();
+	if( RangeCoder.HasOverflowed() )
 	{
 		return SevenZipResult::SevenZipErrorOutputEof;
 	}
@@ -2800,11 +3097,16 @@ SevenZipResult Lzma1Enc::MemEncode( uint8* compressed, int64& compressedLength,
  *                           On exit:  number of bytes written (always 5 on success).
  * @param alloc              Memory allocator; pass nullptr to use the default allocator.
  * @param progress           Optional progress callback; pass nullptr to disable.
+ * @param compactHash        If true, sizes the match-finder hash tables to the data; see Lzma1Enc::UseCompactHash().
  * @return SevenZipOK on success, or an error code.
  */
-SevenZipResult Lzma1Encode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress )
+SevenZipResult Lzma1Encode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress, const bool compactHash )
 {
 	Lzma1Enc enc1( encoderProperties, alloc, progress );
+	if( compactHash )
+	{
+		enc1.UseCompactHash();
+	}
 
 	SevenZipResult result = enc1.GetCodedProperties( propsEncoded, outPropsSize );
 	if( result == SevenZipResult::SevenZipOK )
@@ -2815,3 +3117,32 @@ SevenZipResult Lzma1Encode( uint8* compressed, int64& compressedLength, const ui
 	return result;
 }
 
+/**
+ * @brief Compresses the data read from a stream using LZMA1 in a single call.
+ *
+ * @param compressed         Output buffer to receive the compressed data.
+ * @param compressedLength   On entry: capacity of compressed.
+ *                           On exit:  number of bytes written.
+ * @param inStream           The stream to read the uncompressed data from.
+ * @param decompressedLength Number of uncompressed bytes the stream holds.
+ * @param encoderProperties  Encoder configuration parameters.
+ * @param propsEncoded       Output buffer to receive the 5-byte LZMA properties block.
+ * @param outPropsSize       On entry: capacity of propsEncoded.
+ *                           On exit:  number of bytes written (always 5 on success).
+ * @param alloc              Memory allocator; pass nullptr to use the default allocator.
+ * @param progress           Optional progress callback; pass nullptr to disable.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma1EncodeStream( uint8* compressed, int64& compressedLength, InStreamInterface& inStream, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	Lzma1Enc enc1( encoderProperties, alloc, progress );
+
+	SevenZipResult result = enc1.GetCodedProperties( propsEncoded, outPropsSize );
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		result = enc1.StreamEncode( compressed, compressedLength, &inStream, decompressedLength );
+	}
+
+	return result;
+}
+
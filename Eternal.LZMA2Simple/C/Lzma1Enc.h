@@ -34,29 +34,36 @@ namespace LzmaEncoder
 	static constexpr uint8 EncodeStateRepeatAfterLiteral = 8;
 
 	static constexpr uint32 InfinityPrice = 1u << 30;
-	static constexpr int64 RangeEncoderBufferSize = 1 << 16;
+	// Bytes past the end of the destination buffer are counted in this scratch area before the overflow is reported
+	static constexpr int64 OverflowSinkSize = 64;
 
 	static constexpr uint32 NumOptimals = 1u << 11;
+	static constexpr int64 OptimalsSize = NumOptimals * ( ( 3 + Lzma::NumRepeats ) * sizeof( uint32 ) + sizeof( CState ) + sizeof( CExtra ) );
 	static constexpr uint32 PackReserveSize = NumOptimals << 3;
 	static constexpr uint32 RepeatLengthCount = 64;
 	static constexpr uint32 MarkLiteral = UINT32_MAX;
 
 	static constexpr uint32 MaxDictionarySizeBits = 32;
 	static constexpr uint32 DistanceTableSize = MaxDictionarySizeBits << 1;
+
+	// One bit per literal context, for the largest LZMA1 literal context
+	static constexpr uint32 MaxLiteralContexts = 1u << ( Lzma::MaxLiteralContextBits + Lzma::MaxLiteralPositionBits );
+	static constexpr uint32 LiteralContextWords = MaxLiteralContexts >> 6;
 }
 
+// The optimal parse window, one entry per position, stored as parallel arrays so the price scans only touch prices
 typedef struct
 {
-	uint32 Price;
-	CState State;
-	CExtra Extra;
+	uint32* Price;
+	uint32* Length;
+	uint32* Distance;
+	uint32 ( *Repeats )[Lzma::NumRepeats];
+	CState* State;
 	// 0   : normal
 	// 1   : LIT : MATCH
 	// > 1 : MATCH (extra-1) : LIT : REP0 (len)
-	uint32 Length;
-	uint32 Distance;
-	uint32 Repeats[Lzma::NumRepeats];
-} COptimal;
+	CExtra* Extra;
+} COptimals;
 
 class CLengthEncoder
 {
@@ -76,20 +83,10 @@ typedef struct
 class CRangeEncoder
 {
 public:
-	CRangeEncoder( MemoryInterface* alloc )
-		: Alloc( alloc )
-	{
-	}
-
-	~CRangeEncoder()
-	{
-		FreeMemory();
-	}
-
-	void FreeMemory();
-	uint8* AllocateMemory();
+	void SetOutput( uint8* output, const int64 outputSize );
+	int64 GetOutputLength() const;
+	bool HasOverflowed() const;
 	void Init();
-	void FlushStream();
 	void CheckFlush();
 	void ShiftLow();
 	void FlushData();
@@ -106,9 +103,8 @@ public:
 	void EncodeMatched( CProbability* probabilities, uint32 arrayOffset, uint32 symbol, uint32 matchByte );
 	void ReverseEncode( CProbability* probabilities, uint32 arrayOffset, int8 numBits, uint32 symbol );
 
-	OutStreamInterface* outStream = nullptr;
-
 	int64 Low = 0;
+	// Bytes emitted before OutputBuffer; Processed + BufferOffset is the total emitted so far
 	int64 Processed = 0;
 	int64 BufferOffset = 0;
 	int64 CacheSize = 0;
@@ -118,9 +114,19 @@ public:
 	SevenZipResult Result = SevenZipResult::SevenZipOK;
 
 private:
-	MemoryInterface* Alloc = nullptr;
-	uint8* RangeEncoderBuffer = nullptr;
+	void Overflow();
+
+	// The caller's destination buffer, as set by SetOutput()
+	uint8* Output = nullptr;
+	int64 OutputSize = 0;
+
+	// Where bytes are written: the destination, or OverflowSink once the destination is full
+	uint8* OutputBuffer = nullptr;
+	int64 OutputBufferSize = 0;
+
 	uint32 Cache = 0;
+
+	uint8 OverflowSink[LzmaEncoder::OverflowSinkSize];
 };
 
 typedef struct
@@ -151,26 +157,37 @@ public:
 	Lzma1Enc( const CLzmaEncoderProperties* encoderProperties, MemoryInterface* alloc, ProgressInterface* progress );
 	~Lzma1Enc();
 
+	static int64 GetAllocationSize( const uint32 dictionarySize, const int32 literalBits, const bool binaryTree );
+	static int64 GetStreamWindowSize( const uint32 dictionarySize, const uint32 fastBytes, const uint32 keepWindowSize );
+
 	const uint8* GetBufferBase() const;
 	int64 GetCurrentOffset() const;
+	uint32 GetLookahead( const uint8*& data );
+	SevenZipResult SkipUncompressed( uint32 length );
 	SevenZipResult CodeOneMemBlock( bool reInit, uint8* baseDest, int64 offset, int64& destLen, uint32 desiredPackSize, uint32& unpackSize );
 	void SaveState();
 	void RestoreState();
 	SevenZipResult GetCodedProperties( uint8* properties, uint64& size ) const;
 	void SetDataSize( int64 expectedDataSize ) const;
+	void UseCompactHash() const;
 	SevenZipResult Prepare( InStreamInterface* inStream, uint32 keepWindowSize );
+	SevenZipResult MemPrepare( const uint8* src, int64 srcLen, uint32 keepWindowSize );
 	SevenZipResult MemEncode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength );
+	SevenZipResult StreamEncode( uint8* compressed, int64& compressedLength, InStreamInterface* inStream, int64 decompressedLength );
 
 private:
+	SevenZipResult EncodeAll( SevenZipResult result, int64& compressedLength, int64 decompressedLength );
 	SevenZipResult CheckErrors();
 	uint32 GetPrice( const uint32 literalContext, uint32 symbol ) const;
 	uint32 MatchedGetPrice( const uint32 literalContext, uint32 symbol, uint32 matchByte ) const;
 	uint32 CalcTreeAlignPrice( uint32 symbol, uint32& m ) const;
-	uint32 CalcTreeDistancePrice( uint32 lps, uint32 symbol ) const;
 	static void SetPrices( const CProbability* baseArray, const uint32 baseOffset, const uint32 startPrice, uint32* prices, uint32 priceOffset );
+	static void FillTreePairPrices( const CProbability* probabilities, const int8 numBits, const uint32 numPairs, const uint32 startPrice, uint32* prices );
 	static void UpdateTables( CLengthPriceEncoder* lpe, const uint32 numPosStates, const CLengthEncoder* le );
 
 	void FreeLits();
+	void SaveLiteralContext( const uint32 context );
+	void SaveLiteralContexts();
 	void Lit( const uint32 nowPos32 );
 	bool GetBestPrice( uint32& curRef, const uint32 last );
 	uint32 GetPricePureRep( const uint32 repIndex, const uint64 state, const uint64 posState ) const;
@@ -199,7 +216,6 @@ private:
 	SevenZipResult AllocateMemory( uint32 keepWindowSize );
 	void InitPrices();
 	SevenZipResult AllocAndInit( uint32 keepWindowSize );
-	SevenZipResult MemPrepare( const uint8* src, int64 srcLen, uint32 keepWindowSize );
 	void Init();
 	SevenZipResult ReportProgress() const;
 	void WriteEndMarker( uint32 posState );
@@ -221,7 +237,7 @@ private:
 
 	CProbability* LiteralProbabilities = nullptr;
 	uint32* NewRepeats = nullptr;
-	COptimal* Optimals = nullptr;
+	COptimals Optimals = {};
 
 	int64 NowPos64 = 0;
 
@@ -239,6 +255,10 @@ private:
 
 	uint32 MatchPriceCount = 0u;
 	int32 RepeatLenEncCounter = 0;
+
+	// Set while the price tables match the current probabilities, so InitPrices() can skip rebuilding them
+	bool MatchPricesValid = false;
+	bool RepeatLengthPricesValid = false;
 	uint32 DistanceTableSize = 0u;
 
 	uint32 Position = 0u;
@@ -277,13 +297,19 @@ private:
 
 	CSaveState SavedState;
 
+	// A set bit means the literal context is already in SavedState (or no state is being saved)
+	uint64 LiteralContextSaved[LzmaEncoder::LiteralContextWords];
+
 	static CProbPrice ProbabilityPrices[Lzma::BitModelTableSize >> LzmaEncoder::NumMoveReducingBits];
 
 	bool Finished = false;
 	bool NeedInit = false;
+	// Set by Init() until a block is coded or a state restored, so a requested re-initialisation can be skipped
+	bool StateIsInitial = false;
 	bool WriteEndMark = false;
 	SevenZipResult Result = SevenZipResult::SevenZipOK;
 };
 
 /* ---------- One Call Interface ---------- */
-SevenZipResult Lzma1Encode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress );
+SevenZipResult Lzma1Encode( uint8* compressed, int64& compressedLength, const uint8* decompressed, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress, const bool compactHash );
+SevenZipResult Lzma1EncodeStream( uint8* compressed, int64& compressedLength, InStreamInterface& inStream, int64 decompressedLength, const CLzmaEncoderProperties* encoderProperties, uint8* propsEncoded, uint64& outPropsSize, MemoryInterface* alloc, ProgressInterface* progress );
@@ -27,8 +27,79 @@ SevenZipResult Lzma1Compress( const CLzmaData* data, CLzmaEncoderProperties* enc
 
 	uint64 out_prop_size = 5;
 	result->OutputLength = data->DestinationLength;
-	result->Result = Lzma1Encode( data->DestinationData, result->OutputLength, data->SourceData, data->SourceLength, encoderProperties, result->Properties, out_prop_size, alloc, progress );
 
+	if( encoderProperties->Filter == LzmaFilterType::LzmaFilterTypeNone )
+	{
+		result->Result = Lzma1Encode( data->DestinationData, result->OutputLength, data->SourceData, data->SourceLength, encoderProperties, result->Properties, out_prop_size, alloc, progress, false );
+	}
+	else
+	{
+		// Filter the source as the encoder reads it into its window
+		CLzmaFilter filter( encoderProperties->Filter, encoderProperties->FilterParameter );
+		CFilterInStream in_stream( data->SourceData, data->SourceLength, filter, nullptr );
+
+		result->Result = in_stream.Create( alloc );
+		if( result->Result == SevenZipResult::SevenZipOK )
+		{
+			result->Result = Lzma1EncodeStream( data->DestinationData, result->OutputLength, in_stream, data->SourceLength, encoderProperties, result->Properties, out_prop_size, alloc, progress );
+		}
+	}
+
+	result->Filter = encoderProperties->Filter;
+	result->FilterParameter = encoderProperties->FilterParameter;
+	return result->Result;
+}
+
+/**
+ * The LZMA1 compress function for inputs smaller than Lzma::SmallInputLimit.
+ */
+SevenZipResult Lzma1CompressSmall( const CLzmaData* data, CLzmaEncoderProperties* encoderProperties, CLzma1Result* result, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	if( data->SourceLength >= Lzma::SmallInputLimit )
+	{
+		result->Result = SevenZipResult::SevenZipErrorParam;
+		return result->Result;
+	}
+
+	encoderProperties->EstimatedSourceDataSize = data->SourceLength;
+	result->Result = encoderProperties->Normalize();
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	uint64 out_prop_size = 5;
+	result->OutputLength = data->DestinationLength;
+
+	if( encoderProperties->Filter == LzmaFilterType::LzmaFilterTypeNone )
+	{
+		result->Result = Lzma1Encode( data->DestinationData, result->OutputLength, data->SourceData, data->SourceLength, encoderProperties, result->Properties, out_prop_size, alloc, nullptr, true );
+	}
+	else
+	{
+		// The input is small, so filter it into a copy and compress that
+		uint8* filtered = static_cast< uint8* >( alloc->Alloc( data->SourceLength, "Lzma1CompressSmall::Filtered" ) );
+		if( filtered == nullptr && data->SourceLength > 0 )
+		{
+			result->Result = SevenZipResult::SevenZipErrorMemory;
+			return result->Result;
+		}
+
+		CLzmaFilter filter( encoderProperties->Filter, encoderProperties->FilterParameter );
+		filter.Encode( data->SourceData, filtered, data->SourceLength, true );
+
+		result->Result = Lzma1Encode( data->DestinationData, result->OutputLength, filtered, data->SourceLength, encoderProperties, result->Properties, out_prop_size, alloc, nullptr, true );
+
+		alloc->Free( filtered, data->SourceLength, "Lzma1CompressSmall::Filtered" );
+	}
+
+	result->Filter = encoderProperties->Filter;
+	result->FilterParameter = encoderProperties->FilterParameter;
 	return result->Result;
 }
 
@@ -42,8 +113,355 @@ SevenZipResult Lzma1Decompress( CLzmaData* data, CLzma1Result* result, MemoryInt
 		alloc = &allocator;
 	}
 
+	CLzmaFilter filter( result->Filter, result->FilterParameter );
+	result->Result = filter.Create( alloc );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
 	result->OutputLength = data->DestinationLength;
 	result->Result = Lzma1Decode( data->DestinationData, result->OutputLength, data->SourceData, data->SourceLength, result->Properties, 5, result->FinishMode, result->Status, alloc );
 
+	if( result->Filter != LzmaFilterType::LzmaFilterTypeNone && result->Result == SevenZipResult::SevenZipOK )
+	{
+		filter.DecodeInPlace( data->DestinationData, result->OutputLength, nullptr );
+	}
+
 	return result->Result;
 }
+
+/**
+ * The number of bytes Lzma1Decompress allocates for a stream with these properties.
+ */
+int64 Lzma1EstimateDecoderMemory( const uint8* properties )
+{
+	Lzma1Dec decoder;
+	if( decoder.DecodeProperties( properties, 5 ) != SevenZipResult::SevenZipOK )
+	{
+		return 0;
+	}
+
+	return Lzma1Dec::GetNumProbabilities( decoder.DecoderProperties.LiteralContextBits, decoder.DecoderProperties.LiteralPositionBits ) * static_cast< int64 >( sizeof( CProbability ) );
+}
+
+/**
+ * @brief Decodes until the dictionary has received outputLength more bytes, wrapping it when it is full.
+ *
+ * @param decoder          The decoder, with its dictionary and state set up.
+ * @param compressed       Pointer to the compressed stream.
+ * @param compressedLength Number of bytes in the compressed stream.
+ * @param compressedOffset On entry: where decoding resumes. On exit: just past the input consumed.
+ * @param outputLength     Number of bytes to decode.
+ * @return SevenZipOK, SevenZipErrorData, or SevenZipErrorInputEof if the stream ends first.
+ */
+static SevenZipResult DecodeCircular( Lzma1Dec& decoder, const uint8* compressed, const int64 compressedLength, int64& compressedOffset, int64 outputLength )
+{
+	while( outputLength > 0 )
+	{
+		if( decoder.DictionaryPosition == decoder.DictionaryBufferSize )
+		{
+			decoder.DictionaryPosition = 0;
+		}
+
+		const int64 start = decoder.DictionaryPosition;
+		const int64 limit = std::min( decoder.DictionaryBufferSize, start + outputLength );
+		int64 input_length = compressedLength - compressedOffset;
+		LzmaStatus status = LzmaStatus::LzmaStatusNotSpecified;
+
+		const SevenZipResult result = decoder.DecodeToDict( limit, compressed, compressedOffset, input_length, LzmaFinishMode::LzmaFinishModeAny, status );
+		compressedOffset += input_length;
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		if( decoder.DictionaryPosition == start )
+		{
+			return SevenZipResult::SevenZipErrorInputEof;
+		}
+
+		outputLength -= decoder.DictionaryPosition - start;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Copies the windowLength bytes before the dictionary position into a checkpoint, compressing them if asked.
+ */
+static SevenZipResult SaveWindow( const uint8* dictionary, const Lzma1Dec& decoder, const int64 windowLength, const CLzmaEncoderProperties* windowProperties, CLzma1Checkpoint& checkpoint, MemoryInterface* alloc )
+{
+	checkpoint.WindowLength = windowLength;
+	checkpoint.WindowCompressed = false;
+	if( windowLength == 0 )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	uint8* window = static_cast< uint8* >( alloc->Alloc( windowLength, "CLzma1Checkpoint::Window" ) );
+	if( window == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	// The window may wrap around the end of the dictionary
+	const int64 position = decoder.DictionaryPosition;
+	const int64 wrapped_length = std::max< int64 >( windowLength - position, 0 );
+	memcpy( window, dictionary + decoder.DictionaryBufferSize - wrapped_length, static_cast< uint64 >( wrapped_length ) );
+	memcpy( window + wrapped_length, dictionary + position - ( windowLength - wrapped_length ), static_cast< uint64 >( windowLength - wrapped_length ) );
+	checkpoint.Window = window;
+	checkpoint.WindowSize = windowLength;
+
+	if( windowProperties == nullptr )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	CLzmaEncoderProperties encoder_properties = *windowProperties;
+	encoder_properties.EstimatedSourceDataSize = windowLength;
+
+	uint8* compressed_window = static_cast< uint8* >( alloc->Alloc( windowLength, "SaveWindow::CompressedWindow" ) );
+	if( compressed_window == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	CLzmaData window_data;
+	window_data.SourceData = window;
+	window_data.SourceLength = windowLength;
+	window_data.DestinationData = compressed_window;
+	window_data.DestinationLength = windowLength;
+
+	// A window that does not compress into that space is kept raw
+	CLzma1Result window_result;
+	SevenZipResult result = Lzma1Compress( &window_data, &encoder_properties, &window_result, alloc, nullptr );
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		// Keep only the compressed bytes, in an allocation of their own size
+		uint8* compressed = static_cast< uint8* >( alloc->Alloc( window_result.OutputLength, "CLzma1Checkpoint::Window" ) );
+		if( compressed == nullptr )
+		{
+			result = SevenZipResult::SevenZipErrorMemory;
+		}
+		else
+		{
+			memcpy( compressed, compressed_window, static_cast< uint64 >( window_result.OutputLength ) );
+			alloc->Free( window, windowLength, "CLzma1Checkpoint::Window" );
+			checkpoint.Window = compressed;
+			checkpoint.WindowSize = window_result.OutputLength;
+			checkpoint.WindowCompressed = true;
+			memcpy( checkpoint.WindowProperties, window_result.Properties, sizeof( checkpoint.WindowProperties ) );
+		}
+	}
+	else if( result == SevenZipResult::SevenZipErrorOutputEof )
+	{
+		result = SevenZipResult::SevenZipOK;
+	}
+
+	alloc->Free( compressed_window, windowLength, "SaveWindow::CompressedWindow" );
+	return result;
+}
+
+/**
+ * Release the checkpoints of a LZMA1 stream.
+ */
+void Lzma1FreeCheckpoints( CLzma1Checkpoint* checkpoints, int64 checkpointCount, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	if( checkpoints == nullptr )
+	{
+		return;
+	}
+
+	for( int64 index = 0; index < checkpointCount; index++ )
+	{
+		alloc->Free( checkpoints[index].Probabilities, checkpoints[index].NumProbabilities * static_cast< int64 >( sizeof( CProbability ) ), "CLzma1Checkpoint::Probabilities" );
+		alloc->Free( checkpoints[index].Window, checkpoints[index].WindowSize, "CLzma1Checkpoint::Window" );
+	}
+
+	alloc->Free( checkpoints, checkpointCount * static_cast< int64 >( sizeof( CLzma1Checkpoint ) ), "Lzma1BuildCheckpoints::Checkpoints" );
+}
+
+/**
+ * Index a LZMA1 stream for random access.
+ */
+SevenZipResult Lzma1BuildCheckpoints( const uint8* compressed, int64 compressedLength, const uint8* properties, int64 decompressedLength, int64 interval, const CLzmaEncoderProperties* windowProperties, CLzma1Checkpoint*& checkpoints, int64& checkpointCount, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	checkpoints = nullptr;
+	checkpointCount = 0;
+	if( interval <= 0 || decompressedLength < 0 || compressedLength < 0 )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	Lzma1Dec properties_decoder;
+	SevenZipResult result = properties_decoder.DecodeProperties( properties, 5 );
+	if( result != SevenZipResult::SevenZipOK || decompressedLength <= interval )
+	{
+		return result;
+	}
+
+	// A match reaches back at most DictionarySize bytes, so that is all that needs keeping
+	const int64 dictionary_size = std::min< int64 >( properties_decoder.DecoderProperties.DictionarySize, decompressedLength );
+	uint8* dictionary = static_cast< uint8* >( alloc->Alloc( dictionary_size, "Lzma1BuildCheckpoints::Dictionary" ) );
+	if( dictionary == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	// One checkpoint every interval bytes, up to but not including the end of the stream
+	const int64 checkpoint_count = ( decompressedLength - 1 ) / interval;
+	CLzma1Checkpoint* new_checkpoints = static_cast< CLzma1Checkpoint* >( alloc->Alloc( checkpoint_count * static_cast< int64 >( sizeof( CLzma1Checkpoint ) ), "Lzma1BuildCheckpoints::Checkpoints" ) );
+	if( new_checkpoints == nullptr )
+	{
+		alloc->Free( dictionary, dictionary_size, "Lzma1BuildCheckpoints::Dictionary" );
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	for( int64 index = 0; index < checkpoint_count; index++ )
+	{
+		new ( new_checkpoints + index ) CLzma1Checkpoint();
+	}
+
+	Lzma1Dec decoder( dictionary, alloc );
+	decoder.DecodeProperties( properties, 5 );
+	result = decoder.AllocateProbabilities();
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		decoder.DictionaryBufferSize = dictionary_size;
+		decoder.InitDictAndState( true, true );
+
+		int64 compressed_offset = 0;
+		for( int64 index = 0; index < checkpoint_count && result == SevenZipResult::SevenZipOK; index++ )
+		{
+			const int64 position = ( index + 1 ) * interval;
+			result = DecodeCircular( decoder, compressed, compressedLength, compressed_offset, interval );
+			if( result == SevenZipResult::SevenZipOK )
+			{
+				CLzma1Checkpoint& checkpoint = new_checkpoints[index];
+				checkpoint.CompressedOffset = compressed_offset;
+				checkpoint.UncompressedOffset = position;
+				result = decoder.SaveCheckpoint( checkpoint );
+			}
+
+			if( result == SevenZipResult::SevenZipOK )
+			{
+				result = SaveWindow( dictionary, decoder, std::min( dictionary_size, position ), windowProperties, new_checkpoints[index], alloc );
+			}
+		}
+	}
+
+	decoder.FreeProbabilities();
+	alloc->Free( dictionary, dictionary_size, "Lzma1BuildCheckpoints::Dictionary" );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		Lzma1FreeCheckpoints( new_checkpoints, checkpoint_count, alloc );
+		return result;
+	}
+
+	checkpoints = new_checkpoints;
+	checkpointCount = checkpoint_count;
+	return result;
+}
+
+/**
+ * Decompress part of a LZMA1 stream, starting from the nearest checkpoint.
+ */
+SevenZipResult Lzma1DecompressRange( const uint8* compressed, int64 compressedLength, const uint8* properties, const CLzma1Checkpoint* checkpoints, int64 checkpointCount, int64 offset, uint8* destination, int64 length, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	if( offset < 0 || length < 0 || compressedLength < 0 || checkpointCount < 0 || ( checkpoints == nullptr && checkpointCount > 0 ) )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	if( length == 0 )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	// The last checkpoint at or before offset
+	const CLzma1Checkpoint* next = std::upper_bound( checkpoints, checkpoints + checkpointCount, offset, []( const int64 position, const CLzma1Checkpoint& checkpoint ) { return position < checkpoint.UncompressedOffset; } );
+	const CLzma1Checkpoint* checkpoint = ( next == checkpoints ) ? nullptr : next - 1;
+
+	if( checkpoint != nullptr && checkpoint->CompressedOffset > compressedLength )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	const int64 start = ( checkpoint != nullptr ) ? checkpoint->UncompressedOffset : 0;
+	const int64 window_length = ( checkpoint != nullptr ) ? checkpoint->WindowLength : 0;
+	const int64 buffer_size = window_length + offset + length - start;
+
+	uint8* buffer = static_cast< uint8* >( alloc->Alloc( buffer_size, "Lzma1DecompressRange::Buffer" ) );
+	if( buffer == nullptr )
+	{
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	Lzma1Dec decoder( buffer, alloc );
+	SevenZipResult result = decoder.DecodeProperties( properties, 5 );
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		result = decoder.AllocateProbabilities();
+	}
+
+	if( result == SevenZipResult::SevenZipOK && checkpoint != nullptr )
+	{
+		if( !checkpoint->WindowCompressed )
+		{
+			memcpy( buffer, checkpoint->Window, static_cast< uint64 >( window_length ) );
+		}
+		else
+		{
+			int64 decompressed_window_length = window_length;
+			int64 compressed_window_length = checkpoint->WindowSize;
+			LzmaStatus status = LzmaStatus::LzmaStatusNotSpecified;
+			result = Lzma1Decode( buffer, decompressed_window_length, checkpoint->Window, compressed_window_length, checkpoint->WindowProperties, 5, LzmaFinishMode::LzmaFinishModeAny, status, alloc );
+			if( result == SevenZipResult::SevenZipOK && decompressed_window_length != window_length )
+			{
+				result = SevenZipResult::SevenZipErrorData;
+			}
+		}
+	}
+
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		decoder.DictionaryBufferSize = buffer_size;
+		decoder.DictionaryPosition = window_length;
+		decoder.InitDictAndState( true, true );
+		if( checkpoint != nullptr )
+		{
+			result = decoder.RestoreCheckpoint( *checkpoint );
+		}
+	}
+
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		int64 compressed_offset = ( checkpoint != nullptr ) ? checkpoint->CompressedOffset : 0;
+		result = DecodeCircular( decoder, compressed, compressedLength, compressed_offset, buffer_size - window_length );
+	}
+
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		memcpy( destination, buffer + window_length + offset - start, static_cast< uint64 >( length ) );
+	}
+
+	decoder.FreeProbabilities();
+	alloc->Free( buffer, buffer_size, "Lzma1DecompressRange::Buffer" );
+	return result;
+}
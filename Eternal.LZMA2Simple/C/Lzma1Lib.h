@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "Filter.h"
+
 /**
  * ELzmaFinishMode has meaning only if the decoding reaches output limit !!!
  *
@@ -80,6 +82,13 @@ public:
 
 	/** The number of bytes output from the compress/decompress operation */
 	int64 OutputLength = 0;
+
+	/**
+	 * The filter the data was run through before compression. Compression fills these in from CLzmaEncoderProperties;
+	 * decompression undoes the filter after decoding. Pass them on along with Properties.
+	 */
+	LzmaFilterType Filter = LzmaFilterType::LzmaFilterTypeNone;
+	uint32 FilterParameter = 0u;
 };
 
 class CLzmaEncoderProperties
@@ -123,11 +132,38 @@ public:
 	 */
 	int64 EstimatedSourceDataSize = INT64_MAX;
 
+	/**
+	 * Maximum number of bytes the encoder may allocate. default = 0 (no limit).
+	 * When set, Normalize() lowers the dictionary size until EstimateEncoderMemory() fits, and fails with SevenZipErrorMemory if nothing fits.
+	 */
+	int64 MemoryBudget = 0;
+
+	/**
+	 * A filter to run the source data through before compressing it, default = LzmaFilterTypeNone
+	 * The data is filtered a group at a time as the encoder reads it.
+	 */
+	LzmaFilterType Filter = LzmaFilterType::LzmaFilterTypeNone;
+
+	/** The filter specific parameter, e.g. LzmaFilter::BcnDeltaEndpoints, default = 0 */
+	uint32 FilterParameter = 0u;
+
 	virtual SevenZipResult Normalize();
 
 	uint32 GetDictionarySize() const;
 
+	/** The match finder uses binary trees at level 5 and above, and hash chains below. */
+	bool UsesBinaryTree() const
+	{
+		return CompressionLevel >= 5;
+	}
+
+	virtual int64 EstimateEncoderMemory() const;
+
 	virtual ~CLzmaEncoderProperties() = default;
+
+protected:
+	int64 EstimateLzmaEncoderMemory( const uint32 keepWindowSize ) const;
+	SevenZipResult ApplyMemoryBudget();
 };
 
 /**
@@ -142,10 +178,11 @@ public:
 
 /*
 RAM requirements for LZMA:
-  for compression:   (DictionarySize * 11.5 + 6 MB) + state_size
-  for decompression: DictionarySize + state_size
-	state_size = (4 + (1.5 << (LiteralContextBits + LiteralPositionBits))) KB
-	by default (LiteralContextBits=3, LiteralPositionBits=0), state_size = 16 KB.
+  for compression:   CLzmaEncoderProperties::EstimateEncoderMemory()
+  for decompression: Lzma1EstimateDecoderMemory() + the output buffer
+	roughly DictionarySize * 11.5 + 6 MB for the binary tree match finder, DictionarySize * 5.5 + 6 MB for hash chains.
+	With a filter the compression estimate includes the filter group and the input window the encoder reads the
+	filtered data into. Undoing the BC1, BC3 or shuffle filter needs one more LzmaFilter::GroupSize of scratch space.
 */
 
 /*
@@ -161,6 +198,21 @@ Returns:
 
 SevenZipResult Lzma1Compress( const CLzmaData* data, CLzmaEncoderProperties* encoderProperties, CLzma1Result* result, MemoryInterface* alloc, ProgressInterface* progress );
 
+/*
+Lzma1CompressSmall
+------------------
+Compresses fewer than Lzma::SmallInputLimit bytes with setup sized to the input.
+EstimatedSourceDataSize is set to the source length, and the match-finder hash tables shrink with it, so
+the output can differ from Lzma1Compress (it is still a standard LZMA stream). There is no progress callback.
+Returns:
+  SZ_OK               - OK
+  SZ_ERROR_MEM        - Memory allocation error
+  SZ_ERROR_PARAM      - Incorrect parameter, or the input is too large
+  SZ_ERROR_OUTPUT_EOF - output buffer overflow
+*/
+
+SevenZipResult Lzma1CompressSmall( const CLzmaData* data, CLzmaEncoderProperties* encoderProperties, CLzma1Result* result, MemoryInterface* alloc );
+
 /*
 LzmaDecompress
 --------------
@@ -168,8 +220,87 @@ Returns:
   SZ_OK                - OK
   SZ_ERROR_DATA        - Data error
   SZ_ERROR_MEM         - Memory allocation error
-  SZ_ERROR_UNSUPPORTED - Unsupported properties
+  SZ_ERROR_UNSUPPORTED - Unsupported properties or filter
   SZ_ERROR_INPUT_EOF   - it needs more bytes in input buffer (src)
 */
 
 SevenZipResult Lzma1Decompress( CLzmaData* data, CLzma1Result* result, MemoryInterface* alloc );
+
+/**
+ * Lzma1EstimateDecoderMemory - the number of bytes Lzma1Decompress allocates for a stream
+ * Returns 0 if the properties are invalid.
+ */
+int64 Lzma1EstimateDecoderMemory( const uint8* properties );
+
+/**
+ * A snapshot of the LZMA1 decoder part way through a stream, from which decoding can resume without starting at byte 0.
+ * It holds the range coder and model state, and the window of output a later match can refer back to.
+ * Lzma1BuildCheckpoints() allocates the probabilities and window through the MemoryInterface, and Lzma1FreeCheckpoints()
+ * releases them.
+ */
+class CLzma1Checkpoint
+{
+public:
+	/** Where the snapshot was taken, in the compressed and decompressed data */
+	int64 CompressedOffset = 0;
+	int64 UncompressedOffset = 0;
+
+	/** The decoder state */
+	CProbability* Probabilities = nullptr;
+	int64 NumProbabilities = 0;
+	uint32 RepeatDistances[Lzma::NumRepeats] = {};
+	uint32 Range = 0u;
+	uint32 Code = 0u;
+	uint32 State = 0u;
+	uint32 ProcessedPosition = 0u;
+	uint32 CheckDictionarySize = 0u;
+	uint32 RemainingLength = 0u;
+
+	/** The WindowLength = min( DictionarySize, UncompressedOffset ) bytes before the checkpoint, in WindowSize bytes raw or as an LZMA1 stream */
+	uint8* Window = nullptr;
+	int64 WindowSize = 0;
+	int64 WindowLength = 0;
+	bool WindowCompressed = false;
+	uint8 WindowProperties[5] = {};
+};
+
+/*
+Lzma1BuildCheckpoints
+---------------------
+Decodes a whole LZMA1 stream once, taking a checkpoint every interval decompressed bytes.
+Only a dictionary sized window of output is held, so decompressedLength bytes of memory are not needed.
+Each checkpoint holds up to DictionarySize bytes of window; pass windowProperties to store the windows LZMA1
+compressed with those settings, or nullptr to store them raw.
+The checkpoints and their state are allocated through alloc, and must be released with Lzma1FreeCheckpoints() and the same
+alloc. On failure nothing is left allocated, and checkpoints is nullptr with a checkpointCount of 0.
+Returns:
+  SZ_OK                - OK
+  SZ_ERROR_PARAM       - Incorrect parameter
+  SZ_ERROR_DATA        - Data error
+  SZ_ERROR_MEM         - Memory allocation error
+  SZ_ERROR_UNSUPPORTED - Unsupported properties
+  SZ_ERROR_INPUT_EOF   - The stream ends before decompressedLength bytes
+*/
+
+SevenZipResult Lzma1BuildCheckpoints( const uint8* compressed, int64 compressedLength, const uint8* properties, int64 decompressedLength, int64 interval, const CLzmaEncoderProperties* windowProperties, CLzma1Checkpoint*& checkpoints, int64& checkpointCount, MemoryInterface* alloc );
+
+/**
+ * Lzma1FreeCheckpoints - release the checkpoints made by Lzma1BuildCheckpoints(), with the MemoryInterface that made them
+ */
+void Lzma1FreeCheckpoints( CLzma1Checkpoint* checkpoints, int64 checkpointCount, MemoryInterface* alloc );
+
+/*
+Lzma1DecompressRange
+--------------------
+Decompresses length bytes starting at offset, resuming from the last checkpoint at or before offset.
+Without a checkpoint that early, decoding starts from the beginning of the stream.
+Returns:
+  SZ_OK                - OK
+  SZ_ERROR_PARAM       - Incorrect parameter
+  SZ_ERROR_DATA        - Data error
+  SZ_ERROR_MEM         - Memory allocation error
+  SZ_ERROR_UNSUPPORTED - Unsupported properties, or a checkpoint made with different ones
+  SZ_ERROR_INPUT_EOF   - The stream ends before offset + length
+*/
+
+SevenZipResult Lzma1DecompressRange( const uint8* compressed, int64 compressedLength, const uint8* properties, const CLzma1Checkpoint* checkpoints, int64 checkpointCount, int64 offset, uint8* destination, int64 length, MemoryInterface* alloc );
@@ -3,6 +3,7 @@
 
 #include "7zTypes.h"
 
+#include "Crc.h"
 #include "Lzma1Lib.h"
 #include "Lzma1Dec.h"
 #include "Lzma2Dec.h"
@@ -43,6 +44,7 @@ class Lzma2Dec
 public:
 	Lzma2Dec( uint8* decompressed, MemoryInterface* alloc )
 		: Decoder( decompressed, alloc )
+		, Decompressed( decompressed )
 	{
 	}
 
@@ -52,10 +54,16 @@ public:
 
 	Lzma1Dec Decoder;
 
+	/** Receives the decompressed data a chunk at a time, if set */
+	CChecksum* Checksum = nullptr;
+
 private:
 	Lzma2State DecodeProperties( uint8 stateByte );
 	Lzma2State UpdateState( uint8 stateByte );
 
+	/** The decoder's dictionary, which is the whole output */
+	const uint8* Decompressed = nullptr;
+
 	Lzma2State StateControl = Lzma2State::Lzma2StateControl;
 	uint8 Control = 0;
 	uint8 NeedInitLevel = 224u;
@@ -255,6 +263,10 @@ SevenZipResult Lzma2Dec::DecodeToDictionary( const int64 dictLimit, const uint8*
 			}
 
 			Decoder.UpdateWithDecompressed( compressed, compressedLength, in_current );
+			if( Checksum != nullptr )
+			{
+				Checksum->Update( Decompressed + initial_dictionary_position, in_current );
+			}
 
 			compressedLength += in_current;
 			UnpackSize -= static_cast< uint32 >( in_current );
@@ -282,6 +294,12 @@ SevenZipResult Lzma2Dec::DecodeToDictionary( const int64 dictLimit, const uint8*
 			out_current = Decoder.DictionaryPosition - initial_dictionary_position;
 			UnpackSize -= static_cast< uint32 >( out_current );
 
+			// Checksum the output while it is still in cache
+			if( Checksum != nullptr )
+			{
+				Checksum->Update( Decompressed + initial_dictionary_position, out_current );
+			}
+
 			if( result != SevenZipResult::SevenZipOK )
 			{
 				break;
@@ -318,6 +336,95 @@ SevenZipResult Lzma2Dec::DecodeToDictionary( const int64 dictLimit, const uint8*
 	return SevenZipResult::SevenZipErrorData;
 }
 
+/**
+ * @brief Finds how far ahead of the output the compressed data must start for the stream to decode in place.
+ *
+ * Tracks the output written against the input consumed, chunk by chunk. An LZMA chunk is assumed to
+ * write all of its output before any of its packed bytes are consumed; a copy chunk moves its bytes
+ * down and can never overtake its own input.
+ *
+ * @param compressed         Pointer to the compressed LZMA2 stream.
+ * @param compressedLength   Number of compressed bytes available.
+ * @param inputOffset        On exit: the smallest offset of the compressed data from the output start.
+ * @param decompressedLength On exit: the number of bytes the stream decodes to.
+ * @param progress           Optional progress interface, called after each Lzma::Lzma2DecodeProgressInterval bytes of input are walked.
+ * @return SevenZipOK on success, SevenZipErrorData on a malformed header, SevenZipErrorInputEof if the stream is truncated.
+ */
+SevenZipResult Lzma2GetInPlaceLayout( const uint8* compressed, const int64 compressedLength, int64& inputOffset, int64& decompressedLength, ProgressInterface* progress )
+{
+	int64 in_position = 0;
+	int64 out_position = 0;
+	int64 overrun = 0;
+	int64 next_progress = Lzma::Lzma2DecodeProgressInterval;
+
+	inputOffset = 0;
+	decompressedLength = 0;
+
+	while( true )
+	{
+		if( in_position >= compressedLength )
+		{
+			return SevenZipResult::SevenZipErrorInputEof;
+		}
+
+		const uint8 control = compressed[in_position];
+		if( control == Lzma::Lzma2ControlEof )
+		{
+			break;
+		}
+
+		int64 header_size;
+		if( ( control & Lzma::Lzma2ControlLzma ) == 0u )
+		{
+			if( control > Lzma::Lzma2ControlCopy )
+			{
+				return SevenZipResult::SevenZipErrorData;
+			}
+
+			header_size = 3;
+		}
+		else
+		{
+			// Chunks that set new properties carry one more byte
+			header_size = ( control >= 192u ) ? 6 : 5;
+		}
+
+		if( in_position + header_size > compressedLength )
+		{
+			return SevenZipResult::SevenZipErrorInputEof;
+		}
+
+		int64 unpack_size = ( static_cast< int64 >( compressed[in_position + 1] ) << 8 ) + compressed[in_position + 2] + 1;
+		int64 pack_size = unpack_size;
+		if( header_size > 3 )
+		{
+			unpack_size += static_cast< int64 >( control & 31u ) << 16;
+			pack_size = ( static_cast< int64 >( compressed[in_position + 3] ) << 8 ) + compressed[in_position + 4] + 1;
+		}
+
+		in_position += header_size;
+		overrun = std::max( overrun, out_position + ( header_size > 3 ? unpack_size : 0 ) - in_position );
+
+		in_position += pack_size;
+		out_position += unpack_size;
+
+		if( progress != nullptr && in_position >= next_progress )
+		{
+			const SevenZipResult result = progress->Progress( in_position, out_position );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+
+			next_progress = in_position + Lzma::Lzma2DecodeProgressInterval;
+		}
+	}
+
+	inputOffset = overrun;
+	decompressedLength = out_position;
+	return SevenZipResult::SevenZipOK;
+}
+
 /**
  * @brief Decompresses a complete LZMA2 stream in a single call.
  *
@@ -331,11 +438,14 @@ SevenZipResult Lzma2Dec::DecodeToDictionary( const int64 dictLimit, const uint8*
  * @param finishMode         LzmaFinishModeAny or LzmaFinishModeEnd.
  * @param status             Receives the decoder status on return.
  * @param alloc              Memory allocator; pass nullptr to use the default allocator.
+ * @param checksum           Optional checksum to update with the decompressed data; pass nullptr to disable.
+ * @param progress           Optional progress interface, called before each Lzma::Lzma2DecodeProgressInterval bytes of output.
  * @return SevenZipOK on success, or an error code.
  */
-SevenZipResult Lzma2Decode( uint8* decompressed, int64& decompressedLength, const uint8* compressed, int64& compressedLength, const uint8 prop, LzmaFinishMode finishMode, LzmaStatus& status, MemoryInterface* alloc )
+SevenZipResult Lzma2Decode( uint8* decompressed, int64& decompressedLength, const uint8* compressed, int64& compressedLength, const uint8 prop, LzmaFinishMode finishMode, LzmaStatus& status, MemoryInterface* alloc, CChecksum* checksum, ProgressInterface* progress )
 {
 	Lzma2Dec dec2( decompressed, alloc );
+	dec2.Checksum = checksum;
 	uint8 decoder_properties[Lzma::LzmaPropertiesSize];
 
 	// Decode Lzma2 byte summary to 5 byte array of Lzma1 properties
@@ -370,8 +480,28 @@ SevenZipResult Lzma2Decode( uint8* decompressed, int64& decompressedLength, cons
 	dec2.Decoder.DictionaryPosition = 0u;
 	dec2.Decoder.InitDictAndState( true, true );
 
-	compressedLength = in_size;
-	result = dec2.DecodeToDictionary( out_size, compressed, compressedLength, finishMode, status );
+	// With a progress interface, decode in slices and report before each one; the last slice uses the caller's finish mode
+	const int64 slice_size = ( progress != nullptr ) ? Lzma::Lzma2DecodeProgressInterval : out_size;
+	do
+	{
+		if( progress != nullptr )
+		{
+			result = progress->Progress( compressedLength, dec2.Decoder.DictionaryPosition );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				break;
+			}
+		}
+
+		const int64 dict_limit = dec2.Decoder.DictionaryPosition + std::min( slice_size, out_size - dec2.Decoder.DictionaryPosition );
+		const LzmaFinishMode slice_finish_mode = ( dict_limit == out_size ) ? finishMode : LzmaFinishMode::LzmaFinishModeAny;
+
+		int64 in_current = in_size - compressedLength;
+		result = dec2.DecodeToDictionary( dict_limit, compressed + compressedLength, in_current, slice_finish_mode, status );
+		compressedLength += in_current;
+	}
+	while( result == SevenZipResult::SevenZipOK && status == LzmaStatus::LzmaStatusNotFinished && dec2.Decoder.DictionaryPosition < out_size );
+
 	decompressedLength = dec2.Decoder.DictionaryPosition;
 	if( result == SevenZipResult::SevenZipOK && status == LzmaStatus::LzmaStatusNeedsMoreInput )
 	{
@@ -20,6 +20,26 @@ Returns:
   SZ_ERROR_MEM  - Memory allocation error
   SZ_ERROR_UNSUPPORTED - Unsupported properties
   SZ_ERROR_INPUT_EOF - It needs more bytes in input buffer (src).
+
+checksum - if not nullptr, updated with the output as each chunk is decoded
+progress - if not nullptr, called with the bytes read and written so far before each Lzma::Lzma2DecodeProgressInterval
+           bytes of output are decoded; anything but SZ_OK stops the decode with that result
+*/
+
+SevenZipResult Lzma2Decode( uint8* decompressed, int64& decompressedLength, const uint8* compressed, int64& compressedLength, const uint8 prop, LzmaFinishMode finishMode, LzmaStatus& status, MemoryInterface* alloc, CChecksum* checksum, ProgressInterface* progress );
+
+/*
+Lzma2GetInPlaceLayout - walks the chunk headers of a stream without decoding it
+  inputOffset        - the smallest distance from the start of the output to the compressed data
+                       that keeps every write behind the unread input
+  decompressedLength - the total size of the stream when decoded
+  progress           - if not nullptr, called with the bytes walked and their decoded size after each
+                       Lzma::Lzma2DecodeProgressInterval bytes of input; anything but SZ_OK stops the walk with that result
+
+Returns:
+  SZ_OK
+  SZ_ERROR_DATA - Data error
+  SZ_ERROR_INPUT_EOF - The stream is truncated
 */
 
-SevenZipResult Lzma2Decode( uint8* decompressed, int64& decompressedLength, const uint8* compressed, int64& compressedLength, const uint8 prop, LzmaFinishMode finishMode, LzmaStatus& status, MemoryInterface* alloc );
+SevenZipResult Lzma2GetInPlaceLayout( const uint8* compressed, const int64 compressedLength, int64& inputOffset, int64& decompressedLength, ProgressInterface* progress );
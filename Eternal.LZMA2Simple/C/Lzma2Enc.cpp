@@ -7,6 +7,24 @@
 #include "Lzma1Enc.h"
 #include "Lzma2Enc.h"
 
+#include <cmath>
+
+namespace Lzma2Encoder
+{
+	// Smallest lookahead worth sampling; below this the order-0 estimate is too noisy
+	static constexpr uint32 MinimumSampleSize = 1u << 14;
+
+	// Order-0 entropy at or above which a chunk is predicted to be stored as a copy chunk anyway
+	static constexpr double IncompressibleBitsPerByte = 7.97;
+
+	// Repeated 4-byte sequences are probed with a small direct-mapped table
+	static constexpr int8 RepeatProbeHashBits = 12;
+	static constexpr uint32 RepeatProbeHashSize = 1u << RepeatProbeHashBits;
+
+	// More than 1/RepeatProbeHitDivisor repeated sequences means the LZ stage will find matches
+	static constexpr uint32 RepeatProbeHitDivisor = 32u;
+}
+
 /* ---------- CheckedSeqInStream ---------- */
 
 class CheckedSeqInStream
@@ -81,15 +99,26 @@ public:
 	}
 
 	uint8 GetCodedDictionary() const;
+	static bool IsIncompressible( const uint8* data, uint32 size );
 	SevenZipResult InitStream();
 	void InitBlock();
 	SevenZipResult EncodeSubblock( int64& packSizeRes, OutStreamInterface& outStream );
 	SevenZipResult EncodeStream( OutStreamInterface& outStream, InStreamInterface& inStream, bool finished );
+	SevenZipResult EncodeMemory( OutStreamInterface& outStream, const uint8* source, int64 sourceLength );
+	void UseCompactHash() const;
 
 	bool PropertiesAreSet = false;
 
+	/** Receives the source data a chunk at a time, if set */
+	CChecksum* Checksum = nullptr;
+
 private:
-	const CLzmaEncoderProperties* EncoderProperties = nullptr;
+	SevenZipResult EncodeBlock( OutStreamInterface& outStream, const int64 unpackTotal, int64& packTotal );
+	SevenZipResult WriteEndMarker( OutStreamInterface& outStream );
+	uint8* GetChunkBuffer( const uint32 chunkSize, OutStreamInterface& outStream );
+	SevenZipResult WriteCopyChunks( const uint8* data, uint32 unpackSize, const int64 packSizeLimit, int64& packSizeRes, OutStreamInterface& outStream );
+
+	const CLzma2EncoderProperties* EncoderProperties = nullptr;
 	MemoryInterface* Alloc = nullptr;
 	ProgressInterface* Progress = nullptr;
 	uint8* WorkBuffer = nullptr;
@@ -139,6 +168,130 @@ void Lzma2Enc::InitBlock()
 	NeedInitProp = true;
 }
 
+/**
+ * @brief Estimates whether a run of bytes would end up stored as an LZMA2 copy chunk.
+ *
+ * Uses an order-0 entropy estimate backed up by a probe for repeated 4-byte sequences, so
+ * random or already compressed data is rejected without running the optimal parser over it.
+ *
+ * @param data Pointer to the bytes to examine.
+ * @param size Number of bytes to examine.
+ * @return true if the bytes look incompressible.
+ */
+bool Lzma2Enc::IsIncompressible( const uint8* data, uint32 size )
+{
+	// Four interleaved histograms avoid store-to-load stalls on runs of the same byte
+	uint32 histograms[4][256] = {};
+	uint32 index = 0u;
+	for( ; index + 4u <= size; index += 4u )
+	{
+		histograms[0][data[index + 0u]]++;
+		histograms[1][data[index + 1u]]++;
+		histograms[2][data[index + 2u]]++;
+		histograms[3][data[index + 3u]]++;
+	}
+
+	for( ; index < size; index++ )
+	{
+		histograms[0][data[index]]++;
+	}
+
+	double entropy = 0.0;
+	const double inverse_size = 1.0 / static_cast<double>( size );
+	for( uint32 symbol = 0u; symbol < 256u; symbol++ )
+	{
+		const uint32 count = histograms[0][symbol] + histograms[1][symbol] + histograms[2][symbol] + histograms[3][symbol];
+		if( count != 0u )
+		{
+			const double probability = static_cast<double>( count ) * inverse_size;
+			entropy -= probability * std::log2( probability );
+		}
+	}
+
+	if( entropy < Lzma2Encoder::IncompressibleBitsPerByte )
+	{
+		return false;
+	}
+
+	// High order-0 entropy can still hide long repeats that the match finder would exploit
+	uint32 sequences[Lzma2Encoder::RepeatProbeHashSize] = {};
+	uint32 repeats = 0u;
+	const uint32 repeat_limit = size / Lzma2Encoder::RepeatProbeHitDivisor;
+	for( index = 0u; index + 4u <= size; index++ )
+	{
+		const uint32 sequence = static_cast<uint32>( data[index] ) | ( static_cast<uint32>( data[index + 1u] ) << 8 ) | ( static_cast<uint32>( data[index + 2u] ) << 16 ) | ( static_cast<uint32>( data[index + 3u] ) << 24 );
+		const uint32 slot = ( sequence * 0x9E3779B1u ) >> ( 32 - Lzma2Encoder::RepeatProbeHashBits );
+		if( sequences[slot] == sequence )
+		{
+			if( ++repeats > repeat_limit )
+			{
+				return false;
+			}
+		}
+
+		sequences[slot] = sequence;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Returns the buffer to build the next chunk in.
+ *
+ * Chunks are built straight in the destination when the stream exposes room for them, so the
+ * following Write() does not copy them again. Otherwise they are staged in the work buffer.
+ *
+ * @param chunkSize The largest number of bytes the chunk can take.
+ * @param outStream Destination stream the chunk will be written to.
+ * @return Pointer to at least chunkSize writable bytes.
+ */
+uint8* Lzma2Enc::GetChunkBuffer( const uint32 chunkSize, OutStreamInterface& outStream )
+{
+	uint8* chunk = outStream.GetWriteBuffer( chunkSize );
+	return ( chunk != nullptr ) ? chunk : WorkBuffer;
+}
+
+/**
+ * @brief Writes uncompressed bytes as a series of LZMA2 copy chunks.
+ *
+ * @param data          Pointer to the uncompressed bytes.
+ * @param unpackSize    Number of bytes to store.
+ * @param packSizeLimit Maximum number of bytes that may be written for this sub-block.
+ * @param packSizeRes   Incremented by the number of bytes written to outStream.
+ * @param outStream     Destination stream to write the copy chunks to.
+ * @return SevenZipOK on success, SevenZipErrorOutputEof if the output limit is exceeded.
+ */
+SevenZipResult Lzma2Enc::WriteCopyChunks( const uint8* data, uint32 unpackSize, const int64 packSizeLimit, int64& packSizeRes, OutStreamInterface& outStream )
+{
+	while( unpackSize > 0u )
+	{
+		const uint32 copy_chunk_size = ( unpackSize < Lzma::Lzma2CopyChunkSize ) ? unpackSize : Lzma::Lzma2CopyChunkSize;
+		if( packSizeLimit < copy_chunk_size + 3u )
+		{
+			return SevenZipResult::SevenZipErrorOutputEof;
+		}
+
+		uint8* chunk = GetChunkBuffer( copy_chunk_size + 3u, outStream );
+		uint32 dest_position = 0u;
+		chunk[dest_position++] = static_cast<uint8>( ( SourcePosition == 0 ? Lzma::Lzma2ControlCopyResetDict : Lzma::Lzma2ControlCopy ) & 0xff );
+		chunk[dest_position++] = static_cast<uint8>( ( ( copy_chunk_size - 1u ) >> 8 ) & 0xff );
+		chunk[dest_position++] = static_cast<uint8>( ( copy_chunk_size - 1u ) & 0xff );
+		memcpy( chunk + dest_position, data, copy_chunk_size );
+		data += copy_chunk_size;
+		unpackSize -= copy_chunk_size;
+		dest_position += copy_chunk_size;
+		SourcePosition += copy_chunk_size;
+
+		packSizeRes += dest_position;
+		if( outStream.Write( chunk, 0, dest_position ) != dest_position )
+		{
+			return SevenZipResult::SevenZipErrorWrite;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
 /**
  * @brief Encodes one LZMA2 sub-block, choosing between LZMA and copy mode automatically.
  *
@@ -161,16 +314,53 @@ SevenZipResult Lzma2Enc::EncodeSubblock( int64& packSizeRes, OutStreamInterface&
 		return SevenZipResult::SevenZipErrorOutputEof;
 	}
 
+	if( EncoderProperties->DetectIncompressible )
+	{
+		// Store data that would only become a copy chunk without running the parser over it
+		const uint8* lookahead = nullptr;
+		const uint32 sample_size = std::min( Encoder.GetLookahead( lookahead ), Lzma::Lzma2CopyChunkSize );
+		if( sample_size >= Lzma2Encoder::MinimumSampleSize && IsIncompressible( lookahead, sample_size ) )
+		{
+			const SevenZipResult result = WriteCopyChunks( lookahead, sample_size, pack_size_limit, packSizeRes, outStream );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+
+			if( Checksum != nullptr )
+			{
+				Checksum->Update( lookahead, sample_size );
+			}
+
+			return Encoder.SkipUncompressed( sample_size );
+		}
+	}
+
 	pack_size -= lz_header_size;
 
-	Encoder.SaveState();
-	SevenZipResult result = Encoder.CodeOneMemBlock( NeedInitState, WorkBuffer, lz_header_size, pack_size, Lzma::Lzma2MaxPackSize, unpack_size );
+	uint8* chunk = GetChunkBuffer( Lzma::Lzma2MaxCompressedChunkSize, outStream );
+
+	// A chunk that resets the state is followed by another reset if it falls back to a copy chunk, so there is nothing to restore
+	const bool save_state = !NeedInitState;
+	if( save_state )
+	{
+		Encoder.SaveState();
+	}
+
+	SevenZipResult result = Encoder.CodeOneMemBlock( NeedInitState, chunk, lz_header_size, pack_size, Lzma::Lzma2MaxPackSize, unpack_size );
 
 	if( unpack_size == 0u )
 	{
 		return result;
 	}
 
+	// The chunk was just read by the match finder, so it is still in cache
+	const uint8* unpacked = Encoder.GetBufferBase() + Encoder.GetCurrentOffset() - unpack_size;
+	if( Checksum != nullptr )
+	{
+		Checksum->Update( unpacked, unpack_size );
+	}
+
 	if( result == SevenZipResult::SevenZipOK )
 	{
 		use_copy_block = ( pack_size + 2u >= unpack_size ) || ( pack_size > static_cast<int64>( Lzma::Lzma2MaxPackSize ) );
@@ -185,52 +375,36 @@ SevenZipResult Lzma2Enc::EncodeSubblock( int64& packSizeRes, OutStreamInterface&
 		use_copy_block = true;
 	}
 
-	uint32 dest_position = 0;
 	if( use_copy_block )
 	{
-		while( unpack_size > 0u )
+		result = WriteCopyChunks( unpacked, unpack_size, pack_size_limit, packSizeRes, outStream );
+		if( result != SevenZipResult::SevenZipOK )
 		{
-			const uint32 copy_chunk_size = ( unpack_size < Lzma::Lzma2CopyChunkSize ) ? unpack_size : Lzma::Lzma2CopyChunkSize;
-			if( pack_size_limit - dest_position < copy_chunk_size + 3u )
-			{
-				return SevenZipResult::SevenZipErrorOutputEof;
-			}
-
-			WorkBuffer[dest_position++] = static_cast<uint8>( ( SourcePosition == 0 ? Lzma::Lzma2ControlCopyResetDict : Lzma::Lzma2ControlCopy ) & 0xff );
-			WorkBuffer[dest_position++] = static_cast<uint8>( ( ( copy_chunk_size - 1u ) >> 8 ) & 0xff );
-			WorkBuffer[dest_position++] = static_cast<uint8>( ( copy_chunk_size - 1u ) & 0xff );
-			memcpy( WorkBuffer + dest_position, Encoder.GetBufferBase() + Encoder.GetCurrentOffset() - unpack_size, copy_chunk_size );
-			unpack_size -= copy_chunk_size;
-			dest_position += copy_chunk_size;
-			SourcePosition += copy_chunk_size;
-
-			packSizeRes += dest_position;
-			if( outStream.Write( WorkBuffer, 0, dest_position ) != dest_position )
-			{
-				return SevenZipResult::SevenZipErrorWrite;
-			}
+			return result;
+		}
 
-			dest_position = 0u;
+		if( save_state )
+		{
+			Encoder.RestoreState();
 		}
 
-		Encoder.RestoreState();
 		return SevenZipResult::SevenZipOK;
 	}
 
-	dest_position = 0u;
+	uint32 dest_position = 0u;
 	uint32 copy_size = unpack_size - 1u;
 	const uint32 write_pack_size = static_cast<uint32>( pack_size - 1u );
 	const uint32 mode = ( SourcePosition == 0 ) ? 3u : ( NeedInitState ? ( NeedInitProp ? 2u : 1u ) : 0u );
 
-	WorkBuffer[dest_position++] = static_cast<uint8>( (Lzma::Lzma2ControlLzma | ( mode << 5 ) | ( ( copy_size >> 16 ) & 31u ) ) );
-	WorkBuffer[dest_position++] = static_cast<uint8>( ( copy_size >> 8 ) & 0xff );
-	WorkBuffer[dest_position++] = static_cast<uint8>( copy_size & 0xff );
-	WorkBuffer[dest_position++] = static_cast<uint8>( ( write_pack_size >> 8 ) & 0xff );
-	WorkBuffer[dest_position++] = static_cast<uint8>( write_pack_size & 0xff );
+	chunk[dest_position++] = static_cast<uint8>( (Lzma::Lzma2ControlLzma | ( mode << 5 ) | ( ( copy_size >> 16 ) & 31u ) ) );
+	chunk[dest_position++] = static_cast<uint8>( ( copy_size >> 8 ) & 0xff );
+	chunk[dest_position++] = static_cast<uint8>( copy_size & 0xff );
+	chunk[dest_position++] = static_cast<uint8>( ( write_pack_size >> 8 ) & 0xff );
+	chunk[dest_position++] = static_cast<uint8>( write_pack_size & 0xff );
 
 	if( NeedInitProp )
 	{
-		WorkBuffer[dest_position++] = PropertiesByte;
+		chunk[dest_position++] = PropertiesByte;
 	}
 
 	NeedInitProp = false;
@@ -238,7 +412,7 @@ SevenZipResult Lzma2Enc::EncodeSubblock( int64& packSizeRes, OutStreamInterface&
 	dest_position += static_cast<uint32>( pack_size );
 	SourcePosition += unpack_size;
 
-	if( outStream.Write( WorkBuffer, 0, dest_position ) != dest_position )
+	if( outStream.Write( chunk, 0, dest_position ) != dest_position )
 	{
 		return SevenZipResult::SevenZipErrorWrite;
 	}
@@ -252,11 +426,15 @@ SevenZipResult Lzma2Enc::EncodeSubblock( int64& packSizeRes, OutStreamInterface&
 /**
  * @brief Validates and fills in default values for all LZMA2 encoder properties.
  *
- * @return SevenZipOK on success, SevenZipErrorParam if the literal-bit combination is invalid.
+ * @return SevenZipOK on success, SevenZipErrorParam if the literal-bit combination or the filter is invalid.
  */
 SevenZipResult CLzma2EncoderProperties::Normalize()
 {
-	CLzmaEncoderProperties::Normalize();
+	const SevenZipResult result = CLzmaEncoderProperties::Normalize();
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
 
 	FastBytes = std::clamp<int16>( FastBytes, Lzma::Lzma2MinMatchLength, Lzma::MaxMatchLength );
 
@@ -277,6 +455,18 @@ SevenZipResult CLzma2EncoderProperties::Normalize()
 	return SevenZipResult::SevenZipOK;
 }
 
+/**
+ * @brief Returns the number of bytes the LZMA2 encoder allocates with these properties.
+ *
+ * Adds the chunk work buffer to the LZMA1 encoder's allocations, whose window keeps a whole chunk.
+ *
+ * @return The total of every allocation made through the MemoryInterface.
+ */
+int64 CLzma2EncoderProperties::EstimateEncoderMemory() const
+{
+	return EstimateLzmaEncoderMemory( Lzma::Lzma2KeepWindowSize ) + Lzma::Lzma2MaxCompressedChunkSize;
+}
+
 /* ---------- Lzma2 ---------- */
 
 /**
@@ -299,6 +489,62 @@ uint8 Lzma2Enc::GetCodedDictionary() const
 	return dict_index;
 }
 
+/**
+ * @brief Encodes sub-blocks until the encoder has consumed all of its current input.
+ *
+ * @param outStream   Destination stream to write the sub-blocks to.
+ * @param unpackTotal Number of uncompressed bytes encoded by earlier blocks, for progress reporting.
+ * @param packTotal   Incremented by the number of compressed bytes written.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma2Enc::EncodeBlock( OutStreamInterface& outStream, const int64 unpackTotal, int64& packTotal )
+{
+	while( true )
+	{
+		int64 pack_size = Lzma::Lzma2MaxCompressedChunkSize;
+
+		SevenZipResult result = EncodeSubblock( pack_size, outStream );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		packTotal += pack_size;
+
+		if( Progress != nullptr )
+		{
+			result = Progress->Progress( unpackTotal + SourcePosition, packTotal );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+		}
+
+		// Check if subblock encoding is complete
+		if( pack_size == 0 )
+		{
+			return SevenZipResult::SevenZipOK;
+		}
+	}
+}
+
+/**
+ * @brief Writes the LZMA2 end-of-stream marker.
+ *
+ * @param outStream Destination stream to write the marker to.
+ * @return SevenZipOK on success, SevenZipErrorWrite if the stream is full.
+ */
+SevenZipResult Lzma2Enc::WriteEndMarker( OutStreamInterface& outStream )
+{
+	constexpr uint8 eof_byte = Lzma::Lzma2ControlEof;
+	if( outStream.Write( &eof_byte, 0, 1u ) != 1u )
+	{
+		return SevenZipResult::SevenZipErrorWrite;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
 /**
  * @brief Encodes an entire input stream into an LZMA2 output stream.
  *
@@ -345,36 +591,7 @@ SevenZipResult Lzma2Enc::EncodeStream( OutStreamInterface& outStream, InStreamIn
 			return result;
 		}
 
-		// Encode subblocks within current block
-		while( true )
-		{
-			int64 pack_size = Lzma::Lzma2MaxCompressedChunkSize;
-
-			result = EncodeSubblock( pack_size, outStream );
-
-			if( result != SevenZipResult::SevenZipOK )
-			{
-				break;
-			}
-
-			pack_total += pack_size;
-
-			if( Progress != nullptr )
-			{
-				result = Progress->Progress( unpack_total + SourcePosition, pack_total );
-				if( result != SevenZipResult::SevenZipOK )
-				{
-					break;
-				}
-			}
-
-			// Check if subblock encoding is complete
-			if( pack_size == 0 )
-			{
-				break;
-			}
-		}
-
+		result = EncodeBlock( outStream, unpack_total, pack_total );
 		unpack_total += SourcePosition;
 
 		if( result != SevenZipResult::SevenZipOK )
@@ -393,20 +610,65 @@ SevenZipResult Lzma2Enc::EncodeStream( OutStreamInterface& outStream, InStreamIn
 		if( limited_in_stream.Finished )
 		{
 			// Write EOF marker if requested
-			if( finished )
-			{
-				constexpr uint8 eof_byte = Lzma::Lzma2ControlEof;
-				if( outStream.Write( &eof_byte, 0, 1u ) != 1u )
-				{
-					return SevenZipResult::SevenZipErrorWrite;
-				}
-			}
-
-			return SevenZipResult::SevenZipOK;
+			return finished ? WriteEndMarker( outStream ) : SevenZipResult::SevenZipOK;
 		}
 	}
 }
 
+/**
+ * @brief Encodes an in-memory buffer into an LZMA2 output stream, followed by the end-of-stream marker.
+ *
+ * The match finder reads the source buffer directly, so no input window is allocated and
+ * the data is never copied or moved.
+ *
+ * @param outStream    Destination stream to write the compressed LZMA2 data to.
+ * @param source       Pointer to the uncompressed data.
+ * @param sourceLength Number of uncompressed bytes to encode.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma2Enc::EncodeMemory( OutStreamInterface& outStream, const uint8* source, int64 sourceLength )
+{
+	int64 pack_total = 0;
+
+	SevenZipResult result = InitStream();
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	InitBlock();
+
+	// Match the stream encoder, which never knows the size up front
+	Encoder.SetDataSize( ExpectedDataSize );
+
+	result = Encoder.MemPrepare( source, sourceLength, Lzma::Lzma2KeepWindowSize );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	result = EncodeBlock( outStream, 0, pack_total );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	if( SourcePosition != sourceLength )
+	{
+		return SevenZipResult::SevenZipErrorFail;
+	}
+
+	return WriteEndMarker( outStream );
+}
+
+/**
+ * @brief Sizes the match-finder hash tables to the data; see Lzma1Enc::UseCompactHash().
+ */
+void Lzma2Enc::UseCompactHash() const
+{
+	Encoder.UseCompactHash();
+}
+
 /**
  * @brief Compresses an input stream using LZMA2 and writes the result to an output stream.
  *
@@ -416,11 +678,13 @@ SevenZipResult Lzma2Enc::EncodeStream( OutStreamInterface& outStream, InStreamIn
  * @param propertySummary   Output byte to receive the one-byte LZMA2 property summary.
  * @param alloc             Memory allocator for internal buffers.
  * @param progress          Optional progress callback; pass nullptr to disable.
+ * @param checksum          Optional checksum to update with the source data; pass nullptr to disable.
  * @return SevenZipOK on success, or an error code.
  */
-SevenZipResult Lzma2Encode( OutStreamInterface& outStream, InStreamInterface& inStream, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress )
+SevenZipResult Lzma2Encode( OutStreamInterface& outStream, InStreamInterface& inStream, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress, CChecksum* checksum )
 {
 	Lzma2Enc enc2( encoderProperties, alloc, progress );
+	enc2.Checksum = checksum;
 
 	/** Dict size - this needs passing to Lzma2Decode() */
 	*propertySummary = enc2.GetCodedDictionary();
@@ -430,3 +694,34 @@ SevenZipResult Lzma2Encode( OutStreamInterface& outStream, InStreamInterface& in
 	SevenZipResult result = enc2.EncodeStream( outStream, inStream, true );
 	return result;
 }
+
+/**
+ * @brief Compresses an in-memory buffer using LZMA2 and writes the result to an output stream.
+ *
+ * @param outStream         Destination stream to receive the compressed output.
+ * @param source            Pointer to the uncompressed data.
+ * @param sourceLength      Number of uncompressed bytes to encode.
+ * @param encoderProperties Encoder configuration parameters.
+ * @param propertySummary   Output byte to receive the one-byte LZMA2 property summary.
+ * @param alloc             Memory allocator for internal buffers.
+ * @param progress          Optional progress callback; pass nullptr to disable.
+ * @param compactHash       If true, sizes the match-finder hash tables to the data; see Lzma1Enc::UseCompactHash().
+ * @param checksum          Optional checksum to update with the source data; pass nullptr to disable.
+ * @return SevenZipOK on success, or an error code.
+ */
+SevenZipResult Lzma2EncodeMemory( OutStreamInterface& outStream, const uint8* source, int64 sourceLength, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress, const bool compactHash, CChecksum* checksum )
+{
+	Lzma2Enc enc2( encoderProperties, alloc, progress );
+	enc2.Checksum = checksum;
+	if( compactHash )
+	{
+		enc2.UseCompactHash();
+	}
+
+	/** Dict size - this needs passing to Lzma2Decode() */
+	*propertySummary = enc2.GetCodedDictionary();
+
+	enc2.PropertiesAreSet = false;
+
+	return enc2.EncodeMemory( outStream, source, sourceLength );
+}
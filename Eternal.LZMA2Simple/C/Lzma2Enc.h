@@ -20,4 +20,5 @@ int32:
   SZ_ERROR_THREAD - error in multithreading functions (only for Mt version)
 */
 
-SevenZipResult Lzma2Encode( OutStreamInterface& outStream, InStreamInterface& inStream, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress );
+SevenZipResult Lzma2Encode( OutStreamInterface& outStream, InStreamInterface& inStream, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress, CChecksum* checksum );
+SevenZipResult Lzma2EncodeMemory( OutStreamInterface& outStream, const uint8* source, int64 sourceLength, const CLzma2EncoderProperties* encoderProperties, uint8* propertySummary, MemoryInterface* alloc, ProgressInterface* progress, const bool compactHash, CChecksum* checksum );
@@ -4,8 +4,10 @@
 #include "7zTypes.h"
 
 #include "Lzma2Lib.h"
+#include "Lzma1Dec.h"
 #include "Lzma2Dec.h"
 #include "Lzma2Enc.h"
+#include "LinuxFile.h"
 
 static MemoryInterface allocator;
 
@@ -27,7 +29,11 @@ public:
 	{
 		if( Offset + size < Size )
 		{
-			memcpy( DestinationData + Offset, bufferBase + offset, static_cast<uint64>( size ) );
+			if( bufferBase + offset != DestinationData + Offset )
+			{
+				memcpy( DestinationData + Offset, bufferBase + offset, static_cast<uint64>( size ) );
+			}
+
 			Offset += size;
 			return size;
 		}
@@ -35,6 +41,17 @@ public:
 		return 0;
 	}
 
+	/** Returns: the current write position if a Write() of size bytes would succeed there, otherwise nullptr */
+	virtual uint8* GetWriteBuffer( const int64 size ) override
+	{
+		if( Offset + size < Size )
+		{
+			return DestinationData + Offset;
+		}
+
+		return nullptr;
+	}
+
 	/**
 	 * @brief Returns the number of bytes written to the output buffer so far.
 	 *
@@ -51,43 +68,97 @@ private:
 	int64 Offset;
 };
 
-class FMemoryReader
-	: public InStreamInterface
+/**
+ * @brief Compares the checksum computed while decoding with the one the caller passed in.
+ *
+ * @param checksum The checksum of the decompressed data.
+ * @param result   The decompression result; Result becomes SevenZipErrorCrc on a mismatch.
+ * @return The final result.
+ */
+static SevenZipResult CheckChecksum( const CChecksum& checksum, CLzma2Result* result )
 {
-public:
-	FMemoryReader( const uint8* sourceData, int64 size )
+	if( result->Result == SevenZipResult::SevenZipOK && checksum.Type != ChecksumType::ChecksumTypeNone && checksum.Value != result->ChecksumValue )
 	{
-		SourceData = sourceData;
-		Size = size;
-		Offset = 0;
+		result->Result = SevenZipResult::SevenZipErrorCrc;
 	}
 
-	virtual ~FMemoryReader() override = default;
+	return result->Result;
+}
 
-	/** if (input(*size) != 0 && output(*size) == 0) means end_of_stream. (output(*size) < input(*size)) is allowed */
-	virtual SevenZipResult Read( uint8* bufferBase, const int64 offset, int64* size ) override
+/**
+ * @brief Compresses a block of memory to a stream, through the filter if one is set; everything but OutputLength is filled in.
+ *
+ * @param outStream         Stream to write the compressed data to.
+ * @param source            The data to compress.
+ * @param sourceLength      Number of bytes to compress.
+ * @param encoderProperties Normalized encoder properties.
+ * @param result            Receives the result, property summary, checksum and filter.
+ * @param alloc             Memory allocator.
+ * @param progress          Optional progress interface.
+ * @return The result.
+ */
+static SevenZipResult CompressToStream( OutStreamInterface& outStream, const uint8* source, const int64 sourceLength, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	CChecksum checksum( encoderProperties->Checksum );
+
+	if( encoderProperties->Filter == LzmaFilterType::LzmaFilterTypeNone )
 	{
-		if( Offset == Size )
-		{
-			*size = 0;
-			return SevenZipResult::SevenZipOK;
-		}
+		result->Result = Lzma2EncodeMemory( outStream, source, sourceLength, encoderProperties, &result->PropertySummary, alloc, progress, false, &checksum );
+	}
+	else
+	{
+		// Filter the source as the encoder reads it into its window
+		CLzmaFilter filter( encoderProperties->Filter, encoderProperties->FilterParameter );
+		CFilterInStream in_stream( source, sourceLength, filter, &checksum );
 
-		if( Offset + *size > Size )
+		result->Result = in_stream.Create( alloc );
+		if( result->Result == SevenZipResult::SevenZipOK )
 		{
-			*size = Size - Offset;
+			result->Result = Lzma2Encode( outStream, in_stream, encoderProperties, &result->PropertySummary, alloc, progress, nullptr );
 		}
+	}
+
+	result->Checksum = checksum.Type;
+	result->ChecksumValue = checksum.Value;
+	result->Filter = encoderProperties->Filter;
+	result->FilterParameter = encoderProperties->FilterParameter;
+	return result->Result;
+}
 
-		memcpy( bufferBase + offset, SourceData + Offset, static_cast<uint64>( *size ) );
-		Offset += *size;
-		return SevenZipResult::SevenZipOK;
+/**
+ * @brief Decodes a whole stream into a buffer, undoes any filter and checks the checksum.
+ *
+ * @param destination       Buffer to decompress into.
+ * @param destinationLength Size of the buffer.
+ * @param compressed        The compressed stream.
+ * @param compressedLength  On entry: number of compressed bytes available. On exit: number of bytes consumed.
+ * @param result            The filter, checksum and properties to decode with; receives the result and output length.
+ * @param alloc             Memory allocator.
+ * @param progress          Optional progress interface passed to Lzma2Decode.
+ * @return The final result.
+ */
+static SevenZipResult DecompressToBuffer( uint8* destination, const int64 destinationLength, const uint8* compressed, int64& compressedLength, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	CLzmaFilter filter( result->Filter, result->FilterParameter );
+	result->Result = filter.Create( alloc );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
 	}
 
-private:
-	const uint8* SourceData;
-	int64 Size;
-	int64 Offset;
-};
+	// With a filter, the checksum is of the data once the filter is undone
+	const bool filtered = ( result->Filter != LzmaFilterType::LzmaFilterTypeNone );
+	CChecksum checksum( result->Checksum );
+	result->OutputLength = destinationLength;
+	result->Result = Lzma2Decode( destination, result->OutputLength, compressed, compressedLength, result->PropertySummary, result->FinishMode, result->Status, alloc, filtered ? nullptr : &checksum, progress );
+
+	if( filtered && result->Result == SevenZipResult::SevenZipOK )
+	{
+		filter.DecodeInPlace( destination, result->OutputLength, &checksum );
+	}
+
+	return CheckChecksum( checksum, result );
+}
 
 /**
  * The main LZMA2 compress function.
@@ -105,12 +176,67 @@ SevenZipResult Lzma2Compress( const CLzmaData* data, CLzma2EncoderProperties* en
 		return result->Result;
 	}
 
-	FMemoryReader in_stream( data->SourceData, data->SourceLength );
 	FMemoryWriter out_stream( data->DestinationData, data->DestinationLength );
+	CompressToStream( out_stream, data->SourceData, data->SourceLength, encoderProperties, result, alloc, progress );
+
+	result->OutputLength = out_stream.GetOffset();
+	return result->Result;
+}
+
+/**
+ * The LZMA2 compress function for inputs smaller than Lzma::SmallInputLimit.
+ */
+SevenZipResult Lzma2CompressSmall( const CLzmaData* data, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	if( data->SourceLength >= Lzma::SmallInputLimit )
+	{
+		result->Result = SevenZipResult::SevenZipErrorParam;
+		return result->Result;
+	}
+
+	encoderProperties->EstimatedSourceDataSize = data->SourceLength;
+	result->Result = encoderProperties->Normalize();
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	FMemoryWriter out_stream( data->DestinationData, data->DestinationLength );
+	CChecksum checksum( encoderProperties->Checksum );
 
-	result->Result = Lzma2Encode( out_stream, in_stream, encoderProperties, &result->PropertySummary, alloc, progress );
+	if( encoderProperties->Filter == LzmaFilterType::LzmaFilterTypeNone )
+	{
+		result->Result = Lzma2EncodeMemory( out_stream, data->SourceData, data->SourceLength, encoderProperties, &result->PropertySummary, alloc, nullptr, true, &checksum );
+	}
+	else
+	{
+		// The input is at most one group, so filter it into a copy and compress that
+		uint8* filtered = static_cast< uint8* >( alloc->Alloc( data->SourceLength, "Lzma2CompressSmall::Filtered" ) );
+		if( filtered == nullptr && data->SourceLength > 0 )
+		{
+			result->Result = SevenZipResult::SevenZipErrorMemory;
+			return result->Result;
+		}
+
+		CLzmaFilter filter( encoderProperties->Filter, encoderProperties->FilterParameter );
+		filter.Encode( data->SourceData, filtered, data->SourceLength, true );
+		checksum.Update( data->SourceData, data->SourceLength );
+
+		result->Result = Lzma2EncodeMemory( out_stream, filtered, data->SourceLength, encoderProperties, &result->PropertySummary, alloc, nullptr, true, nullptr );
+
+		alloc->Free( filtered, data->SourceLength, "Lzma2CompressSmall::Filtered" );
+	}
 
 	result->OutputLength = out_stream.GetOffset();
+	result->Checksum = checksum.Type;
+	result->ChecksumValue = checksum.Value;
+	result->Filter = encoderProperties->Filter;
+	result->FilterParameter = encoderProperties->FilterParameter;
 	return result->Result;
 }
 
@@ -124,8 +250,169 @@ SevenZipResult Lzma2Decompress( CLzmaData* data, CLzma2Result* result, MemoryInt
 		alloc = &allocator;
 	}
 
-	result->OutputLength = data->DestinationLength;
-	result->Result = Lzma2Decode( data->DestinationData, result->OutputLength, data->SourceData, data->SourceLength, result->PropertySummary, result->FinishMode, result->Status, alloc );
+	return DecompressToBuffer( data->DestinationData, data->DestinationLength, data->SourceData, data->SourceLength, result, alloc, nullptr );
+}
+
+/**
+ * The number of bytes past the decompressed size needed to decompress a stream in place.
+ */
+SevenZipResult Lzma2GetInPlaceMargin( const uint8* compressed, int64 compressedLength, int64& margin )
+{
+	int64 input_offset = 0;
+	int64 decompressed_length = 0;
+
+	margin = 0;
+	const SevenZipResult result = Lzma2GetInPlaceLayout( compressed, compressedLength, input_offset, decompressed_length, nullptr );
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		margin = std::max( input_offset + compressedLength, decompressed_length ) - decompressed_length;
+	}
+
+	return result;
+}
+
+/**
+ * The LZMA2 decompress function for a stream stored in the last compressedLength bytes of the output buffer.
+ */
+SevenZipResult Lzma2DecompressInPlace( uint8* buffer, int64 bufferLength, int64 compressedLength, CLzma2Result* result, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	result->OutputLength = 0;
+	if( compressedLength < 0 || compressedLength > bufferLength )
+	{
+		result->Result = SevenZipResult::SevenZipErrorParam;
+		return result->Result;
+	}
+
+	const int64 input_offset = bufferLength - compressedLength;
+	const uint8* compressed = buffer + input_offset;
+
+	int64 required_offset = 0;
+	int64 decompressed_length = 0;
+	result->Result = Lzma2GetInPlaceLayout( compressed, compressedLength, required_offset, decompressed_length, nullptr );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	// The headers bound what the decoder writes, so this rules out overwriting unread input
+	if( input_offset < required_offset )
+	{
+		result->Result = SevenZipResult::SevenZipErrorParam;
+		return result->Result;
+	}
+
+	int64 in_size = compressedLength;
+	return DecompressToBuffer( buffer, decompressed_length, compressed, in_size, result, alloc, nullptr );
+}
+
+/**
+ * The number of bytes Lzma2Decompress allocates; LZMA2 always sizes the literal coder for the maximum combined literal bits.
+ */
+int64 Lzma2EstimateDecoderMemory()
+{
+	return Lzma1Dec::GetNumProbabilities( Lzma::MaxCombinedLiteralBits, 0 ) * static_cast< int64 >( sizeof( CProbability ) );
+}
+
+#if defined( _LINUX )
+
+/**
+ * The LZMA2 compress function for a file, mapped and passed to the encoder in place.
+ */
+SevenZipResult Lzma2CompressFile( const char* sourceFile, const char* destinationFile, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	result->OutputLength = 0;
+	result->Result = encoderProperties->Normalize();
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	CMappedFile source;
+	result->Result = source.OpenRead( sourceFile );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	CFileOutStream out_stream;
+	result->Result = out_stream.Create( destinationFile, alloc );
+	if( result->Result == SevenZipResult::SevenZipOK )
+	{
+		// The encoder reads matches up to a dictionary back from where it is
+		CMappedFileProgress mapped_progress( &source, encoderProperties->DictionarySize + static_cast< int64 >( Lzma::Lzma2KeepWindowSize ), nullptr, 0, progress );
+		CompressToStream( out_stream, source.Data, source.Length, encoderProperties, result, alloc, &mapped_progress );
+	}
+
+	result->OutputLength = out_stream.GetOffset();
+	const SevenZipResult close_result = out_stream.Close();
+	if( result->Result == SevenZipResult::SevenZipOK )
+	{
+		result->Result = close_result;
+	}
+
+	return result->Result;
+}
+
+/**
+ * The LZMA2 decompress function for a file, decoded straight into the mapped destination.
+ */
+SevenZipResult Lzma2DecompressFile( const char* sourceFile, const char* destinationFile, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	result->OutputLength = 0;
+
+	CMappedFile source;
+	result->Result = source.OpenRead( sourceFile );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	// Size the output from the chunk headers, releasing the input behind the walk as it touches every page
+	int64 input_offset = 0;
+	int64 decompressed_length = 0;
+	CMappedFileProgress walk_progress( &source, 0, nullptr, 0, nullptr );
+	result->Result = Lzma2GetInPlaceLayout( source.Data, source.Length, input_offset, decompressed_length, &walk_progress );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	CMappedFile destination;
+	result->Result = destination.Create( destinationFile, decompressed_length );
+	if( result->Result == SevenZipResult::SevenZipOK )
+	{
+		// The decoder copies matches from up to a dictionary back in its output; the input is never read twice
+		const uint8 prop = result->PropertySummary;
+		const int64 dictionary_size = ( prop >= 40u ) ? decompressed_length : ( static_cast< int64 >( 2u | ( prop & 1u ) ) << ( prop / 2 + 11 ) );
+		CMappedFileProgress mapped_progress( &source, 0, &destination, dictionary_size, progress );
+
+		int64 in_size = source.Length;
+		DecompressToBuffer( destination.Data, decompressed_length, source.Data, in_size, result, alloc, &mapped_progress );
+	}
+
+	// Keep what was decoded before any error, as Lzma2Decompress does
+	const SevenZipResult close_result = destination.Close( result->OutputLength );
+	if( result->Result == SevenZipResult::SevenZipOK )
+	{
+		result->Result = close_result;
+	}
 
 	return result->Result;
 }
+
+#endif
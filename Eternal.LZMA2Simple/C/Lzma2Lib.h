@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "Crc.h"
 #include "Lzma1Lib.h"
 
 class CLzma2Result
@@ -22,21 +23,53 @@ public:
 
 	/** The number of bytes output from the compress/decompress operation */
 	int64 OutputLength = 0;
+
+	/**
+	 * The checksum of the decompressed data, computed as the data passes through the encoder or decoder.
+	 * Compression fills these in when CLzma2EncoderProperties::Checksum is set. Decompression checks the value when
+	 * Checksum is not ChecksumTypeNone; pass them on along with PropertySummary.
+	 */
+	ChecksumType Checksum = ChecksumType::ChecksumTypeNone;
+	uint64 ChecksumValue = 0u;
+
+	/**
+	 * The filter the data was run through before compression. Compression fills these in from CLzma2EncoderProperties;
+	 * decompression undoes the filter after decoding. Pass them on along with PropertySummary.
+	 */
+	LzmaFilterType Filter = LzmaFilterType::LzmaFilterTypeNone;
+	uint32 FilterParameter = 0u;
 };
 
 class CLzma2EncoderProperties
 	: public CLzmaEncoderProperties
 {
 public:
+	/**
+	 * false - every chunk is run through the LZMA parser, default = false
+	 * true - chunks that look incompressible are stored as copy chunks without being parsed.
+	 * This is a heuristic; enabling it can change the compressed output.
+	 */
+	bool DetectIncompressible = false;
+
+	/**
+	 * The checksum of the source data to return in CLzma2Result, default = ChecksumTypeNone
+	 * It is computed a chunk at a time, straight after the encoder has read the chunk. The compressed output is unchanged.
+	 * With a Filter, the checksum is of the data before filtering.
+	 */
+	ChecksumType Checksum = ChecksumType::ChecksumTypeNone;
+
 	virtual SevenZipResult Normalize() override;
+
+	virtual int64 EstimateEncoderMemory() const override;
 };
 
 /*
-RAM requirements for LZMA:
-  for compression:   (DictionarySize * 11.5 + 6 MB) + state_size
-  for decompression: DictionarySize + state_size
-	state_size = (4 + (1.5 << (LiteralContextBits + LiteralPositionBits))) KB
-	by default (LiteralContextBits=3, LiteralPositionBits=0), state_size = 16 KB.
+RAM requirements for LZMA2:
+  for compression:   CLzma2EncoderProperties::EstimateEncoderMemory()
+	With a filter this includes the filter group and the input window the encoder reads the filtered data into.
+	Lzma2Encode allocates the same input window for an unfiltered stream, which the estimate leaves out.
+  for decompression: Lzma2EstimateDecoderMemory() + the output buffer
+	Undoing the BC1, BC3 or shuffle filter needs one more LzmaFilter::GroupSize of scratch space.
 */
 
 /**
@@ -52,13 +85,87 @@ Returns:
 
 SevenZipResult Lzma2Compress( const CLzmaData* data, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress );
 
+/**
+ * Lzma2CompressSmall - compress fewer than Lzma::SmallInputLimit bytes with setup sized to the input
+ * The output can differ from Lzma2Compress, but decodes with Lzma2Decompress. There is no progress callback.
+ * Returns:
+ * SZ_OK               - OK
+ * SZ_ERROR_MEM        - Memory allocation error
+ * SZ_ERROR_PARAM      - Incorrect parameter, or the input is too large
+ * SZ_ERROR_OUTPUT_EOF - output buffer overflow
+ */
+SevenZipResult Lzma2CompressSmall( const CLzmaData* data, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc );
+
 /**
  * Lzma2Decompress - decompress a block of memory
  * Returns:
  * SZ_OK                - OK
  * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_CRC         - The decompressed data does not match result->ChecksumValue
  * SZ_ERROR_MEM         - Memory allocation arror
- * SZ_ERROR_UNSUPPORTED - Unsupported properties
+ * SZ_ERROR_UNSUPPORTED - Unsupported properties or filter
  * SZ_ERROR_INPUT_EOF   - it needs more bytes in input buffer (src)
  */
 SevenZipResult Lzma2Decompress( CLzmaData* data, CLzma2Result* result, MemoryInterface* alloc );
+
+/**
+ * Lzma2GetInPlaceMargin - the number of bytes past the decompressed size the buffer passed to
+ * Lzma2DecompressInPlace needs, with the compressed data copied to its end
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_INPUT_EOF   - The stream is truncated
+ */
+SevenZipResult Lzma2GetInPlaceMargin( const uint8* compressed, int64 compressedLength, int64& margin );
+
+/**
+ * Lzma2DecompressInPlace - decompress a stream held in the last compressedLength bytes of buffer to the start of buffer
+ * bufferLength must be at least the decompressed size plus Lzma2GetInPlaceMargin(); the compressed data is overwritten.
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_CRC         - The decompressed data does not match result->ChecksumValue
+ * SZ_ERROR_MEM         - Memory allocation arror
+ * SZ_ERROR_PARAM       - The buffer is too small to decode in place
+ * SZ_ERROR_UNSUPPORTED - Unsupported properties or filter
+ * SZ_ERROR_INPUT_EOF   - The stream is truncated
+ */
+SevenZipResult Lzma2DecompressInPlace( uint8* buffer, int64 bufferLength, int64 compressedLength, CLzma2Result* result, MemoryInterface* alloc );
+
+/**
+ * Lzma2EstimateDecoderMemory - the number of bytes Lzma2Decompress allocates
+ */
+int64 Lzma2EstimateDecoderMemory();
+
+#if defined( _LINUX )
+
+/**
+ * Lzma2CompressFile - compress one file to another, as Lzma2Compress
+ * The source is mapped and read by the encoder in place, and the output is written in large batches, so neither
+ * file is held in memory. The source pages are released once they are behind the dictionary.
+ * Returns:
+ * SZ_OK               - OK
+ * SZ_ERROR_MEM        - Memory allocation error
+ * SZ_ERROR_PARAM      - Incorrect parameter
+ * SZ_ERROR_READ       - The source could not be opened
+ * SZ_ERROR_WRITE      - The destination could not be created or written
+ */
+SevenZipResult Lzma2CompressFile( const char* sourceFile, const char* destinationFile, CLzma2EncoderProperties* encoderProperties, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress );
+
+/**
+ * Lzma2DecompressFile - decompress one file to another, as Lzma2Decompress
+ * The destination is sized from the chunk headers and mapped; each slice of it is faulted in just before the decoder
+ * writes it, and written back and released once it is behind the dictionary.
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_CRC         - The decompressed data does not match result->ChecksumValue
+ * SZ_ERROR_MEM         - Memory allocation arror
+ * SZ_ERROR_UNSUPPORTED - Unsupported properties or filter
+ * SZ_ERROR_INPUT_EOF   - The stream is truncated
+ * SZ_ERROR_READ        - The source could not be opened
+ * SZ_ERROR_WRITE       - The destination could not be created
+ */
+SevenZipResult Lzma2DecompressFile( const char* sourceFile, const char* destinationFile, CLzma2Result* result, MemoryInterface* alloc, ProgressInterface* progress );
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "Threads.h"
+
+#include <algorithm>
+
+#if defined( _LINUX )
+#include <pthread.h>
+#else
+#include <windows.h>
+#include <process.h>
+#endif
+
+/** What each new thread runs */
+class CWorker
+{
+public:
+	WorkerFunction Function = nullptr;
+	void* Context = nullptr;
+};
+
+#if defined( _LINUX )
+
+typedef pthread_t ThreadHandle;
+
+static void* RunWorker( void* worker )
+{
+	const CWorker* run = static_cast< const CWorker* >( worker );
+	run->Function( run->Context );
+	return nullptr;
+}
+
+static bool StartThread( ThreadHandle& handle, CWorker* worker )
+{
+	return pthread_create( &handle, nullptr, RunWorker, worker ) == 0;
+}
+
+static void JoinThread( const ThreadHandle handle )
+{
+	pthread_join( handle, nullptr );
+}
+
+#else
+
+typedef HANDLE ThreadHandle;
+
+static unsigned __stdcall RunWorker( void* worker )
+{
+	const CWorker* run = static_cast< const CWorker* >( worker );
+	run->Function( run->Context );
+	return 0u;
+}
+
+static bool StartThread( ThreadHandle& handle, CWorker* worker )
+{
+	// _beginthreadex rather than CreateThread, so the CRT sets up and releases its per thread data
+	handle = reinterpret_cast< HANDLE >( _beginthreadex( nullptr, 0u, RunWorker, worker, 0u, nullptr ) );
+	return handle != nullptr;
+}
+
+static void JoinThread( const ThreadHandle handle )
+{
+	WaitForSingleObject( handle, INFINITE );
+	CloseHandle( handle );
+}
+
+#endif
+
+/**
+ * @brief Runs a worker on the calling thread and on up to count - 1 new threads, then waits for them all.
+ *
+ * Stops creating threads at the first one that fails, as the system is then short of them.
+ *
+ * @param function The worker to run.
+ * @param context  Passed to each call of the worker.
+ * @param count    The number of threads wanted, including the calling thread.
+ */
+void RunWorkers( const WorkerFunction function, void* context, const int32 count )
+{
+	CWorker worker;
+	worker.Function = function;
+	worker.Context = context;
+
+	ThreadHandle handles[Threads::MaxThreads];
+	int32 started = 0;
+	const int32 thread_count = std::clamp( count, 1, Threads::MaxThreads );
+	while( started < thread_count - 1 && StartThread( handles[started], &worker ) )
+	{
+		started++;
+	}
+
+	function( context );
+
+	for( int32 index = 0; index < started; index++ )
+	{
+		JoinThread( handles[index] );
+	}
+}
@@ -0,0 +1,28 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "7zTypes.h"
+
+namespace Threads
+{
+	/** The most threads RunWorkers() runs a worker on, including the calling thread */
+	static constexpr int32 MaxThreads = 64;
+}
+
+typedef void ( *WorkerFunction )( void* context );
+
+/**
+ * RunWorkers - run function( context ) on the calling thread and on up to count - 1 new threads, and wait for them all
+ * The threads are created through the OS rather than std::thread, as the library is built without exceptions. A thread
+ * that cannot be created is skipped, so the worker must share out its work between however many threads run it; with
+ * no threads at all, the calling thread does all of it.
+ */
+void RunWorkers( WorkerFunction function, void* context, int32 count );
+
+/** RunWorkers - run a callable worker, such as a lambda, the same way */
+template< typename TWorker >
+void RunWorkers( TWorker& worker, const int32 count )
+{
+	RunWorkers( []( void* context ) { ( *static_cast< TWorker* >( context ) )(); }, &worker, count );
+}
@@ -0,0 +1,1207 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#include "7zTypes.h"
+
+#include "XzLib.h"
+#include "Crc.h"
+#include "Lzma1Dec.h"
+#include "Lzma2Dec.h"
+#include "Threads.h"
+
+#include <atomic>
+
+namespace Xz
+{
+	static constexpr uint8 HeaderMagic[6] = { 0xFDu, '7', 'z', 'X', 'Z', 0x00u };
+	static constexpr uint8 FooterMagic[2] = { 'Y', 'Z' };
+	static constexpr int64 StreamHeaderSize = 12;
+	static constexpr int64 StreamFooterSize = 12;
+	static constexpr int64 StreamFlagsSize = 2;
+
+	// Size, flags, filter id, property size, property, 3 bytes of padding and the CRC32
+	static constexpr int64 BlockHeaderSize = 12;
+	static constexpr uint8 BlockFlagsFilterCountMask = 0x03u;
+	static constexpr uint8 BlockFlagsReservedMask = 0x3Cu;
+	static constexpr uint8 BlockFlagsCompressedSize = 0x40u;
+	static constexpr uint8 BlockFlagsUncompressedSize = 0x80u;
+	static constexpr uint64 Lzma2FilterId = 0x21u;
+
+	static constexpr uint8 IndexIndicator = 0x00u;
+	static constexpr int64 IndexRecordSize = 2 * sizeof( int64 );
+	static constexpr int32 MaxVliSize = 9;
+	static constexpr uint8 MaxCheckId = 15u;
+
+	static constexpr int64 MinBlockSize = 1 << 20;
+	static constexpr int32 MaxThreads = Threads::MaxThreads;
+}
+
+/* ---------- Helpers ---------- */
+
+static int64 PadToFour( const int64 size )
+{
+	return ( size + 3 ) & ~static_cast< int64 >( 3 );
+}
+
+/**
+ * @brief Returns the number of bytes of the check with the given id; ids share sizes in groups of three.
+ */
+static int64 GetCheckSize( const uint8 check )
+{
+	return ( check == 0u ) ? 0 : ( static_cast< int64 >( 4 ) << ( ( check - 1u ) / 3u ) );
+}
+
+/**
+ * @brief Returns the checksum the LZMA2 coder computes for a check; only called for supported checks.
+ */
+static ChecksumType GetChecksumType( const XzCheck check )
+{
+	switch( check )
+	{
+	case XzCheck::XzCheckCrc32:
+		return ChecksumType::ChecksumTypeCrc32;
+
+	case XzCheck::XzCheckCrc64:
+		return ChecksumType::ChecksumTypeCrc64;
+
+	case XzCheck::XzCheckNone:
+		break;
+	}
+
+	return ChecksumType::ChecksumTypeNone;
+}
+
+static void WriteUInt32( uint8* destination, const uint32 value )
+{
+	for( int32 index = 0; index < 4; index++ )
+	{
+		destination[index] = static_cast< uint8 >( ( value >> ( index * 8 ) ) & 0xff );
+	}
+}
+
+static uint32 ReadUInt32( const uint8* source )
+{
+	return static_cast< uint32 >( source[0] ) | ( static_cast< uint32 >( source[1] ) << 8 ) | ( static_cast< uint32 >( source[2] ) << 16 ) | ( static_cast< uint32 >( source[3] ) << 24 );
+}
+
+/**
+ * @brief Writes a variable length integer, 7 bits per byte with the top bit marking that more follow.
+ *
+ * @return Number of bytes written.
+ */
+static int32 WriteVli( uint8* destination, uint64 value )
+{
+	int32 size = 0;
+	while( value >= 0x80u )
+	{
+		destination[size++] = static_cast< uint8 >( ( value & 0x7fu ) | 0x80u );
+		value >>= 7;
+	}
+
+	destination[size++] = static_cast< uint8 >( value );
+	return size;
+}
+
+static int32 GetVliSize( uint64 value )
+{
+	uint8 scratch[Xz::MaxVliSize];
+	return WriteVli( scratch, value );
+}
+
+/**
+ * @brief Reads a variable length integer.
+ *
+ * @param source   Pointer to the data.
+ * @param size     Number of bytes available.
+ * @param position On entry: where the integer starts. On exit: just past it.
+ * @param value    On exit: the integer, which always fits in an int64.
+ * @return false if it is truncated, longer than 9 bytes, or ends with a redundant zero byte.
+ */
+static bool ReadVli( const uint8* source, const int64 size, int64& position, int64& value )
+{
+	uint64 result = 0u;
+	for( int32 index = 0; index < Xz::MaxVliSize; index++ )
+	{
+		if( position >= size )
+		{
+			return false;
+		}
+
+		const uint8 byte = source[position++];
+		result |= static_cast< uint64 >( byte & 0x7fu ) << ( index * 7 );
+		if( ( byte & 0x80u ) == 0u )
+		{
+			value = static_cast< int64 >( result );
+			return ( byte != 0u || index == 0 );
+		}
+	}
+
+	// Nine bytes hold 63 bits, and a tenth would reach bit 63
+	return false;
+}
+
+static void WriteStreamFlags( uint8* destination, const XzCheck check )
+{
+	destination[0] = 0u;
+	destination[1] = static_cast< uint8 >( check );
+}
+
+/* ---------- Xz Props ---------- */
+
+/**
+ * @brief Returns the number of uncompressed bytes in each block.
+ *
+ * @return BlockSize if set, otherwise INT64_MAX for a single block or the xz -T default.
+ */
+int64 CXzEncoderProperties::GetBlockSize() const
+{
+	if( BlockSize > 0 )
+	{
+		return BlockSize;
+	}
+
+	if( NumThreads <= 1 )
+	{
+		return INT64_MAX;
+	}
+
+	return std::max( static_cast< int64 >( GetDictionarySize() ) * 3, Xz::MinBlockSize );
+}
+
+/**
+ * @brief Validates the container settings, then the LZMA2 settings every block is compressed with.
+ *
+ * @return SevenZipOK on success, SevenZipErrorParam for an unknown check, SevenZipErrorUnsupported for a filter, or a LZMA2 Normalize() error.
+ */
+SevenZipResult CXzEncoderProperties::Normalize()
+{
+	if( Check != XzCheck::XzCheckNone && Check != XzCheck::XzCheckCrc32 && Check != XzCheck::XzCheckCrc64 )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	// Blocks only list the LZMA2 filter, so filtered data could not be told apart on decode
+	if( Filter != LzmaFilterType::LzmaFilterTypeNone )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	NumThreads = std::clamp( NumThreads, 1, Xz::MaxThreads );
+	BlockSize = std::max< int64 >( BlockSize, 0 );
+	return CLzma2EncoderProperties::Normalize();
+}
+
+/**
+ * @brief Returns the number of bytes the xz encoder allocates with these properties.
+ *
+ * Each thread has its own LZMA2 encoder, and with more than one thread each also buffers a compressed block.
+ * The index keeps two sizes for every block, which are only counted when EstimatedSourceDataSize is set.
+ *
+ * @return The total of every allocation made through the MemoryInterface, or an upper bound for small inputs.
+ */
+int64 CXzEncoderProperties::EstimateEncoderMemory() const
+{
+	// No block is larger than the block size, so the dictionary need not be either
+	const int64 block_size = GetBlockSize();
+	CLzma2EncoderProperties block_properties = *this;
+	block_properties.EstimatedSourceDataSize = std::min( EstimatedSourceDataSize, block_size );
+
+	const int64 block_count = ( EstimatedSourceDataSize < INT64_MAX ) ? ( std::max< int64 >( EstimatedSourceDataSize, 1 ) - 1 ) / block_size + 1 : 1;
+	const int64 index_memory = block_count * Xz::IndexRecordSize;
+
+	const int64 encoder_memory = block_properties.EstimateEncoderMemory();
+	if( NumThreads <= 1 )
+	{
+		return encoder_memory + index_memory;
+	}
+
+	return NumThreads * ( encoder_memory + LzmaWorstCompression( block_size ) ) + index_memory;
+}
+
+/* ---------- XzEnc ---------- */
+
+class XzEnc
+{
+public:
+	XzEnc( const CLzmaData* data, const CXzEncoderProperties* encoderProperties, MemoryInterface* alloc, ProgressInterface* progress )
+		: Data( data )
+		, EncoderProperties( encoderProperties )
+		, Alloc( alloc )
+		, Progress( progress )
+	{
+		CheckSize = GetCheckSize( static_cast< uint8 >( encoderProperties->Check ) );
+	}
+
+	~XzEnc()
+	{
+		for( int32 index = 0; index < BlockBufferCount; index++ )
+		{
+			Alloc->Free( BlockBuffers[index], BlockBufferSize, "XzEnc::BlockBuffer" );
+		}
+
+		Alloc->Free( Records, RecordCapacity * static_cast< int64 >( sizeof( int64 ) ), "XzEnc::Records" );
+	}
+
+	SevenZipResult Encode();
+
+	int64 Offset = 0;
+	int64 BlockCount = 0;
+
+private:
+	/** A block being compressed, before it is written out */
+	class CPendingBlock
+	{
+	public:
+		int64 UncompressedOffset = 0;
+		int64 UncompressedSize = 0;
+		uint8* CompressedData = nullptr;
+		int64 CompressedSize = 0;
+		uint64 Check = 0u;
+		uint8 Property = 0u;
+		SevenZipResult Result = SevenZipResult::SevenZipOK;
+	};
+
+	bool Reserve( const int64 size ) const;
+	void CompressBlock( CPendingBlock& block, uint8* destination, const int64 destinationLength ) const;
+	SevenZipResult WriteBlock( const CPendingBlock& block );
+	SevenZipResult EncodeSingleThreaded( const int64 blockSize );
+	SevenZipResult EncodeMultiThreaded( const int64 blockSize, const int32 numThreads );
+	SevenZipResult ReportProgress( const int64 uncompressedSize ) const;
+	SevenZipResult WriteStreamHeader();
+	SevenZipResult WriteIndex();
+	SevenZipResult WriteStreamFooter();
+
+	const CLzmaData* Data = nullptr;
+	const CXzEncoderProperties* EncoderProperties = nullptr;
+	MemoryInterface* Alloc = nullptr;
+	ProgressInterface* Progress = nullptr;
+
+	int64 CheckSize = 0;
+	int64 IndexSize = 0;
+
+	// Unpadded and uncompressed size of every block written, for the index
+	int64* Records = nullptr;
+	int64 RecordCapacity = 0;
+	int64 RecordCount = 0;
+
+	uint8* BlockBuffers[Xz::MaxThreads] = {};
+	int32 BlockBufferCount = 0;
+	int64 BlockBufferSize = 0;
+};
+
+/**
+ * @brief Returns true if size more bytes fit in the destination.
+ */
+bool XzEnc::Reserve( const int64 size ) const
+{
+	return Offset + size <= Data->DestinationLength;
+}
+
+/**
+ * @brief Compresses one block with LZMA2 and computes its check.
+ *
+ * Every block is an independent LZMA2 stream with its own dictionary, so blocks can be compressed concurrently.
+ *
+ * @param block             The block to compress; receives the compressed size, property byte, check and result.
+ * @param destination       Where the LZMA2 data is written.
+ * @param destinationLength Capacity of destination.
+ */
+void XzEnc::CompressBlock( CPendingBlock& block, uint8* destination, const int64 destinationLength ) const
+{
+	const uint8* source = Data->SourceData + block.UncompressedOffset;
+
+	CLzmaData block_data;
+	block_data.SourceData = const_cast< uint8* >( source );
+	block_data.SourceLength = block.UncompressedSize;
+	block_data.DestinationData = destination;
+	block_data.DestinationLength = destinationLength;
+
+	// The memory budget was already shared out between the threads by Normalize()
+	CLzma2EncoderProperties block_properties = *EncoderProperties;
+	block_properties.EstimatedSourceDataSize = std::min( block_properties.EstimatedSourceDataSize, block.UncompressedSize );
+	block_properties.MemoryBudget = 0;
+	block_properties.Checksum = GetChecksumType( EncoderProperties->Check );
+
+	// The check is computed by the encoder as it goes
+	CLzma2Result lzma2_result;
+	block.Result = Lzma2Compress( &block_data, &block_properties, &lzma2_result, Alloc, nullptr );
+	block.CompressedData = destination;
+	block.CompressedSize = lzma2_result.OutputLength;
+	block.Property = lzma2_result.PropertySummary;
+	block.Check = lzma2_result.ChecksumValue;
+}
+
+/**
+ * @brief Writes a compressed block: header, LZMA2 data, padding and check.
+ *
+ * The header leaves out the optional sizes, so it is always BlockHeaderSize bytes; the index carries the sizes.
+ *
+ * @param block The compressed block; its data is copied unless it was compressed in place.
+ * @return SevenZipOK on success, SevenZipErrorOutputEof if the destination is full.
+ */
+SevenZipResult XzEnc::WriteBlock( const CPendingBlock& block )
+{
+	const int64 padding = PadToFour( block.CompressedSize ) - block.CompressedSize;
+	if( !Reserve( Xz::BlockHeaderSize + block.CompressedSize + padding + CheckSize ) )
+	{
+		return SevenZipResult::SevenZipErrorOutputEof;
+	}
+
+	uint8* header = Data->DestinationData + Offset;
+	header[0] = static_cast< uint8 >( Xz::BlockHeaderSize / 4 - 1 );
+	header[1] = 0u;
+	header[2] = static_cast< uint8 >( Xz::Lzma2FilterId );
+	header[3] = 1u;
+	header[4] = block.Property;
+	header[5] = 0u;
+	header[6] = 0u;
+	header[7] = 0u;
+	WriteUInt32( header + 8, Crc32Update( 0u, header, Xz::BlockHeaderSize - 4 ) );
+	Offset += Xz::BlockHeaderSize;
+
+	if( block.CompressedData != Data->DestinationData + Offset )
+	{
+		memcpy( Data->DestinationData + Offset, block.CompressedData, static_cast< uint64 >( block.CompressedSize ) );
+	}
+
+	Offset += block.CompressedSize;
+	memset( Data->DestinationData + Offset, 0, static_cast< uint64 >( padding ) );
+	Offset += padding;
+
+	for( int64 index = 0; index < CheckSize; index++ )
+	{
+		Data->DestinationData[Offset++] = static_cast< uint8 >( ( block.Check >> ( index * 8 ) ) & 0xff );
+	}
+
+	Records[RecordCount++] = Xz::BlockHeaderSize + block.CompressedSize + CheckSize;
+	Records[RecordCount++] = block.UncompressedSize;
+	BlockCount++;
+	return SevenZipResult::SevenZipOK;
+}
+
+SevenZipResult XzEnc::ReportProgress( const int64 uncompressedSize ) const
+{
+	if( Progress != nullptr )
+	{
+		const SevenZipResult result = Progress->Progress( uncompressedSize, Offset );
+		return ( result != SevenZipResult::SevenZipOK ) ? SevenZipResult::SevenZipErrorProgress : SevenZipResult::SevenZipOK;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Compresses the blocks one after another, straight into the destination after their headers.
+ */
+SevenZipResult XzEnc::EncodeSingleThreaded( const int64 blockSize )
+{
+	for( int64 position = 0; position < Data->SourceLength; position += blockSize )
+	{
+		if( !Reserve( Xz::BlockHeaderSize ) )
+		{
+			return SevenZipResult::SevenZipErrorOutputEof;
+		}
+
+		CPendingBlock block;
+		block.UncompressedOffset = position;
+		block.UncompressedSize = std::min( blockSize, Data->SourceLength - position );
+
+		const int64 data_offset = Offset + Xz::BlockHeaderSize;
+		CompressBlock( block, Data->DestinationData + data_offset, Data->DestinationLength - data_offset );
+		if( block.Result != SevenZipResult::SevenZipOK )
+		{
+			return block.Result;
+		}
+
+		SevenZipResult result = WriteBlock( block );
+		if( result == SevenZipResult::SevenZipOK )
+		{
+			result = ReportProgress( position + block.UncompressedSize );
+		}
+
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Compresses up to numThreads blocks at once into block buffers, then writes them out in order.
+ *
+ * Encode() only calls this with two or more threads and blocks, and uses EncodeSingleThreaded() otherwise.
+ * If a worker thread cannot be started, the threads that are running pick up its blocks.
+ */
+SevenZipResult XzEnc::EncodeMultiThreaded( const int64 blockSize, const int32 numThreads )
+{
+	BlockBufferSize = LzmaWorstCompression( std::min( blockSize, Data->SourceLength ) );
+	for( int32 index = 0; index < numThreads; index++ )
+	{
+		uint8* buffer = static_cast< uint8* >( Alloc->Alloc( BlockBufferSize, "XzEnc::BlockBuffer" ) );
+		if( buffer == nullptr )
+		{
+			return SevenZipResult::SevenZipErrorMemory;
+		}
+
+		BlockBuffers[BlockBufferCount++] = buffer;
+	}
+
+	CPendingBlock blocks[Xz::MaxThreads];
+	for( int64 batch_position = 0; batch_position < Data->SourceLength; )
+	{
+		int32 batch_count = 0;
+		for( ; batch_count < numThreads && batch_position < Data->SourceLength; batch_count++ )
+		{
+			CPendingBlock& block = blocks[batch_count];
+			block = CPendingBlock();
+			block.UncompressedOffset = batch_position;
+			block.UncompressedSize = std::min( blockSize, Data->SourceLength - batch_position );
+			batch_position += block.UncompressedSize;
+		}
+
+		std::atomic< int32 > next_block = 0;
+		auto worker = [&]()
+		{
+			int32 index;
+			while( ( index = next_block++ ) < batch_count )
+			{
+				CompressBlock( blocks[index], BlockBuffers[index], BlockBufferSize );
+			}
+		};
+
+		// The calling thread is the first worker, and takes over the blocks of any thread that could not be started
+		RunWorkers( worker, batch_count );
+
+		for( int32 index = 0; index < batch_count; index++ )
+		{
+			const CPendingBlock& block = blocks[index];
+			if( block.Result != SevenZipResult::SevenZipOK )
+			{
+				return block.Result;
+			}
+
+			SevenZipResult result = WriteBlock( block );
+			if( result == SevenZipResult::SevenZipOK )
+			{
+				result = ReportProgress( block.UncompressedOffset + block.UncompressedSize );
+			}
+
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+SevenZipResult XzEnc::WriteStreamHeader()
+{
+	if( !Reserve( Xz::StreamHeaderSize ) )
+	{
+		return SevenZipResult::SevenZipErrorOutputEof;
+	}
+
+	uint8* header = Data->DestinationData + Offset;
+	memcpy( header, Xz::HeaderMagic, sizeof( Xz::HeaderMagic ) );
+	WriteStreamFlags( header + sizeof( Xz::HeaderMagic ), EncoderProperties->Check );
+	WriteUInt32( header + sizeof( Xz::HeaderMagic ) + Xz::StreamFlagsSize, Crc32Update( 0u, header + sizeof( Xz::HeaderMagic ), Xz::StreamFlagsSize ) );
+
+	Offset += Xz::StreamHeaderSize;
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Writes the index: the unpadded and uncompressed size of every block, padded and followed by a CRC32.
+ */
+SevenZipResult XzEnc::WriteIndex()
+{
+	int64 unpadded_size = 1 + GetVliSize( static_cast< uint64 >( BlockCount ) );
+	for( int64 record = 0; record < RecordCount; record++ )
+	{
+		unpadded_size += GetVliSize( static_cast< uint64 >( Records[record] ) );
+	}
+
+	IndexSize = PadToFour( unpadded_size ) + 4;
+	if( !Reserve( IndexSize ) )
+	{
+		return SevenZipResult::SevenZipErrorOutputEof;
+	}
+
+	uint8* index = Data->DestinationData + Offset;
+	int64 position = 0;
+	index[position++] = Xz::IndexIndicator;
+	position += WriteVli( index + position, static_cast< uint64 >( BlockCount ) );
+	for( int64 record = 0; record < RecordCount; record++ )
+	{
+		position += WriteVli( index + position, static_cast< uint64 >( Records[record] ) );
+	}
+
+	while( ( position & 3 ) != 0 )
+	{
+		index[position++] = 0u;
+	}
+
+	WriteUInt32( index + position, Crc32Update( 0u, index, position ) );
+	Offset += IndexSize;
+	return SevenZipResult::SevenZipOK;
+}
+
+SevenZipResult XzEnc::WriteStreamFooter()
+{
+	if( !Reserve( Xz::StreamFooterSize ) )
+	{
+		return SevenZipResult::SevenZipErrorOutputEof;
+	}
+
+	uint8* footer = Data->DestinationData + Offset;
+	WriteUInt32( footer + 4, static_cast< uint32 >( IndexSize / 4 - 1 ) );
+	WriteStreamFlags( footer + 8, EncoderProperties->Check );
+	WriteUInt32( footer, Crc32Update( 0u, footer + 4, 4 + Xz::StreamFlagsSize ) );
+	memcpy( footer + 10, Xz::FooterMagic, sizeof( Xz::FooterMagic ) );
+
+	Offset += Xz::StreamFooterSize;
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Writes the whole .xz stream.
+ */
+SevenZipResult XzEnc::Encode()
+{
+	SevenZipResult result = WriteStreamHeader();
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	const int64 block_size = EncoderProperties->GetBlockSize();
+	const int64 block_count = ( Data->SourceLength > 0 ) ? ( Data->SourceLength - 1 ) / block_size + 1 : 0;
+	const int32 num_threads = static_cast< int32 >( std::min< int64 >( EncoderProperties->NumThreads, block_count ) );
+
+	RecordCapacity = block_count * 2;
+	Records = static_cast< int64* >( Alloc->Alloc( RecordCapacity * static_cast< int64 >( sizeof( int64 ) ), "XzEnc::Records" ) );
+	if( Records == nullptr && RecordCapacity > 0 )
+	{
+		RecordCapacity = 0;
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	result = ( num_threads > 1 ) ? EncodeMultiThreaded( block_size, num_threads ) : EncodeSingleThreaded( block_size );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	result = WriteIndex();
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	return WriteStreamFooter();
+}
+
+/* ---------- XzDec ---------- */
+
+/**
+ * @brief Checks stream flags: the first byte is reserved and the check id must be known.
+ */
+static SevenZipResult CheckStreamFlags( const uint8* flags )
+{
+	return ( flags[0] != 0u || flags[1] > Xz::MaxCheckId ) ? SevenZipResult::SevenZipErrorUnsupported : SevenZipResult::SevenZipOK;
+}
+
+/** The blocks of one stream, as totalled from its index */
+class CXzStreamIndex
+{
+public:
+	int64 BlockCount = 0;
+
+	/** The size of the blocks with their padding, between the stream header and the index */
+	int64 BlocksSize = 0;
+	int64 UncompressedSize = 0;
+};
+
+/**
+ * @brief Parses the index of one stream, totalling its blocks and listing them if asked.
+ *
+ * @param index         Pointer to the index.
+ * @param indexSize     Size of the index from the stream footer.
+ * @param check         The check id of the stream.
+ * @param maxBlocksSize The number of bytes between the stream header and the index, which the blocks must fit in.
+ * @param blocksEnd     If not nullptr, receives the blocks with sizes but no offsets, in the BlockCount entries before it.
+ * @param streamIndex   Receives the block count and sizes.
+ * @return SevenZipOK, SevenZipErrorData if the index is malformed, or SevenZipErrorCrc.
+ */
+static SevenZipResult ParseIndex( const uint8* index, const int64 indexSize, const uint8 check, const int64 maxBlocksSize, CXzBlock* blocksEnd, CXzStreamIndex& streamIndex )
+{
+	const int64 crc_offset = indexSize - 4;
+	if( crc_offset < 4 || index[0] != Xz::IndexIndicator )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	if( Crc32Update( 0u, index, crc_offset ) != ReadUInt32( index + crc_offset ) )
+	{
+		return SevenZipResult::SevenZipErrorCrc;
+	}
+
+	int64 position = 1;
+	int64 block_count = 0;
+	if( !ReadVli( index, crc_offset, position, block_count ) || block_count > crc_offset )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	CXzBlock* blocks = ( blocksEnd != nullptr ) ? blocksEnd - block_count : nullptr;
+	streamIndex = CXzStreamIndex();
+	streamIndex.BlockCount = block_count;
+	for( int64 block_index = 0; block_index < block_count; block_index++ )
+	{
+		CXzBlock block;
+		block.Check = check;
+		if( !ReadVli( index, crc_offset, position, block.UnpaddedSize ) || !ReadVli( index, crc_offset, position, block.UncompressedSize ) )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		// The smallest header is 8 bytes, and LZMA2 data at least 1
+		if( block.UnpaddedSize < 9 + GetCheckSize( check ) )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		streamIndex.BlocksSize += PadToFour( block.UnpaddedSize );
+		if( streamIndex.BlocksSize > maxBlocksSize || block.UncompressedSize > INT64_MAX - streamIndex.UncompressedSize )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		streamIndex.UncompressedSize += block.UncompressedSize;
+		if( blocks != nullptr )
+		{
+			blocks[block_index] = block;
+		}
+	}
+
+	if( PadToFour( position ) != crc_offset )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	for( ; position < crc_offset; position++ )
+	{
+		if( index[position] != 0u )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Walks back from the end of one or more concatenated streams through their indices.
+ *
+ * With no blocksEnd it only counts the blocks, so the list can then be allocated and filled by a second walk.
+ *
+ * @param compressed         Pointer to the .xz data.
+ * @param compressedLength   Number of bytes of .xz data.
+ * @param blocksEnd          If not nullptr, receives every block in file order with its compressed offset, in the
+ *                           blockCount entries before it.
+ * @param blockCount         Receives the number of blocks.
+ * @param decompressedLength Receives the total decompressed size.
+ * @return SevenZipOK, or the error described at XzGetDecompressedSize().
+ */
+static SevenZipResult WalkStreams( const uint8* compressed, const int64 compressedLength, CXzBlock* blocksEnd, int64& blockCount, int64& decompressedLength )
+{
+	blockCount = 0;
+	decompressedLength = 0;
+
+	if( compressedLength < Xz::StreamHeaderSize || memcmp( compressed, Xz::HeaderMagic, sizeof( Xz::HeaderMagic ) ) != 0 )
+	{
+		return SevenZipResult::SevenZipErrorNoArchive;
+	}
+
+	// Streams are found last first
+	int64 end = compressedLength;
+	while( end > 0 )
+	{
+		// Stream padding is zeros in multiples of four bytes
+		while( end >= 4 && ReadUInt32( compressed + end - 4 ) == 0u )
+		{
+			end -= 4;
+		}
+
+		if( end < Xz::StreamHeaderSize + Xz::StreamFooterSize )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		const uint8* footer = compressed + end - Xz::StreamFooterSize;
+		if( memcmp( footer + 10, Xz::FooterMagic, sizeof( Xz::FooterMagic ) ) != 0 )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		if( Crc32Update( 0u, footer + 4, 4 + Xz::StreamFlagsSize ) != ReadUInt32( footer ) )
+		{
+			return SevenZipResult::SevenZipErrorCrc;
+		}
+
+		SevenZipResult result = CheckStreamFlags( footer + 8 );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		const int64 index_size = ( static_cast< int64 >( ReadUInt32( footer + 4 ) ) + 1 ) * 4;
+		const int64 index_offset = end - Xz::StreamFooterSize - index_size;
+		if( index_offset < Xz::StreamHeaderSize )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		CXzStreamIndex stream_index;
+		result = ParseIndex( compressed + index_offset, index_size, footer[9], index_offset - Xz::StreamHeaderSize, blocksEnd, stream_index );
+		if( result != SevenZipResult::SevenZipOK )
+		{
+			return result;
+		}
+
+		const int64 stream_offset = index_offset - stream_index.BlocksSize - Xz::StreamHeaderSize;
+		const uint8* header = compressed + stream_offset;
+		const uint8* header_flags = header + sizeof( Xz::HeaderMagic );
+		if( memcmp( header, Xz::HeaderMagic, sizeof( Xz::HeaderMagic ) ) != 0 || memcmp( header_flags, footer + 8, Xz::StreamFlagsSize ) != 0 )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		if( Crc32Update( 0u, header_flags, Xz::StreamFlagsSize ) != ReadUInt32( header_flags + Xz::StreamFlagsSize ) )
+		{
+			return SevenZipResult::SevenZipErrorCrc;
+		}
+
+		if( stream_index.UncompressedSize > INT64_MAX - decompressedLength )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+
+		if( blocksEnd != nullptr )
+		{
+			blocksEnd -= stream_index.BlockCount;
+
+			int64 block_offset = stream_offset + Xz::StreamHeaderSize;
+			for( int64 index = 0; index < stream_index.BlockCount; index++ )
+			{
+				blocksEnd[index].CompressedOffset = block_offset;
+				block_offset += PadToFour( blocksEnd[index].UnpaddedSize );
+			}
+		}
+
+		blockCount += stream_index.BlockCount;
+		decompressedLength += stream_index.UncompressedSize;
+		end = stream_offset;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Lists every block of one or more concatenated streams, in memory from alloc that FreeBlocks() releases.
+ *
+ * @param compressed         Pointer to the .xz data.
+ * @param compressedLength   Number of bytes of .xz data.
+ * @param alloc              Memory allocator for the block list.
+ * @param blocks             Receives every block in file order, with its compressed and uncompressed offsets.
+ * @param blockCount         Receives the number of blocks.
+ * @param decompressedLength Receives the total decompressed size.
+ * @return SevenZipOK, SevenZipErrorMemory, or the error described at XzGetDecompressedSize().
+ */
+static SevenZipResult ParseStreams( const uint8* compressed, const int64 compressedLength, MemoryInterface* alloc, CXzBlock*& blocks, int64& blockCount, int64& decompressedLength )
+{
+	blocks = nullptr;
+	SevenZipResult result = WalkStreams( compressed, compressedLength, nullptr, blockCount, decompressedLength );
+	if( result != SevenZipResult::SevenZipOK || blockCount == 0 )
+	{
+		return result;
+	}
+
+	blocks = static_cast< CXzBlock* >( alloc->Alloc( blockCount * static_cast< int64 >( sizeof( CXzBlock ) ), "XzDec::Blocks" ) );
+	if( blocks == nullptr )
+	{
+		blockCount = 0;
+		return SevenZipResult::SevenZipErrorMemory;
+	}
+
+	for( int64 index = 0; index < blockCount; index++ )
+	{
+		new ( blocks + index ) CXzBlock();
+	}
+
+	// The second walk reads the same indices, so it lists exactly the blocks the first one counted
+	int64 listed_count = 0;
+	WalkStreams( compressed, compressedLength, blocks + blockCount, listed_count, decompressedLength );
+
+	int64 uncompressed_offset = 0;
+	for( int64 index = 0; index < blockCount; index++ )
+	{
+		blocks[index].UncompressedOffset = uncompressed_offset;
+		uncompressed_offset += blocks[index].UncompressedSize;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Releases a block list made by ParseStreams().
+ */
+static void FreeBlocks( CXzBlock* blocks, const int64 blockCount, MemoryInterface* alloc )
+{
+	alloc->Free( blocks, blockCount * static_cast< int64 >( sizeof( CXzBlock ) ), "XzDec::Blocks" );
+}
+
+/**
+ * @brief Decodes one block into its place in the output and verifies its check.
+ *
+ * @param compressed Pointer to the .xz data.
+ * @param block      The block, as found by ParseStreams().
+ * @param output     Where the block decodes to; UncompressedSize bytes.
+ * @param alloc      Memory allocator for the LZMA2 decoder.
+ * @return SevenZipOK, or the error described at XzDecompress().
+ */
+static SevenZipResult DecodeBlock( const uint8* compressed, const CXzBlock& block, uint8* output, MemoryInterface* alloc )
+{
+	const XzCheck check_type = static_cast< XzCheck >( block.Check );
+	if( check_type != XzCheck::XzCheckNone && check_type != XzCheck::XzCheckCrc32 && check_type != XzCheck::XzCheckCrc64 )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	const uint8* header = compressed + block.CompressedOffset;
+	const int64 check_size = GetCheckSize( block.Check );
+	const int64 header_size = ( static_cast< int64 >( header[0] ) + 1 ) * 4;
+	if( header[0] == Xz::IndexIndicator || header_size >= block.UnpaddedSize - check_size )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	const int64 crc_offset = header_size - 4;
+	if( Crc32Update( 0u, header, crc_offset ) != ReadUInt32( header + crc_offset ) )
+	{
+		return SevenZipResult::SevenZipErrorCrc;
+	}
+
+	const uint8 flags = header[1];
+	if( ( flags & Xz::BlockFlagsReservedMask ) != 0u )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	const int64 compressed_size = block.UnpaddedSize - header_size - check_size;
+	int64 position = 2;
+	int64 value = 0;
+	if( ( flags & Xz::BlockFlagsCompressedSize ) != 0u )
+	{
+		if( !ReadVli( header, crc_offset, position, value ) || value != compressed_size )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+	}
+
+	if( ( flags & Xz::BlockFlagsUncompressedSize ) != 0u )
+	{
+		if( !ReadVli( header, crc_offset, position, value ) || value != block.UncompressedSize )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+	}
+
+	// Only a lone LZMA2 filter, whose one property byte is the dictionary size
+	int64 filter_id = 0;
+	int64 property_size = 0;
+	if( ( flags & Xz::BlockFlagsFilterCountMask ) != 0u
+		|| !ReadVli( header, crc_offset, position, filter_id )
+		|| !ReadVli( header, crc_offset, position, property_size ) )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	if( filter_id != static_cast< int64 >( Xz::Lzma2FilterId ) || property_size != 1 || position >= crc_offset )
+	{
+		return SevenZipResult::SevenZipErrorUnsupported;
+	}
+
+	const uint8 property = header[position++];
+	for( ; position < crc_offset; position++ )
+	{
+		if( header[position] != 0u )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+	}
+
+	int64 output_length = block.UncompressedSize;
+	int64 input_length = compressed_size;
+	LzmaStatus status = LzmaStatus::LzmaStatusNotSpecified;
+	CChecksum checksum( GetChecksumType( check_type ) );
+	const SevenZipResult result = Lzma2Decode( output, output_length, header + header_size, input_length, property, LzmaFinishMode::LzmaFinishModeEnd, status, alloc, &checksum, nullptr );
+	if( result != SevenZipResult::SevenZipOK )
+	{
+		return result;
+	}
+
+	if( output_length != block.UncompressedSize || input_length != compressed_size || status != LzmaStatus::LzmaStatusFinishedWithMark )
+	{
+		return SevenZipResult::SevenZipErrorData;
+	}
+
+	const uint8* padding = header + header_size + compressed_size;
+	const uint8* check = header + PadToFour( block.UnpaddedSize ) - check_size;
+	for( ; padding < check; padding++ )
+	{
+		if( *padding != 0u )
+		{
+			return SevenZipResult::SevenZipErrorData;
+		}
+	}
+
+	uint64 stored_check = 0u;
+	for( int64 index = 0; index < check_size; index++ )
+	{
+		stored_check |= static_cast< uint64 >( check[index] ) << ( index * 8 );
+	}
+
+	return ( checksum.Value == stored_check ) ? SevenZipResult::SevenZipOK : SevenZipResult::SevenZipErrorCrc;
+}
+
+/* ---------- Xz ---------- */
+
+static MemoryInterface allocator;
+
+/**
+ * The main xz compress function.
+ */
+SevenZipResult XzCompress( const CLzmaData* data, CXzEncoderProperties* encoderProperties, CXzResult* result, MemoryInterface* alloc, ProgressInterface* progress )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	result->OutputLength = 0;
+	result->BlockCount = 0;
+	result->Result = encoderProperties->Normalize();
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	XzEnc encoder( data, encoderProperties, alloc, progress );
+	result->Result = encoder.Encode();
+	result->OutputLength = encoder.Offset;
+	result->BlockCount = encoder.BlockCount;
+	return result->Result;
+}
+
+/**
+ * The total decompressed size of the .xz streams, read from their indices.
+ */
+SevenZipResult XzGetDecompressedSize( const uint8* compressed, int64 compressedLength, int64& decompressedLength )
+{
+	int64 block_count = 0;
+	return WalkStreams( compressed, compressedLength, nullptr, block_count, decompressedLength );
+}
+
+/**
+ * The main xz decompress function.
+ */
+SevenZipResult XzDecompress( CLzmaData* data, CXzResult* result, int32 numThreads, MemoryInterface* alloc )
+{
+	if( alloc == nullptr )
+	{
+		alloc = &allocator;
+	}
+
+	result->OutputLength = 0;
+	result->BlockCount = 0;
+
+	CXzBlock* blocks = nullptr;
+	int64 block_count = 0;
+	int64 decompressed_length = 0;
+	result->Result = ParseStreams( data->SourceData, data->SourceLength, alloc, blocks, block_count, decompressed_length );
+	if( result->Result != SevenZipResult::SevenZipOK )
+	{
+		return result->Result;
+	}
+
+	if( decompressed_length > data->DestinationLength )
+	{
+		FreeBlocks( blocks, block_count, alloc );
+		result->Result = SevenZipResult::SevenZipErrorOutputEof;
+		return result->Result;
+	}
+
+	// Each block decodes into its own part of the output, so they are independent
+	std::atomic< int64 > next_block = 0;
+	std::atomic< SevenZipResult > first_error = SevenZipResult::SevenZipOK;
+	auto worker = [&]()
+	{
+		int64 index;
+		while( first_error == SevenZipResult::SevenZipOK && ( index = next_block++ ) < block_count )
+		{
+			const CXzBlock& block = blocks[index];
+			const SevenZipResult block_result = DecodeBlock( data->SourceData, block, data->DestinationData + block.UncompressedOffset, alloc );
+			if( block_result != SevenZipResult::SevenZipOK )
+			{
+				SevenZipResult expected = SevenZipResult::SevenZipOK;
+				first_error.compare_exchange_strong( expected, block_result );
+			}
+		}
+	};
+
+	// The calling thread is the first worker, so a single block or thread starts no others
+	const int64 thread_count = std::min< int64 >( std::clamp( numThreads, 1, Xz::MaxThreads ), block_count );
+	RunWorkers( worker, static_cast< int32 >( thread_count ) );
+	FreeBlocks( blocks, block_count, alloc );
+
+	result->Result = first_error;
+	if( result->Result == SevenZipResult::SevenZipOK )
+	{
+		result->OutputLength = decompressed_length;
+		result->BlockCount = block_count;
+	}
+
+	return result->Result;
+}
+
+/* ---------- CXzSeekableReader ---------- */
+
+CXzSeekableReader::CXzSeekableReader( MemoryInterface* alloc )
+	: Alloc( alloc )
+{
+	if( Alloc == nullptr )
+	{
+		Alloc = &allocator;
+	}
+}
+
+CXzSeekableReader::~CXzSeekableReader()
+{
+	Alloc->Free( Cache, CacheSize, "CXzSeekableReader::Cache" );
+	FreeBlocks( Blocks, BlockCount, Alloc );
+}
+
+/**
+ * @brief Reads the block list from the stream indices; nothing is decoded.
+ *
+ * @param compressed       Pointer to the .xz data, which must stay valid while the reader is used.
+ * @param compressedLength Number of bytes of .xz data.
+ * @return SevenZipOK, SevenZipErrorMemory, or the error described at XzGetDecompressedSize().
+ */
+SevenZipResult CXzSeekableReader::Open( const uint8* compressed, const int64 compressedLength )
+{
+	Alloc->Free( Cache, CacheSize, "CXzSeekableReader::Cache" );
+	Cache = nullptr;
+	CacheSize = 0;
+	CachedBlock = -1;
+
+	FreeBlocks( Blocks, BlockCount, Alloc );
+	Compressed = compressed;
+	return ParseStreams( compressed, compressedLength, Alloc, Blocks, BlockCount, Length );
+}
+
+/**
+ * @brief Copies decompressed bytes out of the stream, decoding only the blocks that cover them.
+ *
+ * Blocks wholly inside the range decode straight into the destination. A block that is only partly wanted decodes into
+ * a cache the size of the largest block, which is kept so the next read from the same block needs no decoding.
+ *
+ * @param offset      Offset into the decompressed data.
+ * @param destination Where the bytes are copied to.
+ * @param length      Number of bytes to read.
+ * @return SevenZipOK, SevenZipErrorParam if the range is outside the data, SevenZipErrorMemory, or a block decode error.
+ */
+SevenZipResult CXzSeekableReader::Read( int64 offset, uint8* destination, int64 length )
+{
+	if( offset < 0 || length < 0 || offset > Length - length )
+	{
+		return SevenZipResult::SevenZipErrorParam;
+	}
+
+	// The last block starting at or before offset
+	const CXzBlock* next = std::upper_bound( Blocks, Blocks + BlockCount, offset, []( const int64 position, const CXzBlock& block ) { return position < block.UncompressedOffset; } );
+	int64 block_index = static_cast< int64 >( next - Blocks ) - 1;
+
+	while( length > 0 )
+	{
+		const CXzBlock& block = Blocks[block_index];
+		const int64 block_offset = offset - block.UncompressedOffset;
+		const int64 count = std::min( length, block.UncompressedSize - block_offset );
+
+		if( count == block.UncompressedSize && block_index != CachedBlock )
+		{
+			const SevenZipResult result = DecodeBlock( Compressed, block, destination, Alloc );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+		}
+		else
+		{
+			const SevenZipResult result = DecodeToCache( block_index );
+			if( result != SevenZipResult::SevenZipOK )
+			{
+				return result;
+			}
+
+			memcpy( destination, Cache + block_offset, static_cast< uint64 >( count ) );
+		}
+
+		destination += count;
+		offset += count;
+		length -= count;
+		block_index++;
+	}
+
+	return SevenZipResult::SevenZipOK;
+}
+
+/**
+ * @brief Makes the cache hold the given block, decoding it unless it is already there.
+ */
+SevenZipResult CXzSeekableReader::DecodeToCache( const int64 blockIndex )
+{
+	if( blockIndex == CachedBlock )
+	{
+		return SevenZipResult::SevenZipOK;
+	}
+
+	if( Cache == nullptr )
+	{
+		for( int64 index = 0; index < BlockCount; index++ )
+		{
+			CacheSize = std::max( CacheSize, Blocks[index].UncompressedSize );
+		}
+
+		Cache = static_cast< uint8* >( Alloc->Alloc( CacheSize, "CXzSeekableReader::Cache" ) );
+		if( Cache == nullptr )
+		{
+			CacheSize = 0;
+			return SevenZipResult::SevenZipErrorMemory;
+		}
+	}
+
+	// A failed decode leaves the cache partly overwritten
+	CachedBlock = -1;
+	const SevenZipResult result = DecodeBlock( Compressed, Blocks[blockIndex], Cache, Alloc );
+	if( result == SevenZipResult::SevenZipOK )
+	{
+		CachedBlock = blockIndex;
+	}
+
+	return result;
+}
@@ -0,0 +1,185 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include "Lzma2Lib.h"
+
+/**
+ * The .xz container around LZMA2, readable and writable by the standard xz tools.
+ *
+ * A stream is a header, a series of independently compressed blocks, an index of the block sizes and a footer.
+ * The index lets the blocks be found without decoding, so they can be decompressed concurrently.
+ * Only the LZMA2 filter is supported; files using BCJ or delta filters fail with SZ_ERROR_UNSUPPORTED.
+ */
+
+/** The integrity check stored after each block */
+enum class XzCheck
+	: uint8
+{
+	XzCheckNone = 0,
+	XzCheckCrc32 = 1,
+	XzCheckCrc64 = 4
+};
+
+class CXzResult
+{
+public:
+	/** The overall result. */
+	SevenZipResult Result = SevenZipResult::SevenZipOK;
+
+	/** The number of bytes output from the compress/decompress operation */
+	int64 OutputLength = 0;
+
+	/** The number of blocks written or read */
+	int64 BlockCount = 0;
+};
+
+/** One block as listed in the index, placed in the compressed and decompressed data */
+class CXzBlock
+{
+public:
+	int64 CompressedOffset = 0;
+	int64 UnpaddedSize = 0;
+	int64 UncompressedOffset = 0;
+	int64 UncompressedSize = 0;
+	uint8 Check = 0;
+};
+
+/**
+ * The LZMA2 settings every block is compressed with, and the container settings.
+ * Filter must stay LzmaFilterTypeNone, as each block is written with the LZMA2 filter alone.
+ */
+class CXzEncoderProperties
+	: public CLzma2EncoderProperties
+{
+public:
+	/** The check written after each block, default = CRC64 as xz uses */
+	XzCheck Check = XzCheck::XzCheckCrc64;
+
+	/**
+	 * Uncompressed bytes per block. default = 0
+	 * 0 means a single block with one thread, or three times the dictionary size (at least 1 MB) with more, as xz -T does.
+	 * Smaller blocks decompress with more parallelism but compress worse.
+	 */
+	int64 BlockSize = 0;
+
+	/**
+	 * Number of blocks compressed at once, default = 1
+	 * With more than one thread the MemoryInterface must be thread safe.
+	 */
+	int32 NumThreads = 1;
+
+	int64 GetBlockSize() const;
+
+	virtual SevenZipResult Normalize() override;
+
+	virtual int64 EstimateEncoderMemory() const override;
+};
+
+/*
+RAM requirements for xz:
+  for compression:   CXzEncoderProperties::EstimateEncoderMemory(), whose 16 bytes of index per block are only
+                     counted for more than one block when EstimatedSourceDataSize is set
+  for decompression: Lzma2EstimateDecoderMemory() per thread + sizeof( CXzBlock ) per block + the output buffer
+*/
+
+/**
+ * XzCompress - compress a block of memory into a single .xz stream
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_MEM         - Memory allocation error
+ * SZ_ERROR_PARAM       - Incorrect parameter
+ * SZ_ERROR_UNSUPPORTED - A filter was set
+ * SZ_ERROR_OUTPUT_EOF  - output buffer overflow
+ * SZ_ERROR_PROGRESS    - some break from progress callback
+ */
+SevenZipResult XzCompress( const CLzmaData* data, CXzEncoderProperties* encoderProperties, CXzResult* result, MemoryInterface* alloc, ProgressInterface* progress );
+
+/**
+ * XzGetDecompressedSize - read the total decompressed size of one or more concatenated .xz streams from their indices
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_NO_ARCHIVE  - Not an .xz stream
+ * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_CRC         - A header, index or footer checksum mismatch
+ * SZ_ERROR_UNSUPPORTED - Unsupported stream flags
+ */
+SevenZipResult XzGetDecompressedSize( const uint8* compressed, int64 compressedLength, int64& decompressedLength );
+
+/**
+ * XzDecompress - decompress one or more concatenated .xz streams, decoding up to numThreads blocks at once
+ * With more than one thread the MemoryInterface must be thread safe.
+ * Returns:
+ * SZ_OK                - OK
+ * SZ_ERROR_NO_ARCHIVE  - Not an .xz stream
+ * SZ_ERROR_DATA        - Data error
+ * SZ_ERROR_CRC         - A checksum mismatch
+ * SZ_ERROR_MEM         - Memory allocation error
+ * SZ_ERROR_UNSUPPORTED - Unsupported check or filter
+ * SZ_ERROR_OUTPUT_EOF  - The destination is smaller than XzGetDecompressedSize()
+ */
+SevenZipResult XzDecompress( CLzmaData* data, CXzResult* result, int32 numThreads, MemoryInterface* alloc );
+
+/**
+ * Random access to the decompressed data of an .xz file.
+ * Each read decodes only the blocks it covers, so the cost of a small read is set by the BlockSize used to compress.
+ * The compressed data is not copied and must outlive the reader. A reader must only be used by one thread at a time.
+ */
+class CXzSeekableReader
+{
+public:
+	explicit CXzSeekableReader( MemoryInterface* alloc );
+	~CXzSeekableReader();
+
+	CXzSeekableReader( const CXzSeekableReader& ) = delete;
+	CXzSeekableReader& operator=( const CXzSeekableReader& ) = delete;
+
+	/**
+	 * Open - read the block index of one or more concatenated .xz streams
+	 * Returns: as XzGetDecompressedSize, or SZ_ERROR_MEM if the block list cannot be allocated
+	 */
+	SevenZipResult Open( const uint8* compressed, int64 compressedLength );
+
+	/**
+	 * Read - decompress length bytes starting at offset
+	 * Returns:
+	 * SZ_OK                - OK
+	 * SZ_ERROR_PARAM       - The range is not inside the decompressed data
+	 * SZ_ERROR_MEM         - Memory allocation error
+	 * SZ_ERROR_DATA        - Data error
+	 * SZ_ERROR_CRC         - A checksum mismatch
+	 * SZ_ERROR_UNSUPPORTED - Unsupported check or filter
+	 */
+	SevenZipResult Read( int64 offset, uint8* destination, int64 length );
+
+	/** The total decompressed size */
+	int64 GetLength() const
+	{
+		return Length;
+	}
+
+	/** The blocks in file order, as listed in the stream indices */
+	const CXzBlock* GetBlocks() const
+	{
+		return Blocks;
+	}
+
+	int64 GetBlockCount() const
+	{
+		return BlockCount;
+	}
+
+private:
+	SevenZipResult DecodeToCache( const int64 blockIndex );
+
+	MemoryInterface* Alloc = nullptr;
+	const uint8* Compressed = nullptr;
+	CXzBlock* Blocks = nullptr;
+	int64 BlockCount = 0;
+	int64 Length = 0;
+
+	/** The last block read in part, kept for the next read */
+	uint8* Cache = nullptr;
+	int64 CacheSize = 0;
+	int64 CachedBlock = -1;
+};
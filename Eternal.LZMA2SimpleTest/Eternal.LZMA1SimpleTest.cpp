@@ -9,11 +9,10 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 #include "../Eternal.LZMA2Simple/C/7zTypes.h"
 #include "../Eternal.LZMA2Simple/C/Lzma1Lib.h"
 #include "../Eternal.LZMA2Utilities/Utilities.h"
+#include "TestUtilities.h"
 
 namespace EternalLZMA2SimpleTest
 {
-	void Log( const char* format, ... );
-
 #define TEST_METHOD_CATEGORY( test_name, category_name ) \
 	BEGIN_TEST_METHOD_ATTRIBUTE( test_name ) \
 		TEST_METHOD_ATTRIBUTE( L"Category", L#category_name ) \
@@ -21,50 +20,6 @@ namespace EternalLZMA2SimpleTest
 	END_TEST_METHOD_ATTRIBUTE() \
 	TEST_METHOD( test_name )
 
-	class Allocator 
-		: public MemoryInterface
-	{
-	public:
-		Allocator()
-		{
-			TotalAllocated = 0;
-		}
-
-		virtual ~Allocator() override = default;
-
-		virtual void* Alloc( const int64 size, const char* tag ) override
-		{
-			if( size != 0 )
-			{
-#ifdef _DEBUG
-				Log( "Allocate, %lld, %s", size, tag );
-#else
-				( void )tag;
-#endif
-				TotalAllocated += size;
-				return malloc( size );
-			}
-
-			return nullptr;
-		}
-
-		virtual void Free( void* address, const int64 size, const char* tag ) override
-		{
-			if( address != nullptr )
-			{
-#ifdef _DEBUG
-				Log( "Free, %lld, %s", size, tag );
-#else
-				( void )tag;
-#endif
-				free( address );
-				TotalAllocated -= size;
-			}
-		}
-
-		int64 TotalAllocated;
-	};
-
 	class ProgressReporter
 		: public ProgressInterface
 	{
@@ -237,6 +192,138 @@ namespace EternalLZMA2SimpleTest
 			delete decompress.DestinationData;
 		}
 
+		TEST_METHOD_CATEGORY( TestLZMA1CompressSmall, "LZMA1" )
+		{
+			SetWorkingDirectory();
+
+			// The decoder needs the properties of the last encode
+			CLzma1Result compress_result;
+			auto compress = [&]( CLzmaData* data, const bool small, MemoryInterface* alloc, int64& outputLength )
+			{
+				CLzma1EncoderProperties encoder_properties;
+				const SevenZipResult result = small ? Lzma1CompressSmall( data, &encoder_properties, &compress_result, alloc ) : Lzma1Compress( data, &encoder_properties, &compress_result, alloc, nullptr );
+				outputLength = compress_result.OutputLength;
+				return result;
+			};
+
+			auto decompress = [&]( CLzmaData* data, MemoryInterface* alloc, int64& outputLength )
+			{
+				CLzma1Result decompress_result;
+				memcpy_s( decompress_result.Properties, 5, compress_result.Properties, 5 );
+				const SevenZipResult result = Lzma1Decompress( data, &decompress_result, alloc );
+				outputLength = decompress_result.OutputLength;
+				return result;
+			};
+
+			CLzmaData sample = LoadFile( "Eternal.LZMA2SimpleTest/TestData/Sample01.bin" );
+			TestSmallCompression( "LZMA1", sample, compress, decompress );
+
+			CLzmaData collisions = CreateHashCollisions( 0x87654321u );
+			TestSmallCompression( "LZMA1", collisions, compress, decompress );
+
+			// The smallest inputs
+			for( const int64 length : { 0ll, 1ll, 5ll } )
+			{
+				CLzmaData tiny = collisions;
+				tiny.SourceLength = length;
+				TestSmallCompression( "LZMA1", tiny, compress, decompress );
+			}
+
+			CLzmaData large = sample;
+			large.SourceLength = Lzma::SmallInputLimit;
+			large.SourceData = new uint8[large.SourceLength];
+			memset( large.SourceData, 0, large.SourceLength );
+			CLzma1EncoderProperties encoder_properties;
+			Assert::IsTrue( Lzma1CompressSmall( &large, &encoder_properties, &compress_result, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An input of the small input limit should be rejected" );
+
+			delete[] large.SourceData;
+			delete[] collisions.SourceData;
+			delete sample.SourceData;
+			delete sample.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA1Checkpoints, "LZMA1" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			// A dictionary smaller than the file, so the indexing pass wraps it
+			CLzma1EncoderProperties encoder_properties;
+			encoder_properties.DictionarySize = 64 * 1024;
+			CLzma1Result compress_result;
+			Assert::IsTrue( Lzma1Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+
+			constexpr int64 read_length = 4096;
+			uint8* buffer = new uint8[read_length];
+
+			CLzmaEncoderProperties window_properties;
+			window_properties.CompressionLevel = 1;
+			for( const CLzmaEncoderProperties* properties : { static_cast< const CLzmaEncoderProperties* >( nullptr ), static_cast< const CLzmaEncoderProperties* >( &window_properties ) } )
+			{
+				Allocator allocator;
+				CLzma1Checkpoint* checkpoints = nullptr;
+				int64 checkpoint_count = 0;
+				Assert::IsTrue( Lzma1BuildCheckpoints( compress.DestinationData, compress_result.OutputLength, compress_result.Properties, compress.SourceLength, 100 * 1024, properties, checkpoints, checkpoint_count, &allocator ) == SevenZipResult::SevenZipOK, L"Indexing should have succeeded" );
+				Assert::AreEqual( ( compress.SourceLength - 1 ) / ( 100 * 1024 ), checkpoint_count, L"Checkpoint count incorrect" );
+
+				std::chrono::duration<double> read_s( 0 );
+				for( int64 offset = 0; offset < compress.SourceLength - read_length; offset += 37 * 1024 )
+				{
+					std::chrono::steady_clock::time_point start_read = std::chrono::steady_clock::now();
+					Assert::IsTrue( Lzma1DecompressRange( compress.DestinationData, compress_result.OutputLength, compress_result.Properties, checkpoints, checkpoint_count, offset, buffer, read_length, &allocator ) == SevenZipResult::SevenZipOK, L"Read should have succeeded" );
+					read_s += std::chrono::steady_clock::now() - start_read;
+
+					Assert::IsTrue( memcmp( buffer, compress.SourceData + offset, read_length ) == 0, L"Read data must match source data" );
+				}
+
+				Lzma1FreeCheckpoints( checkpoints, checkpoint_count, &allocator );
+				Assert::AreEqual( 0ll, allocator.TotalAllocated, L"Mismatch in malloc/free in reading" );
+				Log( "LZMA1: %lld checkpoints, windows %s, read time %f", checkpoint_count, ( properties != nullptr ) ? "compressed" : "raw", read_s.count() );
+			}
+
+			delete[] buffer;
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA1FilterBranch, "LZMA1" )
+		{
+			SetWorkingDirectory();
+
+			// Any data must survive the branch filters, whether or not it is code
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/Sample01.bin" );
+
+			for( const LzmaFilterType filter : { LzmaFilterType::LzmaFilterTypeX86, LzmaFilterType::LzmaFilterTypeArm64 } )
+			{
+				for( const bool small : { false, true } )
+				{
+					Allocator compress_allocator;
+					CLzma1EncoderProperties encoder_properties;
+					encoder_properties.Filter = filter;
+					encoder_properties.FilterParameter = 0x1000u;
+					CLzma1Result compress_result;
+					const SevenZipResult result = small ? Lzma1CompressSmall( &compress, &encoder_properties, &compress_result, &compress_allocator ) : Lzma1Compress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr );
+					Assert::IsTrue( result == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+					Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+					Allocator decompress_allocator;
+					CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+					CLzma1Result decompress_result = compress_result;
+					Assert::IsTrue( Lzma1Decompress( &decompress, &decompress_result, &decompress_allocator ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+					Assert::AreEqual( 0ll, decompress_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+					Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+					Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+					Log( "LZMA1: %s%s filter compressed %lld to %lld", ( filter == LzmaFilterType::LzmaFilterTypeX86 ) ? "x86" : "ARM64", small ? " small" : "", compress.SourceLength, compress_result.OutputLength );
+					delete decompress.DestinationData;
+				}
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
 		static void TestCompression( CLzmaData& compress, CLzma1EncoderProperties* encoderProperties )
 		{
 			Allocator compress_allocator;
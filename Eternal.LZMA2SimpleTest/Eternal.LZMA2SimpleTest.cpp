@@ -7,13 +7,14 @@
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 #include "../Eternal.LZMA2Simple/C/7zTypes.h"
+#include "../Eternal.LZMA2Simple/C/7zArchive.h"
 #include "../Eternal.LZMA2Simple/C/Lzma2Lib.h"
+#include "../Eternal.LZMA2Simple/C/XzLib.h"
 #include "../Eternal.LZMA2Utilities/Utilities.h"
+#include "TestUtilities.h"
 
 namespace EternalLZMA2SimpleTest
 {
-	void Log( const char* format, ... );
-
 #define TEST_METHOD_CATEGORY( test_name, category_name ) \
 	BEGIN_TEST_METHOD_ATTRIBUTE( test_name ) \
 		TEST_METHOD_ATTRIBUTE( L"Category", L#category_name ) \
@@ -21,50 +22,6 @@ namespace EternalLZMA2SimpleTest
 	END_TEST_METHOD_ATTRIBUTE() \
 	TEST_METHOD( test_name )
 
-	class Allocator
-		: public MemoryInterface
-	{
-	public:
-		Allocator()
-		{
-			TotalAllocated = 0;
-		}
-
-		virtual ~Allocator() override = default;
-
-		virtual void* Alloc( const int64 size, const char* tag ) override
-		{
-			if( size != 0 )
-			{
-#ifdef _DEBUG
-				Log( "Allocate, %lld, %s", size, tag );
-#else
-				( void )tag;
-#endif
-				TotalAllocated += size;
-				return malloc( size );
-			}
-
-			return nullptr;
-		}
-
-		virtual void Free( void* address, const int64 size, const char* tag ) override
-		{
-			if( address != nullptr )
-			{
-#ifdef _DEBUG
-				Log( "Free, %lld, %s", size, tag );
-#else
-				( void )tag;
-#endif
-				free( address );
-				TotalAllocated -= size;
-			}
-		}
-
-		int64 TotalAllocated;
-	};
-
 	class ProgressReporter
 		: public ProgressInterface
 	{
@@ -80,6 +37,33 @@ namespace EternalLZMA2SimpleTest
 		}
 	};
 
+	class ExtractChecker
+		: public SevenZipExtractInterface
+	{
+	public:
+		explicit ExtractChecker( const CLzmaData& expected )
+			: Expected( expected )
+		{
+		}
+
+		virtual ~ExtractChecker() override = default;
+
+		virtual SevenZipResult Extract( const CSevenZipEntry& entry, const uint8* data ) override
+		{
+			Log( "7z: %s, %lld bytes%s", entry.Name.c_str(), entry.Size, entry.IsDirectory ? ", directory" : "" );
+			if( entry.Size > 0 && ( entry.Size != Expected.SourceLength || memcmp( data, Expected.SourceData, entry.Size ) != 0 ) )
+			{
+				return SevenZipResult::SevenZipErrorData;
+			}
+
+			ExtractedCount++;
+			return SevenZipResult::SevenZipOK;
+		}
+
+		const CLzmaData& Expected;
+		int64 ExtractedCount = 0;
+	};
+
 	TEST_CLASS( EternalLZMA2SimpleTest )
 	{
 	public:
@@ -235,7 +219,629 @@ namespace EternalLZMA2SimpleTest
 			delete decompress.DestinationData;
 		}
 
-		static void TestCompression( CLzmaData& compress, CLzma2EncoderProperties* encoderProperties )
+		TEST_METHOD_CATEGORY( TestLZMA2DecompressInPlace, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+			CLzma2Result compress_result = Compress2Data( compress );
+
+			int64 margin = 0;
+			Assert::IsTrue( Lzma2GetInPlaceMargin( compress.DestinationData, compress_result.OutputLength, margin ) == SevenZipResult::SevenZipOK, L"Margin calculation should have succeeded" );
+			Log( "LZMA2: In place margin for %lld compressed bytes is %lld", compress_result.OutputLength, margin );
+
+			// Load the compressed data into the end of the one buffer and decode over it
+			const int64 buffer_length = compress.SourceLength + margin;
+			uint8* buffer = new uint8[buffer_length];
+			memcpy( buffer + buffer_length - compress_result.OutputLength, compress.DestinationData, compress_result.OutputLength );
+
+			Allocator overridden_allocator;
+			CLzma2Result decompress_result;
+			decompress_result.PropertySummary = compress_result.PropertySummary;
+
+			Assert::IsTrue( Lzma2DecompressInPlace( buffer + 1, buffer_length - 1, compress_result.OutputLength, &decompress_result, &overridden_allocator ) == SevenZipResult::SevenZipErrorParam, L"A buffer smaller than the margin should be rejected" );
+			Assert::IsTrue( Lzma2DecompressInPlace( buffer, buffer_length, compress_result.OutputLength, &decompress_result, &overridden_allocator ) == SevenZipResult::SevenZipOK, L"In place decompression should have succeeded" );
+			Assert::AreEqual( 0ll, overridden_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+
+			Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+			Assert::IsTrue( memcmp( buffer, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+			delete[] buffer;
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2CompressSmall, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			// The decoder needs the property byte of the last encode
+			CLzma2Result compress_result;
+			auto compress = [&]( CLzmaData* data, const bool small, MemoryInterface* alloc, int64& outputLength )
+			{
+				CLzma2EncoderProperties encoder_properties;
+				const SevenZipResult result = small ? Lzma2CompressSmall( data, &encoder_properties, &compress_result, alloc ) : Lzma2Compress( data, &encoder_properties, &compress_result, alloc, nullptr );
+				outputLength = compress_result.OutputLength;
+				return result;
+			};
+
+			auto decompress = [&]( CLzmaData* data, MemoryInterface* alloc, int64& outputLength )
+			{
+				CLzma2Result decompress_result;
+				decompress_result.PropertySummary = compress_result.PropertySummary;
+				const SevenZipResult result = Lzma2Decompress( data, &decompress_result, alloc );
+				outputLength = decompress_result.OutputLength;
+				return result;
+			};
+
+			CLzmaData sample = LoadFile( "Eternal.LZMA2SimpleTest/TestData/Sample01.bin" );
+			TestSmallCompression( "LZMA2", sample, compress, decompress );
+
+			CLzmaData collisions = CreateHashCollisions( 0x12345678u );
+			TestSmallCompression( "LZMA2", collisions, compress, decompress );
+
+			// The smallest inputs
+			for( const int64 length : { 0ll, 1ll, 5ll } )
+			{
+				CLzmaData tiny = collisions;
+				tiny.SourceLength = length;
+				TestSmallCompression( "LZMA2", tiny, compress, decompress );
+			}
+
+			CLzmaData large = sample;
+			large.SourceLength = Lzma::SmallInputLimit;
+			large.SourceData = new uint8[large.SourceLength];
+			memset( large.SourceData, 0, large.SourceLength );
+			CLzma2EncoderProperties encoder_properties;
+			Assert::IsTrue( Lzma2CompressSmall( &large, &encoder_properties, &compress_result, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An input of the small input limit should be rejected" );
+
+			delete[] large.SourceData;
+			delete[] collisions.SourceData;
+			delete sample.SourceData;
+			delete sample.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2Checksum, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			Log( "Checksum, compress time, decompress time" );
+			for( const ChecksumType checksum : { ChecksumType::ChecksumTypeNone, ChecksumType::ChecksumTypeCrc32, ChecksumType::ChecksumTypeCrc64 } )
+			{
+				CLzma2EncoderProperties encoder_properties;
+				encoder_properties.Checksum = checksum;
+				CLzma2Result compress_result;
+
+				std::chrono::steady_clock::time_point start_compress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+				const std::chrono::duration<double> compress_s = std::chrono::steady_clock::now() - start_compress;
+
+				uint64 expected = 0u;
+				if( checksum == ChecksumType::ChecksumTypeCrc32 )
+				{
+					expected = Crc32Update( 0u, compress.SourceData, compress.SourceLength );
+				}
+				else if( checksum == ChecksumType::ChecksumTypeCrc64 )
+				{
+					expected = Crc64Update( 0u, compress.SourceData, compress.SourceLength );
+				}
+
+				Assert::IsTrue( checksum == compress_result.Checksum, L"Checksum type should be returned" );
+				Assert::IsTrue( expected == compress_result.ChecksumValue, L"Checksum should match the source data" );
+
+				CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+				CLzma2Result decompress_result;
+				decompress_result.PropertySummary = compress_result.PropertySummary;
+				decompress_result.Checksum = compress_result.Checksum;
+				decompress_result.ChecksumValue = compress_result.ChecksumValue;
+
+				std::chrono::steady_clock::time_point start_decompress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, nullptr ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+				const std::chrono::duration<double> decompress_s = std::chrono::steady_clock::now() - start_decompress;
+				Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+				if( checksum != ChecksumType::ChecksumTypeNone )
+				{
+					decompress_result.ChecksumValue ^= 1u;
+					Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, nullptr ) == SevenZipResult::SevenZipErrorCrc, L"A checksum mismatch should be reported" );
+				}
+
+				Log( "%d, %f, %f", static_cast< int32 >( checksum ), compress_s.count(), decompress_s.count() );
+
+				delete decompress.DestinationData;
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2FilterBCn, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			Log( "Filter, parameter, compressed size, compress time, decompress time" );
+			for( const LzmaFilterType filter : { LzmaFilterType::LzmaFilterTypeNone, LzmaFilterType::LzmaFilterTypeBc1, LzmaFilterType::LzmaFilterTypeBc3 } )
+			{
+				for( const uint32 parameter : { 0u, LzmaFilter::BcnDeltaEndpoints } )
+				{
+					if( filter == LzmaFilterType::LzmaFilterTypeNone && parameter != 0u )
+					{
+						continue;
+					}
+
+					Allocator compress_allocator;
+					CLzma2EncoderProperties encoder_properties;
+					encoder_properties.Filter = filter;
+					encoder_properties.FilterParameter = parameter;
+					encoder_properties.Checksum = ChecksumType::ChecksumTypeCrc32;
+					CLzma2Result compress_result;
+
+					std::chrono::steady_clock::time_point start_compress = std::chrono::steady_clock::now();
+					Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+					const std::chrono::duration<double> compress_s = std::chrono::steady_clock::now() - start_compress;
+					Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+					Assert::IsTrue( filter == compress_result.Filter, L"Filter should be returned" );
+					Assert::IsTrue( Crc32Update( 0u, compress.SourceData, compress.SourceLength ) == compress_result.ChecksumValue, L"Checksum should be of the unfiltered data" );
+
+					Allocator decompress_allocator;
+					CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+					CLzma2Result decompress_result;
+					decompress_result.PropertySummary = compress_result.PropertySummary;
+					decompress_result.Checksum = compress_result.Checksum;
+					decompress_result.ChecksumValue = compress_result.ChecksumValue;
+					decompress_result.Filter = compress_result.Filter;
+					decompress_result.FilterParameter = compress_result.FilterParameter;
+
+					std::chrono::steady_clock::time_point start_decompress = std::chrono::steady_clock::now();
+					Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, &decompress_allocator ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+					const std::chrono::duration<double> decompress_s = std::chrono::steady_clock::now() - start_decompress;
+					Assert::AreEqual( 0ll, decompress_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+					Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+					Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+					Log( "%d, %u, %lld, %f, %f", static_cast< int32 >( filter ), parameter, compress_result.OutputLength, compress_s.count(), decompress_s.count() );
+
+					// An odd sized input below the small input limit, to cover the partial final block
+					CLzmaData small = compress;
+					small.SourceLength = Lzma::SmallInputLimit - 11;
+					Assert::IsTrue( Lzma2CompressSmall( &small, &encoder_properties, &compress_result, nullptr ) == SevenZipResult::SevenZipOK, L"Small compression should have succeeded" );
+
+					decompress.SourceLength = compress_result.OutputLength;
+					decompress_result.ChecksumValue = compress_result.ChecksumValue;
+					Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, nullptr ) == SevenZipResult::SevenZipOK, L"Small decompression should have succeeded" );
+					Assert::AreEqual( small.SourceLength, decompress_result.OutputLength, L"Small decompressed size incorrect" );
+					Assert::IsTrue( memcmp( decompress.DestinationData, small.SourceData, decompress_result.OutputLength ) == 0, L"Small decompressed data must match source data" );
+
+					delete decompress.DestinationData;
+				}
+			}
+
+			CLzma2EncoderProperties encoder_properties;
+			encoder_properties.Filter = LzmaFilterType::LzmaFilterTypeBc1;
+			encoder_properties.FilterParameter = 2u;
+			CLzma2Result compress_result;
+			Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An unknown filter parameter should be rejected" );
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2FilterDelta, "LZMA2" )
+		{
+			// Two channels of 16 bit triangle waves with a little noise, like stereo audio
+			constexpr int64 sample_count = 128 * 1024;
+			CLzmaData compress;
+			compress.SourceLength = sample_count * 4;
+			compress.SourceData = new uint8[compress.SourceLength];
+			compress.DestinationLength = LzmaWorstCompression( compress.SourceLength );
+			compress.DestinationData = new uint8[compress.DestinationLength];
+
+			uint32 seed = 0x12345678u;
+			for( int64 index = 0; index < sample_count; index++ )
+			{
+				seed = seed * 1664525u + 1013904223u;
+				const int32 noise = static_cast< int32 >( seed >> 29 );
+				const int32 left = std::abs( static_cast< int32 >( ( index * 97 ) % 16384 ) - 8192 ) * 3 + noise;
+				const int32 right = std::abs( static_cast< int32 >( ( index * 61 ) % 20000 ) - 10000 ) * 2 - noise;
+				compress.SourceData[index * 4 + 0] = static_cast< uint8 >( left );
+				compress.SourceData[index * 4 + 1] = static_cast< uint8 >( left >> 8 );
+				compress.SourceData[index * 4 + 2] = static_cast< uint8 >( right );
+				compress.SourceData[index * 4 + 3] = static_cast< uint8 >( right >> 8 );
+			}
+
+			Log( "Distance, compressed size, compress time, decompress time" );
+			int64 unfiltered_length = 0;
+			int64 stereo_length = 0;
+			for( const uint32 distance : { 0u, 1u, 2u, 4u, 7u, 32u, LzmaFilter::DeltaMaxDistance } )
+			{
+				Allocator compress_allocator;
+				CLzma2EncoderProperties encoder_properties;
+				encoder_properties.Filter = ( distance == 0u ) ? LzmaFilterType::LzmaFilterTypeNone : LzmaFilterType::LzmaFilterTypeDelta;
+				encoder_properties.FilterParameter = distance;
+				encoder_properties.Checksum = ChecksumType::ChecksumTypeCrc64;
+				CLzma2Result compress_result;
+
+				std::chrono::steady_clock::time_point start_compress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+				const std::chrono::duration<double> compress_s = std::chrono::steady_clock::now() - start_compress;
+				Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+				CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+				CLzma2Result decompress_result = compress_result;
+
+				std::chrono::steady_clock::time_point start_decompress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, nullptr ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+				const std::chrono::duration<double> decompress_s = std::chrono::steady_clock::now() - start_decompress;
+				Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+				Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+				Log( "%u, %lld, %f, %f", distance, compress_result.OutputLength, compress_s.count(), decompress_s.count() );
+
+				unfiltered_length = ( distance == 0u ) ? compress_result.OutputLength : unfiltered_length;
+				stereo_length = ( distance == 4u ) ? compress_result.OutputLength : stereo_length;
+
+				delete decompress.DestinationData;
+			}
+
+			Assert::IsTrue( stereo_length < unfiltered_length, L"A delta matching the sample size should compress better" );
+
+			for( const uint32 distance : { 0u, LzmaFilter::DeltaMaxDistance + 1u } )
+			{
+				CLzma2EncoderProperties encoder_properties;
+				encoder_properties.Filter = LzmaFilterType::LzmaFilterTypeDelta;
+				encoder_properties.FilterParameter = distance;
+				CLzma2Result compress_result;
+				Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An out of range distance should be rejected" );
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2FilterShuffle, "LZMA2" )
+		{
+			// A slowly varying array of floats, with an odd number of trailing bytes
+			constexpr int64 element_count = 128 * 1024;
+			CLzmaData compress;
+			compress.SourceLength = element_count * static_cast< int64 >( sizeof( float ) ) + 3;
+			compress.SourceData = new uint8[compress.SourceLength];
+			compress.DestinationLength = LzmaWorstCompression( compress.SourceLength );
+			compress.DestinationData = new uint8[compress.DestinationLength];
+
+			uint32 seed = 0x12345678u;
+			float value = 280.0f;
+			for( int64 index = 0; index < element_count; index++ )
+			{
+				seed = seed * 1664525u + 1013904223u;
+				value += ( static_cast< float >( seed >> 16 ) - 32768.0f ) / 65536.0f;
+				memcpy( compress.SourceData + index * static_cast< int64 >( sizeof( float ) ), &value, sizeof( float ) );
+			}
+			memset( compress.SourceData + element_count * static_cast< int64 >( sizeof( float ) ), 0x5a, 3 );
+
+			Log( "Element size, compressed size, compress time, decompress time" );
+			int64 unfiltered_length = 0;
+			int64 float_length = 0;
+			for( const uint32 element_size : { 0u, 2u, 4u, 8u, 16u } )
+			{
+				Allocator compress_allocator;
+				CLzma2EncoderProperties encoder_properties;
+				encoder_properties.Filter = ( element_size == 0u ) ? LzmaFilterType::LzmaFilterTypeNone : LzmaFilterType::LzmaFilterTypeShuffle;
+				encoder_properties.FilterParameter = element_size;
+				encoder_properties.Checksum = ChecksumType::ChecksumTypeCrc32;
+				CLzma2Result compress_result;
+
+				std::chrono::steady_clock::time_point start_compress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+				const std::chrono::duration<double> compress_s = std::chrono::steady_clock::now() - start_compress;
+				Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+				Allocator decompress_allocator;
+				CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+				CLzma2Result decompress_result = compress_result;
+
+				std::chrono::steady_clock::time_point start_decompress = std::chrono::steady_clock::now();
+				Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, &decompress_allocator ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+				const std::chrono::duration<double> decompress_s = std::chrono::steady_clock::now() - start_decompress;
+				Assert::AreEqual( 0ll, decompress_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+				Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+				Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+				Log( "%u, %lld, %f, %f", element_size, compress_result.OutputLength, compress_s.count(), decompress_s.count() );
+
+				unfiltered_length = ( element_size == 0u ) ? compress_result.OutputLength : unfiltered_length;
+				float_length = ( element_size == 4u ) ? compress_result.OutputLength : float_length;
+
+				delete decompress.DestinationData;
+			}
+
+			Assert::IsTrue( float_length < unfiltered_length, L"Shuffling by the element size should compress better" );
+
+			for( const uint32 element_size : { 0u, 1u, 3u, 32u } )
+			{
+				CLzma2EncoderProperties encoder_properties;
+				encoder_properties.Filter = LzmaFilterType::LzmaFilterTypeShuffle;
+				encoder_properties.FilterParameter = element_size;
+				CLzma2Result compress_result;
+				Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An unsupported element size should be rejected" );
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestLZMA2FilterBranch, "LZMA2" )
+		{
+			// Synthetic code; filler instructions, with calls to a few functions from all over
+			constexpr int64 code_size = 256 * 1024;
+			CLzmaData compress;
+			compress.SourceLength = code_size + 3;
+			compress.SourceData = new uint8[compress.SourceLength];
+			compress.DestinationLength = LzmaWorstCompression( compress.SourceLength );
+			compress.DestinationData = new uint8[compress.DestinationLength];
+
+			uint32 targets[64];
+			for( uint32 index = 0u; index < 64u; index++ )
+			{
+				targets[index] = ( index * 40503u * 4u ) % static_cast< uint32 >( code_size );
+			}
+
+			Log( "Filter, compressed size, filtered compressed size" );
+			for( const LzmaFilterType filter : { LzmaFilterType::LzmaFilterTypeX86, LzmaFilterType::LzmaFilterTypeArm64 } )
+			{
+				uint32 seed = 0x12345678u;
+				int64 position = 0;
+				while( position + 8 <= code_size )
+				{
+					seed = seed * 1664525u + 1013904223u;
+					const uint32 target = targets[( seed >> 8 ) & 63u];
+					const uint32 address = static_cast< uint32 >( position );
+					if( filter == LzmaFilterType::LzmaFilterTypeX86 )
+					{
+						// Register moves and stack adjustments, or CALL rel32
+						static constexpr uint8 filler[4][3] = { { 0x48, 0x89, 0xC7 }, { 0x48, 0x8B, 0x45 }, { 0x48, 0x83, 0xEC }, { 0x31, 0xC0, 0x90 } };
+						if( ( seed >> 24 ) < 64u )
+						{
+							const uint32 offset = target - ( address + 5u );
+							compress.SourceData[position] = 0xE8;
+							memcpy( compress.SourceData + position + 1, &offset, sizeof( offset ) );
+							position += 5;
+						}
+						else
+						{
+							memcpy( compress.SourceData + position, filler[( seed >> 16 ) & 3u], 3 );
+							position += 3;
+						}
+					}
+					else
+					{
+						// NOP, MOV, ADD and LDR, or BL
+						static constexpr uint32 filler[4] = { 0xD503201Fu, 0xAA0103E0u, 0x91002000u, 0xF9400020u };
+						const uint32 instruction = ( ( seed >> 24 ) < 64u ) ? ( 0x94000000u | ( ( ( target - address ) >> 2 ) & 0x03FFFFFFu ) ) : filler[( seed >> 16 ) & 3u];
+						memcpy( compress.SourceData + position, &instruction, sizeof( instruction ) );
+						position += 4;
+					}
+				}
+				memset( compress.SourceData + position, 0xE8, static_cast< size_t >( compress.SourceLength - position ) );
+
+				int64 compressed_length[2] = {};
+				for( const bool filtered : { false, true } )
+				{
+					Allocator compress_allocator;
+					CLzma2EncoderProperties encoder_properties;
+					encoder_properties.Filter = filtered ? filter : LzmaFilterType::LzmaFilterTypeNone;
+					encoder_properties.Checksum = ChecksumType::ChecksumTypeCrc32;
+					CLzma2Result compress_result;
+					Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+					Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+					Allocator decompress_allocator;
+					CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+					CLzma2Result decompress_result = compress_result;
+					Assert::IsTrue( Lzma2Decompress( &decompress, &decompress_result, &decompress_allocator ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+					Assert::AreEqual( 0ll, decompress_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+					Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+					Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+					compressed_length[filtered ? 1 : 0] = compress_result.OutputLength;
+					delete decompress.DestinationData;
+				}
+
+				Log( "%s, %lld, %lld", ( filter == LzmaFilterType::LzmaFilterTypeX86 ) ? "x86" : "ARM64", compressed_length[0], compressed_length[1] );
+				Assert::IsTrue( compressed_length[1] < compressed_length[0], L"Making branch targets absolute should compress better" );
+			}
+
+			CLzma2EncoderProperties encoder_properties;
+			encoder_properties.Filter = LzmaFilterType::LzmaFilterTypeArm64;
+			encoder_properties.FilterParameter = 2u;
+			CLzma2Result compress_result;
+			Assert::IsTrue( Lzma2Compress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorParam, L"An unaligned ARM64 start address should be rejected" );
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestXzCompress, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			Allocator compress_allocator;
+			CXzEncoderProperties encoder_properties;
+			encoder_properties.BlockSize = 128 * 1024;
+			CXzResult compress_result;
+			Assert::IsTrue( XzCompress( &compress, &encoder_properties, &compress_result, &compress_allocator, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+			Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+			Assert::AreEqual( ( compress.SourceLength + encoder_properties.BlockSize - 1 ) / encoder_properties.BlockSize, compress_result.BlockCount, L"Block count incorrect" );
+
+			Log( "XZ: Compressed %lld to %lld in %lld blocks", compress.SourceLength, compress_result.OutputLength, compress_result.BlockCount );
+
+			int64 decompressed_length = 0;
+			Assert::IsTrue( XzGetDecompressedSize( compress.DestinationData, compress_result.OutputLength, decompressed_length ) == SevenZipResult::SevenZipOK, L"Reading the index should have succeeded" );
+			Assert::AreEqual( compress.SourceLength, decompressed_length, L"Indexed size incorrect" );
+
+			// The test allocator is not thread safe, so the threaded decode uses the default one
+			for( const int32 num_threads : { 1, 4 } )
+			{
+				CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+				CXzResult decompress_result;
+				Assert::IsTrue( XzDecompress( &decompress, &decompress_result, num_threads, nullptr ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+
+				Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+				Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+				delete decompress.DestinationData;
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestXzCompressMultiThreaded, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			// Enough blocks for several batches of threads, the last one partial
+			CXzEncoderProperties encoder_properties;
+			encoder_properties.BlockSize = 64 * 1024;
+			CXzResult single_result;
+			Assert::IsTrue( XzCompress( &compress, &encoder_properties, &single_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK, L"Single threaded compression should have succeeded" );
+
+			uint8* single_threaded = new uint8[single_result.OutputLength];
+			memcpy( single_threaded, compress.DestinationData, single_result.OutputLength );
+
+			// The test allocator is not thread safe, so the threaded encode uses the default one
+			encoder_properties.NumThreads = 4;
+			CXzResult compress_result;
+			Assert::IsTrue( XzCompress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK, L"Multi threaded compression should have succeeded" );
+			Assert::AreEqual( ( compress.SourceLength + encoder_properties.BlockSize - 1 ) / encoder_properties.BlockSize, compress_result.BlockCount, L"Block count incorrect" );
+			Assert::IsTrue( compress_result.BlockCount > encoder_properties.NumThreads, L"The input should span more blocks than threads" );
+
+			// Blocks are compressed independently, so the order they are written in is all threading can change
+			Assert::AreEqual( single_result.OutputLength, compress_result.OutputLength, L"Compressed size should not depend on the thread count" );
+			Assert::IsTrue( memcmp( single_threaded, compress.DestinationData, compress_result.OutputLength ) == 0, L"Compressed data should not depend on the thread count" );
+
+			Log( "XZ: Compressed %lld to %lld in %lld blocks on %d threads", compress.SourceLength, compress_result.OutputLength, compress_result.BlockCount, encoder_properties.NumThreads );
+
+			CLzmaData decompress = AllocateDecompressionBuffers( compress, compress_result.OutputLength );
+			CXzResult decompress_result;
+			Assert::IsTrue( XzDecompress( &decompress, &decompress_result, 1, nullptr ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+
+			Assert::AreEqual( compress_result.BlockCount, decompress_result.BlockCount, L"Decoded block count incorrect" );
+			Assert::AreEqual( compress.SourceLength, decompress_result.OutputLength, L"Decompressed size incorrect" );
+			Assert::IsTrue( memcmp( decompress.DestinationData, compress.SourceData, decompress_result.OutputLength ) == 0, L"Decompressed data must match source decompressed data" );
+
+			delete decompress.DestinationData;
+			delete[] single_threaded;
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestXzSeekableRead, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			const std::string file_name = "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin";
+			CLzmaData compress = LoadFile( file_name );
+
+			Log( "Testing: %s", file_name.c_str() );
+			Log( "BlockSize, blocks, compressed, average read time" );
+
+			constexpr int32 read_count = 100;
+			constexpr int64 max_read_length = 8192;
+			uint8* buffer = new uint8[max_read_length];
+
+			for( const int64 block_size : { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 } )
+			{
+				CXzEncoderProperties encoder_properties;
+				encoder_properties.BlockSize = block_size;
+				CXzResult compress_result;
+				Assert::IsTrue( XzCompress( &compress, &encoder_properties, &compress_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+
+				Allocator read_allocator;
+				{
+					CXzSeekableReader reader( &read_allocator );
+					Assert::IsTrue( reader.Open( compress.DestinationData, compress_result.OutputLength ) == SevenZipResult::SevenZipOK, L"Opening should have succeeded" );
+					Assert::AreEqual( compress.SourceLength, reader.GetLength(), L"Indexed size incorrect" );
+
+					std::chrono::duration<double> read_s( 0 );
+					uint32 seed = 0x12345678u;
+					for( int32 read = 0; read < read_count; read++ )
+					{
+						seed = seed * 1664525u + 1013904223u;
+						const int64 length = 1 + ( seed >> 8 ) % max_read_length;
+						seed = seed * 1664525u + 1013904223u;
+						const int64 offset = seed % ( compress.SourceLength - length );
+
+						std::chrono::steady_clock::time_point start_read = std::chrono::steady_clock::now();
+						Assert::IsTrue( reader.Read( offset, buffer, length ) == SevenZipResult::SevenZipOK, L"Read should have succeeded" );
+						read_s += std::chrono::steady_clock::now() - start_read;
+
+						Assert::IsTrue( memcmp( buffer, compress.SourceData + offset, length ) == 0, L"Read data must match source data" );
+					}
+
+					Assert::IsTrue( reader.Read( compress.SourceLength - 1, buffer, 2 ) == SevenZipResult::SevenZipErrorParam, L"A read past the end should be rejected" );
+
+					Log( "%lld, %lld, %lld, %f", block_size, reader.GetBlockCount(), compress_result.OutputLength, read_s.count() / read_count );
+				}
+
+				Assert::AreEqual( 0ll, read_allocator.TotalAllocated, L"Mismatch in malloc/free in reading" );
+			}
+
+			delete[] buffer;
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
+		TEST_METHOD_CATEGORY( TestSevenZipExtract, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			// Sample.7z holds Sample01.bin three times - twice in a solid LZMA folder and once in an LZMA2 folder - with
+			// directories and an empty file, under an LZMA compressed header
+			CLzmaData archive = LoadFile( "Eternal.LZMA2SimpleTest/TestData/Sample.7z" );
+			CLzmaData expected = LoadFile( "Eternal.LZMA2SimpleTest/TestData/Sample01.bin" );
+
+			for( const int32 num_threads : { 1, 4 } )
+			{
+				// The test allocator is not thread safe
+				Allocator extract_allocator;
+				{
+					CSevenZipArchive reader( ( num_threads == 1 ) ? &extract_allocator : nullptr );
+					Assert::IsTrue( reader.Open( archive.SourceData, archive.SourceLength ) == SevenZipResult::SevenZipOK, L"Opening should have succeeded" );
+					Assert::AreEqual( static_cast< size_t >( 6 ), reader.GetEntries().size(), L"Entry count incorrect" );
+
+					ExtractChecker checker( expected );
+					std::chrono::steady_clock::time_point start_extract = std::chrono::steady_clock::now();
+					Assert::IsTrue( reader.Extract( &checker, num_threads ) == SevenZipResult::SevenZipOK, L"Extraction should have succeeded" );
+					const std::chrono::duration<double> extract_s = std::chrono::steady_clock::now() - start_extract;
+					Assert::AreEqual( 6ll, checker.ExtractedCount, L"Every entry should have been extracted" );
+
+					Log( "7z: Extracted with %d threads in %f", num_threads, extract_s.count() );
+				}
+
+				Assert::AreEqual( 0ll, extract_allocator.TotalAllocated, L"Mismatch in malloc/free in extraction" );
+			}
+
+			CSevenZipArchive reader( nullptr );
+			Assert::IsTrue( reader.Open( expected.SourceData, expected.SourceLength ) == SevenZipResult::SevenZipErrorNoArchive, L"A file that is not an archive should be rejected" );
+
+			archive.SourceData[archive.SourceLength - 1] ^= 1u;
+			Assert::IsTrue( reader.Open( archive.SourceData, archive.SourceLength ) == SevenZipResult::SevenZipErrorCrc, L"A damaged header should be rejected" );
+
+			delete archive.SourceData;
+			delete archive.DestinationData;
+			delete expected.SourceData;
+			delete expected.DestinationData;
+		}
+
+		static CLzma2Result TestCompression( CLzmaData& compress, CLzma2EncoderProperties* encoderProperties )
 		{
 			Allocator compress_allocator;
 			Allocator decompress_allocator;
@@ -262,6 +868,52 @@ namespace EternalLZMA2SimpleTest
 			Log( "%u, %u, %u, %u, %u, %u, %u, %u, %u, %f, %f", 
 				encoderProperties->CompressionLevel, encoderProperties->LiteralContextBits, encoderProperties->LiteralPositionBits, encoderProperties->PositionBits, encoderProperties->FastBytes, encoderProperties->MatchCycles,
 				encoderProperties->DictionarySize, compress.SourceLength, compress_result.OutputLength, compress_s.count(), decompress_s.count() );
+			return compress_result;
+		}
+
+		/** Walks the LZMA2 chunks, and returns how many bytes of the decompressed range [start, end) were stored in uncompressed chunks */
+		static int64 CountStoredBytes( const uint8* compressed, const int64 compressedLength, const int64 start, const int64 end )
+		{
+			int64 offset = 0;
+			int64 position = 0;
+			int64 stored = 0;
+			while( true )
+			{
+				Assert::IsTrue( offset < compressedLength, L"The chunks should end with an end marker" );
+				const uint8 control = compressed[offset];
+				if( control == Lzma::Lzma2ControlEof )
+				{
+					Assert::AreEqual( compressedLength, offset + 1, L"The end marker should be the last byte" );
+					return stored;
+				}
+
+				int64 header_size = 0;
+				int64 unpacked_size = 0;
+				int64 packed_size = 0;
+				Assert::IsTrue( offset + 3 <= compressedLength, L"Chunk header truncated" );
+				if( control == Lzma::Lzma2ControlCopyResetDict || control == Lzma::Lzma2ControlCopy )
+				{
+					header_size = 3;
+					unpacked_size = ( ( compressed[offset + 1] << 8 ) | compressed[offset + 2] ) + 1;
+					packed_size = unpacked_size;
+
+					const int64 overlap = std::min( end, position + unpacked_size ) - std::max( start, position );
+					stored += std::max< int64 >( overlap, 0 );
+				}
+				else
+				{
+					Assert::IsTrue( ( control & Lzma::Lzma2ControlLzma ) != 0, L"Unknown chunk control byte" );
+					Assert::IsTrue( offset + 5 <= compressedLength, L"Chunk header truncated" );
+
+					// Modes 2 and 3 reset the state with new properties, and carry the properties byte
+					header_size = ( ( ( control >> 5 ) & 3 ) >= 2 ) ? 6 : 5;
+					unpacked_size = ( ( ( control & 31 ) << 16 ) | ( compressed[offset + 1] << 8 ) | compressed[offset + 2] ) + 1;
+					packed_size = ( ( compressed[offset + 3] << 8 ) | compressed[offset + 4] ) + 1;
+				}
+
+				offset += header_size + packed_size;
+				position += unpacked_size;
+			}
 		}
 
 		static void ExhaustiveTest( const std::string& fileName )
@@ -317,6 +969,122 @@ namespace EternalLZMA2SimpleTest
 			ExhaustiveTest( "Eternal.LZMA2SimpleTest/TestData/SampleBC3.bin" );
 		}
 
+		TEST_METHOD_CATEGORY( TestLZMA2DetectIncompressible, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData sample = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			// Sandwich a run of pseudo random noise between two copies of compressible data
+			constexpr int64 noise_length = 1024 * 1024;
+			CLzmaData compress;
+			compress.SourceLength = sample.SourceLength * 2 + noise_length;
+			compress.SourceData = new uint8[compress.SourceLength];
+			compress.DestinationLength = LzmaWorstCompression( compress.SourceLength );
+			compress.DestinationData = new uint8[compress.DestinationLength];
+
+			uint32 seed = 0x12345678u;
+			memcpy( compress.SourceData, sample.SourceData, sample.SourceLength );
+			for( int64 index = 0; index < noise_length; index++ )
+			{
+				seed = seed * 1664525u + 1013904223u;
+				compress.SourceData[sample.SourceLength + index] = static_cast< uint8 >( seed >> 24 );
+			}
+			memcpy( compress.SourceData + sample.SourceLength + noise_length, sample.SourceData, sample.SourceLength );
+
+			Log( "Level, LiteralContextBits, LiteralPositionBits, PositionBits, FastBytes, MatchCycles, DictionarySize, decompressed, compressed, compress time, decompress time" );
+
+			for( uint8 level = 0; level <= 9; level++ )
+			{
+				CLzma2EncoderProperties encoder_properties;
+
+				encoder_properties.CompressionLevel = level;
+				encoder_properties.DetectIncompressible = true;
+				const CLzma2Result compress_result = TestCompression( compress, &encoder_properties );
+
+				// Storing everything costs a three byte header per copy chunk, and the end marker
+				const int64 stored_size = compress.SourceLength + ( ( compress.SourceLength + Lzma::Lzma2CopyChunkSize - 1 ) / Lzma::Lzma2CopyChunkSize ) * 3 + 1;
+				Assert::IsTrue( compress_result.OutputLength <= stored_size, L"The output should be no larger than storing the input" );
+
+				const int64 stored = CountStoredBytes( compress.DestinationData, compress_result.OutputLength, sample.SourceLength, sample.SourceLength + noise_length );
+				Log( "%lld of %lld noise bytes stored", stored, noise_length );
+
+				// The chunks either side of the noise sample across its edges, so may each take up to a copy chunk of it
+				Assert::IsTrue( stored >= noise_length - 2 * Lzma::Lzma2CopyChunkSize, L"The noise should have been written as uncompressed chunks" );
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+			delete sample.SourceData;
+			delete sample.DestinationData;
+		}
+
+		template< typename TProperties, typename TResult, typename TCompress >
+		static void TestEncoderMemory( const char* name, const CLzmaData& source, TProperties encoderProperties, TCompress compressFunction )
+		{
+			CLzmaData compress = source;
+			encoderProperties.EstimatedSourceDataSize = source.SourceLength;
+
+			Allocator compress_allocator;
+			TResult compress_result;
+			Assert::IsTrue( compressFunction( &compress, &encoderProperties, &compress_result, &compress_allocator ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+			Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+			// The encoder normalised the properties it was given, so this is the estimate for what it actually ran
+			const int64 estimate = encoderProperties.EstimateEncoderMemory();
+			Log( "%s: Level %d, filter %d, budget %lld, peak %lld, estimate %lld", name, encoderProperties.CompressionLevel, static_cast< int32 >( encoderProperties.Filter ), encoderProperties.MemoryBudget, compress_allocator.PeakAllocated, estimate );
+
+			Assert::IsTrue( compress_allocator.PeakAllocated <= estimate, L"Peak allocation should not exceed the estimate" );
+			Assert::IsTrue( encoderProperties.MemoryBudget == 0 || compress_allocator.PeakAllocated <= encoderProperties.MemoryBudget, L"Peak allocation should not exceed the budget" );
+		}
+
+		TEST_METHOD_CATEGORY( TestEncoderMemoryEstimate, "LZMA2" )
+		{
+			SetWorkingDirectory();
+
+			CLzmaData compress = LoadFile( "Eternal.LZMA2SimpleTest/TestData/SampleBC1.bin" );
+
+			for( const int64 budget : { 0ll, 8ll * 1024 * 1024 } )
+			{
+				for( const uint8 level : { 1, 5, 9 } )
+				{
+					for( const LzmaFilterType filter : { LzmaFilterType::LzmaFilterTypeNone, LzmaFilterType::LzmaFilterTypeBc1 } )
+					{
+						CLzmaEncoderProperties lzma1_properties;
+						lzma1_properties.CompressionLevel = level;
+						lzma1_properties.Filter = filter;
+						lzma1_properties.MemoryBudget = budget;
+						TestEncoderMemory< CLzmaEncoderProperties, CLzma1Result >( "LZMA1", compress, lzma1_properties, []( CLzmaData* data, CLzmaEncoderProperties* properties, CLzma1Result* result, MemoryInterface* alloc )
+						{
+							return Lzma1Compress( data, properties, result, alloc, nullptr );
+						} );
+
+						CLzma2EncoderProperties lzma2_properties;
+						lzma2_properties.CompressionLevel = level;
+						lzma2_properties.Filter = filter;
+						lzma2_properties.MemoryBudget = budget;
+						TestEncoderMemory< CLzma2EncoderProperties, CLzma2Result >( "LZMA2", compress, lzma2_properties, []( CLzmaData* data, CLzma2EncoderProperties* properties, CLzma2Result* result, MemoryInterface* alloc )
+						{
+							return Lzma2Compress( data, properties, result, alloc, nullptr );
+						} );
+					}
+
+					// The xz encoder has no filters of its own, so only the plain stream is checked
+					CXzEncoderProperties xz_properties;
+					xz_properties.CompressionLevel = level;
+					xz_properties.BlockSize = 256 * 1024;
+					xz_properties.MemoryBudget = budget;
+					TestEncoderMemory< CXzEncoderProperties, CXzResult >( "XZ", compress, xz_properties, []( CLzmaData* data, CXzEncoderProperties* properties, CXzResult* result, MemoryInterface* alloc )
+					{
+						return XzCompress( data, properties, result, alloc, nullptr );
+					} );
+				}
+			}
+
+			delete compress.SourceData;
+			delete compress.DestinationData;
+		}
+
 		TEST_METHOD_CATEGORY( TestLZMA2DictionarySize, "LZMA2" )
 		{
 			SetWorkingDirectory();
@@ -0,0 +1,71 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+
+#include "../Eternal.LZMA2Simple/C/7zTypes.h"
+
+namespace EternalLZMA2SimpleTest
+{
+	void Log( const char* format, ... );
+
+	/** Counts the bytes allocated and not yet freed, so a test can check every allocation is released, and the most ever allocated at once */
+	class Allocator
+		: public MemoryInterface
+	{
+	public:
+		Allocator()
+		{
+			TotalAllocated = 0;
+			PeakAllocated = 0;
+		}
+
+		virtual ~Allocator() override = default;
+
+		virtual void* Alloc( const int64 size, const char* tag ) override
+		{
+			if( size != 0 )
+			{
+#ifdef _DEBUG
+				Log( "Allocate, %lld, %s", size, tag );
+#else
+				( void )tag;
+#endif
+				TotalAllocated += size;
+				PeakAllocated = std::max( PeakAllocated, TotalAllocated );
+				return malloc( size );
+			}
+
+			return nullptr;
+		}
+
+		virtual void Free( void* address, const int64 size, const char* tag ) override
+		{
+			if( address != nullptr )
+			{
+#ifdef _DEBUG
+				Log( "Free, %lld, %s", size, tag );
+#else
+				( void )tag;
+#endif
+				free( address );
+				TotalAllocated -= size;
+			}
+		}
+
+		int64 TotalAllocated;
+		int64 PeakAllocated;
+	};
+
+	/** Compresses data with the small input entry point if small is set, or the regular one, and returns the output length */
+	typedef std::function< SevenZipResult( CLzmaData* data, bool small, MemoryInterface* alloc, int64& outputLength ) > SmallCompressFunction;
+
+	/** Decompresses the data from the last SmallCompressFunction call, and returns the output length */
+	typedef std::function< SevenZipResult( CLzmaData* data, MemoryInterface* alloc, int64& outputLength ) > SmallDecompressFunction;
+
+	void TestSmallCompression( const char* name, const CLzmaData& source, const SmallCompressFunction& compress, const SmallDecompressFunction& decompress );
+
+	CLzmaData CreateHashCollisions( uint32 seed );
+}
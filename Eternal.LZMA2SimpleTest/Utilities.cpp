@@ -7,6 +7,7 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 #include "../Eternal.LZMA2Simple/C/7zTypes.h"
 #include "../Eternal.LZMA2Simple/C/Lzma1Enc.h"
+#include "TestUtilities.h"
 
 #pragma comment( lib, "Eternal.LZMA2Utilities.lib" )
 
@@ -24,6 +25,70 @@ namespace EternalLZMA2SimpleTest
 		Logger::WriteMessage( buffer );
 	}
 
+	/** Compresses the source with the small and regular entry points, and checks both decode to the source */
+	void TestSmallCompression( const char* name, const CLzmaData& source, const SmallCompressFunction& compress, const SmallDecompressFunction& decompress )
+	{
+		CLzmaData compress_data = source;
+		compress_data.DestinationLength = LzmaWorstCompression( source.SourceLength );
+		compress_data.DestinationData = new uint8[compress_data.DestinationLength];
+
+		uint8* decoded[2] = { new uint8[source.SourceLength + 1], new uint8[source.SourceLength + 1] };
+		for( const bool small : { true, false } )
+		{
+			Allocator compress_allocator;
+			int64 compressed_length = 0;
+			Assert::IsTrue( compress( &compress_data, small, &compress_allocator, compressed_length ) == SevenZipResult::SevenZipOK, L"Compression should have succeeded" );
+			Assert::AreEqual( 0ll, compress_allocator.TotalAllocated, L"Mismatch in malloc/free in compression" );
+
+			Log( "%s: %s compressed %lld to %lld", name, small ? "Small" : "Regular", source.SourceLength, compressed_length );
+
+			Allocator decompress_allocator;
+			CLzmaData decompress_data;
+			decompress_data.SourceData = compress_data.DestinationData;
+			decompress_data.SourceLength = compressed_length;
+			decompress_data.DestinationData = decoded[small ? 0 : 1];
+			decompress_data.DestinationLength = source.SourceLength;
+			int64 decompressed_length = 0;
+			Assert::IsTrue( decompress( &decompress_data, &decompress_allocator, decompressed_length ) == SevenZipResult::SevenZipOK, L"Decompression should have succeeded" );
+			Assert::AreEqual( 0ll, decompress_allocator.TotalAllocated, L"Mismatch in malloc/free in decompression" );
+			Assert::AreEqual( source.SourceLength, decompressed_length, L"Decompressed size incorrect" );
+			Assert::IsTrue( memcmp( decompress_data.DestinationData, source.SourceData, decompressed_length ) == 0, L"Decompressed data must match source data" );
+		}
+
+		Assert::IsTrue( memcmp( decoded[0], decoded[1], source.SourceLength ) == 0, L"The small and regular paths must decode to the same data" );
+
+		delete[] decoded[0];
+		delete[] decoded[1];
+		delete[] compress_data.DestinationData;
+	}
+
+	/**
+	 * Three byte runs that all start with the same byte, far more of them than the compact 3-byte hash has slots,
+	 * then the same runs in reverse order so the colliding candidates sit among real matches. The caller deletes SourceData.
+	 */
+	CLzmaData CreateHashCollisions( uint32 seed )
+	{
+		constexpr int64 run_count = 8000;
+		CLzmaData collisions;
+		collisions.SourceLength = run_count * 3 * 2;
+		collisions.SourceData = new uint8[collisions.SourceLength];
+
+		for( int64 run = 0; run < run_count; run++ )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			collisions.SourceData[run * 3] = 'A';
+			collisions.SourceData[run * 3 + 1] = static_cast< uint8 >( seed >> 24 );
+			collisions.SourceData[run * 3 + 2] = static_cast< uint8 >( seed >> 16 );
+		}
+
+		for( int64 run = 0; run < run_count; run++ )
+		{
+			memcpy( collisions.SourceData + ( run_count + run ) * 3, collisions.SourceData + ( run_count - 1 - run ) * 3, 3 );
+		}
+
+		return collisions;
+	}
+
 #define TEST_METHOD_CATEGORY( test_name, category_name ) \
 	BEGIN_TEST_METHOD_ATTRIBUTE( test_name ) \
 		TEST_METHOD_ATTRIBUTE( L"Category", L#category_name ) \
@@ -174,7 +239,7 @@ namespace EternalLZMA2SimpleTest
 				{
 					w = w * w;
 					bit_count <<= 1;
-					while( w >= LzmaEncoder::RangeEncoderBufferSize )
+					while( w >= ( 1u << 16 ) )
 					{
 						w >>= 1;
 						bit_count++;
@@ -0,0 +1,184 @@
+// Copyright Eternal Developments, LLC. All rights reserved.
+
+/**
+ * Round trips data through Lzma2CompressFile() and Lzma2DecompressFile(), and checks the compressed file is byte
+ * identical to the output of Lzma2Compress() on the same data. Returns the number of failed checks.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Eternal.LZMA2Simple/C/7zTypes.h"
+#include "../Eternal.LZMA2Simple/C/Lzma2Lib.h"
+#include "../Eternal.LZMA2Simple/C/LinuxMemory.h"
+
+#if defined( _LINUX )
+
+static int32 Failures = 0;
+
+#define CHECK( condition ) if( !( condition ) ) { printf( "FAILED %s:%d %s\n", __FILE__, __LINE__, #condition ); Failures++; }
+
+static std::vector<uint8> ReadFile( const std::string& fileName )
+{
+	std::ifstream stream( fileName, std::ios::binary );
+	return std::vector<uint8>( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
+}
+
+static void WriteFile( const std::string& fileName, const std::vector<uint8>& data )
+{
+	std::ofstream stream( fileName, std::ios::binary );
+	stream.write( reinterpret_cast< const char* >( data.data() ), static_cast< std::streamsize >( data.size() ) );
+}
+
+/** Aborts on the second progress call, which the file decoder makes after its first slice */
+class CAbortProgress
+	: public ProgressInterface
+{
+public:
+	virtual SevenZipResult Progress( int64, int64 ) override
+	{
+		return ( ++Calls > 1 ) ? SevenZipResult::SevenZipErrorProgress : SevenZipResult::SevenZipOK;
+	}
+
+	int32 Calls = 0;
+};
+
+static CLzma2EncoderProperties GetProperties( const uint8 level, const LzmaFilterType filter, const ChecksumType checksum )
+{
+	CLzma2EncoderProperties encoder_properties;
+
+	encoder_properties.CompressionLevel = level;
+	encoder_properties.Filter = filter;
+	encoder_properties.Checksum = checksum;
+	return encoder_properties;
+}
+
+static void TestRoundTrip( const std::string& folder, const std::vector<uint8>& source, const uint8 level, const LzmaFilterType filter, const ChecksumType checksum )
+{
+	const std::string source_name = folder + "/source.bin";
+	const std::string compressed_name = folder + "/source.lzma2";
+	const std::string decompressed_name = folder + "/decompressed.bin";
+	WriteFile( source_name, source );
+
+	// Compress file to file, with the match finder on huge pages
+	LinuxMemoryInterface memory;
+	CLzma2EncoderProperties file_properties = GetProperties( level, filter, checksum );
+	CLzma2Result file_result;
+	CHECK( Lzma2CompressFile( source_name.c_str(), compressed_name.c_str(), &file_properties, &file_result, &memory, nullptr ) == SevenZipResult::SevenZipOK );
+
+	std::vector<uint8> compressed = ReadFile( compressed_name );
+	CHECK( static_cast< int64 >( compressed.size() ) == file_result.OutputLength );
+
+	// Compress buffer to buffer; an empty source has no data, as an empty file has no mapping
+	std::vector<uint8> buffer_source = source;
+	std::vector<uint8> buffer_compressed( LzmaWorstCompression( static_cast< int64 >( source.size() ) ) );
+	CLzmaData compress;
+	compress.SourceData = source.empty() ? nullptr : buffer_source.data();
+	compress.SourceLength = static_cast< int64 >( source.size() );
+	compress.DestinationData = buffer_compressed.data();
+	compress.DestinationLength = static_cast< int64 >( buffer_compressed.size() );
+
+	CLzma2EncoderProperties buffer_properties = GetProperties( level, filter, checksum );
+	CLzma2Result buffer_result;
+	CHECK( Lzma2Compress( &compress, &buffer_properties, &buffer_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK );
+
+	CHECK( buffer_result.OutputLength == file_result.OutputLength );
+	CHECK( buffer_result.PropertySummary == file_result.PropertySummary );
+	CHECK( buffer_result.ChecksumValue == file_result.ChecksumValue );
+	CHECK( buffer_result.OutputLength <= static_cast< int64 >( compressed.size() ) && memcmp( buffer_compressed.data(), compressed.data(), static_cast< size_t >( buffer_result.OutputLength ) ) == 0 );
+
+	// Decompress file to file, checking the checksum and undoing the filter from the file encoder
+	CLzma2Result decompress_result;
+	decompress_result.PropertySummary = file_result.PropertySummary;
+	decompress_result.Checksum = file_result.Checksum;
+	decompress_result.ChecksumValue = file_result.ChecksumValue;
+	decompress_result.Filter = file_result.Filter;
+	decompress_result.FilterParameter = file_result.FilterParameter;
+	CHECK( Lzma2DecompressFile( compressed_name.c_str(), decompressed_name.c_str(), &decompress_result, nullptr, nullptr ) == SevenZipResult::SevenZipOK );
+	CHECK( decompress_result.OutputLength == static_cast< int64 >( source.size() ) );
+	CHECK( ReadFile( decompressed_name ) == source );
+
+	printf( "%10zu bytes, level %u, filter %d -> %10lld bytes\n", source.size(), level, static_cast< int32 >( filter ), static_cast< long long >( file_result.OutputLength ) );
+}
+
+static void TestErrors( const std::string& folder, const std::vector<uint8>& source )
+{
+	const std::string source_name = folder + "/source.bin";
+	const std::string compressed_name = folder + "/source.lzma2";
+	const std::string truncated_name = folder + "/truncated.lzma2";
+	const std::string decompressed_name = folder + "/decompressed.bin";
+	WriteFile( source_name, source );
+
+	CLzma2EncoderProperties encoder_properties = GetProperties( 3, LzmaFilterType::LzmaFilterTypeNone, ChecksumType::ChecksumTypeNone );
+	CLzma2Result result;
+	CHECK( Lzma2CompressFile( source_name.c_str(), compressed_name.c_str(), &encoder_properties, &result, nullptr, nullptr ) == SevenZipResult::SevenZipOK );
+
+	// A missing source, and a destination that cannot be created
+	CLzma2Result missing_result = result;
+	CHECK( Lzma2DecompressFile( ( folder + "/missing.lzma2" ).c_str(), decompressed_name.c_str(), &missing_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorRead );
+	CHECK( Lzma2CompressFile( source_name.c_str(), ( folder + "/missing/source.lzma2" ).c_str(), &encoder_properties, &missing_result, nullptr, nullptr ) == SevenZipResult::SevenZipErrorWrite );
+
+	// A truncated stream fails, rather than leaving a full length file behind
+	std::vector<uint8> truncated = ReadFile( compressed_name );
+	truncated.resize( truncated.size() / 2 );
+	WriteFile( truncated_name, truncated );
+
+	CLzma2Result truncated_result = result;
+	CHECK( Lzma2DecompressFile( truncated_name.c_str(), decompressed_name.c_str(), &truncated_result, nullptr, nullptr ) != SevenZipResult::SevenZipOK );
+
+	// An aborted decode leaves only the output written so far
+	CAbortProgress abort_progress;
+	CLzma2Result abort_result = result;
+	CHECK( Lzma2DecompressFile( compressed_name.c_str(), decompressed_name.c_str(), &abort_result, nullptr, &abort_progress ) == SevenZipResult::SevenZipErrorProgress );
+	CHECK( static_cast< int64 >( ReadFile( decompressed_name ).size() ) == abort_result.OutputLength );
+}
+
+int32 main( int32, char** )
+{
+	const std::filesystem::path folder = std::filesystem::temp_directory_path() / "Eternal.LZMA2FileRoundTrip";
+	std::filesystem::create_directories( folder );
+
+	// Runs of an incrementing pattern with random bytes mixed in; large enough for several decode slices
+	std::mt19937 random( 1 );
+	std::vector<uint8> mixed( 40 << 20 );
+	for( size_t index = 0; index < mixed.size(); index++ )
+	{
+		mixed[index] = static_cast< uint8 >( ( index * 7 + ( ( random() & 3 ) == 0 ? random() : 0 ) ) >> 3 );
+	}
+
+	// Incompressible data, stored in uncompressed chunks
+	std::vector<uint8> noise( 20 << 20 );
+	for( uint8& value : noise )
+	{
+		value = static_cast< uint8 >( random() );
+	}
+
+	TestRoundTrip( folder.string(), {}, 5, LzmaFilterType::LzmaFilterTypeNone, ChecksumType::ChecksumTypeNone );
+	TestRoundTrip( folder.string(), {}, 5, LzmaFilterType::LzmaFilterTypeX86, ChecksumType::ChecksumTypeCrc32 );
+	TestRoundTrip( folder.string(), { 1, 2, 3 }, 5, LzmaFilterType::LzmaFilterTypeNone, ChecksumType::ChecksumTypeCrc32 );
+	TestRoundTrip( folder.string(), mixed, 1, LzmaFilterType::LzmaFilterTypeNone, ChecksumType::ChecksumTypeCrc32 );
+	TestRoundTrip( folder.string(), mixed, 5, LzmaFilterType::LzmaFilterTypeX86, ChecksumType::ChecksumTypeCrc32 );
+	TestRoundTrip( folder.string(), noise, 3, LzmaFilterType::LzmaFilterTypeNone, ChecksumType::ChecksumTypeCrc64 );
+	TestErrors( folder.string(), noise );
+
+	std::filesystem::remove_all( folder );
+
+	printf( Failures ? "%d checks FAILED\n" : "All checks passed\n", Failures );
+	return Failures;
+}
+
+#else
+
+int32 main( int32, char** )
+{
+	printf( "The file API is only built for Linux\n" );
+	return 0;
+}
+
+#endif